@@ -1102,6 +1102,80 @@ ssize_t cosocket_send(struct cosocket * cc, const void * buf, size_t buf_size, i
   return sent;
 }
 
+/*
+ * Gather write with sendmsg(), the iov array is consumed (advanced) on partial sends.
+ * Returns total number of bytes sent or -1 on error / timeout
+ */
+ssize_t cosocket_sendv(struct cosocket * cc, struct iovec * iov, int iovcnt, int flags)
+{
+  struct msghdr msg;
+  ssize_t sent = 0;
+  ssize_t size;
+
+  struct cclist_node * node =
+      add_waiter(current_core, &(struct io_waiter ) {
+          .co = co_current(),
+          .tmo = cc->sndtmo >= 0 ? gettime_ms() + cc->sndtmo * 1000 : -1,
+          .mask = EPOLLOUT
+          });
+
+  struct io_waiter * w = cclist_peek(node);
+
+  epoll_queue(&cc->e, w);
+
+  while ( iovcnt > 0 && iov->iov_len == 0 ) {
+    ++iov, --iovcnt;
+  }
+
+  while ( iovcnt > 0 ) {
+
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = iov;
+    msg.msg_iovlen = iovcnt;
+
+    if ( (size = sendmsg(cc->e.so, &msg, flags | MSG_NOSIGNAL | MSG_DONTWAIT)) > 0 ) {
+
+      sent += size;
+
+      while ( iovcnt > 0 && (size_t) size >= iov->iov_len ) {
+        size -= iov->iov_len;
+        ++iov, --iovcnt;
+      }
+
+      if ( iovcnt > 0 ) {
+        iov->iov_base = (uint8_t*) iov->iov_base + size;
+        iov->iov_len -= size;
+      }
+
+      if ( cc->sndtmo >= 0 ) {
+        w->tmo = gettime_ms() + cc->sndtmo * 1000;
+      }
+
+    }
+    else if ( errno == EAGAIN ) {
+
+      co_call(current_core->main);
+
+      if ( !(w->revents & EPOLLOUT) ) {
+        PDBG("WARNING: w->events=0x%0X so=%d iovcnt=%d sent=%zd", w->revents, cc->e.so, iovcnt, sent);
+        errno = EAGAIN;
+        sent = -1;
+        break;
+      }
+
+    }
+    else if ( errno != EINTR ) {
+      sent = -1;
+      break;
+    }
+  }
+
+  epoll_dequeue(&cc->e, w);
+  remove_waiter(current_core, node);
+
+  return sent;
+}
+
 ssize_t cosocket_recv(struct cosocket * cc, void * buf, size_t buf_size, int flags)
 {
   ssize_t size;
@@ -18,6 +18,7 @@
 #include <poll.h>
 #include <sys/epoll.h>
 #include <netinet/in.h>
+#include <sys/uio.h>
 
 
 #ifdef __cplusplus
@@ -41,6 +42,7 @@ void cosocket_delete(struct cosocket ** cc);
 void cosocket_set_rcvtmout(struct cosocket * cc, int tmo_sec);
 void cosocket_set_sndtmout(struct cosocket * cc, int tmo_sec);
 ssize_t cosocket_send(struct cosocket * cc, const void * buf, size_t size, int flags);
+ssize_t cosocket_sendv(struct cosocket * cc, struct iovec * iov, int iovcnt, int flags);
 ssize_t cosocket_recv(struct cosocket * cc, void * buf, size_t size, int flags);
 
 
@@ -17,6 +17,8 @@
 
 #define RATE_E_MIN_DT (10*1000)
 
+#define FFGOP_BITRATE_WINDOW (1000*1000) // [us]
+
 static inline void w_lock(struct ffgop * gop)
 {
   pthread_rwlock_wrlock(&gop->rwlock);
@@ -50,6 +52,9 @@ static inline void ffgop_ctrl_set(struct ffgop * gop, uint ctrl_bits, bool set)
 int ffgop_set_event(struct ffgop * gop)
 {
   coevent_set(gop->gopev);
+  for ( uint i = 0; i < gop->nb_notify; ++i ) {
+    coevent_set(gop->notify[i]);
+  }
   return 0;
 }
 
@@ -287,6 +292,7 @@ void ffgop_cleanup(struct ffgop * gop)
 
   ffgop_free_streams(gop);
   coevent_delete(&gop->gopev);
+  free(gop->notify);
   pthread_rwlock_destroy(&gop->rwlock);
 
 }
@@ -326,7 +332,7 @@ void ffgop_put_eof(struct ffgop * gop, int reason)
   w_lock(gop);
   gop->eof_status = reason ? reason : AVERROR_EOF;
   ffgop_free_streams(gop);
-  coevent_set(gop->gopev);
+  ffgop_set_event(gop);
   w_unlock(gop);
 }
 
@@ -367,6 +373,7 @@ int ffgop_create_listener(struct ffgop * gop, struct ffgoplistener ** pgl,
 
   if( args ) {
     gl->getoutspc = args->getoutspc;
+    gl->onidle = args->onidle;
     gl->cookie = args->cookie;
   }
 
@@ -375,6 +382,19 @@ int ffgop_create_listener(struct ffgop * gop, struct ffgoplistener ** pgl,
     goto end;
   }
 
+  if ( args && args->notify ) {
+
+    coevent ** notify;
+
+    if ( !(notify = realloc(gop->notify, (gop->nb_notify + 1) * sizeof(*notify))) ) {
+      status = AVERROR(ENOMEM);
+      goto end;
+    }
+
+    gop->notify = notify;
+    gop->notify[gop->nb_notify++] = gl->notify = args->notify;
+  }
+
 
   ++gop->refs;
 
@@ -403,6 +423,12 @@ void ffgop_delete_listener(struct ffgoplistener ** gl)
 
     w_lock(gop);
     coevent_remove_waiter(gop->gopev, (*gl)->w);
+    for ( uint i = 0; (*gl)->notify && i < gop->nb_notify; ++i ) {
+      if ( gop->notify[i] == (*gl)->notify ) {
+        gop->notify[i] = gop->notify[--gop->nb_notify];
+        break;
+      }
+    }
     --gop->refs;
     w_unlock(gop);
 
@@ -414,6 +440,35 @@ void ffgop_delete_listener(struct ffgoplistener ** gl)
 }
 
 
+// must be called with gop locked for write
+static void ffgop_update_bitrate(struct ffgop * gop, int size)
+{
+  const int64_t now = ffmpeg_gettime_us();
+  int64_t rate;
+
+  gop->br.bytes += size;
+
+  if ( !gop->br.t0 ) {
+    gop->br.t0 = now;
+  }
+  else if ( now - gop->br.t0 >= FFGOP_BITRATE_WINDOW ) {
+    rate = gop->br.bytes * 1000000 / (now - gop->br.t0);
+    gop->br.rate = gop->br.rate ? (3 * gop->br.rate + rate) / 4 : rate;
+    gop->br.bytes = 0;
+    gop->br.t0 = now;
+  }
+}
+
+int64_t ffgop_get_bitrate(struct ffgop * gop)
+{
+  int64_t rate;
+  r_lock(gop);
+  rate = gop->br.rate;
+  r_unlock(gop);
+  return rate;
+}
+
+
 int ffgop_put_pkt(struct ffgop * gop, AVPacket * pkt)
 {
   int status = 0;
@@ -449,6 +504,8 @@ int ffgop_put_pkt(struct ffgop * gop, AVPacket * pkt)
       av_packet_ref(&gop->st[sidx].pkts[gop->st[sidx].wpos++], pkt);
       ffgop_set_event(gop);
     }
+
+    ffgop_update_bitrate(gop, pkt->size);
   }
 
   w_unlock(gop);
@@ -510,7 +567,8 @@ static inline bool ffgop_getoutspc(struct ffgoplistener * gl, int * outspc, int
   return gl->getoutspc && gl->getoutspc(gl->cookie, outspc, maxspc);
 }
 
-int ffgop_get_pkt(struct ffgoplistener * gl, AVPacket * pkt)
+// wait=false returns AVERROR(EAGAIN) instead of blocking on empty gop
+static int get_pkt(struct ffgoplistener * gl, AVPacket * pkt, bool wait)
 {
   struct ffgop * gop;
   int sidx = -1;
@@ -550,6 +608,10 @@ int ffgop_get_pkt(struct ffgoplistener * gl, AVPacket * pkt)
         if ( has_audio(gl) && ffgop_get_stream_type(gop, sidx) == AVMEDIA_TYPE_VIDEO ) {
           if ( ffgop_getoutspc(gl, &outspc, &maxspc) && outspc < maxspc / 2 ) {
             if ( gl->rpos[sidx] > 0 ) {
+              if ( !wait ) {
+                status = AVERROR(EAGAIN);
+                break;
+              }
               r_unlock(gop);
               coevent_wait(gl->w, 20);
               r_lock(gop);
@@ -563,7 +625,15 @@ int ffgop_get_pkt(struct ffgoplistener * gl, AVPacket * pkt)
         break;
       }
 
+      if ( !wait ) {
+        status = AVERROR(EAGAIN);
+        break;
+      }
+
       r_unlock(gop);
+      if ( gl->onidle ) {
+        gl->onidle(gl->cookie);
+      }
       coevent_wait(gl->w, -1);
       r_lock(gop);
     }
@@ -574,6 +644,16 @@ int ffgop_get_pkt(struct ffgoplistener * gl, AVPacket * pkt)
   return status;
 }
 
+int ffgop_get_pkt(struct ffgoplistener * gl, AVPacket * pkt)
+{
+  return get_pkt(gl, pkt, true);
+}
+
+int ffgop_poll_pkt(struct ffgoplistener * gl, AVPacket * pkt)
+{
+  return get_pkt(gl, pkt, false);
+}
+
 
 
 int ffgop_get_frm(struct ffgoplistener * gl, AVFrame * frm)
@@ -612,6 +692,9 @@ int ffgop_get_frm(struct ffgoplistener * gl, AVFrame * frm)
       }
 
       r_unlock(gop);
+      if ( gl->onidle ) {
+        gl->onidle(gl->cookie);
+      }
       coevent_wait(gl->w, -1);
       r_lock(gop);
     }
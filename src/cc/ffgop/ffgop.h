@@ -30,6 +30,8 @@ enum {
 
 struct ffgop {
   coevent * gopev;
+  coevent ** notify; // [nb_notify] events of listeners which read several gops
+  uint  nb_notify;
   uint  gtype;
   uint  gcap;
   uint  refs;
@@ -48,6 +50,13 @@ struct ffgop {
 
   pthread_rwlock_t rwlock;
 
+  // measured source bitrate
+  struct {
+    int64_t t0;     // [us] current measurement window start
+    int64_t bytes;  // bytes put since t0
+    int64_t rate;   // [bytes/s] smoothed
+  } br;
+
   uint  ctrl;
   int   eof_status;
 };
@@ -64,15 +73,19 @@ struct ffgop_init_args {
 struct ffgoplistener {
   struct ffgop * gop;
   struct coevent_waiter * w;
+  struct coevent * notify;
   int * gidx, * rpos;
   bool finish:1, skip_video:1;
   bool (*getoutspc)(void * cookie, int * outspc, int * maxspc);
+  void (*onidle)(void * cookie);
   void * cookie;
 };
 
 struct ffgop_create_listener_args {
   bool (*getoutspc)(void * cookie, int * outspc, int * maxspc);
+  void (*onidle)(void * cookie); // called when all pending packets are consumed, before blocking wait
   void * cookie;
+  struct coevent * notify; // optional, set along with gop event: one coroutine waits for several gops
 };
 
 
@@ -92,10 +105,16 @@ int ffgop_wait_event(struct ffgoplistener * gl, int tmo);
 int ffgop_set_event(struct ffgop * gop);
 enum ffgoptype ffgop_get_type(const struct ffgop * gop);
 
+/* Smoothed rate [bytes/s] of packets put into gop, 0 if not measured yet */
+int64_t ffgop_get_bitrate(struct ffgop * gop);
+
 
 void ffgop_put_eof(struct ffgop * gop, int reason);
 int ffgop_put_pkt(struct ffgop * gop, AVPacket * pkt);
 int ffgop_get_pkt(struct ffgoplistener * gl, AVPacket * pkt);
+/* Non-blocking ffgop_get_pkt(), AVERROR(EAGAIN) if no packet is pending.
+ *  Used by readers of several gops which wait on the notify event of their listeners */
+int ffgop_poll_pkt(struct ffgoplistener * gl, AVPacket * pkt);
 
 
 /** stream index MUST be stored as (int) (ssize_t) frm->opaque */
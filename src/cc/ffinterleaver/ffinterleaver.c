@@ -0,0 +1,209 @@
+/*
+ * ffinterleaver.c
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: amyznikov
+ */
+
+#include "ffinterleaver.h"
+#include "debug.h"
+
+
+struct ffilentry {
+  AVPacket pkt;
+  int64_t ts;       // [us] dts in common time base
+  int64_t enqueued; // [us] wall clock
+};
+
+struct ffinterleaver {
+  struct ffilentry * q; // [capacity] sorted by ts
+  uint size, capacity;
+
+  AVRational * tbs;     // [nb_streams]
+  int64_t * last;       // [nb_streams] last ts seen per stream
+  uint nb_streams;
+
+  int64_t maxskew;
+  int64_t newest;
+
+  int64_t delay_sum, delay_max;
+  uint64_t delay_count;
+};
+
+
+int ffinterleaver_create(struct ffinterleaver ** pil, const AVRational tbs[], uint nb_streams, int64_t maxskew)
+{
+  struct ffinterleaver * il = NULL;
+  int status = 0;
+
+  if ( !(il = calloc(1, sizeof(*il))) ) {
+    status = AVERROR(ENOMEM);
+    goto end;
+  }
+
+  if ( !(il->tbs = calloc(nb_streams, sizeof(*il->tbs))) || !(il->last = calloc(nb_streams, sizeof(*il->last))) ) {
+    status = AVERROR(ENOMEM);
+    goto end;
+  }
+
+  for ( uint i = 0; i < nb_streams; ++i ) {
+    il->tbs[i] = tbs[i];
+    il->last[i] = AV_NOPTS_VALUE;
+  }
+
+  il->nb_streams = nb_streams;
+  il->maxskew = maxskew;
+  il->newest = AV_NOPTS_VALUE;
+
+end:
+
+  if ( status ) {
+    ffinterleaver_destroy(&il);
+  }
+
+  *pil = il;
+
+  return status;
+}
+
+
+void ffinterleaver_destroy(struct ffinterleaver ** pil)
+{
+  struct ffinterleaver * il;
+
+  if ( pil && (il = *pil) ) {
+
+    for ( uint i = 0; i < il->size; ++i ) {
+      av_packet_unref(&il->q[i].pkt);
+    }
+
+    free(il->q);
+    free(il->tbs);
+    free(il->last);
+    free(il);
+
+    *pil = NULL;
+  }
+}
+
+
+int ffinterleaver_put(struct ffinterleaver * il, AVPacket * pkt)
+{
+  const AVRational utb = (AVRational ) { 1, 1000000 };
+  const int sidx = pkt->stream_index;
+  int64_t ts;
+  uint pos;
+
+  if ( sidx < 0 || sidx >= (int) il->nb_streams ) {
+    return AVERROR(EINVAL);
+  }
+
+  if ( il->size == il->capacity ) {
+
+    uint capacity = il->capacity ? 2 * il->capacity : 64;
+    struct ffilentry * q;
+
+    if ( !(q = realloc(il->q, capacity * sizeof(*q))) ) {
+      return AVERROR(ENOMEM);
+    }
+
+    il->q = q;
+    il->capacity = capacity;
+  }
+
+  if ( pkt->dts != AV_NOPTS_VALUE ) {
+    ts = av_rescale_q(pkt->dts, il->tbs[sidx], utb);
+    il->last[sidx] = ts;
+    if ( il->newest == AV_NOPTS_VALUE || ts > il->newest ) {
+      il->newest = ts;
+    }
+  }
+  else if ( (ts = il->last[sidx]) == AV_NOPTS_VALUE ) {
+    ts = il->newest;
+  }
+
+  // input is nearly ordered (ffgop reads are already interleaved), so search from the tail
+  for ( pos = il->size; pos > 0 && ts != AV_NOPTS_VALUE && il->q[pos - 1].ts > ts; --pos ) {
+  }
+
+  if ( pos < il->size ) {
+    memmove(&il->q[pos + 1], &il->q[pos], (il->size - pos) * sizeof(*il->q));
+  }
+
+  il->q[pos].ts = ts;
+  il->q[pos].enqueued = ffmpeg_gettime_us();
+  av_packet_move_ref(&il->q[pos].pkt, pkt);
+  ++il->size;
+
+  return 0;
+}
+
+
+static bool is_releasable(const struct ffinterleaver * il, const struct ffilentry * e)
+{
+  if ( e->ts == AV_NOPTS_VALUE || il->newest - e->ts >= il->maxskew ) {
+    return true;
+  }
+
+  // no earlier packet can come from any other stream
+  for ( uint i = 0; i < il->nb_streams; ++i ) {
+    if ( (int) i != e->pkt.stream_index && (il->last[i] == AV_NOPTS_VALUE || il->last[i] < e->ts) ) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+
+bool ffinterleaver_get(struct ffinterleaver * il, AVPacket * pkt, bool flush)
+{
+  int64_t delay;
+
+  if ( !il->size || (!flush && !is_releasable(il, &il->q[0])) ) {
+    return false;
+  }
+
+  if ( (delay = ffmpeg_gettime_us() - il->q[0].enqueued) > il->delay_max ) {
+    il->delay_max = delay;
+  }
+
+  il->delay_sum += delay;
+  ++il->delay_count;
+
+  av_packet_move_ref(pkt, &il->q[0].pkt);
+
+  if ( --il->size > 0 ) {
+    memmove(&il->q[0], &il->q[1], il->size * sizeof(*il->q));
+  }
+
+  return true;
+}
+
+
+int ffinterleaver_write_frame(struct ffinterleaver * il, AVFormatContext * oc, AVPacket * pkt)
+{
+  AVPacket opkt;
+  int status = 0;
+
+  if ( pkt && (status = ffinterleaver_put(il, pkt)) < 0 ) {
+    return status;
+  }
+
+  av_init_packet(&opkt);
+  opkt.data = NULL, opkt.size = 0;
+
+  while ( status >= 0 && ffinterleaver_get(il, &opkt, !pkt) ) {
+    status = av_write_frame(oc, &opkt);
+    av_packet_unref(&opkt);
+  }
+
+  return status;
+}
+
+
+void ffinterleaver_get_delay(const struct ffinterleaver * il, int64_t * avg, int64_t * max)
+{
+  *avg = il->delay_count ? il->delay_sum / (int64_t) il->delay_count : 0;
+  *max = il->delay_max;
+}
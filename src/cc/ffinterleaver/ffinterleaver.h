@@ -0,0 +1,52 @@
+/*
+ * ffinterleaver.h
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: amyznikov
+ *
+ *  Bounded-skew packet interleaver.
+ *
+ *  Packets are released in dts order, but a packet is never held for more than
+ *  max skew of stream time behind the newest packet seen: a stalled stream
+ *  can't delay the others unboundedly as with av_interleaved_write_frame().
+ */
+
+// #pragma once
+
+#ifndef __ffinterleaver_h__
+#define __ffinterleaver_h__
+
+#include "ffmpeg.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+struct ffinterleaver;
+
+
+/* tbs[nb_streams] : time bases of packets which will be put, maxskew in [us] */
+int ffinterleaver_create(struct ffinterleaver ** il, const AVRational tbs[], uint nb_streams, int64_t maxskew);
+void ffinterleaver_destroy(struct ffinterleaver ** il);
+
+/* Take packet reference into the queue, pkt is reset */
+int ffinterleaver_put(struct ffinterleaver * il, AVPacket * pkt);
+
+/* Get next releasable packet, if flush is true the queue is drained regardless of skew.
+ *  Returns false if nothing can be released now */
+bool ffinterleaver_get(struct ffinterleaver * il, AVPacket * pkt, bool flush);
+
+/* Put pkt (may be NULL) and av_write_frame() everything releasable into oc,
+ *  pkt NULL drains the queue */
+int ffinterleaver_write_frame(struct ffinterleaver * il, AVFormatContext * oc, AVPacket * pkt);
+
+/* Effective wall clock delay [us] added by queueing */
+void ffinterleaver_get_delay(const struct ffinterleaver * il, int64_t * avg, int64_t * max);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __ffinterleaver_h__ */
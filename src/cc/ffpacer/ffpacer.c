@@ -0,0 +1,46 @@
+/*
+ * ffpacer.c
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: amyznikov
+ */
+
+#include "ffpacer.h"
+#include "ffmpeg.h"
+#include "co-scheduler.h"
+#include <time.h>
+
+
+#define FFPACER_MIN_WINDOW  1000  // us
+
+
+void ffpacer_init(struct ffpacer * pacer, int64_t window_us)
+{
+  pacer->t0 = ffmpeg_gettime_us();
+  pacer->window = window_us < FFPACER_MIN_WINDOW ? FFPACER_MIN_WINDOW : window_us;
+}
+
+
+void ffpacer_wait(struct ffpacer * pacer, int64_t ts)
+{
+  const int64_t release_time = pacer->t0 + ts - pacer->window;
+  int64_t now, tick;
+
+  if ( (now = ffmpeg_gettime_us()) >= release_time ) {
+    return;
+  }
+
+  // round up to the window grid
+  tick = ((release_time + pacer->window - 1) / pacer->window) * pacer->window;
+
+  if ( is_in_cothread() ) {
+    co_sleep(tick - now);
+  }
+  else {
+    struct timespec t = {
+      .tv_sec = tick / 1000000,
+      .tv_nsec = (tick % 1000000) * 1000
+    };
+    clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &t, NULL);
+  }
+}
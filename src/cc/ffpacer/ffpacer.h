@@ -0,0 +1,45 @@
+/*
+ * ffpacer.h
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: amyznikov
+ *
+ *  Rate emulation pacing stage.
+ *
+ *  Packets are released in batches: a packet is released immediately if it is due
+ *  within the release window, otherwise the caller sleeps until next window tick.
+ *  Ticks are aligned to the monotonic clock grid, so all paced inputs on the same core
+ *  wake up together instead of sleeping per packet.
+ */
+
+// #pragma once
+
+#ifndef __ffpacer_h__
+#define __ffpacer_h__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+struct ffpacer {
+  int64_t t0;       // [us] stream start time
+  int64_t window;   // [us] release window
+};
+
+
+/* Start pacing from now with given release window */
+void ffpacer_init(struct ffpacer * pacer, int64_t window_us);
+
+/* Wait until packet with stream time offset ts [us] is allowed to be released */
+void ffpacer_wait(struct ffpacer * pacer, int64_t ts);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __ffpacer_h__ */
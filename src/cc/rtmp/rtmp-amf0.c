@@ -0,0 +1,327 @@
+/*
+ * rtmp-amf0.c
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: amyznikov
+ */
+
+#include "rtmp-amf0.h"
+#include <string.h>
+
+#define AMF0_MAX_DEPTH  16
+
+
+static inline uint16_t rd16(const uint8_t * p)
+{
+  return (((uint16_t) p[0]) << 8) | p[1];
+}
+
+static inline uint32_t rd32(const uint8_t * p)
+{
+  return (((uint32_t) p[0]) << 24) | (((uint32_t) p[1]) << 16) | (((uint32_t) p[2]) << 8) | p[3];
+}
+
+
+uint8_t * amf0_put_number(uint8_t * p, const uint8_t * end, double v)
+{
+  union {
+    double d;
+    uint64_t u;
+  } x;
+
+  if ( !p || end - p < 9 ) {
+    return NULL;
+  }
+
+  x.d = v;
+  *p++ = amf0_number;
+  for ( int i = 7; i >= 0; --i ) {
+    *p++ = (uint8_t) (x.u >> (i * 8));
+  }
+
+  return p;
+}
+
+uint8_t * amf0_put_boolean(uint8_t * p, const uint8_t * end, bool v)
+{
+  if ( !p || end - p < 2 ) {
+    return NULL;
+  }
+
+  *p++ = amf0_boolean;
+  *p++ = v ? 1 : 0;
+
+  return p;
+}
+
+uint8_t * amf0_put_prop_name(uint8_t * p, const uint8_t * end, const char * name)
+{
+  size_t n = strlen(name);
+
+  if ( !p || n > 0xFFFF || (size_t) (end - p) < n + 2 ) {
+    return NULL;
+  }
+
+  *p++ = (uint8_t) (n >> 8);
+  *p++ = (uint8_t) (n);
+  memcpy(p, name, n);
+
+  return p + n;
+}
+
+uint8_t * amf0_put_string(uint8_t * p, const uint8_t * end, const char * s)
+{
+  if ( !p || end - p < 1 ) {
+    return NULL;
+  }
+
+  *p++ = amf0_string;
+
+  return amf0_put_prop_name(p, end, s);
+}
+
+uint8_t * amf0_put_null(uint8_t * p, const uint8_t * end)
+{
+  if ( !p || end - p < 1 ) {
+    return NULL;
+  }
+
+  *p++ = amf0_null;
+
+  return p;
+}
+
+uint8_t * amf0_put_undefined(uint8_t * p, const uint8_t * end)
+{
+  if ( !p || end - p < 1 ) {
+    return NULL;
+  }
+
+  *p++ = amf0_undefined;
+
+  return p;
+}
+
+uint8_t * amf0_put_object_start(uint8_t * p, const uint8_t * end)
+{
+  if ( !p || end - p < 1 ) {
+    return NULL;
+  }
+
+  *p++ = amf0_object;
+
+  return p;
+}
+
+uint8_t * amf0_put_object_end(uint8_t * p, const uint8_t * end)
+{
+  if ( !p || end - p < 3 ) {
+    return NULL;
+  }
+
+  *p++ = 0;
+  *p++ = 0;
+  *p++ = amf0_object_end;
+
+  return p;
+}
+
+uint8_t * amf0_put_prop_string(uint8_t * p, const uint8_t * end, const char * name, const char * s)
+{
+  return amf0_put_string(amf0_put_prop_name(p, end, name), end, s);
+}
+
+uint8_t * amf0_put_prop_number(uint8_t * p, const uint8_t * end, const char * name, double v)
+{
+  return amf0_put_number(amf0_put_prop_name(p, end, name), end, v);
+}
+
+
+
+
+const uint8_t * amf0_get_number(const uint8_t * p, const uint8_t * end, double * v)
+{
+  union {
+    double d;
+    uint64_t u;
+  } x;
+
+  if ( !p || end - p < 9 || *p != amf0_number ) {
+    return NULL;
+  }
+
+  x.u = 0;
+  for ( int i = 1; i <= 8; ++i ) {
+    x.u = (x.u << 8) | p[i];
+  }
+
+  *v = x.d;
+
+  return p + 9;
+}
+
+const uint8_t * amf0_get_string(const uint8_t * p, const uint8_t * end, char s[], size_t cbs)
+{
+  size_t n, hdrsize;
+
+  if ( !p || end - p < 3 ) {
+    return NULL;
+  }
+
+  if ( *p == amf0_string ) {
+    n = rd16(p + 1);
+    hdrsize = 3;
+  }
+  else if ( *p == amf0_long_string && end - p >= 5 ) {
+    n = rd32(p + 1);
+    hdrsize = 5;
+  }
+  else {
+    return NULL;
+  }
+
+  if ( (size_t) (end - p) < hdrsize + n ) {
+    return NULL;
+  }
+
+  if ( cbs > 0 ) {
+    size_t cb = n < cbs - 1 ? n : cbs - 1;
+    memcpy(s, p + hdrsize, cb);
+    s[cb] = 0;
+  }
+
+  return p + hdrsize + n;
+}
+
+
+static const uint8_t * amf0_skip_value(const uint8_t * p, const uint8_t * end, int depth);
+
+static const uint8_t * amf0_skip_props(const uint8_t * p, const uint8_t * end, int depth)
+{
+  size_t n;
+
+  while ( p && end - p >= 3 ) {
+
+    if ( (n = rd16(p)) == 0 && p[2] == amf0_object_end ) {
+      return p + 3;
+    }
+
+    if ( (size_t) (end - p) < 2 + n ) {
+      return NULL;
+    }
+
+    p = amf0_skip_value(p + 2 + n, end, depth + 1);
+  }
+
+  return NULL;
+}
+
+static const uint8_t * amf0_skip_value(const uint8_t * p, const uint8_t * end, int depth)
+{
+  size_t n;
+
+  if ( !p || p >= end || depth > AMF0_MAX_DEPTH ) {
+    return NULL;
+  }
+
+  switch ( *p ) {
+
+    case amf0_number :
+      n = 9;
+    break;
+
+    case amf0_boolean :
+      n = 2;
+    break;
+
+    case amf0_string :
+      n = end - p < 3 ? (size_t) (end - p) + 1 : 3 + (size_t) rd16(p + 1);
+    break;
+
+    case amf0_long_string :
+      n = end - p < 5 ? (size_t) (end - p) + 1 : 5 + (size_t) rd32(p + 1);
+    break;
+
+    case amf0_null :
+    case amf0_undefined :
+      n = 1;
+    break;
+
+    case amf0_date :
+      n = 11;
+    break;
+
+    case amf0_object :
+      return amf0_skip_props(p + 1, end, depth);
+
+    case amf0_ecma_array :
+      return end - p < 5 ? NULL : amf0_skip_props(p + 5, end, depth);
+
+    case amf0_strict_array : {
+      uint32_t count;
+      if ( end - p < 5 ) {
+        return NULL;
+      }
+      count = rd32(p + 1);
+      for ( p += 5; p && count > 0; --count ) {
+        p = amf0_skip_value(p, end, depth + 1);
+      }
+      return p;
+    }
+
+    default :
+      return NULL;
+  }
+
+  return (size_t) (end - p) < n ? NULL : p + n;
+}
+
+const uint8_t * amf0_skip(const uint8_t * p, const uint8_t * end)
+{
+  return amf0_skip_value(p, end, 0);
+}
+
+const uint8_t * amf0_get_prop_string(const uint8_t * p, const uint8_t * end, const char * name,
+    char s[], size_t cbs)
+{
+  size_t namelen = strlen(name);
+  size_t n;
+
+  if ( cbs > 0 ) {
+    *s = 0;
+  }
+
+  if ( !p || p >= end ) {
+    return NULL;
+  }
+
+  if ( *p == amf0_object ) {
+    p += 1;
+  }
+  else if ( *p == amf0_ecma_array && end - p >= 5 ) {
+    p += 5;
+  }
+  else {
+    return NULL;
+  }
+
+  while ( p && end - p >= 3 ) {
+
+    if ( (n = rd16(p)) == 0 && p[2] == amf0_object_end ) {
+      return p + 3;
+    }
+
+    if ( (size_t) (end - p) < 3 + n ) {
+      return NULL;
+    }
+
+    if ( n == namelen && memcmp(p + 2, name, n) == 0 && p[2 + n] == amf0_string ) {
+      p = amf0_get_string(p + 2 + n, end, s, cbs);
+    }
+    else {
+      p = amf0_skip_value(p + 2 + n, end, 1);
+    }
+  }
+
+  return NULL;
+}
@@ -0,0 +1,72 @@
+/*
+ * rtmp-amf0.h
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: amyznikov
+ *
+ *  Minimal AMF0 encoder / decoder for RTMP command messages.
+ *  All functions take current position and buffer end and return the new position,
+ *  or NULL on overflow / malformed input. NULL input position is propagated,
+ *  so the calls can be chained without intermediate checks.
+ */
+
+// #pragma once
+
+#ifndef __rtmp_amf0_h__
+#define __rtmp_amf0_h__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+enum amf0_type {
+  amf0_number = 0x00,
+  amf0_boolean = 0x01,
+  amf0_string = 0x02,
+  amf0_object = 0x03,
+  amf0_null = 0x05,
+  amf0_undefined = 0x06,
+  amf0_ecma_array = 0x08,
+  amf0_object_end = 0x09,
+  amf0_strict_array = 0x0A,
+  amf0_date = 0x0B,
+  amf0_long_string = 0x0C,
+};
+
+
+uint8_t * amf0_put_number(uint8_t * p, const uint8_t * end, double v);
+uint8_t * amf0_put_boolean(uint8_t * p, const uint8_t * end, bool v);
+uint8_t * amf0_put_string(uint8_t * p, const uint8_t * end, const char * s);
+uint8_t * amf0_put_null(uint8_t * p, const uint8_t * end);
+uint8_t * amf0_put_undefined(uint8_t * p, const uint8_t * end);
+uint8_t * amf0_put_object_start(uint8_t * p, const uint8_t * end);
+uint8_t * amf0_put_object_end(uint8_t * p, const uint8_t * end);
+uint8_t * amf0_put_prop_name(uint8_t * p, const uint8_t * end, const char * name);
+uint8_t * amf0_put_prop_string(uint8_t * p, const uint8_t * end, const char * name, const char * s);
+uint8_t * amf0_put_prop_number(uint8_t * p, const uint8_t * end, const char * name, double v);
+
+
+const uint8_t * amf0_get_number(const uint8_t * p, const uint8_t * end, double * v);
+
+/* Extract string value, truncating to cbs - 1 characters */
+const uint8_t * amf0_get_string(const uint8_t * p, const uint8_t * end, char s[], size_t cbs);
+
+/* Skip any single value including nested objects and arrays */
+const uint8_t * amf0_skip(const uint8_t * p, const uint8_t * end);
+
+/* Scan object (or ecma array) for string property 'name'.
+ * s[] is set to empty string if not found */
+const uint8_t * amf0_get_prop_string(const uint8_t * p, const uint8_t * end, const char * name,
+    char s[], size_t cbs);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __rtmp_amf0_h__ */
@@ -8,6 +8,7 @@
 #define _GNU_SOURCE
 
 #include <string.h>
+#include <stdlib.h>
 #include <ctype.h>
 #include <malloc.h>
 #include <errno.h>
@@ -16,6 +17,8 @@
 #include "debug.h"
 
 #define MAX_REQUEST_LINES   128
+#define MAX_CONTENT_LENGTH  (64*1024)
+#define MAX_FRAME_SIZE      (4 + 65535)
 
 
 struct pmap {
@@ -168,6 +171,7 @@ static bool on_rtsp_parse_setup(struct rtsp_parser * p, const char * url, const
         { "CSeq", &c.cseq },
         { "User-Agent", &c.user_agent },
         { "Transport", &c.transport },
+        { "Session", &c.session },
         { NULL }
       });
 
@@ -215,9 +219,14 @@ static bool on_rtsp_parse_announce(struct rtsp_parser * p, const char * url, con
   parse_header(p, (struct pmap[] ) {
         { "CSeq", &c.cseq },
         { "User-Agent", &c.user_agent },
+        { "Content-Type", &c.content_type },
+        { "Session", &c.session },
         { NULL }
       });
 
+  c.body = p->body;
+  c.body_size = p->body_size;
+
   if ( c.cseq ) {
     fok = p->cb->on_announce(p->cookie, &c);
   }
@@ -262,6 +271,8 @@ static bool on_rtsp_parse_record(struct rtsp_parser * p, const char * url, const
   parse_header(p, (struct pmap[] ) {
         { "CSeq", &c.cseq },
         { "User-Agent", &c.user_agent },
+        { "Session", &c.session },
+        { "Range", &c.range },
         { NULL }
       });
 
@@ -352,6 +363,7 @@ static bool on_rtsp_parse_teardown(struct rtsp_parser * p, const char * url, con
   parse_header(p, (struct pmap[] ) {
         { "CSeq", &c.cseq },
         { "User-Agent", &c.user_agent },
+        { "Session", &c.session },
         { NULL }
       });
 
@@ -418,6 +430,10 @@ end:
   free_strings(p->lines, p->nb_lines);
   p->nb_lines = 0;
 
+  free(p->body);
+  p->body = NULL;
+  p->body_size = p->content_length = 0;
+
   return fok;
 }
 
@@ -436,15 +452,101 @@ void rtsp_parser_cleanup(struct rtsp_parser * p)
 {
   free_string_array(p->lines, MAX_REQUEST_LINES);
   free(p->current_line);
+  free(p->body);
+  free(p->frame);
+}
+
+
+static size_t get_content_length(const struct rtsp_parser * p)
+{
+  static const char hdr[] = "Content-Length:";
+
+  for ( size_t i = 1; i < p->nb_lines; ++i ) {
+    if ( p->lines[i] && strncasecmp(p->lines[i], hdr, sizeof(hdr) - 1) == 0 ) {
+      return strtoul(p->lines[i] + sizeof(hdr) - 1, NULL, 10);
+    }
+  }
+
+  return 0;
+}
+
+static size_t rtsp_parse_body(struct rtsp_parser * p, const char * data, size_t size)
+{
+  size_t n = p->content_length - p->body_size;
+
+  if ( n > size ) {
+    n = size;
+  }
+
+  memcpy(p->body + p->body_size, data, n);
+  p->body[p->body_size += n] = 0;
+
+  return n;
+}
+
+/* RFC 2326 10.12 Embedded (Interleaved) Binary Data: '$' channel size[2] data[size] */
+static size_t rtsp_parse_interleaved(struct rtsp_parser * p, const char * data, size_t size)
+{
+  size_t required = p->frame_size < 4 ? 4 : 4 + ((p->frame[2] << 8) | p->frame[3]);
+  size_t n = required - p->frame_size;
+
+  if ( n > size ) {
+    n = size;
+  }
+
+  memcpy(p->frame + p->frame_size, data, n);
+  p->frame_size += n;
+
+  return n;
 }
 
 bool rtsp_parser_execute(struct rtsp_parser * p, const char * data, size_t size)
 {
   const char * eol;
   bool eor = false;
+  size_t n;
 
   while ( size ) {
 
+    if ( p->state == rtsp_parser_state_body ) {
+
+      n = rtsp_parse_body(p, data, size);
+      size -= n, data += n;
+
+      if ( p->body_size == p->content_length ) {
+        p->state = rtsp_parser_state_header;
+        if ( !rtsp_parse_request(p) ) {
+          PDBG("rtsp_parse_request(p) fails");
+          return false;
+        }
+      }
+      continue;
+    }
+
+    if ( p->state == rtsp_parser_state_interleaved ) {
+
+      n = rtsp_parse_interleaved(p, data, size);
+      size -= n, data += n;
+
+      if ( p->frame_size >= 4 && p->frame_size == 4 + (size_t) ((p->frame[2] << 8) | p->frame[3]) ) {
+        p->state = rtsp_parser_state_header;
+        if ( p->cb->on_interleaved && !p->cb->on_interleaved(p->cookie, p->frame[1], p->frame + 4, p->frame_size - 4) ) {
+          PDBG("on_interleaved(channel=%d) fails", p->frame[1]);
+          return false;
+        }
+      }
+      continue;
+    }
+
+    if ( !p->current_line && !p->nb_lines && *data == '$' ) {
+      if ( !p->frame && !(p->frame = malloc(MAX_FRAME_SIZE)) ) {
+        return false;
+      }
+      p->frame_size = 0;
+      p->state = rtsp_parser_state_interleaved;
+      continue;
+    }
+
     if ( p->nb_lines >= MAX_REQUEST_LINES ) {
       errno = EMSGSIZE;
       return false;
@@ -464,9 +566,28 @@ bool rtsp_parser_execute(struct rtsp_parser * p, const char * data, size_t size)
     size -= ((eol - data) + 1);
     data = eol +1;
 
-    if ( eor && !rtsp_parse_request(p) ) {
-      PDBG("rtsp_parse_request(p) fails");
-      return false;
+    if ( eor ) {
+
+      if ( (p->content_length = get_content_length(p)) > 0 ) {
+
+        if ( p->content_length > MAX_CONTENT_LENGTH ) {
+          errno = EMSGSIZE;
+          return false;
+        }
+
+        if ( !(p->body = malloc(p->content_length + 1)) ) {
+          return false;
+        }
+
+        p->body_size = 0;
+        p->state = rtsp_parser_state_body;
+        continue;
+      }
+
+      if ( !rtsp_parse_request(p) ) {
+        PDBG("rtsp_parse_request(p) fails");
+        return false;
+      }
     }
   }
 
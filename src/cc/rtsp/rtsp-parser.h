@@ -78,6 +78,9 @@ struct rtsp_parser_callback_args {
   const char * transport;
   const char * session;
   const char * range;
+  const char * content_type;
+  const char * body;
+  size_t body_size;
 };
 
 struct rtsp_parser_callback {
@@ -92,6 +95,7 @@ struct rtsp_parser_callback {
   bool (*on_get_parameter)(void * cookie, const struct rtsp_parser_callback_args * args);
   bool (*on_set_parameter)(void * cookie, const struct rtsp_parser_callback_args * args);
   bool (*on_teardown)(void * cookie, const struct rtsp_parser_callback_args * args);
+  bool (*on_interleaved)(void * cookie, int channel, const uint8_t * data, size_t size);
 };
 
 struct rtsp_parser {
@@ -100,6 +104,19 @@ struct rtsp_parser {
   char * current_line;
   char ** lines;
   size_t nb_lines;
+
+  char * body;
+  size_t content_length;
+  size_t body_size;
+
+  uint8_t * frame; // '$' channel size data
+  size_t frame_size;
+
+  enum {
+    rtsp_parser_state_header = 0,
+    rtsp_parser_state_body = 1,
+    rtsp_parser_state_interleaved = 2,
+  } state;
 };
 
 
@@ -24,6 +24,10 @@
 #include <stdarg.h>
 #include <fcntl.h>
 
+#ifndef SO_MAX_PACING_RATE
+# define SO_MAX_PACING_RATE 47
+#endif
+
 #define INET_ADDR(a,b,c,d)    \
   (uint32_t)((((uint32_t)(a))<<24)|((b)<<16)|((c)<<8)|(d))
 
@@ -466,3 +470,20 @@ int so_get_outq_size(int so)
   }
   return size;
 }
+
+int so_get_inq_size(int so)
+{
+  int size;
+  if ( ioctl(so, FIONREAD, &size) == -1 ) {
+    size = -1;
+  }
+  return size;
+}
+
+int so_set_max_pacing_rate(int so, uint32_t bytes_per_sec)
+{
+  if ( !bytes_per_sec ) {
+    bytes_per_sec = ~0U;
+  }
+  return setsockopt(so, SOL_SOCKET, SO_MAX_PACING_RATE, &bytes_per_sec, sizeof(bytes_per_sec));
+}
@@ -63,6 +63,12 @@ ssize_t so_srecv(int so, char line[], size_t size);
 
 int so_get_outq_size(int so);
 
+/* Number of received bytes not read yet, -1 on error */
+int so_get_inq_size(int so);
+
+/* Limit kernel transmit rate of the socket (fq qdisc or TCP internal pacing), 0 removes the limit */
+int so_set_max_pacing_rate(int so, uint32_t bytes_per_sec);
+
 
 #ifdef __cplusplus
 }
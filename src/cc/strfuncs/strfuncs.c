@@ -244,6 +244,38 @@ end: ;
 }
 
 
+bool get_url_arg(const char * urlargs, const char * key, char value[], size_t value_size)
+{
+  const size_t keylen = strlen(key);
+  const char * arg, * eq, * end;
+  size_t n;
+
+  for ( arg = urlargs; *arg; arg = *end ? end + 1 : end ) {
+
+    if ( !(end = strchr(arg, '&')) ) {
+      end = arg + strlen(arg);
+    }
+
+    if ( !(eq = memchr(arg, '=', end - arg)) ) {
+      eq = end;
+    }
+
+    if ( (size_t) (eq - arg) == keylen && strncmp(arg, key, keylen) == 0 ) {
+      if ( value_size > 0 ) {
+        if ( (n = eq < end ? (size_t) (end - eq - 1) : 0) > value_size - 1 ) {
+          n = value_size - 1;
+        }
+        memcpy(value, eq + 1, n);
+        value[n] = 0;
+      }
+      return true;
+    }
+  }
+
+  return false;
+}
+
+
 void parse_url(const char * url, char proto[], size_t proto_size, char auth[], size_t auth_size, char host[],
     size_t host_size, int * port_ptr, char path[], size_t path_size)
 {
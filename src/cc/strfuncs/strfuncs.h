@@ -49,6 +49,11 @@ void split_url(const char * url,
     char urlpath[], size_t urlpath_size,
     char urlargs[], size_t urlargs_size);
 
+// value of key in '&'-separated key=value list, false if key is not there
+bool get_url_arg(const char * urlargs,
+    const char * key,
+    char value[], size_t value_size);
+
 void parse_url(const char * url,
     char proto[], size_t proto_size,
     char auth[], size_t auth_size,
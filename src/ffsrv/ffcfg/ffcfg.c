@@ -61,6 +61,45 @@ struct ffsrv_config ffsrv = {
     .sndtmo    = 20, // sec
   },
 
+  .rtmp = {
+    .rxbuf     = 64 * 1024,
+    .txbuf     = 256 * 1024,
+    .chunksize = 64 * 1024,
+    .maxmsgsize = 4 * 1024 * 1024,
+    .maxchunkstreams = 8,
+    .rcvtmo    = 20, // sec
+    .sndtmo    = 20, // sec
+  },
+
+  .pacing = {
+    .window = 40, // ms
+    .output = 0,
+  },
+
+  .interleave = {
+    .bounded = false,
+    .maxskew = 500, // ms
+  },
+
+  .muxpool = {
+    .size = 2,
+  },
+
+  .segments = {
+    .persist = false,
+    .maxfiles = 64,
+    .ioqueue = 64,
+    .archive_maxage = 168,
+  },
+
+  .popen = {
+    .restart      = popen_restart_on_failure,
+    .maxrestarts  = 5,
+    .restartdelay = 1, // sec
+    .nice         = 0,
+    .cpus         = NULL,
+  },
+
   .keepalive = {
     .enable    = true,
     .idle      = 5,
@@ -204,6 +243,7 @@ static void ffconfig_init(void)
     ccarray_init(&ffsrv.http.faces, 32, sizeof(struct sockaddr_in));
     ccarray_init(&ffsrv.https.faces, 32, sizeof(struct sockaddr_in));
     ccarray_init(&ffsrv.rtsp.faces, 32, sizeof(struct sockaddr_in));
+    ccarray_init(&ffsrv.rtmp.faces, 32, sizeof(struct sockaddr_in));
 
     csmap_init(&ffsrv.magic.mime);
 
@@ -484,6 +524,159 @@ bool ffsrv_parse_option(char * keyname, char * keyvalue)
     }
   }
 
+  ///////////
+  else if ( strcmp(keyname, "rtmp.listen") == 0 ) {
+    if( !parse_listen_faces(keyvalue, &ffsrv.rtmp.faces) ) {
+      return false;
+    }
+  }
+  else if ( strcmp(keyname, "rtmp.rxbuf") == 0 ) {
+    if ( *keyvalue && !str2size(keyvalue, &ffsrv.rtmp.rxbuf) ) {
+      fprintf(stderr, "FATAL: Invalid key value: %s=%s\n", keyname, keyvalue);
+      return false;
+    }
+  }
+  else if ( strcmp(keyname, "rtmp.txbuf") == 0 ) {
+    if ( *keyvalue && !str2size(keyvalue, &ffsrv.rtmp.txbuf) ) {
+      fprintf(stderr, "FATAL: Invalid key value: %s=%s\n", keyname, keyvalue);
+      return false;
+    }
+  }
+  else if ( strcmp(keyname, "rtmp.chunksize") == 0 ) {
+    if ( *keyvalue && (!str2size(keyvalue, &ffsrv.rtmp.chunksize) || ffsrv.rtmp.chunksize < 128
+        || ffsrv.rtmp.chunksize > 0xFFFFFF) ) {
+      fprintf(stderr, "FATAL: Invalid key value: %s=%s\n", keyname, keyvalue);
+      return false;
+    }
+  }
+  else if ( strcmp(keyname, "rtmp.maxmsgsize") == 0 ) {
+    if ( *keyvalue && (!str2size(keyvalue, &ffsrv.rtmp.maxmsgsize) || ffsrv.rtmp.maxmsgsize < 128
+        || ffsrv.rtmp.maxmsgsize > 0xFFFFFF) ) {
+      fprintf(stderr, "FATAL: Invalid key value: %s=%s\n", keyname, keyvalue);
+      return false;
+    }
+  }
+  else if ( strcmp(keyname, "rtmp.maxchunkstreams") == 0 ) {
+    if ( *keyvalue && (sscanf(keyvalue, "%d", &ffsrv.rtmp.maxchunkstreams) != 1 || ffsrv.rtmp.maxchunkstreams < 1) ) {
+      fprintf(stderr, "FATAL: Invalid key value: %s=%s\n", keyname, keyvalue);
+      return false;
+    }
+  }
+  else if ( strcmp(keyname, "rtmp.rcvtmo") == 0 ) {
+    if ( *keyvalue && sscanf(keyvalue, "%d", &ffsrv.rtmp.rcvtmo) != 1 ) {
+      fprintf(stderr, "FATAL: Invalid key value: %s=%s\n", keyname, keyvalue);
+      return false;
+    }
+  }
+  else if ( strcmp(keyname, "rtmp.sndtmo") == 0 ) {
+    if ( *keyvalue && sscanf(keyvalue, "%d", &ffsrv.rtmp.sndtmo) != 1 ) {
+      fprintf(stderr, "FATAL: Invalid key value: %s=%s\n", keyname, keyvalue);
+      return false;
+    }
+  }
+
+
+  ///////////
+  else if ( strcmp(keyname, "pacing.window") == 0 ) {
+    if ( *keyvalue && (sscanf(keyvalue, "%d", &ffsrv.pacing.window) != 1 || ffsrv.pacing.window < 1) ) {
+      fprintf(stderr, "FATAL: Invalid key value: %s=%s\n", keyname, keyvalue);
+      return false;
+    }
+  }
+  else if ( strcmp(keyname, "interleave.mode") == 0 ) {
+    if ( strcasecmp(keyvalue, "muxer") == 0 ) {
+      ffsrv.interleave.bounded = false;
+    }
+    else if ( strcasecmp(keyvalue, "bounded") == 0 ) {
+      ffsrv.interleave.bounded = true;
+    }
+    else {
+      fprintf(stderr, "FATAL: Invalid key value: %s=%s\n", keyname, keyvalue);
+      return false;
+    }
+  }
+  else if ( strcmp(keyname, "interleave.maxskew") == 0 ) {
+    if ( *keyvalue && (sscanf(keyvalue, "%d", &ffsrv.interleave.maxskew) != 1 || ffsrv.interleave.maxskew < 0) ) {
+      fprintf(stderr, "FATAL: Invalid key value: %s=%s\n", keyname, keyvalue);
+      return false;
+    }
+  }
+  else if ( strcmp(keyname, "muxpool.size") == 0 ) {
+    if ( *keyvalue && (sscanf(keyvalue, "%d", &ffsrv.muxpool.size) != 1 || ffsrv.muxpool.size < 0) ) {
+      fprintf(stderr, "FATAL: Invalid key value: %s=%s\n", keyname, keyvalue);
+      return false;
+    }
+  }
+  else if ( strcmp(keyname, "segments.persist") == 0 ) {
+    if ( *keyvalue && !str2bool(keyvalue, &ffsrv.segments.persist) ) {
+      fprintf(stderr, "FATAL: Invalid key value: %s=%s\n", keyname, keyvalue);
+      return false;
+    }
+  }
+  else if ( strcmp(keyname, "segments.maxfiles") == 0 ) {
+    if ( *keyvalue && (sscanf(keyvalue, "%d", &ffsrv.segments.maxfiles) != 1 || ffsrv.segments.maxfiles < 4) ) {
+      fprintf(stderr, "FATAL: Invalid key value: %s=%s\n", keyname, keyvalue);
+      return false;
+    }
+  }
+  else if ( strcmp(keyname, "segments.ioqueue") == 0 ) {
+    if ( *keyvalue && (sscanf(keyvalue, "%d", &ffsrv.segments.ioqueue) != 1 || ffsrv.segments.ioqueue < 1) ) {
+      fprintf(stderr, "FATAL: Invalid key value: %s=%s\n", keyname, keyvalue);
+      return false;
+    }
+  }
+  else if ( strcmp(keyname, "segments.archive_maxage") == 0 ) {
+    if ( *keyvalue && (sscanf(keyvalue, "%d", &ffsrv.segments.archive_maxage) != 1 || ffsrv.segments.archive_maxage < 0) ) {
+      fprintf(stderr, "FATAL: Invalid key value: %s=%s\n", keyname, keyvalue);
+      return false;
+    }
+  }
+  else if ( strcmp(keyname, "pacing.output") == 0 ) {
+    if ( *keyvalue && (sscanf(keyvalue, "%lf", &ffsrv.pacing.output) != 1 || (ffsrv.pacing.output != 0 && ffsrv.pacing.output < 1)) ) {
+      fprintf(stderr, "FATAL: Invalid key value: %s=%s\n", keyname, keyvalue);
+      return false;
+    }
+  }
+
+  ///////////
+  else if ( strcmp(keyname, "popen.restart") == 0 ) {
+    if ( strcasecmp(keyvalue, "never") == 0 || strcasecmp(keyvalue, "no") == 0 ) {
+      ffsrv.popen.restart = popen_restart_never;
+    }
+    else if ( strcasecmp(keyvalue, "on-failure") == 0 ) {
+      ffsrv.popen.restart = popen_restart_on_failure;
+    }
+    else if ( strcasecmp(keyvalue, "always") == 0 ) {
+      ffsrv.popen.restart = popen_restart_always;
+    }
+    else {
+      fprintf(stderr, "FATAL: Invalid key value: %s=%s\n", keyname, keyvalue);
+      return false;
+    }
+  }
+  else if ( strcmp(keyname, "popen.maxrestarts") == 0 ) {
+    if ( *keyvalue && sscanf(keyvalue, "%d", &ffsrv.popen.maxrestarts) != 1 ) {
+      fprintf(stderr, "FATAL: Invalid key value: %s=%s\n", keyname, keyvalue);
+      return false;
+    }
+  }
+  else if ( strcmp(keyname, "popen.restartdelay") == 0 ) {
+    if ( *keyvalue && sscanf(keyvalue, "%d", &ffsrv.popen.restartdelay) != 1 ) {
+      fprintf(stderr, "FATAL: Invalid key value: %s=%s\n", keyname, keyvalue);
+      return false;
+    }
+  }
+  else if ( strcmp(keyname, "popen.nice") == 0 ) {
+    if ( *keyvalue && sscanf(keyvalue, "%d", &ffsrv.popen.nice) != 1 ) {
+      fprintf(stderr, "FATAL: Invalid key value: %s=%s\n", keyname, keyvalue);
+      return false;
+    }
+  }
+  else if ( strcmp(keyname, "popen.cpus") == 0 ) {
+    if ( *keyvalue ) {
+      SDUP(ffsrv.popen.cpus, keyvalue);
+    }
+  }
 
   ///////////
   else if ( strcmp(keyname, "db.root") == 0 ) {
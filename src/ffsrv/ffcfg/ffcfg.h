@@ -67,6 +67,50 @@ extern struct ffsrv_config {
     int sndtmo;
   }rtsp;
 
+  struct {
+    ccarray_t faces;
+    size_t rxbuf;
+    size_t txbuf;
+    size_t chunksize;
+    size_t maxmsgsize;     // max size of incoming message
+    int maxchunkstreams;   // max incoming chunk streams per connection
+    int rcvtmo;
+    int sndtmo;
+  }rtmp;
+
+  struct {
+    int window; // [ms] rate emulation release window
+    double output; // viewer send rate over measured source bitrate, 0 disables output pacing
+  }pacing;
+
+  struct {
+    bool bounded; // multi-stream outputs use bounded-skew interleaver instead of av_interleaved_write_frame()
+    int maxskew;  // [ms] max stream time a packet may wait for other streams
+  }interleave;
+
+  struct {
+    int size; // prepared muxer contexts kept per (source, format), 0 disables pooling
+  }muxpool;
+
+  struct {
+    bool persist; // write hls/dash files under db.root instead of in-memory store
+    int maxfiles; // in-memory files per rendition for playlists without window, oldest are dropped first
+    int ioqueue;  // persisted file writes queued to I/O thread, muxing yields while full
+    int archive_maxage; // [h] hls_archive segments older than this are removed, 0 keeps them forever
+  }segments;
+
+  struct {
+    enum {
+      popen_restart_never = 0,
+      popen_restart_on_failure = 1,
+      popen_restart_always = 2,
+    } restart;
+    int maxrestarts;
+    int restartdelay;
+    int nice;
+    char * cpus;
+  }popen;
+
 
   struct {
     char * mgc;
@@ -448,8 +448,17 @@ bool ffdb_load_object_params(const char * urlpath, enum ffobjtype * objtype, ffo
 
       case ffobjtype_segments : {
         if ( strcmp(key, "source") == 0 ) {
-          free(params->segments.source);
-          params->segments.source = convert_path(curpath, value);
+          // source = name1 [name2 ...]
+          char * saveptr = NULL;
+          for ( char * p = strtok_r(value, " \t,", &saveptr); p; p = strtok_r(NULL, " \t,", &saveptr) ) {
+            char ** sources = realloc(params->segments.sources, (params->segments.nb_sources + 1) * sizeof(*sources));
+            if ( sources ) {
+              params->segments.sources = sources;
+              if ( (sources[params->segments.nb_sources] = convert_path(curpath, p)) ) {
+                ++params->segments.nb_sources;
+              }
+            }
+          }
         }
         else if ( strcmp(key, "opts") == 0 ) {
           free(params->segments.opts);
@@ -518,7 +527,10 @@ void ffdb_cleanup_object_params(enum ffobjtype objtype, ffobjparams * params)
       free(params->mixer.smap);
     break;
     case ffobjtype_segments:
-      free(params->segments.source);
+      for ( size_t i = 0; i < params->segments.nb_sources; ++i ) {
+        free(params->segments.sources[i]);
+      }
+      free(params->segments.sources);
       free(params->segments.opts);
       free(params->segments.manifest);
       break;
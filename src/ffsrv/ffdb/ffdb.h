@@ -66,7 +66,8 @@ struct ffmixer_params {
 };
 
 struct ffsegments_params {
-  char * source;
+  char ** sources; // encoder ladder: several sources become renditions of one manifest
+  size_t nb_sources;
   char * manifest;
   char * opts;
   int rtmo;
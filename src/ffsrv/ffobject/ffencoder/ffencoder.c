@@ -25,6 +25,7 @@ struct ostream {
   ffstream base;
   AVCodecContext * codec;
   int64_t ppts;
+  int64_t nextkey; // [us] pts of the next forced key frame
 
   union {
 
@@ -53,7 +54,7 @@ struct ffenc {
   struct ostream ** oss;  // [nb_output_streams]
   struct ffstmap * smap;  // [nb_output_streams]
 
-  int64_t t0, force_key_frames;
+  int64_t force_key_frames;
 };
 
 
@@ -458,6 +459,7 @@ static int start_encoding(struct ffenc * enc, struct ffobject * source, const st
 
           os->base.time_base = os->codec->time_base;
           os->ppts = AV_NOPTS_VALUE;
+          os->nextkey = AV_NOPTS_VALUE;
         }
         break;
 
@@ -691,7 +693,7 @@ static int encode_and_send(struct ffenc * enc, int stidx, AVFrame * frame)
   struct ostream * os;
 
   AVPacket pkt;
-  int64_t t0 = 0;
+  int64_t upts;
   int status, gotpkt;
 
   os = enc->oss[stidx];
@@ -708,13 +710,27 @@ static int encode_and_send(struct ffenc * enc, int stidx, AVFrame * frame)
 
     case AVMEDIA_TYPE_VIDEO :
 
-      if ( enc->force_key_frames <= 0 || (t0 = ffmpeg_gettime_us()) < enc->t0 + enc->force_key_frames ) {
+      // key frames are forced on the grid of input pts, not wall clock:
+      // encoders fed by the same decoder cut on the same frames and their segments stay aligned
+      upts = AV_NOPTS_VALUE;
+
+      if ( enc->force_key_frames > 0 && frame->pts != AV_NOPTS_VALUE ) {
+
+        upts = av_rescale_ts(frame->pts, os->codec->time_base, (AVRational ) { 1, FFMPEG_TIME_SCALE });
+
+        // pts jumped back by more than one interval (source reconnect, decoder restart, wrap): re-anchor the grid
+        if ( os->nextkey != AV_NOPTS_VALUE && upts < os->nextkey - enc->force_key_frames ) {
+          os->nextkey = AV_NOPTS_VALUE;
+        }
+      }
+
+      if ( upts == AV_NOPTS_VALUE || (os->nextkey != AV_NOPTS_VALUE && upts < os->nextkey) ) {
         frame->pict_type = AV_PICTURE_TYPE_NONE;
       }
       else {
         frame->key_frame = 1;
         frame->pict_type = AV_PICTURE_TYPE_I;
-        enc->t0 = t0;
+        os->nextkey = (upts / enc->force_key_frames + 1) * enc->force_key_frames;
         // PDBG("[%s] FORCE KEY", objname(enc));
       }
 
@@ -734,10 +750,6 @@ static int encode_and_send(struct ffenc * enc, int stidx, AVFrame * frame)
             av_ts2str(frame->pts), av_ts2str(os->ppts), av_err2str(status));
       }
 
-      if ( (enc->force_key_frames > 0) && (pkt.flags & AV_PKT_FLAG_KEY) ) {
-        enc->t0 = t0;
-      }
-
     break;
 
     default :
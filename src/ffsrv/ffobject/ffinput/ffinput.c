@@ -6,8 +6,11 @@
  */
 
 #include "ffinput.h"
+#include "ffudpinput.h"
+#include "ffpopen.h"
 #include "ffcfg.h"
 #include "ffgop.h"
+#include "ffpacer.h"
 #include "debug.h"
 
 
@@ -41,6 +44,8 @@ struct ffinput {
   int rtmo, itmo;
 
   int (*onrecvpkt)(void * cookie, uint8_t *buf, int buf_size);
+  int (*onopeninput)(void * cookie, AVFormatContext ** ic);
+  int (*onreadpkt)(void * cookie, AVPacket * pkt);
   void * cookie;
 
   coevent * ev;
@@ -242,12 +247,17 @@ int ff_create_input(struct ffobject ** obj, const struct ff_create_input_args *
     goto end;
   }
 
-  if ( (args->params && args->params->source && *args->params->source) && args->recv_pkt ) {
+  if ( !args->read_pkt != !args->open_input ) {
+    status = AVERROR(EINVAL);
+    goto end;
+  }
+
+  if ( (args->params && args->params->source && *args->params->source) && (args->recv_pkt || args->read_pkt) ) {
     status = AVERROR(EPERM);
     goto end;
   }
 
-  if ( !(args->params && args->params->source && *args->params->source) && !args->recv_pkt ) {
+  if ( !(args->params && args->params->source && *args->params->source) && !args->recv_pkt && !args->read_pkt ) {
     status = AVERROR(EPERM);
     goto end;
   }
@@ -282,6 +292,8 @@ int ff_create_input(struct ffobject ** obj, const struct ff_create_input_args *
   input->re = args->params->re;
   input->genpts = args->params->genpts != 0;
   input->onrecvpkt = args->recv_pkt;
+  input->onopeninput = args->open_input;
+  input->onreadpkt = args->read_pkt;
   input->cookie = args->cookie;
   input->rtmo = args->params->rtmo > 0 ? args->params->rtmo : 15;
   input->itmo = args->params->itmo > 0 ? args->params->itmo : 5;
@@ -347,9 +359,12 @@ static bool can_start_in_cothread(const struct ffinput * ffsrc)
 {
   bool fok = false;
 
-  if ( ffsrc->onrecvpkt ) {
+  if ( ffsrc->onrecvpkt || ffsrc->onreadpkt ) {
     fok = true;
   }
+  else if ( ffsrc->url && strncasecmp(ffsrc->url, "popen://", 8) == 0 ) {
+    fok = true; // non-blocking pipe, child is reaped via pidfd
+  }
   else if ( ffsrc->url != NULL ) {
 
     static const char * netprotos[] = {
@@ -373,106 +388,6 @@ static bool can_start_in_cothread(const struct ffinput * ffsrc)
 ////////////////////////////////////////////////////////////////////////////////////////////
 
 
-#define FF_POPEN_INPUT_BUF_SIZE (256*1024)
-struct ff_popen_context {
-  char * command;
-  FILE * fp;
-  uint8_t * iobuf;
-  int fd;
-};
-
-static int ff_popen_read_pkt(void * opaque, uint8_t * buf, int buf_size)
-{
-  struct ff_popen_context * ctx = opaque;
-  int status = 0;
-
-  if ( !ctx->fp && !(ctx->fp = popen(ctx->command, "r")) ) {
-    status = AVERROR(errno);
-    goto end;
-  }
-
-  if ( ctx->fd == -1 && (ctx->fd = fileno(ctx->fp)) ) {
-    status = AVERROR(errno);
-    goto end;
-  }
-
-  //PDBG("C co_read(buf=%p buf_size=%d)", buf, buf_size);
-  status = co_read(ctx->fd, buf, buf_size);
-  //PDBG("C co_read(): status=%d", status);
-
-end:
-
-  return status;
-}
-
-static int ff_create_popen_context(AVIOContext ** pb, const char * command)
-{
-  struct ff_popen_context * ctx = NULL;
-  const size_t bufsize = FF_POPEN_INPUT_BUF_SIZE;
-  int status = 0;
-
-  *pb = NULL;
-
-  if ( !(ctx = av_mallocz(sizeof(*ctx))) ) {
-    status = AVERROR(ENOMEM);
-    goto end;
-  }
-
-  ctx->fd = -1;
-
-  if ( !(ctx->command = strdup(command)) ) {
-    status = AVERROR(ENOMEM);
-    goto end;
-  }
-
-  if ( !(ctx->iobuf = av_malloc(bufsize)) ) {
-    status = AVERROR(ENOMEM);
-    goto end;
-  }
-
-  if ( !(*pb = avio_alloc_context(ctx->iobuf, bufsize, false, ctx, ff_popen_read_pkt, NULL, NULL)) ) {
-    status = AVERROR(ENOMEM);
-    goto end;
-  }
-
-
-end:
-
-  if ( status ) {
-    if ( ctx ) {
-      free(ctx->command);
-      av_free(ctx->iobuf);
-      av_free(ctx);
-    }
-  }
-
-  return status;
-}
-
-static void ff_close_popen_context(AVIOContext ** pb)
-{
-  if ( pb && *pb ) {
-
-    struct ff_popen_context * ctx = (*pb)->opaque;
-
-    if ( ctx ) {
-
-      if ( ctx->fp ) {
-        PDBG("C pclose(fp=%p)", ctx->fp);
-        pclose(ctx->fp);
-        PDBG("R pclose(fp=%p)", ctx->fp);
-      }
-      free(ctx->command);
-    }
-
-    av_free((*pb)->buffer);
-    av_freep(pb);
-  }
-}
-
-
-
-
 static void ff_usleep(int64_t usec)
 {
   if ( is_in_cothread() ) {
@@ -489,6 +404,11 @@ static void set_timeout_interrupt_callback(struct ffinput * input, struct ff_tim
   ffmpeg_set_timeout_interrupt_callback(tcb, ffmpeg_gettime_us() + input->rtmo * FFMPEG_TIME_SCALE);
 }
 
+static int read_input_frame(struct ffinput * input, AVFormatContext * ic, AVPacket * pkt)
+{
+  return input->onreadpkt ? input->onreadpkt(input->cookie, pkt) : av_read_frame(ic, pkt);
+}
+
 
 int ff_run_input_stream(struct ffinput * input)
 {
@@ -506,7 +426,7 @@ int ff_run_input_stream(struct ffinput * input)
   // for rate emulation
   int64_t * firstdts = NULL;
   int64_t * prevdts = NULL;
-  int64_t ts0 = 0, now = 0 ;
+  struct ffpacer pacer = { 0 };
 
   int64_t pkt_pts, pkt_dts, pkt_duration;
 
@@ -516,6 +436,7 @@ int ff_run_input_stream(struct ffinput * input)
     pb_type_none = 0,
     pb_type_callback = 1,
     pb_type_popen = 2,
+    pb_type_udp = 3,
   } pb_type = pb_type_none;
 
   int64_t idle_time;
@@ -542,7 +463,7 @@ int ff_run_input_stream(struct ffinput * input)
 
   if ( input->url && strncasecmp(input->url, "popen://", 8) == 0 ) {
 
-    if ( (status = ff_create_popen_context(&pb, input->url + 8)) ) {
+    if ( (status = ff_create_popen_context(&pb, input->url + 8, objname(input), input->rtmo)) ) {
       PDBG("ff_create_popen_context() fails: %s", av_err2str(status));
       goto end;
     }
@@ -581,30 +502,52 @@ int ff_run_input_stream(struct ffinput * input)
     PDBG("[%s] R co_resolve_url_4(%s) -> %s", objname(input), input->url, url);
   }
 
+  if ( !pb && ff_is_udp_input_url(url) ) {
+
+    if ( (status = ff_create_udp_input_context(&pb, url, objname(input), input->rtmo)) ) {
+      PDBG("[%s] ff_create_udp_input_context() fails: %s", objname(input), av_err2str(status));
+      goto end;
+    }
+
+    pb_type = pb_type_udp;
+  }
+
 
   ////////////////////////////////////////////////////////////////////
 
-  PDBG("[%s] ffmpeg_open_input('%s')", objname(input), url);
+  if ( input->onopeninput ) {
 
-  set_timeout_interrupt_callback(input, &tcb);
+    PDBG("[%s] onopeninput()", objname(input));
 
-  if ( opts ) {
-    av_dict_copy(&input_opts, opts, 0);
+    if ( (status = input->onopeninput(input->cookie, &ic)) ) {
+      PDBG("[%s] onopeninput() fails: %s", objname(input), av_err2str(status));
+      goto end;
+    }
   }
+  else {
 
-  if ( (status = ffmpeg_open_input(&ic, url, pb, &tcb.icb, &input_opts)) ) {
-    PDBG("[%s] ffmpeg_open_input() fails: %s", objname(input), av_err2str(status));
-    goto end;
-  }
+    PDBG("[%s] ffmpeg_open_input('%s')", objname(input), url);
 
+    set_timeout_interrupt_callback(input, &tcb);
 
-  ////////////////////////////////////////////////////////////////////
+    if ( opts ) {
+      av_dict_copy(&input_opts, opts, 0);
+    }
 
-  PDBG("[%s] ffmpeg_probe_input()", objname(input));
-  set_timeout_interrupt_callback(input, &tcb);
-  if ( (status = ffmpeg_probe_input(ic, true)) < 0 ) {
-    PDBG("[%s] ffmpeg_probe_input() fails", objname(input));
-    goto end;
+    if ( (status = ffmpeg_open_input(&ic, url, pb, &tcb.icb, &input_opts)) ) {
+      PDBG("[%s] ffmpeg_open_input() fails: %s", objname(input), av_err2str(status));
+      goto end;
+    }
+
+
+    ////////////////////////////////////////////////////////////////////
+
+    PDBG("[%s] ffmpeg_probe_input()", objname(input));
+    set_timeout_interrupt_callback(input, &tcb);
+    if ( (status = ffmpeg_probe_input(ic, true)) < 0 ) {
+      PDBG("[%s] ffmpeg_probe_input() fails", objname(input));
+      goto end;
+    }
   }
 
   if ( input->genpts ) {
@@ -643,7 +586,7 @@ int ff_run_input_stream(struct ffinput * input)
 
 
   if ( input->re > 0 ) {
-    ts0 = ffmpeg_gettime_us();
+    ffpacer_init(&pacer, ffsrv.pacing.window * 1000);
   }
 
   idle_time = 0;
@@ -665,7 +608,7 @@ int ff_run_input_stream(struct ffinput * input)
     }
 
     set_timeout_interrupt_callback(input, &tcb);
-    while ( (status = av_read_frame(ic, &pkt)) == AVERROR(EAGAIN) ) {
+    while ( (status = read_input_frame(input, ic, &pkt)) == AVERROR(EAGAIN) ) {
       ff_usleep(10 * 1000);
     }
 
@@ -697,12 +640,7 @@ int ff_run_input_stream(struct ffinput * input)
     }
     else if ( input->re > 0 && isidx == input->re - 1 && firstdts[isidx] != AV_NOPTS_VALUE ) {
 
-      int64_t ts = av_rescale_ts(pkt.dts - firstdts[isidx], is->time_base, TIME_BASE_USEC);
-
-      if ( (now = ffmpeg_gettime_us() - ts0) < ts ) {
-        // PDBG("[%s] sleep %s", objname(input), av_ts2str(ts - now));
-        ff_usleep(ts - now);
-      }
+      ffpacer_wait(&pacer, av_rescale_ts(pkt.dts - firstdts[isidx], is->time_base, TIME_BASE_USEC));
     }
 
     if ( firstdts[isidx] == AV_NOPTS_VALUE ) {
@@ -773,6 +711,9 @@ end: ;
       case pb_type_popen :
         ff_close_popen_context(&pb);
       break;
+      case pb_type_udp :
+        ff_close_udp_input_context(&pb);
+      break;
       default :
         PDBG("BUG: pb_type = %d", pb_type);
         exit(1);
@@ -23,6 +23,8 @@ struct ff_create_input_args {
   const struct ffinput_params * params;
   void * cookie;
   int (*recv_pkt)(void * cookie, uint8_t *buf, int buf_size);
+  int (*open_input)(void * cookie, AVFormatContext ** ic);
+  int (*read_pkt)(void * cookie, AVPacket * pkt);
 };
 
 int ff_create_input(struct ffobject ** obj, const struct ff_create_input_args * args);
@@ -0,0 +1,395 @@
+/*
+ * ffpopen.c
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: amyznikov
+ */
+#define _GNU_SOURCE
+
+#include "ffpopen.h"
+#include "ffcfg.h"
+#include "co-scheduler.h"
+#include "debug.h"
+#include <spawn.h>
+#include <sched.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/wait.h>
+#include <sys/syscall.h>
+
+
+#define FF_POPEN_INPUT_BUF_SIZE   (256*1024)
+#define FF_POPEN_TERM_TIMEOUT     2000  // ms to wait after SIGTERM before SIGKILL
+#define FF_POPEN_EXIT_TIMEOUT     5000  // ms to wait for child exit after pipe EOF
+#define FF_POPEN_STABLE_TIME      60    // s of child run time after which restarts counter is reset
+
+extern char ** environ;
+
+struct ff_popen_context {
+  char * command;
+  char * name;
+  uint8_t * iobuf;
+  pid_t pid;
+  int fd;
+  int pidfd;
+  int rtmo;
+  int restarts;
+  int64_t started;
+};
+
+
+static void ff_popen_sleep_ms(int ms)
+{
+  if ( is_in_cothread() ) {
+    co_sleep(ms * 1000);
+  }
+  else {
+    usleep(ms * 1000);
+  }
+}
+
+static void ff_popen_wait_io(int fd, int tmo_ms)
+{
+  if ( is_in_cothread() ) {
+    co_io_wait(fd, EPOLLIN, tmo_ms);
+  }
+  else {
+    poll(&(struct pollfd ) { .fd = fd, .events = POLLIN }, 1, tmo_ms);
+  }
+}
+
+
+static bool parse_cpus(const char * s, cpu_set_t * cpus)
+{
+  int first, last, n;
+
+  CPU_ZERO(cpus);
+
+  while ( *s ) {
+
+    if ( sscanf(s, "%d%n", &first, &n) != 1 || first < 0 || first >= CPU_SETSIZE ) {
+      return false;
+    }
+
+    s += n, last = first;
+
+    if ( *s == '-' && (sscanf(s + 1, "%d%n", &last, &n) != 1 || last < first || last >= CPU_SETSIZE) ) {
+      return false;
+    }
+    else if ( *s == '-' ) {
+      s += n + 1;
+    }
+
+    while ( first <= last ) {
+      CPU_SET(first++, cpus);
+    }
+
+    s += strspn(s, ", ");
+  }
+
+  return true;
+}
+
+
+static int spawn_child(struct ff_popen_context * ctx)
+{
+  posix_spawn_file_actions_t fa;
+  posix_spawnattr_t attr;
+  sigset_t sigs;
+  cpu_set_t cpus;
+  char nice[16];
+  char * argv[10];
+  int argc = 0;
+  int pipefd[2] = { -1, -1 };
+  int status;
+
+  // nice and affinity must be in effect before exec, so that the whole pipeline inherits them
+  if ( ffsrv.popen.nice ) {
+    snprintf(nice, sizeof(nice), "%d", ffsrv.popen.nice);
+    argv[argc++] = "nice";
+    argv[argc++] = "-n";
+    argv[argc++] = nice;
+  }
+
+  if ( ffsrv.popen.cpus && *ffsrv.popen.cpus ) {
+    if ( !parse_cpus(ffsrv.popen.cpus, &cpus) ) {
+      PDBG("[%s] Invalid popen.cpus '%s'", ctx->name, ffsrv.popen.cpus);
+    }
+    else {
+      argv[argc++] = "taskset";
+      argv[argc++] = "-c";
+      argv[argc++] = ffsrv.popen.cpus;
+    }
+  }
+
+  argv[argc++] = "/bin/sh";
+  argv[argc++] = "-c";
+  argv[argc++] = ctx->command;
+  argv[argc] = NULL;
+
+  if ( pipe2(pipefd, O_CLOEXEC) == -1 ) {
+    status = AVERROR(errno);
+    PDBG("[%s] pipe2() fails: %s", ctx->name, strerror(errno));
+    return status;
+  }
+
+  posix_spawn_file_actions_init(&fa);
+  posix_spawn_file_actions_adddup2(&fa, pipefd[1], STDOUT_FILENO);
+
+  // own process group so that whole shell pipeline can be signaled,
+  // signal mask and handlers of ffsrv must not leak into the child
+  posix_spawnattr_init(&attr);
+  posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETPGROUP | POSIX_SPAWN_SETSIGMASK | POSIX_SPAWN_SETSIGDEF);
+  posix_spawnattr_setpgroup(&attr, 0);
+  sigemptyset(&sigs);
+  posix_spawnattr_setsigmask(&attr, &sigs);
+  sigfillset(&sigs);
+  sigdelset(&sigs, SIGKILL);
+  sigdelset(&sigs, SIGSTOP);
+  posix_spawnattr_setsigdefault(&attr, &sigs);
+
+  status = posix_spawnp(&ctx->pid, argv[0], &fa, &attr, argv, environ);
+
+  posix_spawnattr_destroy(&attr);
+  posix_spawn_file_actions_destroy(&fa);
+  close(pipefd[1]);
+
+  if ( status ) {
+    PDBG("[%s] posix_spawnp('%s') fails: %s", ctx->name, ctx->command, strerror(status));
+    close(pipefd[0]);
+    ctx->pid = 0;
+    return AVERROR(status);
+  }
+
+  ctx->fd = pipefd[0];
+  ctx->started = ffmpeg_gettime_us();
+  fcntl(ctx->fd, F_SETFL, fcntl(ctx->fd, F_GETFL) | O_NONBLOCK);
+
+#ifdef SYS_pidfd_open
+  ctx->pidfd = syscall(SYS_pidfd_open, ctx->pid, 0);
+#else
+  ctx->pidfd = -1;
+#endif
+
+  PDBG("[%s] SPAWNED pid=%d pidfd=%d: %s", ctx->name, ctx->pid, ctx->pidfd, ctx->command);
+
+  return 0;
+}
+
+
+/*
+ * Reap child without blocking the core, returns true if child is gone
+ */
+static bool wait_child(struct ff_popen_context * ctx, int tmo_ms, int * wstatus)
+{
+  pid_t pid;
+
+  while ( (pid = waitpid(ctx->pid, wstatus, WNOHANG)) == 0 && tmo_ms > 0 ) {
+    if ( ctx->pidfd != -1 ) {
+      ff_popen_wait_io(ctx->pidfd, tmo_ms);
+      tmo_ms = 0;
+    }
+    else {
+      ff_popen_sleep_ms(20);
+      tmo_ms -= 20;
+    }
+  }
+
+  if ( pid == 0 ) {
+    pid = waitpid(ctx->pid, wstatus, WNOHANG);
+  }
+
+  return pid == ctx->pid || (pid == -1 && errno == ECHILD);
+}
+
+static void stop_child(struct ff_popen_context * ctx, bool terminate, int * wstatus)
+{
+  *wstatus = 0;
+
+  if ( ctx->fd != -1 ) {
+    close(ctx->fd);
+    ctx->fd = -1;
+  }
+
+  if ( ctx->pid > 0 ) {
+
+    if ( !wait_child(ctx, terminate ? 0 : FF_POPEN_EXIT_TIMEOUT, wstatus) ) {
+
+      kill(-ctx->pid, SIGTERM);
+
+      if ( !wait_child(ctx, FF_POPEN_TERM_TIMEOUT, wstatus) ) {
+        PDBG("[%s] pid=%d does not respond to SIGTERM, killing", ctx->name, ctx->pid);
+        kill(-ctx->pid, SIGKILL);
+        if ( !wait_child(ctx, FF_POPEN_TERM_TIMEOUT, wstatus) ) {
+          PDBG("[%s] pid=%d is left unreaped", ctx->name, ctx->pid);
+        }
+      }
+    }
+
+    if ( WIFSIGNALED(*wstatus) ) {
+      PDBG("[%s] pid=%d killed by signal %d", ctx->name, ctx->pid, WTERMSIG(*wstatus));
+    }
+    else {
+      PDBG("[%s] pid=%d exited with status %d", ctx->name, ctx->pid, WEXITSTATUS(*wstatus));
+    }
+
+    ctx->pid = 0;
+  }
+
+  if ( ctx->pidfd != -1 ) {
+    close(ctx->pidfd);
+    ctx->pidfd = -1;
+  }
+}
+
+static bool should_restart(struct ff_popen_context * ctx, int wstatus)
+{
+  bool failed = WIFSIGNALED(wstatus) || (WIFEXITED(wstatus) && WEXITSTATUS(wstatus) != 0);
+
+  switch ( ffsrv.popen.restart ) {
+    case popen_restart_always :
+    break;
+    case popen_restart_on_failure :
+      if ( !failed ) {
+        return false;
+      }
+    break;
+    default :
+      return false;
+  }
+
+  return ffsrv.popen.maxrestarts < 0 || ctx->restarts < ffsrv.popen.maxrestarts;
+}
+
+
+
+/*
+ * Child restarts are transparent at byte stream level,
+ * so they fit self-synchronizing formats like mpegts.
+ * Child silent for rtmo seconds is considered hung and is terminated.
+ */
+static int ff_popen_read_pkt(void * opaque, uint8_t * buf, int buf_size)
+{
+  struct ff_popen_context * ctx = opaque;
+  int64_t deadline = 0, left;
+  ssize_t size;
+  bool hung;
+  int wstatus;
+  int status;
+
+  while ( 42 ) {
+
+    if ( ctx->fd == -1 && (status = spawn_child(ctx)) ) {
+      break;
+    }
+
+    if ( !deadline ) {
+      deadline = ctx->rtmo > 0 ? ffmpeg_gettime_us() + ctx->rtmo * FFMPEG_TIME_SCALE : -1;
+    }
+
+    if ( (size = read(ctx->fd, buf, buf_size)) > 0 ) {
+      status = size;
+      break;
+    }
+
+    if ( (hung = size < 0 && (errno == EAGAIN || errno == EINTR)) ) {
+      if ( deadline < 0 || (left = deadline - ffmpeg_gettime_us()) > 0 ) {
+        ff_popen_wait_io(ctx->fd, deadline < 0 ? -1 : (int) ((left + 999) / 1000));
+        continue;
+      }
+      PDBG("[%s] pid=%d: no output for %d sec", ctx->name, ctx->pid, ctx->rtmo);
+      status = AVERROR(ETIMEDOUT);
+    }
+    else {
+      status = size == 0 ? AVERROR_EOF : AVERROR(errno);
+    }
+
+    stop_child(ctx, hung, &wstatus);
+
+    // only quick successive failures count against maxrestarts
+    if ( ffmpeg_gettime_us() - ctx->started >= FF_POPEN_STABLE_TIME * FFMPEG_TIME_SCALE ) {
+      ctx->restarts = 0;
+    }
+
+    if ( !should_restart(ctx, wstatus) ) {
+      break;
+    }
+
+    ++ctx->restarts;
+    deadline = 0;
+
+    PDBG("[%s] RESTART %d/%d in %d sec", ctx->name, ctx->restarts, ffsrv.popen.maxrestarts,
+        ffsrv.popen.restartdelay);
+
+    ff_popen_sleep_ms(ffsrv.popen.restartdelay * 1000);
+  }
+
+  return status;
+}
+
+
+int ff_create_popen_context(AVIOContext ** pb, const char * command, const char * name, int rtmo)
+{
+  struct ff_popen_context * ctx = NULL;
+  const size_t bufsize = FF_POPEN_INPUT_BUF_SIZE;
+  int status = 0;
+
+  *pb = NULL;
+
+  if ( !(ctx = av_mallocz(sizeof(*ctx))) ) {
+    status = AVERROR(ENOMEM);
+    goto end;
+  }
+
+  ctx->fd = -1;
+  ctx->pidfd = -1;
+  ctx->rtmo = rtmo;
+
+  if ( !(ctx->command = strdup(command)) || !(ctx->name = strdup(name ? name : command)) ) {
+    status = AVERROR(ENOMEM);
+    goto end;
+  }
+
+  if ( !(ctx->iobuf = av_malloc(bufsize)) ) {
+    status = AVERROR(ENOMEM);
+    goto end;
+  }
+
+  if ( !(*pb = avio_alloc_context(ctx->iobuf, bufsize, false, ctx, ff_popen_read_pkt, NULL, NULL)) ) {
+    status = AVERROR(ENOMEM);
+    goto end;
+  }
+
+end:
+
+  if ( status ) {
+    if ( ctx ) {
+      free(ctx->command);
+      free(ctx->name);
+      av_free(ctx->iobuf);
+      av_free(ctx);
+    }
+  }
+
+  return status;
+}
+
+void ff_close_popen_context(AVIOContext ** pb)
+{
+  if ( pb && *pb ) {
+
+    struct ff_popen_context * ctx = (*pb)->opaque;
+
+    if ( ctx ) {
+      int wstatus;
+      stop_child(ctx, true, &wstatus);
+      free(ctx->command);
+      free(ctx->name);
+      av_free(ctx);
+    }
+
+    av_free((*pb)->buffer);
+    av_freep(pb);
+  }
+}
@@ -0,0 +1,36 @@
+/*
+ * ffpopen.h
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: amyznikov
+ *
+ *  popen:// input: child process spawned with posix_spawn() writing into non-blocking pipe.
+ *  Child exit is tracked via pidfd (with waitpid() polling fallback), crashed children are
+ *  restarted according to ffsrv.popen policy.
+ */
+
+// #pragma once
+
+#ifndef __ffpopen_h__
+#define __ffpopen_h__
+
+#include "ffmpeg.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+/* Create AVIO context reading stdout of the shell command, the child is spawned on first read.
+ *  name    : object name for log messages
+ *  rtmo    : seconds without child output after which it is terminated as hung, <= 0 waits forever
+ */
+int ff_create_popen_context(AVIOContext ** pb, const char * command, const char * name, int rtmo);
+void ff_close_popen_context(AVIOContext ** pb);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __ffpopen_h__ */
@@ -0,0 +1,491 @@
+/*
+ * ffudpinput.c
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: amyznikov
+ */
+#define _GNU_SOURCE
+
+#include "ffudpinput.h"
+#include "co-scheduler.h"
+#include "debug.h"
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <fcntl.h>
+
+
+#define UDP_INPUT_BATCH_SIZE      64      // datagrams per recvmmsg()
+#define UDP_INPUT_MAX_DGRAM_SIZE  2048    // 7 * 188 TS packets + RTP header fits well
+#define UDP_INPUT_IO_BUF_SIZE     (64*1024)
+#define UDP_INPUT_DEFAULT_RXBUF   (4*1024*1024)
+#define UDP_INPUT_STATS_INTERVAL  (30 * FFMPEG_TIME_SCALE)
+
+#define TS_PACKET_SIZE            188
+#define TS_SYNC_BYTE              0x47
+#define TS_NULL_PID               0x1FFF
+#define RTP_MP2T_PAYLOAD_TYPE     33
+
+
+struct ff_udp_input_context {
+
+  char * name;
+  int so;
+  int rtmo;
+  bool rtp;
+
+  // recvmmsg() batch, current datagram is msgs[pos]
+  struct mmsghdr msgs[UDP_INPUT_BATCH_SIZE];
+  struct iovec iov[UDP_INPUT_BATCH_SIZE];
+  uint8_t dgrams[UDP_INPUT_BATCH_SIZE][UDP_INPUT_MAX_DGRAM_SIZE];
+  uint32_t dgoffs[UDP_INPUT_BATCH_SIZE];
+  int count, pos;
+
+  // loss detection
+  int32_t rtpseq;
+  int8_t cc[TS_NULL_PID + 1];
+
+  struct {
+    uint64_t datagrams;
+    uint64_t batches;
+    uint64_t truncated;
+    uint64_t rtp_lost;
+    uint64_t rtp_invalid;
+    uint64_t ts_sync;
+    uint64_t ts_cc;
+    int64_t next_report;
+  } stats;
+
+  uint8_t * iobuf;
+};
+
+
+
+static bool parse_udp_url(const char * url, char host[], size_t cbhost, uint16_t * port, char localaddr[],
+    size_t cblocaladdr, int * rxbuf)
+{
+  const char * p, * q;
+  char tok[256];
+  size_t n;
+  int v;
+
+  if ( strncasecmp(url, "udp://", 6) == 0 ) {
+    p = url + 6;
+  }
+  else if ( strncasecmp(url, "rtp://", 6) == 0 ) {
+    p = url + 6;
+  }
+  else {
+    return false;
+  }
+
+  if ( *p == '@' ) {
+    ++p;
+  }
+
+  if ( !(q = strchr(p, ':')) || (n = q - p) >= cbhost ) {
+    return false;
+  }
+
+  memcpy(host, p, n);
+  host[n] = 0;
+
+  if ( sscanf(q + 1, "%d", &v) != 1 || v <= 0 || v > 0xFFFF ) {
+    return false;
+  }
+
+  *port = (uint16_t) v;
+
+  if ( !(p = strchr(q, '?')) ) {
+    return true;
+  }
+
+  for ( ++p; *p; p += *p == '&' ) {
+
+    if ( (n = strcspn(p, "&")) >= sizeof(tok) ) {
+      return false;
+    }
+
+    memcpy(tok, p, n);
+    tok[n] = 0;
+    p += n;
+
+    if ( sscanf(tok, "buffer_size=%d", &v) == 1 && v > 0 ) {
+      *rxbuf = v;
+    }
+    else if ( strncmp(tok, "localaddr=", 10) == 0 && strlen(tok + 10) < cblocaladdr ) {
+      strcpy(localaddr, tok + 10);
+    }
+  }
+
+  return true;
+}
+
+
+static int create_udp_socket(const char * url, const char * name)
+{
+  char host[256] = "";
+  char localaddr[64] = "";
+  uint16_t port = 0;
+  int rxbuf = UDP_INPUT_DEFAULT_RXBUF;
+
+  struct sockaddr_in sin;
+  struct in_addr group = { .s_addr = INADDR_ANY };
+  bool multicast = false;
+  int so = -1;
+  int status = 0;
+
+  if ( !parse_udp_url(url, host, sizeof(host), &port, localaddr, sizeof(localaddr), &rxbuf) ) {
+    PDBG("[%s] Invalid udp url '%s'", name, url);
+    errno = EINVAL;
+    goto end;
+  }
+
+  if ( *host && !inet_aton(host, &group) ) {
+    PDBG("[%s] Invalid address '%s'", name, host);
+    errno = EINVAL;
+    goto end;
+  }
+
+  multicast = IN_MULTICAST(ntohl(group.s_addr));
+
+  if ( (so = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0)) == -1 ) {
+    PDBG("[%s] socket() fails: %s", name, strerror(errno));
+    goto end;
+  }
+
+  setsockopt(so, SOL_SOCKET, SO_REUSEADDR, &(int ) { 1 }, sizeof(int));
+
+  // try privileged variant first to pass over rmem_max
+  if ( setsockopt(so, SOL_SOCKET, SO_RCVBUFFORCE, &rxbuf, sizeof(rxbuf)) == -1 ) {
+    if ( setsockopt(so, SOL_SOCKET, SO_RCVBUF, &rxbuf, sizeof(rxbuf)) == -1 ) {
+      PDBG("[%s] setsockopt(SO_RCVBUF=%d) fails: %s", name, rxbuf, strerror(errno));
+    }
+  }
+
+  memset(&sin, 0, sizeof(sin));
+  sin.sin_family = AF_INET;
+  sin.sin_port = htons(port);
+
+  // unicast url host is the sender: like libavformat udp, bind to localaddr or any
+  if ( multicast ) {
+    sin.sin_addr = group; // bind to group to filter out other groups on the same port
+  }
+  else if ( *localaddr && !inet_aton(localaddr, &sin.sin_addr) ) {
+    PDBG("[%s] Invalid localaddr '%s'", name, localaddr);
+    errno = EINVAL;
+    status = -1;
+    goto end;
+  }
+
+  if ( bind(so, (struct sockaddr*) &sin, sizeof(sin)) == -1 ) {
+    PDBG("[%s] bind(%s:%u) fails: %s", name, inet_ntoa(sin.sin_addr), port, strerror(errno));
+    status = -1;
+    goto end;
+  }
+
+  if ( multicast ) {
+
+    struct ip_mreq mreq = {
+      .imr_multiaddr = group,
+      .imr_interface.s_addr = INADDR_ANY
+    };
+
+    if ( *localaddr && !inet_aton(localaddr, &mreq.imr_interface) ) {
+      PDBG("[%s] Invalid localaddr '%s'", name, localaddr);
+      errno = EINVAL;
+      status = -1;
+      goto end;
+    }
+
+    if ( setsockopt(so, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq, sizeof(mreq)) == -1 ) {
+      PDBG("[%s] IP_ADD_MEMBERSHIP(%s) fails: %s", name, host, strerror(errno));
+      status = -1;
+      goto end;
+    }
+  }
+
+end:
+
+  if ( status && so != -1 ) {
+    int errno_backup = errno;
+    close(so), so = -1;
+    errno = errno_backup;
+  }
+
+  return so;
+}
+
+
+
+static void report_udp_stats(struct ff_udp_input_context * ctx)
+{
+  PDBG("[%s] udp: dgrams=%" PRIu64 " batches=%" PRIu64 " truncated=%" PRIu64 " rtp_lost=%" PRIu64
+      " rtp_invalid=%" PRIu64 " ts_sync=%" PRIu64 " ts_cc=%" PRIu64,
+      ctx->name,
+      ctx->stats.datagrams,
+      ctx->stats.batches,
+      ctx->stats.truncated,
+      ctx->stats.rtp_lost,
+      ctx->stats.rtp_invalid,
+      ctx->stats.ts_sync,
+      ctx->stats.ts_cc);
+}
+
+
+/*
+ * Strip RTP header, returns payload offset or -1 if datagram must be dropped
+ */
+static int check_rtp(struct ff_udp_input_context * ctx, const uint8_t * p, uint32_t * size)
+{
+  uint32_t hdrsize, seq;
+
+  if ( *size < 12 || (p[0] >> 6) != 2 || (p[1] & 0x7F) != RTP_MP2T_PAYLOAD_TYPE ) {
+    ++ctx->stats.rtp_invalid;
+    return -1;
+  }
+
+  hdrsize = 12 + 4 * (p[0] & 0x0F);
+
+  if ( (p[0] & 0x10) && *size >= hdrsize + 4 ) { // extension
+    hdrsize += 4 + 4 * ((p[hdrsize + 2] << 8) | p[hdrsize + 3]);
+  }
+
+  if ( (p[0] & 0x20) && *size > hdrsize && p[*size - 1] < *size ) { // padding
+    *size -= p[*size - 1];
+  }
+
+  if ( *size <= hdrsize ) {
+    ++ctx->stats.rtp_invalid;
+    return -1;
+  }
+
+  seq = (p[2] << 8) | p[3];
+  if ( ctx->rtpseq >= 0 && seq != (((uint32_t) ctx->rtpseq + 1) & 0xFFFF) ) {
+    ctx->stats.rtp_lost += (seq - ctx->rtpseq - 1) & 0xFFFF;
+  }
+  ctx->rtpseq = seq;
+
+  return hdrsize;
+}
+
+/*
+ * Check TS continuity counters
+ */
+static void check_ts(struct ff_udp_input_context * ctx, const uint8_t * p, uint32_t size)
+{
+  uint32_t pid, afc, cc;
+
+  for ( ; size >= TS_PACKET_SIZE; p += TS_PACKET_SIZE, size -= TS_PACKET_SIZE ) {
+
+    if ( p[0] != TS_SYNC_BYTE ) {
+      ++ctx->stats.ts_sync;
+      break;
+    }
+
+    if ( (pid = ((p[1] & 0x1F) << 8) | p[2]) == TS_NULL_PID ) {
+      continue;
+    }
+
+    afc = (p[3] >> 4) & 0x3;
+    cc = p[3] & 0x0F;
+
+    if ( (afc & 0x2) && p[4] > 0 && (p[5] & 0x80) ) { // discontinuity indicator
+      ctx->cc[pid] = -1;
+    }
+
+    if ( afc & 0x1 ) {
+      if ( ctx->cc[pid] >= 0 && cc != (((uint32_t) ctx->cc[pid] + 1) & 0x0F) && cc != (uint32_t) ctx->cc[pid] ) {
+        ++ctx->stats.ts_cc;
+      }
+      ctx->cc[pid] = cc;
+    }
+  }
+}
+
+
+static int recv_batch(struct ff_udp_input_context * ctx)
+{
+  int64_t deadline = ctx->rtmo > 0 ? ffmpeg_gettime_us() + ctx->rtmo * FFMPEG_TIME_SCALE : -1;
+  int n;
+
+  for ( int i = 0; i < UDP_INPUT_BATCH_SIZE; ++i ) {
+    ctx->iov[i].iov_base = ctx->dgrams[i];
+    ctx->iov[i].iov_len = UDP_INPUT_MAX_DGRAM_SIZE;
+    ctx->msgs[i].msg_hdr.msg_iov = &ctx->iov[i];
+    ctx->msgs[i].msg_hdr.msg_iovlen = 1;
+    ctx->msgs[i].msg_hdr.msg_flags = 0;
+  }
+
+  while ( (n = recvmmsg(ctx->so, ctx->msgs, UDP_INPUT_BATCH_SIZE, MSG_DONTWAIT, NULL)) < 0 ) {
+
+    int64_t now;
+
+    if ( errno != EAGAIN && errno != EINTR ) {
+      return AVERROR(errno);
+    }
+
+    if ( deadline > 0 && (now = ffmpeg_gettime_us()) >= deadline ) {
+      return AVERROR(ETIMEDOUT);
+    }
+
+    co_io_wait(ctx->so, EPOLLIN, deadline > 0 ? (int) ((deadline - ffmpeg_gettime_us()) / 1000) + 1 : -1);
+  }
+
+  ++ctx->stats.batches;
+  ctx->stats.datagrams += n;
+
+  // validate datagrams and precompute payload offsets
+  for ( int i = 0; i < n; ++i ) {
+
+    uint32_t size = ctx->msgs[i].msg_len;
+    int offset = 0;
+
+    if ( ctx->msgs[i].msg_hdr.msg_flags & MSG_TRUNC ) {
+      ++ctx->stats.truncated;
+    }
+
+    if ( ctx->rtp && (offset = check_rtp(ctx, ctx->dgrams[i], &size)) < 0 ) {
+      ctx->msgs[i].msg_len = ctx->dgoffs[i] = 0;
+      continue;
+    }
+
+    check_ts(ctx, ctx->dgrams[i] + offset, size - offset);
+
+    ctx->dgoffs[i] = offset;
+    ctx->msgs[i].msg_len = size;
+  }
+
+  ctx->count = n;
+  ctx->pos = 0;
+
+  if ( ffmpeg_gettime_us() >= ctx->stats.next_report ) {
+    if ( ctx->stats.rtp_lost || ctx->stats.ts_cc || ctx->stats.ts_sync || ctx->stats.truncated ) {
+      report_udp_stats(ctx);
+    }
+    ctx->stats.next_report = ffmpeg_gettime_us() + UDP_INPUT_STATS_INTERVAL;
+  }
+
+  return 0;
+}
+
+
+static int ff_udp_read_pkt(void * opaque, uint8_t * buf, int buf_size)
+{
+  struct ff_udp_input_context * ctx = opaque;
+  int total = 0;
+  int status;
+
+  while ( total < buf_size ) {
+
+    uint32_t avail;
+
+    if ( ctx->pos >= ctx->count ) {
+      if ( total > 0 ) {
+        break; // don't block while holding data
+      }
+      if ( (status = recv_batch(ctx)) ) {
+        return status;
+      }
+      continue;
+    }
+
+    if ( (avail = ctx->msgs[ctx->pos].msg_len - ctx->dgoffs[ctx->pos]) == 0 ) {
+      ++ctx->pos;
+      continue;
+    }
+
+    if ( avail > (uint32_t) (buf_size - total) ) {
+      avail = buf_size - total;
+    }
+
+    memcpy(buf + total, ctx->dgrams[ctx->pos] + ctx->dgoffs[ctx->pos], avail);
+    ctx->dgoffs[ctx->pos] += avail;
+    total += avail;
+  }
+
+  return total;
+}
+
+
+
+bool ff_is_udp_input_url(const char * url)
+{
+  return url && (strncasecmp(url, "udp://", 6) == 0 || strncasecmp(url, "rtp://", 6) == 0);
+}
+
+
+int ff_create_udp_input_context(AVIOContext ** pb, const char * url, const char * name, int rtmo)
+{
+  struct ff_udp_input_context * ctx = NULL;
+  int status = 0;
+
+  *pb = NULL;
+
+  if ( !(ctx = av_mallocz(sizeof(*ctx))) ) {
+    status = AVERROR(ENOMEM);
+    goto end;
+  }
+
+  ctx->so = -1;
+  ctx->rtmo = rtmo;
+  ctx->rtp = strncasecmp(url, "rtp://", 6) == 0;
+  ctx->rtpseq = -1;
+  memset(ctx->cc, -1, sizeof(ctx->cc));
+
+  if ( !(ctx->name = strdup(name ? name : url)) ) {
+    status = AVERROR(ENOMEM);
+    goto end;
+  }
+
+  if ( (ctx->so = create_udp_socket(url, ctx->name)) == -1 ) {
+    status = AVERROR(errno);
+    goto end;
+  }
+
+  if ( !(ctx->iobuf = av_malloc(UDP_INPUT_IO_BUF_SIZE)) ) {
+    status = AVERROR(ENOMEM);
+    goto end;
+  }
+
+  if ( !(*pb = avio_alloc_context(ctx->iobuf, UDP_INPUT_IO_BUF_SIZE, false, ctx, ff_udp_read_pkt, NULL, NULL)) ) {
+    status = AVERROR(ENOMEM);
+    goto end;
+  }
+
+  ctx->stats.next_report = ffmpeg_gettime_us() + UDP_INPUT_STATS_INTERVAL;
+
+end:
+
+  if ( status && ctx ) {
+    if ( ctx->so != -1 ) {
+      close(ctx->so);
+    }
+    free(ctx->name);
+    av_free(ctx->iobuf);
+    av_free(ctx);
+  }
+
+  return status;
+}
+
+
+void ff_close_udp_input_context(AVIOContext ** pb)
+{
+  if ( pb && *pb ) {
+
+    struct ff_udp_input_context * ctx = (*pb)->opaque;
+
+    if ( ctx ) {
+      report_udp_stats(ctx);
+      if ( ctx->so != -1 ) {
+        close(ctx->so);
+      }
+      free(ctx->name);
+      av_free(ctx);
+    }
+
+    av_free((*pb)->buffer);
+    av_freep(pb);
+  }
+}
@@ -0,0 +1,43 @@
+/*
+ * ffudpinput.h
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: amyznikov
+ *
+ *  Native udp:// and rtp:// (MP2T payload) ingest for ffinput.
+ *  Datagrams are received in batches with recvmmsg() from the coroutine
+ *  and fed to libavformat through AVIO read callback.
+ */
+
+// #pragma once
+
+#ifndef __ffudpinput_h__
+#define __ffudpinput_h__
+
+#include "ffmpeg.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+/* Check if url can be served by native udp reader */
+bool ff_is_udp_input_url(const char * url);
+
+
+/* Open socket (join multicast group if required) and create AVIO context.
+ *  url     : udp://[group|localaddr]:port[?buffer_size=N&localaddr=ADDR]
+ *            rtp://[group|localaddr]:port[?...], payload must be MP2T
+ *  name    : object name for log messages
+ *  rtmo    : receive timeout in seconds
+ */
+int ff_create_udp_input_context(AVIOContext ** pb, const char * url, const char * name, int rtmo);
+
+void ff_close_udp_input_context(AVIOContext ** pb);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __ffudpinput_h__ */
@@ -11,13 +11,16 @@
 #include <ctype.h>
 #include <errno.h>
 #include <pthread.h>
+#include <sched.h>
 
 #include "pathfuncs.h"
 #include "co-scheduler.h"
 #include "strfuncs.h"
+#include "hashfuncs.h"
 #include "ccarray.h"
 #include "ffinput.h"
 #include "ffoutput.h"
+#include "ffmuxpool.h"
 #include "ffsegments.h"
 #include "ffmixer.h"
 #include "ffencoder.h"
@@ -112,6 +115,8 @@ static void delete_object(struct ffobject * obj)
   ccarray_erase_item(&g_objects, &obj);
   unlock(&create_object_mtx);
 
+  ffmuxpool_purge(obj);
+
   if ( obj->iface->on_destroy) {
     obj->iface->on_destroy(obj);
   }
@@ -262,24 +267,43 @@ static int get_object(struct ffobject ** pp, const char * urlpath, uint type_mas
 
     case ffobjtype_segments : {
 
-      // segments requires packetized source
-      const char * source_name = objparams.segments.source;
-      struct ffobject * source = NULL;
+      // segments requires packetized source(s), each of several sources becomes separate rendition
+      const uint nb_sources = objparams.segments.nb_sources;
+      struct ffobject * sources[nb_sources ? nb_sources : 1];
+      uint n = 0;
 
-      if ( (status = get_object(&source, source_name, ffobjtype_input | ffobjtype_encoder | ffobjtype_mixer)) ) {
-        PDBG("ff_get_object(source='%s') fails: %s", source_name, av_err2str(status));
+      if ( nb_sources < 1 ) {
+        PDBG("[%s] source not specified", urlpath);
+        status = AVERROR(EINVAL);
         break;
       }
 
-      status = ff_create_segments_stream(&obj, &(struct ff_create_segments_args ) {
-            .name = urlpath,
-            .source = source,
-            .params = &objparams.segments,
-          });
+      for ( ; n < nb_sources; ++n ) {
+        const char * source_name = objparams.segments.sources[n];
+        if ( (status = get_object(&sources[n], source_name, ffobjtype_input | ffobjtype_encoder | ffobjtype_mixer)) ) {
+          PDBG("ff_get_object(source='%s') fails: %s", source_name, av_err2str(status));
+          break;
+        }
+      }
+
+      if ( !status ) {
+
+        status = ff_create_segments_stream(&obj, &(struct ff_create_segments_args ) {
+              .name = urlpath,
+              .sources = sources,
+              .nb_sources = nb_sources,
+              .params = &objparams.segments,
+            });
+
+        if ( status ) {
+          PDBG("ff_create_segments_stream(%s) fails: %s", urlpath, av_err2str(status));
+        }
+      }
 
       if ( status ) {
-        PDBG("ff_create_segments_stream(%s) fails: %s", urlpath, av_err2str(status));
-        release_object(source);
+        while ( n > 0 ) {
+          release_object(sources[--n]);
+        }
       }
     }
     break;
@@ -377,7 +401,11 @@ int create_output_stream(struct ffoutput ** output, const char * urlpath,
           .format = args->format,
           .cookie = args->cookie,
           .sendpkt = args->send_pkt,
-          .getoutspc = args->getoutspc
+          .getoutspc = args->getoutspc,
+          .onidle = args->onidle,
+          .sendpktv = args->send_pktv,
+          .flushpkts = args->flush_pkts,
+          .setpacing = args->set_pacing_rate,
         });
 
     if ( status ) {
@@ -460,7 +488,9 @@ int create_input_stream(struct ffinput ** obj, const char * stream_path,
         .name = input_name,
         .params = &objparams.input,
         .cookie = args->cookie,
-        .recv_pkt = args->recv_pkt
+        .recv_pkt = args->recv_pkt,
+        .open_input = args->open_input,
+        .read_pkt = args->read_pkt,
       });
 
   if ( status ) {
@@ -496,31 +526,110 @@ void release_input_stream(struct ffinput ** input)
 struct access_hook_item {
   char * path;
   size_t plen;
+  uint32_t hash;
   void (*fn)(void * arg);
   void * arg;
 };
 
-static ccarray_t access_hooks; // <struct access_hook_item * >
-static pthread_mutex_t access_hooks_lock = PTHREAD_MUTEX_INITIALIZER;
+// open addressing table of hooks keyed by directory path.
+// Readers never lock: the table is immutable and replaced as a whole on each change,
+// replaced tables and removed items are freed when no reader can still see them.
+struct access_hooks_table {
+  uint mask;
+  uint nb_items;
+  struct access_hook_item * items[];
+};
+
+static struct access_hooks_table * access_hooks = NULL;
+static uint access_hooks_epoch = 0;
+static uint access_hooks_readers[2];
+static pthread_mutex_t access_hooks_lock = PTHREAD_MUTEX_INITIALIZER; // serializes writers
+
+
+static void insert_access_hook(struct access_hooks_table * table, struct access_hook_item * item)
+{
+  uint i;
+  for ( i = item->hash & table->mask; table->items[i]; i = (i + 1) & table->mask ) {
+  }
+  table->items[i] = item;
+  ++table->nb_items;
+}
+
+// copy of old table plus add, minus del
+static struct access_hooks_table * build_access_hooks(const struct access_hooks_table * old,
+    struct access_hook_item * add, const struct access_hook_item * del)
+{
+  struct access_hooks_table * table;
+  uint n = (old ? old->nb_items : 0) + (add ? 1 : 0);
+  uint size = 16;
+
+  while ( size < 2 * n ) {
+    size <<= 1;
+  }
+
+  if ( (table = calloc(1, sizeof(*table) + size * sizeof(table->items[0]))) ) {
+
+    table->mask = size - 1;
+
+    if ( old ) {
+      for ( uint i = 0; i <= old->mask; ++i ) {
+        if ( old->items[i] && old->items[i] != del ) {
+          insert_access_hook(table, old->items[i]);
+        }
+      }
+    }
+
+    if ( add ) {
+      insert_access_hook(table, add);
+    }
+  }
+
+  return table;
+}
+
+static const struct access_hook_item * find_access_hook(const struct access_hooks_table * table,
+    const char * path, size_t plen)
+{
+  const struct access_hook_item * p;
+  const uint32_t hash = djb2(path, plen);
+
+  for ( uint i = hash & table->mask; (p = table->items[i]); i = (i + 1) & table->mask ) {
+    if ( p->hash == hash && p->plen == plen && memcmp(p->path, path, plen) == 0 ) {
+      break;
+    }
+  }
+
+  return p;
+}
+
+// publish new table and wait until readers of the old one have left, must be called under access_hooks_lock
+static void replace_access_hooks(struct access_hooks_table * table)
+{
+  struct access_hooks_table * old;
+
+  old = __atomic_exchange_n(&access_hooks, table, __ATOMIC_SEQ_CST);
+
+  // two epoch flips: readers counted on either side may still hold the old table
+  for ( int k = 0; k < 2; ++k ) {
+    const uint e = __atomic_fetch_add(&access_hooks_epoch, 1, __ATOMIC_SEQ_CST);
+    while ( __atomic_load_n(&access_hooks_readers[e & 1], __ATOMIC_SEQ_CST) ) {
+      sched_yield();
+    }
+  }
+
+  free(old);
+}
 
 
 // temporary hack for segmenter idle timer reset
 void * addaccesshook(const char * path, void (*fn)(void * arg), void * arg)
 {
   struct access_hook_item * ticket = NULL;
+  struct access_hooks_table * table;
   bool fok = false;
 
   pthread_mutex_lock(&access_hooks_lock);
 
-  if ( !access_hooks.capacity && !ccarray_init(&access_hooks, 1024, sizeof(struct access_hook_item*)) ) {
-    goto end;
-  }
-
-  if ( ccarray_size(&access_hooks) == ccarray_capacity(&access_hooks) ) {
-    errno = ENOBUFS;
-    goto end;
-  }
-
   if ( !(ticket = malloc(sizeof(*ticket))) ) {
     goto end;
   }
@@ -530,10 +639,15 @@ void * addaccesshook(const char * path, void (*fn)(void * arg), void * arg)
   }
 
   ticket->plen = strlen(path);
+  ticket->hash = djb2(ticket->path, ticket->plen);
   ticket->fn = fn;
   ticket->arg = arg;
 
-  ccarray_ppush_back(&access_hooks, ticket);
+  if ( !(table = build_access_hooks(access_hooks, ticket, NULL)) ) {
+    goto end;
+  }
+
+  replace_access_hooks(table);
 
   fok = true;
 
@@ -542,6 +656,7 @@ end:
   if ( !fok && ticket ) {
     free(ticket->path);
     free(ticket);
+    ticket = NULL;
   }
 
   pthread_mutex_unlock(&access_hooks_lock);
@@ -552,29 +667,45 @@ end:
 void rmaccesshook(void * ticket)
 {
   struct access_hook_item * p = ticket;
+  struct access_hooks_table * table;
+
   if ( p ) {
+
     pthread_mutex_lock(&access_hooks_lock);
-    ccarray_erase_item(&access_hooks, &p);
+
+    while ( !(table = build_access_hooks(access_hooks, NULL, p)) ) {
+      sched_yield(); // the item must not be freed while the table references it
+    }
+
+    replace_access_hooks(table);
+
     pthread_mutex_unlock(&access_hooks_lock);
+
     free(p->path);
     free(p);
   }
 }
 
+// the path itself and then its parent directories are looked up, the deepest hook wins
 void processaccesshooks(const char * path)
 {
-  size_t n;
-  pthread_mutex_lock(&access_hooks_lock);
+  const struct access_hooks_table * table;
+  const struct access_hook_item * p;
+  const uint e = __atomic_load_n(&access_hooks_epoch, __ATOMIC_SEQ_CST) & 1;
 
-  if ( (n = ccarray_size(&access_hooks)) ) {
-    for ( size_t i = 0, plen = strlen(path); i < n; ++i ) {
-      const struct access_hook_item * p = ccarray_ppeek(&access_hooks, i);
-      if ( plen >= p->plen && memcmp(path, p->path, p->plen) == 0 ) {
+  __atomic_fetch_add(&access_hooks_readers[e], 1, __ATOMIC_SEQ_CST);
+
+  if ( (table = __atomic_load_n(&access_hooks, __ATOMIC_SEQ_CST)) && table->nb_items ) {
+    for ( size_t plen = strlen(path); plen > 0; ) {
+      if ( (p = find_access_hook(table, path, plen)) ) {
         p->fn(p->arg);
         break;
       }
+      while ( plen > 0 && path[--plen] != '/' ) {
+      }
     }
   }
-  pthread_mutex_unlock(&access_hooks_lock);
+
+  __atomic_fetch_sub(&access_hooks_readers[e], 1, __ATOMIC_SEQ_CST);
 }
 
@@ -13,6 +13,7 @@
 #include <stddef.h>
 #include <stdbool.h>
 #include <pthread.h>
+#include <sys/uio.h>
 #include "ffmpeg.h"
 #include "ffdb.h"
 
@@ -81,6 +82,10 @@ struct ffinput;
 struct create_input_args {
   void * cookie;
   int (*recv_pkt)(void * cookie, uint8_t *buf, int buf_size);
+
+  // packet-level source which bypasses libavformat demuxer
+  int (*open_input)(void * cookie, AVFormatContext ** ic);
+  int (*read_pkt)(void * cookie, AVPacket * pkt);
 };
 
 int create_input_stream(struct ffinput ** input,
@@ -101,6 +106,15 @@ struct create_output_args {
   const char * format;
   int (*send_pkt)(void * cookie, int stream_index, uint8_t * buf, int buf_size);
   bool (*getoutspc)(void * cookie, int * outspc, int * maxspc);
+  void (*onidle)(void * cookie); // flush point: source has no more pending packets
+
+  // optional gather path for rtp outputs, called per RTP packet:
+  //  iov[0] is transient (RTP header or whole RTCP packet), iov[1..] stay valid until flush_pkts()
+  int (*send_pktv)(void * cookie, int stream_index, const struct iovec * iov, int iovcnt);
+  int (*flush_pkts)(void * cookie); // muxer flush boundary: end of source frame
+
+  // optional kernel pacing of the connection (SO_MAX_PACING_RATE), returns 0 on success
+  int (*set_pacing_rate)(void * cookie, uint32_t bytes_per_sec);
   void * cookie;
 };
 
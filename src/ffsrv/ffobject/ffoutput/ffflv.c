@@ -0,0 +1,521 @@
+/*
+ * ffflv.c
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: amyznikov
+ */
+
+#include "ffflv.h"
+#include "rtmp-amf0.h"
+#include "debug.h"
+#include <pthread.h>
+
+#define FLV_TAG_AUDIO         8
+#define FLV_TAG_VIDEO         9
+#define FLV_TAG_SCRIPT        18
+#define FLV_TAG_HEADER_SIZE   11
+#define FLV_CODECID_H264      7
+#define FLV_CODECID_AAC       10
+#define FLV_AAC_FLAGS         0xAF  // AAC, 44 kHz, 16 bit, stereo: fixed by spec for AAC
+#define FLV_MAX_STREAMS       2
+
+struct ffflvheader {
+  struct ffflvheader * next;
+  const void * source;
+  const ffstream * const * iss;
+
+  uint8_t * data;
+  size_t size, capacity;
+
+  struct {
+    uint8_t tagtype;
+    bool annexb;
+  } st[FLV_MAX_STREAMS];
+
+  int refs;
+};
+
+
+static struct ffflvheader * g_headers = NULL;
+static pthread_mutex_t g_headers_mtx = PTHREAD_MUTEX_INITIALIZER;
+
+static const int aac_sample_rates[] = {
+  96000, 88200, 64000, 48000, 44100, 32000, 24000, 22050, 16000, 12000, 11025, 8000, 7350
+};
+
+
+static inline void wr16(uint8_t * p, uint32_t v)
+{
+  p[0] = v >> 8, p[1] = v;
+}
+
+static inline void wr24(uint8_t * p, uint32_t v)
+{
+  p[0] = v >> 16, p[1] = v >> 8, p[2] = v;
+}
+
+static inline void wr32(uint8_t * p, uint32_t v)
+{
+  p[0] = v >> 24, p[1] = v >> 16, p[2] = v >> 8, p[3] = v;
+}
+
+static void put_tag_header(uint8_t * p, uint8_t tagtype, uint32_t datasize, uint32_t timestamp)
+{
+  p[0] = tagtype;
+  wr24(p + 1, datasize);
+  wr24(p + 4, timestamp & 0xFFFFFF);
+  p[7] = timestamp >> 24;
+  wr24(p + 8, 0);
+}
+
+
+static bool reserve(struct ffflvheader * hdr, size_t size)
+{
+  if ( hdr->size + size > hdr->capacity ) {
+
+    size_t capacity = FFMAX(hdr->size + size, 2 * hdr->capacity);
+    uint8_t * p;
+
+    if ( !(p = realloc(hdr->data, capacity)) ) {
+      return false;
+    }
+
+    hdr->data = p;
+    hdr->capacity = capacity;
+  }
+
+  return true;
+}
+
+/*
+ * Append complete tag (tag header, data, previous tag size)
+ */
+static bool append_tag(struct ffflvheader * hdr, uint8_t tagtype, const uint8_t * data, size_t size)
+{
+  if ( !reserve(hdr, FLV_TAG_HEADER_SIZE + size + 4) ) {
+    return false;
+  }
+
+  put_tag_header(hdr->data + hdr->size, tagtype, size, 0);
+  memcpy(hdr->data + hdr->size + FLV_TAG_HEADER_SIZE, data, size);
+  wr32(hdr->data + hdr->size + FLV_TAG_HEADER_SIZE + size, FLV_TAG_HEADER_SIZE + size);
+  hdr->size += FLV_TAG_HEADER_SIZE + size + 4;
+
+  return true;
+}
+
+
+/* Find next AnnexB NAL unit, returns NULL at end */
+static const uint8_t * next_nal(const uint8_t * p, const uint8_t * end, const uint8_t ** nalend)
+{
+  const uint8_t * nal;
+
+  while ( end - p >= 3 && !(p[0] == 0 && p[1] == 0 && p[2] == 1) ) {
+    ++p;
+  }
+
+  if ( end - p < 3 ) {
+    return NULL;
+  }
+
+  nal = p += 3;
+
+  while ( end - p >= 3 && !(p[0] == 0 && p[1] == 0 && (p[2] == 1 || (p[2] == 0 && end - p >= 4 && p[3] == 1))) ) {
+    ++p;
+  }
+
+  *nalend = end - p < 3 ? end : p;
+
+  return nal;
+}
+
+/*
+ * Build AVCDecoderConfigurationRecord from AnnexB SPS / PPS
+ */
+static int annexb_to_avcc(const uint8_t * extradata, int extradata_size, uint8_t * avcc, int avccmax)
+{
+  const uint8_t * p = extradata, * end = extradata + extradata_size;
+  const uint8_t * nal, * nalend, * sps = NULL, * pps = NULL;
+  int spssize = 0, ppssize = 0;
+
+  while ( (nal = next_nal(p, end, &nalend)) ) {
+    if ( (nal[0] & 0x1F) == 7 && !sps ) {
+      sps = nal, spssize = nalend - nal;
+    }
+    else if ( (nal[0] & 0x1F) == 8 && !pps ) {
+      pps = nal, ppssize = nalend - nal;
+    }
+    p = nalend;
+  }
+
+  if ( !sps || !pps || spssize < 4 || 11 + spssize + ppssize > avccmax ) {
+    return AVERROR_INVALIDDATA;
+  }
+
+  avcc[0] = 1;
+  avcc[1] = sps[1];
+  avcc[2] = sps[2];
+  avcc[3] = sps[3];
+  avcc[4] = 0xFF; // 4-byte NAL lengths
+  avcc[5] = 0xE1; // 1 SPS
+  wr16(avcc + 6, spssize);
+  memcpy(avcc + 8, sps, spssize);
+  avcc[8 + spssize] = 1; // 1 PPS
+  wr16(avcc + 9 + spssize, ppssize);
+  memcpy(avcc + 11 + spssize, pps, ppssize);
+
+  return 11 + spssize + ppssize;
+}
+
+/*
+ * AudioSpecificConfig from codec parameters when source has no extradata (ADTS input)
+ */
+static int make_aac_asc(const AVCodecParameters * codecpar, uint8_t asc[2])
+{
+  int aot = codecpar->profile >= 0 ? codecpar->profile + 1 : 2;
+  int sfi;
+
+  for ( sfi = 0; sfi < (int) (sizeof(aac_sample_rates) / sizeof(aac_sample_rates[0])); ++sfi ) {
+    if ( aac_sample_rates[sfi] == codecpar->sample_rate ) {
+      break;
+    }
+  }
+
+  if ( sfi == (int) (sizeof(aac_sample_rates) / sizeof(aac_sample_rates[0])) || codecpar->channels < 1 ) {
+    return AVERROR_INVALIDDATA;
+  }
+
+  wr16(asc, (aot << 11) | (sfi << 7) | (FFMIN(codecpar->channels, 7) << 3));
+
+  return 2;
+}
+
+
+bool ffflv_supported(const ffstream * const * iss, uint nb_streams)
+{
+  int nv = 0, na = 0;
+
+  if ( nb_streams < 1 || nb_streams > FLV_MAX_STREAMS ) {
+    return false;
+  }
+
+  for ( uint i = 0; i < nb_streams; ++i ) {
+    const AVCodecParameters * codecpar = iss[i]->codecpar;
+    switch ( codecpar->codec_id ) {
+      case AV_CODEC_ID_H264 :
+        if ( ++nv > 1 || codecpar->extradata_size < 4 ) {
+          return false;
+        }
+      break;
+      case AV_CODEC_ID_AAC :
+        if ( ++na > 1 ) {
+          return false;
+        }
+      break;
+      default :
+        return false;
+    }
+  }
+
+  return true;
+}
+
+
+static void ffflv_destroy(struct ffflvheader * hdr)
+{
+  if ( hdr ) {
+    free(hdr->data);
+    free(hdr);
+  }
+}
+
+static int ffflv_create(struct ffflvheader ** phdr, const void * source, const ffstream * const * iss, uint nb_streams)
+{
+  struct ffflvheader * hdr = NULL;
+  uint8_t buf[4096], * p, * end = buf + sizeof(buf);
+  bool has_audio = false, has_video = false;
+  int size;
+  int status = 0;
+
+  if ( !(hdr = calloc(1, sizeof(*hdr))) ) {
+    status = AVERROR(ENOMEM);
+    goto end;
+  }
+
+  hdr->source = source;
+  hdr->iss = iss;
+
+  for ( uint i = 0; i < nb_streams; ++i ) {
+    if ( iss[i]->codecpar->codec_id == AV_CODEC_ID_H264 ) {
+      hdr->st[i].tagtype = FLV_TAG_VIDEO;
+      hdr->st[i].annexb = iss[i]->codecpar->extradata[0] != 1;
+      has_video = true;
+    }
+    else {
+      hdr->st[i].tagtype = FLV_TAG_AUDIO;
+      has_audio = true;
+    }
+  }
+
+  /* FLV file header and PreviousTagSize0 */
+  if ( !reserve(hdr, 13) ) {
+    status = AVERROR(ENOMEM);
+    goto end;
+  }
+
+  memcpy(hdr->data, "FLV\x01", 4);
+  hdr->data[4] = (has_audio ? 0x04 : 0) | (has_video ? 0x01 : 0);
+  wr32(hdr->data + 5, 9);
+  wr32(hdr->data + 9, 0);
+  hdr->size = 13;
+
+  /* onMetaData */
+  p = amf0_put_string(buf, end, "onMetaData");
+  p = amf0_put_object_start(p, end);
+  p = amf0_put_prop_number(p, end, "duration", 0);
+
+  for ( uint i = 0; i < nb_streams; ++i ) {
+    const AVCodecParameters * codecpar = iss[i]->codecpar;
+    if ( hdr->st[i].tagtype == FLV_TAG_VIDEO ) {
+      p = amf0_put_prop_number(p, end, "width", codecpar->width);
+      p = amf0_put_prop_number(p, end, "height", codecpar->height);
+      p = amf0_put_prop_number(p, end, "videocodecid", FLV_CODECID_H264);
+    }
+    else {
+      p = amf0_put_prop_number(p, end, "audiocodecid", FLV_CODECID_AAC);
+      p = amf0_put_prop_number(p, end, "audiosamplerate", codecpar->sample_rate);
+      p = amf0_put_prop_name(p, end, "stereo");
+      p = amf0_put_boolean(p, end, codecpar->channels > 1);
+    }
+  }
+
+  p = amf0_put_prop_string(p, end, "encoder", "ffsrv");
+  p = amf0_put_object_end(p, end);
+
+  if ( !p || !append_tag(hdr, FLV_TAG_SCRIPT, buf, p - buf) ) {
+    status = AVERROR(ENOMEM);
+    goto end;
+  }
+
+  /* Sequence headers */
+  for ( uint i = 0; i < nb_streams; ++i ) {
+
+    const AVCodecParameters * codecpar = iss[i]->codecpar;
+
+    if ( hdr->st[i].tagtype == FLV_TAG_VIDEO ) {
+
+      buf[0] = 0x10 | FLV_CODECID_H264; // key frame
+      buf[1] = 0; // AVC sequence header
+      wr24(buf + 2, 0);
+
+      if ( !hdr->st[i].annexb ) {
+        if ( (size = codecpar->extradata_size) > (int) sizeof(buf) - 5 ) {
+          status = AVERROR_INVALIDDATA;
+          goto end;
+        }
+        memcpy(buf + 5, codecpar->extradata, size);
+      }
+      else if ( (size = annexb_to_avcc(codecpar->extradata, codecpar->extradata_size, buf + 5, sizeof(buf) - 5)) < 0 ) {
+        PDBG("annexb_to_avcc() fails: SPS/PPS not found in extradata");
+        status = size;
+        goto end;
+      }
+
+      if ( !append_tag(hdr, FLV_TAG_VIDEO, buf, 5 + size) ) {
+        status = AVERROR(ENOMEM);
+        goto end;
+      }
+    }
+    else {
+
+      buf[0] = FLV_AAC_FLAGS;
+      buf[1] = 0; // AAC sequence header
+
+      if ( codecpar->extradata_size >= 2 && codecpar->extradata_size <= (int) sizeof(buf) - 2 ) {
+        memcpy(buf + 2, codecpar->extradata, size = codecpar->extradata_size);
+      }
+      else if ( (size = make_aac_asc(codecpar, buf + 2)) < 0 ) {
+        PDBG("make_aac_asc() fails: sample_rate=%d channels=%d", codecpar->sample_rate, codecpar->channels);
+        status = size;
+        goto end;
+      }
+
+      if ( !append_tag(hdr, FLV_TAG_AUDIO, buf, 2 + size) ) {
+        status = AVERROR(ENOMEM);
+        goto end;
+      }
+    }
+  }
+
+end:
+
+  if ( status ) {
+    ffflv_destroy(hdr);
+    hdr = NULL;
+  }
+
+  *phdr = hdr;
+
+  return status;
+}
+
+
+int ffflv_attach(struct ffflvheader ** phdr, const void * source, const ffstream * const * iss, uint nb_streams)
+{
+  struct ffflvheader * hdr;
+  int status = 0;
+
+  pthread_mutex_lock(&g_headers_mtx);
+
+  for ( hdr = g_headers; hdr; hdr = hdr->next ) {
+    if ( hdr->source == source && hdr->iss == iss ) {
+      break;
+    }
+  }
+
+  if ( hdr ) {
+    ++hdr->refs;
+  }
+  else if ( (status = ffflv_create(&hdr, source, iss, nb_streams)) == 0 ) {
+    hdr->refs = 1;
+    hdr->next = g_headers;
+    g_headers = hdr;
+  }
+
+  pthread_mutex_unlock(&g_headers_mtx);
+
+  *phdr = hdr;
+
+  return status;
+}
+
+void ffflv_detach(struct ffflvheader ** phdr)
+{
+  struct ffflvheader * hdr, ** pp;
+
+  if ( phdr && (hdr = *phdr) ) {
+
+    pthread_mutex_lock(&g_headers_mtx);
+
+    if ( --hdr->refs == 0 ) {
+      for ( pp = &g_headers; *pp; pp = &(*pp)->next ) {
+        if ( *pp == hdr ) {
+          *pp = hdr->next;
+          break;
+        }
+      }
+      ffflv_destroy(hdr);
+    }
+
+    pthread_mutex_unlock(&g_headers_mtx);
+
+    *phdr = NULL;
+  }
+}
+
+
+const uint8_t * ffflv_get_header(const struct ffflvheader * hdr, size_t * size)
+{
+  *size = hdr->size;
+  return hdr->data;
+}
+
+
+void ffflv_cleanup_scratch(struct ffflvscratch * tmp)
+{
+  free(tmp->buf);
+  tmp->buf = NULL;
+  tmp->capacity = 0;
+}
+
+/*
+ * Rewrite AnnexB access unit with 4-byte NAL lengths
+ */
+static int annexb_to_avcc_pkt(const uint8_t * data, int size, struct ffflvscratch * tmp)
+{
+  const uint8_t * p = data, * end = data + size;
+  const uint8_t * nal, * nalend;
+  size_t n = 0;
+
+  // worst case: 3-byte start codes replaced with 4-byte lengths
+  if ( tmp->capacity < (size_t) size + size / 3 + 4 ) {
+
+    size_t capacity = size + size / 3 + 4;
+    uint8_t * buf;
+
+    if ( !(buf = realloc(tmp->buf, capacity)) ) {
+      return AVERROR(ENOMEM);
+    }
+
+    tmp->buf = buf;
+    tmp->capacity = capacity;
+  }
+
+  while ( (nal = next_nal(p, end, &nalend)) ) {
+    wr32(tmp->buf + n, nalend - nal);
+    memcpy(tmp->buf + n + 4, nal, nalend - nal);
+    n += 4 + (nalend - nal);
+    p = nalend;
+  }
+
+  return n;
+}
+
+
+int ffflv_send_pkt(const struct ffflvheader * hdr, const AVPacket * pkt, int64_t dts, int64_t pts,
+    struct ffflvscratch * tmp, int (*sendpkt)(void * opaque, uint8_t * buf, int buf_size), void * opaque)
+{
+  uint8_t taghdr[FLV_TAG_HEADER_SIZE + 5];
+  uint8_t prevsize[4];
+  const uint8_t * data = pkt->data;
+  int size = pkt->size;
+  int hsize;
+  int cts;
+  int status;
+
+  if ( pkt->stream_index < 0 || pkt->stream_index >= FLV_MAX_STREAMS || !hdr->st[pkt->stream_index].tagtype ) {
+    return 0;
+  }
+
+  if ( dts < 0 ) {
+    dts = 0;
+  }
+
+  if ( hdr->st[pkt->stream_index].tagtype == FLV_TAG_VIDEO ) {
+
+    if ( hdr->st[pkt->stream_index].annexb ) {
+      if ( (size = annexb_to_avcc_pkt(pkt->data, pkt->size, tmp)) < 0 ) {
+        return size;
+      }
+      data = tmp->buf;
+    }
+
+    cts = pts != AV_NOPTS_VALUE && pts > dts ? pts - dts : 0;
+
+    taghdr[FLV_TAG_HEADER_SIZE + 0] = ((pkt->flags & AV_PKT_FLAG_KEY) ? 0x10 : 0x20) | FLV_CODECID_H264;
+    taghdr[FLV_TAG_HEADER_SIZE + 1] = 1; // AVC NALU
+    wr24(taghdr + FLV_TAG_HEADER_SIZE + 2, cts);
+    hsize = FLV_TAG_HEADER_SIZE + 5;
+  }
+  else {
+
+    // strip ADTS header, AudioSpecificConfig was sent in sequence header
+    if ( size > 7 && data[0] == 0xFF && (data[1] & 0xF0) == 0xF0 ) {
+      int adts_size = (data[1] & 0x01) ? 7 : 9;
+      data += adts_size, size -= adts_size;
+    }
+
+    taghdr[FLV_TAG_HEADER_SIZE + 0] = FLV_AAC_FLAGS;
+    taghdr[FLV_TAG_HEADER_SIZE + 1] = 1; // AAC raw
+    hsize = FLV_TAG_HEADER_SIZE + 2;
+  }
+
+  put_tag_header(taghdr, hdr->st[pkt->stream_index].tagtype, hsize - FLV_TAG_HEADER_SIZE + size, dts);
+  wr32(prevsize, hsize + size);
+
+  if ( (status = sendpkt(opaque, taghdr, hsize)) >= 0 && (status = sendpkt(opaque, (uint8_t*) data, size)) >= 0 ) {
+    status = sendpkt(opaque, prevsize, sizeof(prevsize));
+  }
+
+  return status;
+}
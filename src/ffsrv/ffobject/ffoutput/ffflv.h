@@ -0,0 +1,56 @@
+/*
+ * ffflv.h
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: amyznikov
+ *
+ *  Native FLV tag writer for H.264 / AAC sources (fmt=flv fast path).
+ *  FLV header, onMetaData and AVC / AAC sequence header tags are built once per source
+ *  and shared by all clients, media tags are built from gop packets without muxer.
+ */
+
+// #pragma once
+
+#ifndef __ffflv_h__
+#define __ffflv_h__
+
+#include "ffmpeg.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+struct ffflvheader;
+
+/* per-client scratch buffer for AnnexB -> AVCC conversion */
+struct ffflvscratch {
+  uint8_t * buf;
+  size_t capacity;
+};
+
+
+/* Check if streams can be served by native writer: at most one H.264 and one AAC stream */
+bool ffflv_supported(const ffstream * const * iss, uint nb_streams);
+
+/* Get (create on first use) shared header for streams of source */
+int ffflv_attach(struct ffflvheader ** hdr, const void * source, const ffstream * const * iss, uint nb_streams);
+void ffflv_detach(struct ffflvheader ** hdr);
+
+/* FLV file header + onMetaData + sequence header tags, ready to send */
+const uint8_t * ffflv_get_header(const struct ffflvheader * hdr, size_t * size);
+
+/* Send single media tag for pkt: tag header, payload and previous tag size.
+ *  dts, pts are in milliseconds relative to stream start.
+ */
+int ffflv_send_pkt(const struct ffflvheader * hdr, const AVPacket * pkt, int64_t dts, int64_t pts,
+    struct ffflvscratch * tmp, int (*sendpkt)(void * opaque, uint8_t * buf, int buf_size), void * opaque);
+
+void ffflv_cleanup_scratch(struct ffflvscratch * tmp);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __ffflv_h__ */
@@ -0,0 +1,413 @@
+/*
+ * ffmp4frag.c
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: amyznikov
+ */
+
+#include "ffmp4frag.h"
+#include "debug.h"
+#include <pthread.h>
+
+#define MP4FRAG_IO_BUF_SIZE   (32*1024)
+
+
+/* Muxed data: init segment or moof + mdat of single source packet */
+struct ffmp4fragment {
+  const uint8_t * data; // source packet identity
+  int64_t pts, dts;
+  int size, stream_index;
+
+  uint8_t * buf;
+  int bufsize, bufcap;
+  int refs;
+};
+
+struct ffmp4frag {
+  struct ffmp4frag * next;
+  const void * source;
+  const ffstream * const * iss;
+  uint nb_streams;
+
+  AVFormatContext * oc;
+
+  pthread_mutex_t mtx;
+  struct ffmp4fragment init;
+  struct ffmp4fragment ** frames; // [capacity] ring
+  struct ffmp4fragment * capture;
+  uint capacity, wpos;
+
+  struct {
+    int64_t lastdts;
+    int64_t lastdelta;
+  } * st; // [nb_streams]
+
+  uint64_t stale;
+
+  int refs;
+  bool write_header_ok;
+};
+
+
+static struct ffmp4frag * g_frags = NULL;
+static pthread_mutex_t g_frags_mtx = PTHREAD_MUTEX_INITIALIZER;
+
+
+
+static void unref_fragment(struct ffmp4fragment * frm)
+{
+  if ( frm && --frm->refs == 0 ) {
+    free(frm->buf);
+    free(frm);
+  }
+}
+
+
+// AVIO write callback of shared mp4 muxer
+static int ffmp4frag_capture(void * opaque, uint8_t * buf, int buf_size)
+{
+  struct ffmp4frag * frag = opaque;
+  struct ffmp4fragment * frm = frag->capture;
+  int need;
+
+  if ( !frm ) {
+    return 0; // trailer or anything else outside of header / fragment is dropped
+  }
+
+  if ( (need = frm->bufsize + buf_size) > frm->bufcap ) {
+
+    int cap = FFMAX(need, FFMAX(2 * frm->bufcap, 4096));
+    uint8_t * p;
+
+    if ( !(p = realloc(frm->buf, cap)) ) {
+      return AVERROR(ENOMEM);
+    }
+
+    frm->buf = p;
+    frm->bufcap = cap;
+  }
+
+  memcpy(frm->buf + frm->bufsize, buf, buf_size);
+  frm->bufsize = need;
+
+  return 0;
+}
+
+
+static void ffmp4frag_destroy(struct ffmp4frag * frag)
+{
+  if ( frag ) {
+
+    if ( frag->stale ) {
+      PDBG("%" PRIu64 " packets were too late for shared fragmenter", frag->stale);
+    }
+
+    if ( frag->oc ) {
+      if ( frag->write_header_ok ) {
+        av_write_trailer(frag->oc);
+      }
+      if ( frag->oc->pb ) {
+        av_freep(&frag->oc->pb->buffer);
+        av_freep(&frag->oc->pb);
+      }
+      avformat_free_context(frag->oc);
+    }
+
+    if ( frag->frames ) {
+      for ( uint i = 0; i < frag->capacity; ++i ) {
+        unref_fragment(frag->frames[i]);
+      }
+      free(frag->frames);
+    }
+
+    free(frag->init.buf);
+    free(frag->st);
+
+    pthread_mutex_destroy(&frag->mtx);
+    free(frag);
+  }
+}
+
+
+static int ffmp4frag_create(struct ffmp4frag ** pfrag, const void * source, const ffstream * const * iss,
+    uint nb_streams, uint capacity)
+{
+  struct ffmp4frag * frag = NULL;
+  AVDictionary * opts = NULL;
+  uint8_t * iobuf = NULL;
+  int status = 0;
+
+  if ( !(frag = calloc(1, sizeof(*frag))) ) {
+    status = AVERROR(ENOMEM);
+    goto end;
+  }
+
+  pthread_mutex_init(&frag->mtx, NULL);
+
+  frag->source = source;
+  frag->iss = iss;
+  frag->nb_streams = nb_streams;
+  frag->capacity = capacity ? capacity : 512;
+
+  if ( !(frag->frames = calloc(frag->capacity, sizeof(*frag->frames))) ) {
+    status = AVERROR(ENOMEM);
+    goto end;
+  }
+
+  if ( !(frag->st = calloc(nb_streams, sizeof(*frag->st))) ) {
+    status = AVERROR(ENOMEM);
+    goto end;
+  }
+
+  for ( uint i = 0; i < nb_streams; ++i ) {
+    frag->st[i].lastdts = AV_NOPTS_VALUE;
+  }
+
+  if ( (status = avformat_alloc_output_context2(&frag->oc, NULL, "mp4", NULL)) ) {
+    PDBG("avformat_alloc_output_context2() fails: %s", av_err2str(status));
+    goto end;
+  }
+
+  frag->oc->flags |= AVFMT_FLAG_CUSTOM_IO;
+
+  if ( !(iobuf = av_malloc(MP4FRAG_IO_BUF_SIZE)) ) {
+    PDBG("av_malloc(iobuf) fails");
+    status = AVERROR(ENOMEM);
+    goto end;
+  }
+
+  frag->oc->pb = avio_alloc_context(iobuf, MP4FRAG_IO_BUF_SIZE, true, frag, NULL, ffmp4frag_capture, NULL);
+  if ( !frag->oc->pb ) {
+    PDBG("avio_alloc_context() fails");
+    av_free(iobuf);
+    status = AVERROR(ENOMEM);
+    goto end;
+  }
+
+  if ( (status = ffstreams_to_context(iss, nb_streams, frag->oc)) ) {
+    PDBG("ffstreams_to_context() fails: %s", av_err2str(status));
+    goto end;
+  }
+
+  // moov without samples, then exactly one moof + mdat per av_write_frame(oc, NULL)
+  av_dict_set(&opts, "movflags", "frag_custom+empty_moov+default_base_moof", 0);
+
+  frag->capture = &frag->init;
+  if ( (status = avformat_write_header(frag->oc, &opts)) >= 0 ) {
+    avio_flush(frag->oc->pb);
+  }
+  frag->capture = NULL;
+
+  if ( status < 0 ) {
+    PDBG("avformat_write_header() fails: %s", av_err2str(status));
+    goto end;
+  }
+
+  if ( !frag->init.bufsize ) {
+    PDBG("mp4 muxer produced empty init segment");
+    status = AVERROR_BUG;
+    goto end;
+  }
+
+  status = 0;
+  frag->write_header_ok = true;
+
+end:
+
+  av_dict_free(&opts);
+
+  if ( status ) {
+    ffmp4frag_destroy(frag);
+    frag = NULL;
+  }
+
+  *pfrag = frag;
+
+  return status;
+}
+
+
+
+int ffmp4frag_attach(struct ffmp4frag ** pfrag, const void * source, const ffstream * const * iss, uint nb_streams,
+    uint capacity)
+{
+  struct ffmp4frag * frag;
+  int status = 0;
+
+  pthread_mutex_lock(&g_frags_mtx);
+
+  for ( frag = g_frags; frag; frag = frag->next ) {
+    if ( frag->source == source && frag->iss == iss ) {
+      break;
+    }
+  }
+
+  if ( frag ) {
+    ++frag->refs;
+  }
+  else if ( (status = ffmp4frag_create(&frag, source, iss, nb_streams, capacity)) == 0 ) {
+    frag->refs = 1;
+    frag->next = g_frags;
+    g_frags = frag;
+  }
+
+  pthread_mutex_unlock(&g_frags_mtx);
+
+  *pfrag = frag;
+
+  return status;
+}
+
+
+void ffmp4frag_detach(struct ffmp4frag ** pfrag)
+{
+  struct ffmp4frag * frag, ** pp;
+
+  if ( pfrag && (frag = *pfrag) ) {
+
+    pthread_mutex_lock(&g_frags_mtx);
+
+    if ( --frag->refs == 0 ) {
+      for ( pp = &g_frags; *pp; pp = &(*pp)->next ) {
+        if ( *pp == frag ) {
+          *pp = frag->next;
+          break;
+        }
+      }
+      ffmp4frag_destroy(frag);
+    }
+
+    pthread_mutex_unlock(&g_frags_mtx);
+
+    *pfrag = NULL;
+  }
+}
+
+
+const uint8_t * ffmp4frag_get_init(const struct ffmp4frag * frag, size_t * size)
+{
+  *size = frag->init.bufsize;
+  return frag->init.buf;
+}
+
+
+
+// must be called with frag->mtx locked
+static int ffmp4frag_fragment(struct ffmp4frag * frag, const AVPacket * pkt, struct ffmp4fragment ** pfrm)
+{
+  struct ffmp4fragment * frm;
+  const ffstream * is;
+  AVStream * os;
+  AVPacket opkt;
+  int stidx;
+  int status;
+
+  *pfrm = NULL;
+
+  if ( (stidx = pkt->stream_index) < 0 || stidx >= (int) frag->nb_streams ) {
+    return AVERROR(EINVAL);
+  }
+
+  is = frag->iss[stidx];
+  os = frag->oc->streams[stidx];
+
+  if ( pkt->dts != AV_NOPTS_VALUE && frag->st[stidx].lastdts != AV_NOPTS_VALUE ) {
+    if ( pkt->dts <= frag->st[stidx].lastdts ) {
+      ++frag->stale; // client lags behind the cache, the muxer can't go back
+      return AVERROR(EAGAIN);
+    }
+  }
+
+  if ( !(frm = calloc(1, sizeof(*frm))) ) {
+    return AVERROR(ENOMEM);
+  }
+
+  frm->data = pkt->data;
+  frm->size = pkt->size;
+  frm->pts = pkt->pts;
+  frm->dts = pkt->dts;
+  frm->stream_index = stidx;
+  frm->refs = 1;
+
+  opkt = *pkt;
+
+  // trun needs the sample duration at fragment flush, the next packet is not known yet
+  if ( opkt.duration <= 0 && frag->st[stidx].lastdelta > 0 ) {
+    opkt.duration = frag->st[stidx].lastdelta;
+  }
+
+  av_packet_rescale_ts(&opkt, is->time_base, os->time_base);
+
+  frag->capture = frm;
+  if ( (status = av_write_frame(frag->oc, &opkt)) >= 0 && (status = av_write_frame(frag->oc, NULL)) >= 0 ) {
+    avio_flush(frag->oc->pb);
+  }
+  frag->capture = NULL;
+
+  if ( status < 0 ) {
+    PDBG("av_write_frame() fails: %s", av_err2str(status));
+    unref_fragment(frm);
+    return status;
+  }
+
+  if ( pkt->dts != AV_NOPTS_VALUE ) {
+    if ( frag->st[stidx].lastdts != AV_NOPTS_VALUE ) {
+      frag->st[stidx].lastdelta = pkt->dts - frag->st[stidx].lastdts;
+    }
+    frag->st[stidx].lastdts = pkt->dts;
+  }
+
+  unref_fragment(frag->frames[frag->wpos]);
+  frag->frames[frag->wpos] = frm;
+  frag->wpos = (frag->wpos + 1) % frag->capacity;
+
+  *pfrm = frm;
+
+  return 0;
+}
+
+
+int ffmp4frag_send(struct ffmp4frag * frag, const AVPacket * pkt,
+    int (*sendpkt)(void * opaque, uint8_t * buf, int buf_size), void * opaque)
+{
+  struct ffmp4fragment * frm = NULL, * f;
+  int status = 0;
+
+  pthread_mutex_lock(&frag->mtx);
+
+  // clients are normally close to the head, so search from newest
+  for ( uint i = 1; i <= frag->capacity; ++i ) {
+    if ( !(f = frag->frames[(frag->wpos + frag->capacity - i) % frag->capacity]) ) {
+      break;
+    }
+    if ( f->data == pkt->data && f->size == pkt->size && f->pts == pkt->pts && f->dts == pkt->dts
+        && f->stream_index == pkt->stream_index ) {
+      frm = f;
+      break;
+    }
+  }
+
+  if ( !frm ) {
+    status = ffmp4frag_fragment(frag, pkt, &frm);
+  }
+
+  if ( frm ) {
+    ++frm->refs;
+  }
+
+  pthread_mutex_unlock(&frag->mtx);
+
+  if ( frm ) {
+
+    // sendpkt() may block this coroutine, so the fragment is pinned by reference rather than by lock
+    if ( frm->bufsize > 0 ) {
+      status = sendpkt(opaque, frm->buf, frm->bufsize);
+    }
+
+    pthread_mutex_lock(&frag->mtx);
+    unref_fragment(frm);
+    pthread_mutex_unlock(&frag->mtx);
+  }
+
+  return status;
+}
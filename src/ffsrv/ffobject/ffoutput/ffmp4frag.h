@@ -0,0 +1,51 @@
+/*
+ * ffmp4frag.h
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: amyznikov
+ *
+ *  Fragmented MP4 writer shared by all fmp4 outputs of the same source.
+ *  The init segment (ftyp + moov) is built once, each source packet is muxed once
+ *  into its own moof + mdat fragment which is cached and replayed to every client.
+ */
+
+// #pragma once
+
+#ifndef __ffmp4frag_h__
+#define __ffmp4frag_h__
+
+#include "ffmpeg.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+struct ffmp4frag;
+
+
+/* Get (create on first use) shared fragmenter for streams of source.
+ *  capacity : number of source packets kept fragmented, normally the gop size
+ */
+int ffmp4frag_attach(struct ffmp4frag ** frag, const void * source, const ffstream * const * iss, uint nb_streams,
+    uint capacity);
+
+void ffmp4frag_detach(struct ffmp4frag ** frag);
+
+/* ftyp + moov, ready to send */
+const uint8_t * ffmp4frag_get_init(const struct ffmp4frag * frag, size_t * size);
+
+/* Fragment pkt (or reuse cached fragment) and send it as single sendpkt() call.
+ *  pkt timestamps are in the source stream time base.
+ *  Returns AVERROR(EAGAIN) if pkt is already evicted from the cache: nothing is sent,
+ *  the client must resync at the next key frame.
+ */
+int ffmp4frag_send(struct ffmp4frag * frag, const AVPacket * pkt,
+    int (*sendpkt)(void * opaque, uint8_t * buf, int buf_size), void * opaque);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __ffmp4frag_h__ */
@@ -0,0 +1,346 @@
+/*
+ * ffmuxpool.c
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: amyznikov
+ */
+
+#include "ffmuxpool.h"
+#include "ffcfg.h"
+#include "debug.h"
+#include <pthread.h>
+
+#define MUXPOOL_IO_BUF_SIZE   (32*1024)
+#define MUXPOOL_MAX_IDLE      16
+
+
+/* Header bytes written by avformat_write_header() */
+struct muxhdr {
+  uint8_t * data;
+  size_t size, cap;
+};
+
+struct ffmuxpool {
+  struct ffmuxpool * next;
+  const void * source;
+  AVOutputFormat * oformat;
+  const ffstream * const * iss;
+  uint nb_streams;
+
+  // header is shared by all contexts if it does not depend on the context,
+  // otherwise each context keeps own header in oc->opaque
+  struct muxhdr hdr;
+  bool shared, hdr_ok;
+
+  AVFormatContext * idle[MUXPOOL_MAX_IDLE];
+  uint nb_idle;
+};
+
+
+static struct ffmuxpool * g_pools = NULL;
+static pthread_mutex_t g_pools_mtx = PTHREAD_MUTEX_INITIALIZER;
+
+
+
+static inline void lock(void)
+{
+  pthread_mutex_lock(&g_pools_mtx);
+}
+
+static inline void unlock(void)
+{
+  pthread_mutex_unlock(&g_pools_mtx);
+}
+
+
+// header bytes are the same for every context of the source,
+// other muxers put random ids (matroska segment uid) or creation times into the header
+static bool is_deterministic(const AVOutputFormat * oformat)
+{
+  return strcmp(oformat->name, "mpegts") == 0 || strcmp(oformat->name, "flv") == 0;
+}
+
+
+// AVIO write callback while header is written
+static int capture_header(void * opaque, uint8_t * buf, int buf_size)
+{
+  struct muxhdr * hdr = opaque;
+  size_t need;
+
+  if ( !hdr ) {
+    return 0;
+  }
+
+  if ( (need = hdr->size + buf_size) > hdr->cap ) {
+
+    size_t cap = FFMAX(need, 2 * hdr->cap);
+    uint8_t * p;
+
+    if ( !(p = realloc(hdr->data, cap)) ) {
+      return AVERROR(ENOMEM);
+    }
+
+    hdr->data = p;
+    hdr->cap = cap;
+  }
+
+  memcpy(hdr->data + hdr->size, buf, buf_size);
+  hdr->size = need;
+
+  return 0;
+}
+
+
+static void free_header(struct muxhdr ** hdr)
+{
+  if ( *hdr ) {
+    free((*hdr)->data);
+    free(*hdr);
+    *hdr = NULL;
+  }
+}
+
+static void free_context(AVFormatContext ** oc)
+{
+  if ( *oc ) {
+    free_header((struct muxhdr **) &(*oc)->opaque);
+    if ( (*oc)->pb ) {
+      av_freep(&(*oc)->pb->buffer);
+      av_freep(&(*oc)->pb);
+    }
+    avformat_free_context(*oc);
+    *oc = NULL;
+  }
+}
+
+
+/* New context with header written, header bytes are kept in oc->opaque.
+ *  Called without g_pools_mtx: avformat_write_header() is heavy enough to stall other viewers.
+ */
+static int prepare_context(AVOutputFormat * oformat, const ffstream * const * iss, uint nb_streams,
+    AVFormatContext ** poc)
+{
+  AVFormatContext * oc = NULL;
+  struct muxhdr * hdr = NULL;
+  uint8_t * iobuf = NULL;
+  int status;
+
+  if ( (status = avformat_alloc_output_context2(&oc, oformat, NULL, NULL)) ) {
+    PDBG("avformat_alloc_output_context2() fails: %s", av_err2str(status));
+    goto end;
+  }
+
+  oc->flags |= AVFMT_FLAG_CUSTOM_IO;
+
+  if ( !(oc->opaque = hdr = calloc(1, sizeof(*hdr))) ) {
+    status = AVERROR(ENOMEM);
+    goto end;
+  }
+
+  if ( !(iobuf = av_malloc(MUXPOOL_IO_BUF_SIZE)) ) {
+    status = AVERROR(ENOMEM);
+    goto end;
+  }
+
+  oc->pb = avio_alloc_context(iobuf, MUXPOOL_IO_BUF_SIZE, true, hdr, NULL, capture_header, NULL);
+  if ( !oc->pb ) {
+    av_free(iobuf);
+    status = AVERROR(ENOMEM);
+    goto end;
+  }
+
+  if ( (status = ffstreams_to_context(iss, nb_streams, oc)) ) {
+    PDBG("ffstreams_to_context() fails: %s", av_err2str(status));
+    goto end;
+  }
+
+  oc->flush_packets = 1;
+
+  if ( (status = avformat_write_header(oc, NULL)) < 0 ) {
+    PDBG("avformat_write_header() fails: %s", av_err2str(status));
+    goto end;
+  }
+
+  avio_flush(oc->pb);
+  oc->pb->opaque = NULL;
+
+  // header-less formats still get valid (empty) header
+  if ( !hdr->data && !(hdr->data = malloc(1)) ) {
+    status = AVERROR(ENOMEM);
+    goto end;
+  }
+
+  status = 0;
+
+end:
+
+  if ( status ) {
+    free_context(&oc);
+  }
+
+  *poc = oc;
+
+  return status;
+}
+
+
+// must be called with g_pools_mtx locked
+static void adopt_header(struct ffmuxpool * pool, AVFormatContext * oc)
+{
+  struct muxhdr * hdr = oc->opaque;
+
+  if ( pool->shared && hdr ) {
+    if ( !pool->hdr_ok ) {
+      pool->hdr = *hdr;
+      pool->hdr_ok = true;
+      free(hdr);
+    }
+    else {
+      free_header(&hdr);
+    }
+    oc->opaque = NULL;
+  }
+}
+
+
+// must be called with g_pools_mtx locked
+static void get_header(const struct ffmuxpool * pool, const AVFormatContext * oc, const uint8_t ** hdr, size_t * hdrsize)
+{
+  const struct muxhdr * h = oc->opaque ? oc->opaque : &pool->hdr;
+  *hdr = h->data;
+  *hdrsize = h->size;
+}
+
+
+static struct ffmuxpool * find_pool(const void * source, AVOutputFormat * oformat, const ffstream * const * iss)
+{
+  struct ffmuxpool * pool;
+
+  for ( pool = g_pools; pool; pool = pool->next ) {
+    if ( pool->source == source && pool->oformat == oformat && pool->iss == iss ) {
+      break;
+    }
+  }
+
+  return pool;
+}
+
+
+
+int ffmuxpool_take(AVFormatContext ** poc, const uint8_t ** hdr, size_t * hdrsize,
+    const void * source, AVOutputFormat * oformat, const ffstream * const * iss, uint nb_streams,
+    int (*write_packet)(void * opaque, uint8_t * buf, int buf_size), void * opaque)
+{
+  struct ffmuxpool * pool;
+  AVFormatContext * oc = NULL;
+  int status = 0;
+
+  lock();
+
+  if ( !(pool = find_pool(source, oformat, iss)) ) {
+
+    if ( !(pool = calloc(1, sizeof(*pool))) ) {
+      status = AVERROR(ENOMEM);
+      unlock();
+      goto end;
+    }
+
+    pool->source = source;
+    pool->oformat = oformat;
+    pool->iss = iss;
+    pool->nb_streams = nb_streams;
+    pool->shared = is_deterministic(oformat);
+    pool->next = g_pools;
+    g_pools = pool;
+  }
+
+  if ( pool->nb_idle > 0 ) {
+    oc = pool->idle[--pool->nb_idle];
+    get_header(pool, oc, hdr, hdrsize);
+  }
+
+  unlock();
+
+  if ( !oc ) {
+
+    if ( (status = prepare_context(oformat, iss, nb_streams, &oc)) ) {
+      goto end;
+    }
+
+    lock();
+
+    // the pool may be purged meanwhile, then the context keeps own header
+    if ( (pool = find_pool(source, oformat, iss)) ) {
+      adopt_header(pool, oc);
+    }
+
+    get_header(pool, oc, hdr, hdrsize);
+
+    unlock();
+  }
+
+  oc->pb->opaque = opaque;
+  oc->pb->write_packet = write_packet;
+
+end:
+
+  *poc = oc;
+
+  return status;
+}
+
+
+void ffmuxpool_release(AVFormatContext ** oc, const void * source, AVOutputFormat * oformat,
+    const ffstream * const * iss)
+{
+  struct ffmuxpool * pool;
+  AVFormatContext * replacement = NULL;
+  const uint maxidle = FFMIN(ffsrv.muxpool.size, MUXPOOL_MAX_IDLE);
+  uint nb_streams = 0;
+
+  free_context(oc);
+
+  lock();
+  if ( (pool = find_pool(source, oformat, iss)) && pool->nb_idle < maxidle ) {
+    nb_streams = pool->nb_streams;
+  }
+  unlock();
+
+  // prepare the next viewer's context now rather than on its connect
+  if ( nb_streams && prepare_context(oformat, iss, nb_streams, &replacement) == 0 ) {
+
+    lock();
+    if ( (pool = find_pool(source, oformat, iss)) && pool->nb_idle < maxidle ) {
+      adopt_header(pool, replacement);
+      pool->idle[pool->nb_idle++] = replacement;
+      replacement = NULL;
+    }
+    unlock();
+
+    free_context(&replacement);
+  }
+}
+
+
+void ffmuxpool_purge(const void * source)
+{
+  struct ffmuxpool * pool, ** pp;
+
+  lock();
+
+  for ( pp = &g_pools; (pool = *pp); ) {
+    if ( pool->source != source ) {
+      pp = &pool->next;
+    }
+    else {
+      *pp = pool->next;
+      while ( pool->nb_idle > 0 ) {
+        free_context(&pool->idle[--pool->nb_idle]);
+      }
+      free(pool->hdr.data);
+      free(pool);
+    }
+  }
+
+  unlock();
+}
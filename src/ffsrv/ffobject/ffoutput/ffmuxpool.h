@@ -0,0 +1,46 @@
+/*
+ * ffmuxpool.h
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: amyznikov
+ *
+ *  Pool of prepared muxer contexts per (source, output format).
+ *  Pooled contexts have streams set up and avformat_write_header() already done,
+ *  so a new viewer starts streaming without muxer construction. Header bytes are cached
+ *  once per pool entry for mpegts and flv, other muxers put per-context data (uids,
+ *  creation time) into the header, so their contexts keep own header bytes.
+ *  Replacements are prepared when viewers leave, outside of the pool lock.
+ */
+
+// #pragma once
+
+#ifndef __ffmuxpool_h__
+#define __ffmuxpool_h__
+
+#include "ffmpeg.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+/* Take prepared context (or create one on pool miss) and redirect its output to write_packet(opaque).
+ *  hdr, hdrsize receive header bytes, valid until the context is released.
+ */
+int ffmuxpool_take(AVFormatContext ** oc, const uint8_t ** hdr, size_t * hdrsize,
+    const void * source, AVOutputFormat * oformat, const ffstream * const * iss, uint nb_streams,
+    int (*write_packet)(void * opaque, uint8_t * buf, int buf_size), void * opaque);
+
+/* Free used context and prepare replacement if the pool is below configured size */
+void ffmuxpool_release(AVFormatContext ** oc, const void * source, AVOutputFormat * oformat,
+    const ffstream * const * iss);
+
+/* Drop all pooled contexts and cached headers of the source */
+void ffmuxpool_purge(const void * source);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __ffmuxpool_h__ */
@@ -6,11 +6,22 @@
  */
 
 #include "ffoutput.h"
+#include "ffrtpshared.h"
+#include "ffflv.h"
+#include "ffmp4frag.h"
+#include "ffts.h"
+#include "ffmuxpool.h"
 #include "ffgop.h"
+#include "ffinterleaver.h"
+#include "ffcfg.h"
 #include "debug.h"
 
-#define TCP_OUTPUT_IO_BUF_SIZE    (32*1024)
-#define RTP_OUTPUT_IO_BUF_SIZE    1472
+#define RTP_OUTPUT_MAX_PACKET_SIZE  1472
+
+#define PACING_UPDATE_INTERVAL  (1000*1000)   // [us] pacing rate follows source bitrate at this interval
+#define PACING_MIN_RATE         (16*1024)     // [bytes/s]
+#define PACING_MIN_SLEEP        (5*1000)      // [us] coroutine pacer granularity
+#define PACING_MAX_LAG          (1000*1000)   // [us] coroutine pacer doesn't try to catch up more than this
 
 struct ffoutput {
   struct ffobject * source;
@@ -25,26 +36,61 @@ struct ffoutput {
   void * cookie;
   int  (*sendpkt)(void * cookie, int stream_index, uint8_t * buf, int buf_size);
   bool (*getoutspc)(void * cookie, int * outspc, int * maxspc);
+  void (*onidle)(void * cookie);
+  int  (*sendpktv)(void * cookie, int stream_index, const struct iovec * iov, int iovcnt);
+  int  (*flushpkts)(void * cookie);
+  int  (*setpacing)(void * cookie, uint32_t bytes_per_sec);
+
+  // per-viewer send pacing, enabled once the viewer has caught up with the live edge
+  struct {
+    int64_t last_update;  // [us]
+    int64_t t0, sent;     // [us], [bytes] coroutine pacer budget origin
+    uint32_t rate;        // [bytes/s], 0 = not paced
+    bool kernel, live;
+  } pacing;
 
   enum {
     output_type_tcp = 0,
     output_type_rtp = 1,
+    output_type_flv = 2,
+    output_type_fmp4 = 3,
+    output_type_ts = 4,
   } output_type;
 
 
   union {
-    // tcp-specific
+    // tcp-specific: muxer context comes from the pool with header already written
     struct {
       AVFormatContext * oc;
-      uint8_t * iobuf; // [TCP_OUTPUT_IO_BUF_SIZE]
+      const uint8_t * hdr; // cached header bytes
+      size_t hdrsize;
     } tcp;
 
-    // rtp-specific
+    // rtp-specific: packetizers are shared between all rtp outputs of the source
     struct {
-      AVFormatContext ** oc; // [nb_streams]
-      uint8_t ** iobuf; // nb_streams * (OUTPUT_IO_BUF_SIZE | RTSP_TCP_MAX_PACKET_SIZE)
+      struct ffrtpshared ** sh; // [nb_streams]
+      struct ffrtpsession * ss; // [nb_streams]
       uint current_stream_index;
+      int resync; // video stream waiting for key frame after stale packet, -1 if none
     } rtp;
+
+    // native flv: header and sequence header tags are shared between all flv outputs of the source
+    struct {
+      struct ffflvheader * hdr;
+      struct ffflvscratch tmp;
+    } flv;
+
+    // fragmented mp4: init segment and moof + mdat fragments are shared between all fmp4 outputs of the source
+    struct {
+      struct ffmp4frag * frag;
+      int resync; // video stream waiting for key frame after stale packet, -1 if none
+    } fmp4;
+
+    // native mpegts: PES packets are packetized once and shared between all mpegts outputs of the source
+    struct {
+      struct ffts * ts;
+      int resync; // video stream waiting for key frame after stale packet, -1 if none
+    } ts;
   };
 
   bool running :1, finish :1;
@@ -58,10 +104,109 @@ static int ffoutput_send_tcp_pkt(void * opaque, uint8_t * buf, int buf_size)
   return output->sendpkt(output->cookie, -1, buf, buf_size);
 }
 
-static int ffoutput_send_rtp_pkt(void * opaque, uint8_t * buf, int buf_size)
+static int ffoutput_send_rtp_pkt(void * opaque, const struct iovec * iov, int iovcnt)
+{
+  struct ffoutput * output = opaque;
+  uint8_t buf[RTP_OUTPUT_MAX_PACKET_SIZE];
+  int size = 0;
+
+  if ( output->sendpktv ) {
+    return output->sendpktv(output->cookie, output->rtp.current_stream_index, iov, iovcnt);
+  }
+
+  for ( int i = 0; i < iovcnt; ++i ) {
+    if ( size + iov[i].iov_len > sizeof(buf) ) {
+      return AVERROR(EMSGSIZE);
+    }
+    memcpy(buf + size, iov[i].iov_base, iov[i].iov_len);
+    size += iov[i].iov_len;
+  }
+
+  return output->sendpkt(output->cookie, output->rtp.current_stream_index, buf, size);
+}
+
+static int ffoutput_flush_rtp_pkts(void * opaque)
+{
+  struct ffoutput * output = opaque;
+  return output->flushpkts ? output->flushpkts(output->cookie) : 0;
+}
+
+
+
+// ffgop listener callbacks: track live edge for pacing, then forward to the viewer
+static void ffoutput_onidle(void * opaque)
+{
+  struct ffoutput * output = opaque;
+  output->pacing.live = true;
+  if ( output->onidle ) {
+    output->onidle(output->cookie);
+  }
+}
+
+static bool ffoutput_getoutspc(void * opaque, int * outspc, int * maxspc)
 {
   struct ffoutput * output = opaque;
-  return output->sendpkt(output->cookie, output->rtp.current_stream_index, buf, buf_size);
+  return output->getoutspc(output->cookie, outspc, maxspc);
+}
+
+
+/*
+ * Pacing rate follows measured source bitrate times pacing.output headroom.
+ * Kernel pacing (SO_MAX_PACING_RATE) is preferred,
+ * otherwise the coroutine sleeps when it is ahead of the rate budget.
+ * Initial gop burst is not paced so that the viewer starts without delay.
+ */
+static void ffoutput_update_pacing(struct ffoutput * output, struct ffgop * gop)
+{
+  const int64_t now = ffmpeg_gettime_us();
+  int64_t bitrate, rate;
+
+  if ( ffsrv.pacing.output <= 0 || !output->pacing.live ) {
+    return;
+  }
+
+  if ( now - output->pacing.last_update < PACING_UPDATE_INTERVAL ) {
+    return;
+  }
+
+  output->pacing.last_update = now;
+
+  if ( (bitrate = ffgop_get_bitrate(gop)) <= 0 ) {
+    return;
+  }
+
+  rate = FFMAX(FFMIN(bitrate * ffsrv.pacing.output, UINT32_MAX), PACING_MIN_RATE);
+
+  // don't touch the socket on small bitrate fluctuations
+  if ( output->pacing.rate && llabs(rate - output->pacing.rate) < output->pacing.rate / 8 ) {
+    return;
+  }
+
+  output->pacing.rate = rate;
+  output->pacing.kernel = output->setpacing && output->setpacing(output->cookie, rate) == 0;
+  output->pacing.t0 = now;
+  output->pacing.sent = 0;
+}
+
+static void ffoutput_pace(struct ffoutput * output, int size)
+{
+  int64_t now, delay;
+
+  if ( !output->pacing.rate || output->pacing.kernel ) {
+    return;
+  }
+
+  now = ffmpeg_gettime_us();
+  delay = output->pacing.t0 + output->pacing.sent * 1000000 / output->pacing.rate - now;
+  output->pacing.sent += size;
+
+  if ( delay >= PACING_MIN_SLEEP ) {
+    co_sleep(delay);
+  }
+  else if ( delay < -PACING_MAX_LAG ) {
+    output->pacing.t0 = now;
+    output->pacing.sent = size;
+  }
 }
 
 
@@ -71,81 +216,78 @@ static int ff_create_output_context(struct ffoutput * output)
 
   if ( output->output_type == output_type_tcp ) {
 
-    if ( !(output->tcp.iobuf = av_malloc(TCP_OUTPUT_IO_BUF_SIZE)) ) {
-      PDBG("av_malloc(iobuf) fails");
-      status = AVERROR(ENOMEM);
-      goto end;
-    }
+    status = ffmuxpool_take(&output->tcp.oc, &output->tcp.hdr, &output->tcp.hdrsize,
+        output->source, output->oformat, output->iss, output->nb_streams,
+        ffoutput_send_tcp_pkt, output);
 
-    if ( (status = avformat_alloc_output_context2(&output->tcp.oc, output->oformat, NULL, NULL)) ) {
-      PDBG("avformat_alloc_output_context2() fails: %s", av_err2str(status));
+    if ( status ) {
+      PDBG("ffmuxpool_take() fails: %s", av_err2str(status));
       goto end;
     }
 
-    output->tcp.oc->flags |= AVFMT_FLAG_CUSTOM_IO;
-    output->tcp.oc->pb = avio_alloc_context(output->tcp.iobuf, TCP_OUTPUT_IO_BUF_SIZE, true, output, NULL,
-        ffoutput_send_tcp_pkt, NULL);
-    if ( !output->tcp.oc->pb ) {
-      status = AVERROR(ENOMEM);
+  }
+  else if ( output->output_type == output_type_flv ) {
+
+    if ( (status = ffflv_attach(&output->flv.hdr, output->source, output->iss, output->nb_streams)) ) {
+      PDBG("ffflv_attach() fails: %s", av_err2str(status));
       goto end;
     }
+  }
+  else if ( output->output_type == output_type_fmp4 ) {
+
+    const struct ffgop * gop = get_gop(output->source);
+
+    output->fmp4.resync = -1;
 
-    // av_dict_set(&output->tcp.oc->metadata, "title", "No Title", 0);
+    status = ffmp4frag_attach(&output->fmp4.frag, output->source, output->iss, output->nb_streams,
+        gop ? gop->gcap : 0);
 
-    if ( (status = ffstreams_to_context(output->iss, output->nb_streams, output->tcp.oc)) ) {
-      PDBG("ffstreams_to_context() fails: %s", av_err2str(status));
+    if ( status ) {
+      PDBG("ffmp4frag_attach() fails: %s", av_err2str(status));
       goto end;
     }
-
   }
-  else {
+  else if ( output->output_type == output_type_ts ) {
 
-    output->rtp.oc = av_malloc_array(output->nb_streams, sizeof(AVFormatContext*));
-    output->rtp.iobuf = av_malloc_array(output->nb_streams, sizeof(uint8_t*));
+    const struct ffgop * gop = get_gop(output->source);
 
-    PDBG("COPY STREAMS output->format=%p %s", output->oformat, output->oformat ? output->oformat->name : "");
+    output->ts.resync = -1;
 
-    for ( uint i = 0; i < output->nb_streams; ++i ) {
+    status = ffts_attach(&output->ts.ts, output->source, output->iss, output->nb_streams,
+        gop ? gop->gcap : 0);
 
-      if ( (status = avformat_alloc_output_context2(&output->rtp.oc[i], output->oformat, "rtp", NULL)) ) {
-        PDBG("avformat_alloc_output_context2() fails: %s", av_err2str(status));
-        break;
-      }
+    if ( status ) {
+      PDBG("ffts_attach() fails: %s", av_err2str(status));
+      goto end;
+    }
+  }
+  else {
 
-      output->rtp.oc[i]->flags |= AVFMT_FLAG_CUSTOM_IO;
-      // av_dict_set(&output->rtp.oc[i]->metadata, "title", "No Title", 0);
+    const struct ffgop * gop = get_gop(output->source);
 
-      if ( !(output->rtp.iobuf[i] = av_malloc(RTP_OUTPUT_IO_BUF_SIZE)) ) {
-        PDBG("av_malloc(iobuf) fails");
-        status = AVERROR(ENOMEM);
-        break;
-      }
+    output->rtp.resync = -1;
 
-      output->rtp.oc[i]->pb = avio_alloc_context(output->rtp.iobuf[i], RTP_OUTPUT_IO_BUF_SIZE, true, output, NULL,
-          ffoutput_send_rtp_pkt, NULL);
-      if ( !output->rtp.oc[i]->pb ) {
-        PDBG("avio_alloc_context() fails");
-        status = AVERROR(ENOMEM);
-        break;
-      }
+    output->rtp.sh = av_mallocz_array(output->nb_streams, sizeof(struct ffrtpshared*));
+    output->rtp.ss = av_mallocz_array(output->nb_streams, sizeof(struct ffrtpsession));
+
+    if ( !output->rtp.sh || !output->rtp.ss ) {
+      status = AVERROR(ENOMEM);
+      goto end;
+    }
 
-      output->rtp.oc[i]->pb->max_packet_size = RTP_OUTPUT_IO_BUF_SIZE;
+    for ( uint i = 0; i < output->nb_streams; ++i ) {
 
-      if ( !avformat_new_stream(output->rtp.oc[i], NULL) ) {
-        PDBG("avformat_new_stream() fails");
-        status = AVERROR(ENOMEM);
-        break;
-      }
+      status = ffrtpshared_attach(&output->rtp.sh[i], output->source, output->iss[i], output->oformat,
+          gop ? gop->gcap : 0);
 
-      if ( (status = ffstream_to_context(output->iss[i], output->rtp.oc[i]->streams[0])) ) {
-        PDBG("ffstream_to_context() fails: %s", av_err2str(status));
+      if ( status ) {
+        PDBG("ffrtpshared_attach(st=%u) fails: %s", i, av_err2str(status));
         break;
       }
 
-      output->rtp.oc[i]->streams[0]->index = 0;
+      ffrtpsession_init(&output->rtp.ss[i]);
     }
 
-    PDBG("COPY FINISH");
     if ( status ) {
       goto end;
     }
@@ -161,21 +303,27 @@ static void ff_destroy_output_context(struct ffoutput * output)
   if ( output ) {
     if ( output->output_type == output_type_tcp ) {
       if ( output->tcp.oc ) {
-        av_freep(&output->tcp.oc->pb->buffer);
-        av_freep(&output->tcp.oc->pb);
-        avformat_free_context(output->tcp.oc);
-        output->tcp.oc = NULL;
+        ffmuxpool_release(&output->tcp.oc, output->source, output->oformat, output->iss);
       }
     }
     else if ( output->output_type == output_type_rtp ) {
-      for ( uint i = 0; i < output->nb_streams; ++i ) {
-        if ( output->rtp.oc[i] ) {
-          av_freep(&output->rtp.oc[i]->pb->buffer);
-          av_freep(&output->rtp.oc[i]->pb);
-          avformat_free_context(output->rtp.oc[i]);
-          output->rtp.oc[i] = NULL;
+      if ( output->rtp.sh ) {
+        for ( uint i = 0; i < output->nb_streams; ++i ) {
+          ffrtpshared_detach(&output->rtp.sh[i]);
         }
+        av_freep(&output->rtp.sh);
       }
+      av_freep(&output->rtp.ss);
+    }
+    else if ( output->output_type == output_type_flv ) {
+      ffflv_detach(&output->flv.hdr);
+      ffflv_cleanup_scratch(&output->flv.tmp);
+    }
+    else if ( output->output_type == output_type_fmp4 ) {
+      ffmp4frag_detach(&output->fmp4.frag);
+    }
+    else if ( output->output_type == output_type_ts ) {
+      ffts_detach(&output->ts.ts);
     }
   }
 }
@@ -187,6 +335,7 @@ int ff_create_output(struct ffoutput ** pps, const struct ff_create_output_args
   const char * output_format_name = "matroska";
   AVOutputFormat * format = NULL;
   bool rtp = false;
+  bool fmp4 = false;
 
 
   int status = 0;
@@ -209,6 +358,12 @@ int ff_create_output(struct ffoutput ** pps, const struct ff_create_output_args
     output_format_name = args->format;
   }
 
+  // fmp4 is not a muxer name but the shared fragmented mp4 writer
+  if ( strcasecmp(output_format_name, "fmp4") == 0 ) {
+    output_format_name = "mp4";
+    fmp4 = true;
+  }
+
   if ( !(format = av_guess_format(output_format_name, NULL, NULL)) ) {
     PDBG("av_guess_format(%s) fails", output_format_name);
     status = AVERROR_MUXER_NOT_FOUND;
@@ -234,8 +389,22 @@ int ff_create_output(struct ffoutput ** pps, const struct ff_create_output_args
   output->cookie = args->cookie;
   output->sendpkt = args->sendpkt;
   output->getoutspc = args->getoutspc;
+  output->onidle = args->onidle;
+  output->sendpktv = args->sendpktv;
+  output->flushpkts = args->flushpkts;
+  output->setpacing = args->setpacing;
   output->oformat = format;
   output->output_type = rtp ? output_type_rtp : output_type_tcp;
+
+  if ( strcasecmp(output_format_name, "flv") == 0 && ffflv_supported(output->iss, output->nb_streams) ) {
+    output->output_type = output_type_flv;
+  }
+  else if ( fmp4 ) {
+    output->output_type = output_type_fmp4;
+  }
+  else if ( strcasecmp(output_format_name, "mpegts") == 0 && ffts_supported(output->iss, output->nb_streams) ) {
+    output->output_type = output_type_ts;
+  }
   output->finish = false;
 
 end:
@@ -333,6 +502,7 @@ int ff_run_output_stream(struct ffoutput * output)
   AVFormatContext * oc;
 
   struct ffgop * gop = NULL;
+  struct ffinterleaver * il = NULL;
 
   const struct ffstream * is;
   AVStream * os;
@@ -368,8 +538,9 @@ int ff_run_output_stream(struct ffoutput * output)
   }
 
   status = ffgop_create_listener(gop, &output->gl, &(struct ffgop_create_listener_args ) {
-        .getoutspc = output->getoutspc,
-        .cookie = output->cookie
+        .getoutspc = output->getoutspc ? ffoutput_getoutspc : NULL,
+        .onidle = ffoutput_onidle,
+        .cookie = output
       });
 
   if ( status ) {
@@ -392,7 +563,25 @@ int ff_run_output_stream(struct ffoutput * output)
     }
   }
   else if ( output->output_type == output_type_rtp ) {
-    if ( !output->rtp.oc && (status = ff_create_output_context(output)) ) {
+    if ( !output->rtp.sh && (status = ff_create_output_context(output)) ) {
+      PDBG("ff_create_output_context() fails: %s", av_err2str(status));
+      goto end;
+    }
+  }
+  else if ( output->output_type == output_type_flv ) {
+    if ( !output->flv.hdr && (status = ff_create_output_context(output)) ) {
+      PDBG("ff_create_output_context() fails: %s", av_err2str(status));
+      goto end;
+    }
+  }
+  else if ( output->output_type == output_type_fmp4 ) {
+    if ( !output->fmp4.frag && (status = ff_create_output_context(output)) ) {
+      PDBG("ff_create_output_context() fails: %s", av_err2str(status));
+      goto end;
+    }
+  }
+  else if ( output->output_type == output_type_ts ) {
+    if ( !output->ts.ts && (status = ff_create_output_context(output)) ) {
       PDBG("ff_create_output_context() fails: %s", av_err2str(status));
       goto end;
     }
@@ -411,26 +600,49 @@ int ff_run_output_stream(struct ffoutput * output)
 
   PDBG("WRITE HEADER");
 
+  // rtp headers are written once by shared packetizers, tcp header is cached by the muxer pool
   if ( output->output_type == output_type_tcp ) {
-    output->tcp.oc->flush_packets = 1;
-    if ( (status = avformat_write_header(output->tcp.oc, NULL)) >= 0 ) {
+    if ( (status = ffoutput_send_tcp_pkt(output, (uint8_t*) output->tcp.hdr, output->tcp.hdrsize)) >= 0 ) {
       write_header_ok = true;
+      if ( nb_streams > 1 && ffsrv.interleave.bounded ) {
+        AVRational * tbs = alloca(nb_streams * sizeof(*tbs));
+        for ( uint i = 0; i < nb_streams; ++i ) {
+          tbs[i] = output->tcp.oc->streams[i]->time_base;
+        }
+        if ( (status = ffinterleaver_create(&il, tbs, nb_streams, ffsrv.interleave.maxskew * 1000LL)) ) {
+          PDBG("ffinterleaver_create() fails: %s", av_err2str(status));
+          goto end;
+        }
+      }
+      if ( output->flushpkts ) {
+        avio_flush(output->tcp.oc->pb);
+        status = output->flushpkts(output->cookie);
+      }
     }
     else {
-      PDBG("avformat_write_header() fails: %s", av_err2str(status));
+      PDBG("send header fails: %s", av_err2str(status));
       goto end;
     }
   }
-  else {
-    for ( uint i = 0; i < nb_streams; ++i ) {
-      output->rtp.oc[i]->flush_packets = 1;
-      if ( (status = avformat_write_header(output->rtp.oc[i], NULL)) >= 0 ) {
-        write_header_ok = true;
-      }
-      else {
-        PDBG("avformat_write_header(st=%u) fails: %s", i, av_err2str(status));
-        goto end;
-      }
+  else if ( output->output_type == output_type_flv ) {
+    size_t size;
+    const uint8_t * hdr = ffflv_get_header(output->flv.hdr, &size);
+    if ( (status = ffoutput_send_tcp_pkt(output, (uint8_t*) hdr, size)) >= 0 && output->flushpkts ) {
+      status = output->flushpkts(output->cookie);
+    }
+  }
+  else if ( output->output_type == output_type_fmp4 ) {
+    size_t size;
+    const uint8_t * init = ffmp4frag_get_init(output->fmp4.frag, &size);
+    if ( (status = ffoutput_send_tcp_pkt(output, (uint8_t*) init, size)) >= 0 && output->flushpkts ) {
+      status = output->flushpkts(output->cookie);
+    }
+  }
+  else if ( output->output_type == output_type_ts ) {
+    uint8_t psi[FFTS_HEADER_SIZE];
+    ffts_get_header(output->ts.ts, psi);
+    if ( (status = ffoutput_send_tcp_pkt(output, psi, sizeof(psi))) >= 0 && output->flushpkts ) {
+      status = output->flushpkts(output->cookie);
     }
   }
 
@@ -448,17 +660,91 @@ int ff_run_output_stream(struct ffoutput * output)
       continue;
     }
 
+    ffoutput_update_pacing(output, gop);
+    ffoutput_pace(output, pkt.size);
+
 
     stidx = pkt.stream_index;
     is = output->iss[stidx];
 
-    if ( output->output_type == output_type_tcp ) {
-      oc = output->tcp.oc;
-      os = oc->streams[stidx];
+    if ( output->output_type == output_type_rtp ) {
+      // shared packetizer takes source timestamps, per-session offsets are applied in RTP headers
+      output->rtp.current_stream_index = stidx;
+      if ( stidx == output->rtp.resync && !(pkt.flags & AV_PKT_FLAG_KEY) ) {
+        // skip up to the next key frame
+      }
+      else if ( (status = ffrtpshared_send(output->rtp.sh[stidx], &output->rtp.ss[stidx], &pkt, ffoutput_send_rtp_pkt,
+          ffoutput_flush_rtp_pkts, output)) == AVERROR(EAGAIN) ) {
+        if ( is->codecpar->codec_type == AVMEDIA_TYPE_VIDEO ) {
+          output->rtp.resync = stidx;
+        }
+        status = 0;
+      }
+      else if ( status < 0 ) {
+        PDBG("ffrtpshared_send() fails: %s", av_err2str(status));
+      }
+      else if ( stidx == output->rtp.resync ) {
+        output->rtp.resync = -1;
+      }
+      av_packet_unref(&pkt);
+      co_yield();
+      continue;
     }
-    else {
-      oc = output->rtp.oc[stidx];
-      os = oc->streams[0];
+
+    if ( output->output_type == output_type_fmp4 ) {
+      // fragments carry source timestamps (tfdt), so they can be shared as is;
+      // each fragment is flushed separately to let the client start decoding it immediately
+      if ( stidx == output->fmp4.resync && !(pkt.flags & AV_PKT_FLAG_KEY) ) {
+        // skip up to the next key frame
+      }
+      else if ( (status = ffmp4frag_send(output->fmp4.frag, &pkt, ffoutput_send_tcp_pkt, output)) == AVERROR(EAGAIN) ) {
+        // client lags behind the shared cache: video resumes from the next key frame, other packets are just lost
+        if ( is->codecpar->codec_type == AVMEDIA_TYPE_VIDEO ) {
+          output->fmp4.resync = stidx;
+        }
+        status = 0;
+      }
+      else if ( status < 0 ) {
+        PDBG("ffmp4frag_send() fails: %s", av_err2str(status));
+      }
+      else {
+        if ( stidx == output->fmp4.resync ) {
+          output->fmp4.resync = -1;
+        }
+        if ( output->flushpkts && (status = output->flushpkts(output->cookie)) < 0 ) {
+          PDBG("flushpkts() fails: %s", av_err2str(status));
+        }
+      }
+      av_packet_unref(&pkt);
+      co_yield();
+      continue;
+    }
+
+    if ( output->output_type == output_type_ts ) {
+      // TS packets carry source timestamps and shared continuity counters
+      if ( stidx == output->ts.resync && !(pkt.flags & AV_PKT_FLAG_KEY) ) {
+        // skip up to the next key frame
+      }
+      else if ( (status = ffts_send(output->ts.ts, &pkt, ffoutput_send_tcp_pkt, output)) == AVERROR(EAGAIN) ) {
+        if ( is->codecpar->codec_type == AVMEDIA_TYPE_VIDEO ) {
+          output->ts.resync = stidx;
+        }
+        status = 0;
+      }
+      else if ( status < 0 ) {
+        PDBG("ffts_send() fails: %s", av_err2str(status));
+      }
+      else {
+        if ( stidx == output->ts.resync ) {
+          output->ts.resync = -1;
+        }
+        if ( output->flushpkts && (status = output->flushpkts(output->cookie)) < 0 ) {
+          PDBG("flushpkts() fails: %s", av_err2str(status));
+        }
+      }
+      av_packet_unref(&pkt);
+      co_yield();
+      continue;
     }
 
 //    {
@@ -488,6 +774,30 @@ int ff_run_output_stream(struct ffoutput * output)
       }
     }
 
+    if ( output->output_type == output_type_flv ) {
+
+      const AVRational mstb = (AVRational ) { 1, 1000 };
+
+      status = ffflv_send_pkt(output->flv.hdr, &pkt,
+          pkt.dts == AV_NOPTS_VALUE ? 0 : av_rescale_q(pkt.dts, is->time_base, mstb),
+          pkt.pts == AV_NOPTS_VALUE ? AV_NOPTS_VALUE : av_rescale_q(pkt.pts, is->time_base, mstb),
+          &output->flv.tmp, ffoutput_send_tcp_pkt, output);
+
+      if ( status < 0 ) {
+        PDBG("ffflv_send_pkt() fails: %s", av_err2str(status));
+      }
+      else if ( output->flushpkts && (status = output->flushpkts(output->cookie)) < 0 ) {
+        PDBG("flushpkts() fails: %s", av_err2str(status));
+      }
+
+      av_packet_unref(&pkt);
+      co_yield();
+      continue;
+    }
+
+    oc = output->tcp.oc;
+    os = oc->streams[stidx];
+
     if ( is->time_base.num != os->time_base.num || is->time_base.den != os->time_base.den ) {
       av_packet_rescale_ts(&pkt, is->time_base, os->time_base);
     }
@@ -507,10 +817,8 @@ int ff_run_output_stream(struct ffoutput * output)
 //      co_sleep(delay);
 //    }
 
-    if ( output->output_type == output_type_rtp ) {
-      output->rtp.current_stream_index = stidx;
-      pkt.stream_index = 0;
-      status = av_write_frame(oc, &pkt);
+    if ( il ) {
+      status = ffinterleaver_write_frame(il, oc, &pkt);
     }
     else if ( nb_streams > 1 ) {
       status = av_interleaved_write_frame(oc, &pkt);
@@ -522,6 +830,12 @@ int ff_run_output_stream(struct ffoutput * output)
     if ( status < 0 ) {
       PDBG("write frame fails: %s", av_err2str(status));
     }
+    else if ( output->flushpkts ) {
+      avio_flush(oc->pb);
+      if ( (status = output->flushpkts(output->cookie)) < 0 ) {
+        PDBG("flushpkts() fails: %s", av_err2str(status));
+      }
+    }
 
     av_packet_unref(&pkt);
 
@@ -530,19 +844,26 @@ int ff_run_output_stream(struct ffoutput * output)
 
 end : ;
 
-  if ( write_header_ok ) {
-    if ( output->output_type == output_type_tcp ) {
-      av_write_trailer(output->tcp.oc);
+  if ( il ) {
+    int64_t avg, max;
+    if ( write_header_ok ) {
+      ffinterleaver_write_frame(il, output->tcp.oc, NULL);
     }
-    else {
-      for ( uint i = 0; i < nb_streams; ++i ) {
-        av_write_trailer(output->rtp.oc[i]);
-      }
+    ffinterleaver_get_delay(il, &avg, &max);
+    PDBG("interleaver delay: avg=%" PRId64 " max=%" PRId64 " ms", avg / 1000, max / 1000);
+    ffinterleaver_destroy(&il);
+  }
+
+  if ( write_header_ok ) {
+    av_write_trailer(output->tcp.oc);
+    if ( output->flushpkts ) {
+      output->flushpkts(output->cookie);
     }
   }
 
   if ( output ) {
     ff_destroy_output_context(output);
+    memset(&output->pacing, 0, sizeof(output->pacing)); // a next run starts unpaced
     output->running = false;
   }
 
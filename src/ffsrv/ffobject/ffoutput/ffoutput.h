@@ -25,6 +25,10 @@ struct ff_create_output_args {
   void * cookie;
   int (*sendpkt)(void * cookie, int stream_index, uint8_t * buf, int buf_size);
   bool (*getoutspc)(void * cookie, int * outspc, int * maxspc);
+  void (*onidle)(void * cookie);
+  int (*sendpktv)(void * cookie, int stream_index, const struct iovec * iov, int iovcnt);
+  int (*flushpkts)(void * cookie);
+  int (*setpacing)(void * cookie, uint32_t bytes_per_sec);
 };
 
 int ff_create_output(struct ffoutput ** output, const struct ff_create_output_args * args);
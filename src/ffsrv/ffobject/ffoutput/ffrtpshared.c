@@ -0,0 +1,479 @@
+/*
+ * ffrtpshared.c
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: amyznikov
+ */
+
+#include "ffrtpshared.h"
+#include "debug.h"
+#include <pthread.h>
+
+#define RTP_SHARED_MAX_PACKET_SIZE  1472
+#define RTP_HEADER_SIZE             12
+
+
+/* Packetized source packet: sequence of [uint16_t size][RTP or RTCP packet] */
+struct ffrtpframe {
+  const uint8_t * data; // source packet identity
+  int64_t pts, dts;
+  int size;
+
+  uint8_t * rtp;
+  int rtpsize, rtpcap;
+  int refs;
+};
+
+struct ffrtpshared {
+  struct ffrtpshared * next;
+  const void * source;
+  const ffstream * is;
+
+  AVFormatContext * oc;
+  AVRational otb;
+
+  pthread_mutex_t mtx;
+  struct ffrtpframe ** frames; // [capacity] ring
+  struct ffrtpframe * capture;
+  uint capacity, wpos;
+  int64_t lastdts;
+  uint64_t stale;
+
+  int refs;
+  bool write_header_ok;
+};
+
+
+static struct ffrtpshared * g_shared = NULL;
+static pthread_mutex_t g_shared_mtx = PTHREAD_MUTEX_INITIALIZER;
+
+
+
+static inline uint32_t rd32(const uint8_t * p)
+{
+  return ((uint32_t) p[0] << 24) | ((uint32_t) p[1] << 16) | ((uint32_t) p[2] << 8) | p[3];
+}
+
+static inline void wr32(uint8_t * p, uint32_t v)
+{
+  p[0] = v >> 24, p[1] = v >> 16, p[2] = v >> 8, p[3] = v;
+}
+
+
+static void unref_frame(struct ffrtpframe * frm)
+{
+  if ( frm && --frm->refs == 0 ) {
+    free(frm->rtp);
+    free(frm);
+  }
+}
+
+
+// AVIO write callback of shared rtp muxer
+static int ffrtpshared_capture(void * opaque, uint8_t * buf, int buf_size)
+{
+  struct ffrtpshared * sh = opaque;
+  struct ffrtpframe * frm = sh->capture;
+  uint16_t size = buf_size;
+  int need;
+
+  if ( !frm ) {
+    return 0; // nothing is expected outside of ffrtpshared_packetize()
+  }
+
+  if ( buf_size > RTP_SHARED_MAX_PACKET_SIZE ) {
+    return AVERROR(EMSGSIZE);
+  }
+
+  if ( (need = frm->rtpsize + sizeof(size) + buf_size) > frm->rtpcap ) {
+
+    int cap = FFMAX(need, FFMAX(2 * frm->rtpcap, 4096));
+    uint8_t * rtp;
+
+    if ( !(rtp = realloc(frm->rtp, cap)) ) {
+      return AVERROR(ENOMEM);
+    }
+
+    frm->rtp = rtp;
+    frm->rtpcap = cap;
+  }
+
+  memcpy(frm->rtp + frm->rtpsize, &size, sizeof(size));
+  memcpy(frm->rtp + frm->rtpsize + sizeof(size), buf, buf_size);
+  frm->rtpsize = need;
+
+  return 0;
+}
+
+
+static void ffrtpshared_destroy(struct ffrtpshared * sh)
+{
+  if ( sh ) {
+
+    if ( sh->stale ) {
+      PDBG("%" PRIu64 " packets were too late for shared packetizer", sh->stale);
+    }
+
+    if ( sh->oc ) {
+      if ( sh->write_header_ok ) {
+        av_write_trailer(sh->oc);
+      }
+      if ( sh->oc->pb ) {
+        av_freep(&sh->oc->pb->buffer);
+        av_freep(&sh->oc->pb);
+      }
+      avformat_free_context(sh->oc);
+    }
+
+    if ( sh->frames ) {
+      for ( uint i = 0; i < sh->capacity; ++i ) {
+        unref_frame(sh->frames[i]);
+      }
+      free(sh->frames);
+    }
+
+    pthread_mutex_destroy(&sh->mtx);
+    free(sh);
+  }
+}
+
+
+static int ffrtpshared_create(struct ffrtpshared ** psh, const void * source, const ffstream * is,
+    AVOutputFormat * oformat, uint capacity)
+{
+  struct ffrtpshared * sh = NULL;
+  uint8_t * iobuf = NULL;
+  int status = 0;
+
+  if ( !(sh = calloc(1, sizeof(*sh))) ) {
+    status = AVERROR(ENOMEM);
+    goto end;
+  }
+
+  pthread_mutex_init(&sh->mtx, NULL);
+
+  sh->source = source;
+  sh->is = is;
+  sh->capacity = capacity ? capacity : 512;
+  sh->lastdts = AV_NOPTS_VALUE;
+
+  if ( !(sh->frames = calloc(sh->capacity, sizeof(*sh->frames))) ) {
+    status = AVERROR(ENOMEM);
+    goto end;
+  }
+
+  if ( (status = avformat_alloc_output_context2(&sh->oc, oformat, "rtp", NULL)) ) {
+    PDBG("avformat_alloc_output_context2() fails: %s", av_err2str(status));
+    goto end;
+  }
+
+  sh->oc->flags |= AVFMT_FLAG_CUSTOM_IO;
+
+  if ( !(iobuf = av_malloc(RTP_SHARED_MAX_PACKET_SIZE)) ) {
+    PDBG("av_malloc(iobuf) fails");
+    status = AVERROR(ENOMEM);
+    goto end;
+  }
+
+  sh->oc->pb = avio_alloc_context(iobuf, RTP_SHARED_MAX_PACKET_SIZE, true, sh, NULL, ffrtpshared_capture, NULL);
+  if ( !sh->oc->pb ) {
+    PDBG("avio_alloc_context() fails");
+    av_free(iobuf);
+    status = AVERROR(ENOMEM);
+    goto end;
+  }
+
+  sh->oc->pb->max_packet_size = RTP_SHARED_MAX_PACKET_SIZE;
+
+  if ( !avformat_new_stream(sh->oc, NULL) ) {
+    PDBG("avformat_new_stream() fails");
+    status = AVERROR(ENOMEM);
+    goto end;
+  }
+
+  if ( (status = ffstream_to_context(is, sh->oc->streams[0])) ) {
+    PDBG("ffstream_to_context() fails: %s", av_err2str(status));
+    goto end;
+  }
+
+  sh->oc->streams[0]->index = 0;
+  sh->oc->flush_packets = 1;
+
+  if ( (status = avformat_write_header(sh->oc, NULL)) < 0 ) {
+    PDBG("avformat_write_header() fails: %s", av_err2str(status));
+    goto end;
+  }
+
+  status = 0;
+  sh->write_header_ok = true;
+  sh->otb = sh->oc->streams[0]->time_base;
+
+end:
+
+  if ( status ) {
+    ffrtpshared_destroy(sh);
+    sh = NULL;
+  }
+
+  *psh = sh;
+
+  return status;
+}
+
+
+
+int ffrtpshared_attach(struct ffrtpshared ** psh, const void * source, const ffstream * is,
+    AVOutputFormat * oformat, uint capacity)
+{
+  struct ffrtpshared * sh;
+  int status = 0;
+
+  pthread_mutex_lock(&g_shared_mtx);
+
+  for ( sh = g_shared; sh; sh = sh->next ) {
+    if ( sh->source == source && sh->is == is ) {
+      break;
+    }
+  }
+
+  if ( sh ) {
+    ++sh->refs;
+  }
+  else if ( (status = ffrtpshared_create(&sh, source, is, oformat, capacity)) == 0 ) {
+    sh->refs = 1;
+    sh->next = g_shared;
+    g_shared = sh;
+  }
+
+  pthread_mutex_unlock(&g_shared_mtx);
+
+  *psh = sh;
+
+  return status;
+}
+
+
+void ffrtpshared_detach(struct ffrtpshared ** psh)
+{
+  struct ffrtpshared * sh, ** pp;
+
+  if ( psh && (sh = *psh) ) {
+
+    pthread_mutex_lock(&g_shared_mtx);
+
+    if ( --sh->refs == 0 ) {
+      for ( pp = &g_shared; *pp; pp = &(*pp)->next ) {
+        if ( *pp == sh ) {
+          *pp = sh->next;
+          break;
+        }
+      }
+      ffrtpshared_destroy(sh);
+    }
+
+    pthread_mutex_unlock(&g_shared_mtx);
+
+    *psh = NULL;
+  }
+}
+
+
+
+void ffrtpsession_init(struct ffrtpsession * ss)
+{
+  memset(ss, 0, sizeof(*ss));
+  ss->ssrc = av_get_random_seed();
+  ss->seq = av_get_random_seed();
+}
+
+static void ffrtpsession_start(struct ffrtpsession * ss, uint32_t ts)
+{
+  ss->tsoffset = av_get_random_seed() - ts;
+  ss->started = true;
+}
+
+/*
+ * Rewrite shared packet for this session:
+ *  RTP : sequence number, timestamp, SSRC (only header is touched, size is the full packet size)
+ *  RTCP: SSRC of SR / SDES / BYE, SR RTP timestamp and sender counts
+ */
+static void ffrtpsession_rewrite(struct ffrtpsession * ss, uint8_t * buf, int size)
+{
+  uint8_t * p;
+  int pos, len;
+
+  if ( size < 8 ) {
+    return;
+  }
+
+  if ( buf[1] >= 200 && buf[1] <= 204 ) {
+
+    for ( pos = 0; pos + 8 <= size; pos += len ) {
+
+      p = buf + pos;
+
+      if ( pos + (len = 4 * (((p[2] << 8) | p[3]) + 1)) > size ) {
+        break;
+      }
+
+      switch ( p[1] ) {
+        case 200 :
+          if ( len >= 28 ) {
+            if ( !ss->started ) {
+              ffrtpsession_start(ss, rd32(p + 16));
+            }
+            wr32(p + 16, rd32(p + 16) + ss->tsoffset);
+            wr32(p + 20, ss->packet_count);
+            wr32(p + 24, ss->octet_count);
+          }
+          wr32(p + 4, ss->ssrc);
+        break;
+
+        case 202 :
+        case 203 :
+          wr32(p + 4, ss->ssrc);
+        break;
+      }
+    }
+  }
+  else if ( size >= RTP_HEADER_SIZE ) {
+
+    if ( !ss->started ) {
+      ffrtpsession_start(ss, rd32(buf + 4));
+    }
+
+    buf[2] = ss->seq >> 8;
+    buf[3] = ss->seq;
+    wr32(buf + 4, rd32(buf + 4) + ss->tsoffset);
+    wr32(buf + 8, ss->ssrc);
+
+    ++ss->seq;
+    ++ss->packet_count;
+    ss->octet_count += size - RTP_HEADER_SIZE;
+  }
+}
+
+
+
+// must be called with sh->mtx locked
+static int ffrtpshared_packetize(struct ffrtpshared * sh, const AVPacket * pkt, struct ffrtpframe ** pfrm)
+{
+  struct ffrtpframe * frm;
+  AVPacket opkt;
+  int status;
+
+  *pfrm = NULL;
+
+  if ( pkt->dts != AV_NOPTS_VALUE && sh->lastdts != AV_NOPTS_VALUE && pkt->dts <= sh->lastdts ) {
+    ++sh->stale; // session lags behind the cache, the muxer can't go back
+    return AVERROR(EAGAIN);
+  }
+
+  if ( !(frm = calloc(1, sizeof(*frm))) ) {
+    return AVERROR(ENOMEM);
+  }
+
+  frm->data = pkt->data;
+  frm->size = pkt->size;
+  frm->pts = pkt->pts;
+  frm->dts = pkt->dts;
+  frm->refs = 1;
+
+  opkt = *pkt;
+  opkt.stream_index = 0;
+  av_packet_rescale_ts(&opkt, sh->is->time_base, sh->otb);
+
+  sh->capture = frm;
+  status = av_write_frame(sh->oc, &opkt);
+  sh->capture = NULL;
+
+  if ( status < 0 ) {
+    PDBG("av_write_frame() fails: %s", av_err2str(status));
+    unref_frame(frm);
+    return status;
+  }
+
+  if ( pkt->dts != AV_NOPTS_VALUE ) {
+    sh->lastdts = pkt->dts;
+  }
+
+  unref_frame(sh->frames[sh->wpos]);
+  sh->frames[sh->wpos] = frm;
+  sh->wpos = (sh->wpos + 1) % sh->capacity;
+
+  *pfrm = frm;
+
+  return 0;
+}
+
+
+int ffrtpshared_send(struct ffrtpshared * sh, struct ffrtpsession * ss, const AVPacket * pkt,
+    int (*sendv)(void * opaque, const struct iovec * iov, int iovcnt),
+    int (*flush)(void * opaque),
+    void * opaque)
+{
+  struct ffrtpframe * frm = NULL, * f;
+  uint8_t buf[RTP_SHARED_MAX_PACKET_SIZE];
+  struct iovec iov[2];
+  const uint8_t * data;
+  uint16_t size;
+  int status = 0;
+
+  pthread_mutex_lock(&sh->mtx);
+
+  // sessions are normally close to the head, so search from newest
+  for ( uint i = 1; i <= sh->capacity; ++i ) {
+    if ( !(f = sh->frames[(sh->wpos + sh->capacity - i) % sh->capacity]) ) {
+      break;
+    }
+    if ( f->data == pkt->data && f->size == pkt->size && f->pts == pkt->pts && f->dts == pkt->dts ) {
+      frm = f;
+      break;
+    }
+  }
+
+  if ( !frm ) {
+    status = ffrtpshared_packetize(sh, pkt, &frm);
+  }
+
+  if ( frm ) {
+    ++frm->refs;
+  }
+
+  pthread_mutex_unlock(&sh->mtx);
+
+  if ( frm ) {
+
+    // sendv() may block this coroutine, so the frame is pinned by reference rather than by lock.
+    // RTP payload is passed by pointer into the cache, only the header is copied and rewritten
+    for ( int pos = 0; status >= 0 && pos < frm->rtpsize; pos += sizeof(size) + size ) {
+
+      memcpy(&size, frm->rtp + pos, sizeof(size));
+      data = frm->rtp + pos + sizeof(size);
+
+      if ( size < RTP_HEADER_SIZE || (data[1] >= 200 && data[1] <= 204) ) {
+        memcpy(buf, data, size);
+        ffrtpsession_rewrite(ss, buf, size);
+        iov[0] = (struct iovec ) { buf, size };
+        status = sendv(opaque, iov, 1);
+      }
+      else {
+        memcpy(buf, data, RTP_HEADER_SIZE);
+        ffrtpsession_rewrite(ss, buf, size);
+        iov[0] = (struct iovec ) { buf, RTP_HEADER_SIZE };
+        iov[1] = (struct iovec ) { (uint8_t*) data + RTP_HEADER_SIZE, size - RTP_HEADER_SIZE };
+        status = sendv(opaque, iov, 2);
+      }
+    }
+
+    if ( status >= 0 && flush ) {
+      status = flush(opaque);
+    }
+
+    pthread_mutex_lock(&sh->mtx);
+    unref_frame(frm);
+    pthread_mutex_unlock(&sh->mtx);
+  }
+
+  return status;
+}
@@ -0,0 +1,68 @@
+/*
+ * ffrtpshared.h
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: amyznikov
+ *
+ *  RTP packetizer shared by all RTP outputs of the same (source, stream).
+ *  Each source packet is packetized once by single rtp muxer, the resulting
+ *  RTP/RTCP packets are cached and replayed to every session with
+ *  SSRC, sequence number and timestamp rewritten in place.
+ */
+
+// #pragma once
+
+#ifndef __ffrtpshared_h__
+#define __ffrtpshared_h__
+
+#include "ffmpeg.h"
+#include <sys/uio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+struct ffrtpshared;
+
+/* per-session (per-stream) RTP header state */
+struct ffrtpsession {
+  uint32_t ssrc;
+  uint32_t tsoffset;
+  uint32_t packet_count;
+  uint32_t octet_count;
+  uint16_t seq;
+  bool started;
+};
+
+
+/* Get (create on first use) shared packetizer for stream 'is' of 'source'.
+ *  capacity : number of source packets kept packetized, normally the gop size
+ */
+int ffrtpshared_attach(struct ffrtpshared ** sh, const void * source, const ffstream * is,
+    AVOutputFormat * oformat, uint capacity);
+
+void ffrtpshared_detach(struct ffrtpshared ** sh);
+
+
+void ffrtpsession_init(struct ffrtpsession * ss);
+
+
+/* Packetize pkt (or reuse cached packets) and send them with session header.
+ *  pkt timestamps are in the source stream time base.
+ *  sendv() is called per RTP/RTCP packet: iov[0] is transient session copy of the header
+ *  (or of whole RTCP packet), iov[1] points into the cache and stays valid until flush() returns.
+ *  Returns AVERROR(EAGAIN) without sending if pkt is older than the packetizer state
+ *  (session lags behind the cache), the caller must resync video at the next key frame.
+ */
+int ffrtpshared_send(struct ffrtpshared * sh, struct ffrtpsession * ss, const AVPacket * pkt,
+    int (*sendv)(void * opaque, const struct iovec * iov, int iovcnt),
+    int (*flush)(void * opaque),
+    void * opaque);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __ffrtpshared_h__ */
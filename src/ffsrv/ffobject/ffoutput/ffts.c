@@ -0,0 +1,904 @@
+/*
+ * ffts.c
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: amyznikov
+ */
+
+#include "ffts.h"
+#include "debug.h"
+#include <pthread.h>
+
+#define TS_PACKET_SIZE        188
+#define TS_PAYLOAD_SIZE       184
+#define TS_MAX_STREAMS        8
+#define TS_PMT_PID            0x1000
+#define TS_FIRST_ES_PID       0x100
+#define TS_PROGRAM_NUMBER     1
+#define TS_DELAY              63000   // PES timestamps run 0.7 s of 90 kHz ahead of PCR (decoder buffering)
+#define TS_PSI_INTERVAL       45000   // PAT/PMT repetition for sources without video, 90 kHz
+#define TS_PES_HEADER_SIZE    19
+
+#define STREAM_TYPE_AUDIO_MPEG1   0x03
+#define STREAM_TYPE_AUDIO_AAC     0x0F
+#define STREAM_TYPE_VIDEO_H264    0x1B
+#define STREAM_TYPE_VIDEO_HEVC    0x24
+#define STREAM_TYPE_AUDIO_AC3     0x81
+
+
+/* Packetized source packet: PES in whole TS packets, optionally preceded by PAT + PMT */
+struct fftsframe {
+  const uint8_t * data; // source packet identity
+  int64_t pts, dts;
+  int size, stream_index;
+
+  uint8_t * buf; // av_malloc()'ed, [bufsize] multiple of TS_PACKET_SIZE
+  int bufsize;
+  int refs;
+};
+
+struct fftsstream {
+  enum AVCodecID codec_id;
+  uint16_t pid;
+  uint8_t stream_id;
+  uint8_t cc;
+  int64_t lastdts;      // source time base, older packets can't be packetized any more
+  int nal_length_size;  // avcC input if > 0
+  uint8_t * prefix;     // AnnexB parameter sets for keyframes
+  int prefix_size;
+  uint8_t asc[3];       // aot, sampling frequency index, channels for ADTS
+};
+
+struct ffts {
+  struct ffts * next;
+  const void * source;
+  const ffstream * const * iss;
+  uint nb_streams;
+
+  pthread_mutex_t mtx;
+
+  uint8_t psi[2 * TS_PACKET_SIZE]; // PAT + PMT, continuity counters are stamped on copies
+  uint8_t pat_cc, pmt_cc;
+  int64_t last_psi;
+
+  struct fftsstream st[TS_MAX_STREAMS];
+
+  int pcr_stream;
+  bool has_video;
+
+  uint8_t * es; // scratch for avcC -> AnnexB conversion
+  size_t escap;
+
+  struct fftsframe ** frames; // [capacity] ring
+  uint capacity, wpos;
+
+  uint64_t stale;
+
+  int refs;
+};
+
+
+static struct ffts * g_ts = NULL;
+static pthread_mutex_t g_ts_mtx = PTHREAD_MUTEX_INITIALIZER;
+
+static uint32_t crc_table[256];
+static pthread_once_t crc_table_once = PTHREAD_ONCE_INIT;
+
+static const int aac_sample_rates[] = {
+  96000, 88200, 64000, 48000, 44100, 32000, 24000, 22050, 16000, 12000, 11025, 8000, 7350
+};
+
+static const uint8_t h264_aud[] = { 0, 0, 0, 1, 0x09, 0xF0 };
+static const uint8_t hevc_aud[] = { 0, 0, 0, 1, 0x46, 0x01, 0x50 };
+
+
+
+static void crc_table_init(void)
+{
+  for ( uint32_t i = 0; i < 256; ++i ) {
+    uint32_t c = i << 24;
+    for ( int j = 0; j < 8; ++j ) {
+      c = (c & 0x80000000) ? (c << 1) ^ 0x04C11DB7 : (c << 1);
+    }
+    crc_table[i] = c;
+  }
+}
+
+// CRC-32/MPEG-2 of PSI sections
+static uint32_t crc32_mpeg(const uint8_t * p, size_t size)
+{
+  uint32_t crc = 0xFFFFFFFF;
+  while ( size-- ) {
+    crc = (crc << 8) ^ crc_table[((crc >> 24) ^ *p++) & 0xFF];
+  }
+  return crc;
+}
+
+static inline void wr32(uint8_t * p, uint32_t v)
+{
+  p[0] = v >> 24, p[1] = v >> 16, p[2] = v >> 8, p[3] = v;
+}
+
+
+static void unref_frame(struct fftsframe * frm)
+{
+  if ( frm && --frm->refs == 0 ) {
+    av_free(frm->buf);
+    free(frm);
+  }
+}
+
+
+/* PSI section with long header into single TS packet */
+static void put_psi_packet(uint8_t * ts, uint16_t pid, uint8_t table_id, uint16_t id, const uint8_t * data, int size)
+{
+  uint8_t * s = ts + 5;
+  int len = 5 + size + 4; // bytes after section_length field
+
+  ts[0] = 0x47;
+  ts[1] = 0x40 | (pid >> 8);
+  ts[2] = pid;
+  ts[3] = 0x10;
+  ts[4] = 0; // pointer field
+
+  s[0] = table_id;
+  s[1] = 0xB0 | (len >> 8);
+  s[2] = len;
+  s[3] = id >> 8;
+  s[4] = id;
+  s[5] = 0xC1; // version 0, current
+  s[6] = 0;
+  s[7] = 0;
+  memcpy(s + 8, data, size);
+  wr32(s + 8 + size, crc32_mpeg(s, 8 + size));
+
+  memset(s + 3 + len, 0xFF, TS_PACKET_SIZE - 5 - 3 - len);
+}
+
+
+static void put_pes_ts(uint8_t * p, int fourbits, int64_t ts)
+{
+  p[0] = (fourbits << 4) | (((ts >> 30) & 0x07) << 1) | 1;
+  p[1] = ts >> 22;
+  p[2] = ((ts >> 14) & 0xFE) | 1;
+  p[3] = ts >> 7;
+  p[4] = ((ts << 1) & 0xFE) | 1;
+}
+
+static void put_pcr(uint8_t * p, int64_t base)
+{
+  p[0] = base >> 25;
+  p[1] = base >> 17;
+  p[2] = base >> 9;
+  p[3] = base >> 1;
+  p[4] = ((base & 1) << 7) | 0x7E;
+  p[5] = 0;
+}
+
+
+static bool is_video_codec(enum AVCodecID codec_id)
+{
+  return codec_id == AV_CODEC_ID_H264 || codec_id == AV_CODEC_ID_HEVC;
+}
+
+static bool is_annexb(const uint8_t * p, int size)
+{
+  return size >= 4 && p[0] == 0 && p[1] == 0 && (p[2] == 1 || (p[2] == 0 && p[3] == 1));
+}
+
+static bool get_aac_config(const AVCodecParameters * codecpar, uint8_t asc[3])
+{
+  if ( codecpar->extradata_size >= 2 ) {
+    const uint8_t * ed = codecpar->extradata;
+    asc[0] = ed[0] >> 3;
+    asc[1] = ((ed[0] & 0x07) << 1) | (ed[1] >> 7);
+    asc[2] = (ed[1] >> 3) & 0x0F;
+    return asc[0] >= 1 && asc[0] <= 4 && asc[1] < 13 && asc[2] >= 1 && asc[2] <= 7;
+  }
+
+  for ( uint i = 0; i < sizeof(aac_sample_rates) / sizeof(aac_sample_rates[0]); ++i ) {
+    if ( aac_sample_rates[i] == codecpar->sample_rate ) {
+      asc[0] = codecpar->profile >= 0 && codecpar->profile <= 3 ? codecpar->profile + 1 : 2;
+      asc[1] = i;
+      asc[2] = codecpar->channels;
+      return asc[2] >= 1 && asc[2] <= 7;
+    }
+  }
+
+  return false;
+}
+
+
+bool ffts_supported(const ffstream * const * iss, uint nb_streams)
+{
+  uint8_t asc[3];
+
+  if ( nb_streams < 1 || nb_streams > TS_MAX_STREAMS ) {
+    return false;
+  }
+
+  for ( uint i = 0; i < nb_streams; ++i ) {
+
+    const AVCodecParameters * codecpar = iss[i]->codecpar;
+
+    switch ( codecpar->codec_id ) {
+      case AV_CODEC_ID_H264 :
+        if ( codecpar->extradata_size > 0 && !is_annexb(codecpar->extradata, codecpar->extradata_size)
+            && (codecpar->extradata_size < 7 || codecpar->extradata[0] != 1) ) {
+          return false;
+        }
+      break;
+
+      case AV_CODEC_ID_HEVC :
+        // hvcC input is left to libavformat
+        if ( codecpar->extradata_size > 0 && !is_annexb(codecpar->extradata, codecpar->extradata_size) ) {
+          return false;
+        }
+      break;
+
+      case AV_CODEC_ID_AAC :
+        if ( !get_aac_config(codecpar, asc) ) {
+          return false;
+        }
+      break;
+
+      case AV_CODEC_ID_MP2 :
+      case AV_CODEC_ID_MP3 :
+      case AV_CODEC_ID_AC3 :
+      break;
+
+      default :
+        return false;
+    }
+  }
+
+  return true;
+}
+
+
+
+/* avcC SPS / PPS as AnnexB */
+static int avcc_to_annexb_prefix(const uint8_t * ed, int size, uint8_t ** prefix, int * prefix_size)
+{
+  const uint8_t * p = ed + 5, * end = ed + size;
+  uint8_t * out;
+  int n, len, pos = 0;
+
+  // each NAL has at least 1 byte, so 2-byte length -> 4-byte start code at most doubles the size
+  if ( !(out = malloc(2 * size)) ) {
+    return AVERROR(ENOMEM);
+  }
+
+  for ( int k = 0; k < 2; ++k ) {
+
+    if ( p >= end ) {
+      goto invalid;
+    }
+
+    for ( n = k == 0 ? (*p++ & 0x1F) : *p++; n > 0; --n ) {
+
+      if ( p + 2 > end || p + 2 + (len = (p[0] << 8) | p[1]) > end || len < 1 ) {
+        goto invalid;
+      }
+
+      wr32(out + pos, 1);
+      memcpy(out + pos + 4, p + 2, len);
+      pos += 4 + len;
+      p += 2 + len;
+    }
+  }
+
+  *prefix = out;
+  *prefix_size = pos;
+  return 0;
+
+invalid:
+  free(out);
+  return AVERROR_INVALIDDATA;
+}
+
+
+static void ffts_destroy(struct ffts * ts)
+{
+  if ( ts ) {
+
+    if ( ts->stale ) {
+      PDBG("%" PRIu64 " packets were too late for shared packetizer", ts->stale);
+    }
+
+    if ( ts->frames ) {
+      for ( uint i = 0; i < ts->capacity; ++i ) {
+        unref_frame(ts->frames[i]);
+      }
+      free(ts->frames);
+    }
+
+    for ( uint i = 0; i < TS_MAX_STREAMS; ++i ) {
+      free(ts->st[i].prefix);
+    }
+
+    free(ts->es);
+    pthread_mutex_destroy(&ts->mtx);
+    free(ts);
+  }
+}
+
+
+static int ffts_create(struct ffts ** pts, const void * source, const ffstream * const * iss, uint nb_streams,
+    uint capacity)
+{
+  struct ffts * ts = NULL;
+  uint8_t pmt[4 + 5 * TS_MAX_STREAMS];
+  uint8_t pat[4];
+  uint nv = 0, na = 0;
+  int status = 0;
+
+  pthread_once(&crc_table_once, crc_table_init);
+
+  if ( !ffts_supported(iss, nb_streams) ) {
+    status = AVERROR(ENOTSUP);
+    goto end;
+  }
+
+  if ( !(ts = calloc(1, sizeof(*ts))) ) {
+    status = AVERROR(ENOMEM);
+    goto end;
+  }
+
+  pthread_mutex_init(&ts->mtx, NULL);
+
+  ts->source = source;
+  ts->iss = iss;
+  ts->nb_streams = nb_streams;
+  ts->capacity = capacity ? capacity : 512;
+  ts->last_psi = AV_NOPTS_VALUE;
+  ts->pcr_stream = 0;
+
+  if ( !(ts->frames = calloc(ts->capacity, sizeof(*ts->frames))) ) {
+    status = AVERROR(ENOMEM);
+    goto end;
+  }
+
+  for ( uint i = 0; i < nb_streams; ++i ) {
+
+    const AVCodecParameters * codecpar = iss[i]->codecpar;
+    uint8_t * s = pmt + 4 + 5 * i;
+    uint8_t stream_type = 0;
+
+    ts->st[i].codec_id = codecpar->codec_id;
+    ts->st[i].pid = TS_FIRST_ES_PID + i;
+    ts->st[i].cc = 0x0F;
+    ts->st[i].lastdts = AV_NOPTS_VALUE;
+
+    switch ( codecpar->codec_id ) {
+      case AV_CODEC_ID_H264 :
+        stream_type = STREAM_TYPE_VIDEO_H264;
+        if ( codecpar->extradata_size > 0 && codecpar->extradata[0] == 1 ) {
+          ts->st[i].nal_length_size = (codecpar->extradata[4] & 0x03) + 1;
+          status = avcc_to_annexb_prefix(codecpar->extradata, codecpar->extradata_size,
+              &ts->st[i].prefix, &ts->st[i].prefix_size);
+          if ( status ) {
+            PDBG("avcc_to_annexb_prefix() fails: %s", av_err2str(status));
+            goto end;
+          }
+        }
+      break;
+      case AV_CODEC_ID_HEVC :
+        stream_type = STREAM_TYPE_VIDEO_HEVC;
+      break;
+      case AV_CODEC_ID_AAC :
+        stream_type = STREAM_TYPE_AUDIO_AAC;
+        get_aac_config(codecpar, ts->st[i].asc);
+      break;
+      case AV_CODEC_ID_AC3 :
+        stream_type = STREAM_TYPE_AUDIO_AC3;
+      break;
+      default : // MP2, MP3
+        stream_type = STREAM_TYPE_AUDIO_MPEG1;
+      break;
+    }
+
+    if ( is_video_codec(codecpar->codec_id) ) {
+      if ( !ts->has_video ) {
+        ts->has_video = true;
+        ts->pcr_stream = i;
+      }
+      ts->st[i].stream_id = 0xE0 + nv++;
+    }
+    else if ( codecpar->codec_id == AV_CODEC_ID_AC3 ) {
+      ts->st[i].stream_id = 0xBD; // private_stream_1
+    }
+    else {
+      ts->st[i].stream_id = 0xC0 + na++;
+    }
+
+    if ( !ts->st[i].prefix && is_video_codec(codecpar->codec_id) && codecpar->extradata_size > 0 ) {
+      if ( !(ts->st[i].prefix = malloc(codecpar->extradata_size)) ) {
+        status = AVERROR(ENOMEM);
+        goto end;
+      }
+      memcpy(ts->st[i].prefix, codecpar->extradata, ts->st[i].prefix_size = codecpar->extradata_size);
+    }
+
+    s[0] = stream_type;
+    s[1] = 0xE0 | (ts->st[i].pid >> 8);
+    s[2] = ts->st[i].pid;
+    s[3] = 0xF0; // es_info_length = 0
+    s[4] = 0;
+  }
+
+  pat[0] = TS_PROGRAM_NUMBER >> 8;
+  pat[1] = TS_PROGRAM_NUMBER & 0xFF;
+  pat[2] = 0xE0 | (TS_PMT_PID >> 8);
+  pat[3] = TS_PMT_PID & 0xFF;
+
+  pmt[0] = 0xE0 | (ts->st[ts->pcr_stream].pid >> 8);
+  pmt[1] = ts->st[ts->pcr_stream].pid;
+  pmt[2] = 0xF0; // program_info_length = 0
+  pmt[3] = 0;
+
+  put_psi_packet(ts->psi, 0, 0x00, 0x0001, pat, sizeof(pat));
+  put_psi_packet(ts->psi + TS_PACKET_SIZE, TS_PMT_PID, 0x02, TS_PROGRAM_NUMBER, pmt, 4 + 5 * nb_streams);
+
+end:
+
+  if ( status ) {
+    ffts_destroy(ts);
+    ts = NULL;
+  }
+
+  *pts = ts;
+
+  return status;
+}
+
+
+
+int ffts_attach(struct ffts ** pts, const void * source, const ffstream * const * iss, uint nb_streams,
+    uint capacity)
+{
+  struct ffts * ts;
+  int status = 0;
+
+  pthread_mutex_lock(&g_ts_mtx);
+
+  for ( ts = g_ts; ts; ts = ts->next ) {
+    if ( ts->source == source && ts->iss == iss ) {
+      break;
+    }
+  }
+
+  if ( ts ) {
+    ++ts->refs;
+  }
+  else if ( (status = ffts_create(&ts, source, iss, nb_streams, capacity)) == 0 ) {
+    ts->refs = 1;
+    ts->next = g_ts;
+    g_ts = ts;
+  }
+
+  pthread_mutex_unlock(&g_ts_mtx);
+
+  *pts = ts;
+
+  return status;
+}
+
+
+void ffts_detach(struct ffts ** pts)
+{
+  struct ffts * ts, ** pp;
+
+  if ( pts && (ts = *pts) ) {
+
+    pthread_mutex_lock(&g_ts_mtx);
+
+    if ( --ts->refs == 0 ) {
+      for ( pp = &g_ts; *pp; pp = &(*pp)->next ) {
+        if ( *pp == ts ) {
+          *pp = ts->next;
+          break;
+        }
+      }
+      ffts_destroy(ts);
+    }
+
+    pthread_mutex_unlock(&g_ts_mtx);
+
+    *pts = NULL;
+  }
+}
+
+
+void ffts_get_header(struct ffts * ts, uint8_t hdr[FFTS_HEADER_SIZE])
+{
+  pthread_mutex_lock(&ts->mtx);
+  memcpy(hdr, ts->psi, sizeof(ts->psi));
+  hdr[3] = (hdr[3] & 0xF0) | ts->pat_cc;
+  hdr[TS_PACKET_SIZE + 3] = (hdr[TS_PACKET_SIZE + 3] & 0xF0) | ts->pmt_cc;
+  pthread_mutex_unlock(&ts->mtx);
+}
+
+
+
+static bool es_reserve(struct ffts * ts, size_t size)
+{
+  if ( size > ts->escap ) {
+
+    size_t cap = FFMAX(size, 2 * ts->escap);
+    uint8_t * p;
+
+    if ( !(p = realloc(ts->es, cap)) ) {
+      return false;
+    }
+
+    ts->es = p;
+    ts->escap = cap;
+  }
+  return true;
+}
+
+/* Length-prefixed NALs to AnnexB, AUD are dropped (packetizer inserts its own) */
+static int avcc_to_annexb(struct ffts * ts, const uint8_t * p, int size, int nal_length_size, int * outsize)
+{
+  const uint8_t * end = p + size;
+  size_t pos = 0;
+  uint32_t len;
+
+  while ( p + nal_length_size <= end ) {
+
+    for ( int i = len = 0; i < nal_length_size; ++i ) {
+      len = (len << 8) | p[i];
+    }
+
+    if ( (p += nal_length_size) + len > end ) {
+      return AVERROR_INVALIDDATA;
+    }
+
+    if ( len > 0 && (p[0] & 0x1F) != 9 ) {
+      if ( !es_reserve(ts, pos + 4 + len) ) {
+        return AVERROR(ENOMEM);
+      }
+      wr32(ts->es + pos, 1);
+      memcpy(ts->es + pos + 4, p, len);
+      pos += 4 + len;
+    }
+
+    p += len;
+  }
+
+  *outsize = pos;
+  return 0;
+}
+
+/* First NAL type and presence of parameter sets before the first slice */
+static void scan_annexb(const uint8_t * p, int size, bool hevc, int * first_type, bool * has_ps)
+{
+  *first_type = -1;
+  *has_ps = false;
+
+  for ( int i = 0, t; i + 3 < size; ++i ) {
+    if ( p[i] == 0 && p[i + 1] == 0 && p[i + 2] == 1 ) {
+
+      t = hevc ? (p[i + 3] >> 1) & 0x3F : p[i + 3] & 0x1F;
+
+      if ( *first_type < 0 ) {
+        *first_type = t;
+      }
+
+      if ( hevc ? (t >= 32 && t <= 34) : (t == 7) ) {
+        *has_ps = true;
+        break;
+      }
+
+      if ( hevc ? t < 32 : (t >= 1 && t <= 5) ) {
+        break;
+      }
+
+      i += 2;
+    }
+  }
+}
+
+
+struct tsseg {
+  const uint8_t * p;
+  int size;
+};
+
+static void gather(uint8_t * dst, int n, struct tsseg * seg, int * k, int * off)
+{
+  while ( n > 0 ) {
+    int m = FFMIN(n, seg[*k].size - *off);
+    memcpy(dst, seg[*k].p + *off, m);
+    dst += m, n -= m;
+    if ( (*off += m) == seg[*k].size ) {
+      ++*k, *off = 0;
+    }
+  }
+}
+
+
+// must be called with ts->mtx locked
+static int ffts_packetize(struct ffts * ts, const AVPacket * pkt, struct fftsframe ** pfrm)
+{
+  struct fftsframe * frm = NULL;
+  const AVRational tb90 = (AVRational ) { 1, 90000 };
+  const int stidx = pkt->stream_index;
+
+  const ffstream * is;
+  struct fftsstream * st;
+
+  struct tsseg seg[4];
+  int nseg = 0, k = 0, off = 0;
+
+  uint8_t pesh[TS_PES_HEADER_SIZE];
+  uint8_t adts[7];
+
+  int64_t pts = AV_NOPTS_VALUE, dts = AV_NOPTS_VALUE, pcr = AV_NOPTS_VALUE;
+  bool key = pkt->flags & AV_PKT_FLAG_KEY;
+  bool psi = false;
+
+  int hdrsize, essize, total, written, cap;
+  uint8_t * out;
+
+  int status = 0;
+
+  *pfrm = NULL;
+
+  if ( stidx < 0 || stidx >= (int) ts->nb_streams ) {
+    return AVERROR(EINVAL);
+  }
+
+  is = ts->iss[stidx];
+  st = &ts->st[stidx];
+
+  if ( pkt->dts != AV_NOPTS_VALUE && st->lastdts != AV_NOPTS_VALUE && pkt->dts <= st->lastdts ) {
+    ++ts->stale; // client lags behind the cache, continuity counters can't go back
+    return AVERROR(EAGAIN);
+  }
+
+  if ( pkt->dts != AV_NOPTS_VALUE ) {
+    dts = av_rescale_q(pkt->dts, is->time_base, tb90);
+  }
+  if ( pkt->pts != AV_NOPTS_VALUE ) {
+    pts = av_rescale_q(pkt->pts, is->time_base, tb90);
+  }
+  if ( pts == AV_NOPTS_VALUE ) {
+    pts = dts;
+  }
+  if ( dts == AV_NOPTS_VALUE ) {
+    dts = pts;
+  }
+
+  if ( stidx == ts->pcr_stream && dts != AV_NOPTS_VALUE ) {
+    pcr = dts & 0x1FFFFFFFFLL;
+  }
+
+  /* Elementary stream data: [AUD][parameter sets | ADTS header][payload] */
+  seg[nseg++] = (struct tsseg ) { pesh, 0 };
+
+  if ( is_video_codec(st->codec_id) ) {
+
+    const bool hevc = st->codec_id == AV_CODEC_ID_HEVC;
+    bool has_ps = false;
+    int first_type = -1;
+
+    if ( st->nal_length_size > 0 ) {
+      if ( (status = avcc_to_annexb(ts, pkt->data, pkt->size, st->nal_length_size, &essize)) ) {
+        PDBG("avcc_to_annexb() fails: %s", av_err2str(status));
+        return status;
+      }
+    }
+    else {
+      scan_annexb(pkt->data, pkt->size, hevc, &first_type, &has_ps);
+    }
+
+    if ( first_type != (hevc ? 35 : 9) ) {
+      seg[nseg++] = hevc ? (struct tsseg ) { hevc_aud, sizeof(hevc_aud) } : (struct tsseg ) { h264_aud, sizeof(h264_aud) };
+    }
+
+    if ( key && !has_ps && st->prefix ) {
+      seg[nseg++] = (struct tsseg ) { st->prefix, st->prefix_size };
+    }
+
+    if ( st->nal_length_size > 0 ) {
+      seg[nseg++] = (struct tsseg ) { ts->es, essize };
+    }
+    else {
+      seg[nseg++] = (struct tsseg ) { pkt->data, pkt->size };
+    }
+  }
+  else {
+
+    if ( st->codec_id == AV_CODEC_ID_AAC && !(pkt->size >= 2 && pkt->data[0] == 0xFF && (pkt->data[1] & 0xF0) == 0xF0) ) {
+
+      const int size = 7 + pkt->size;
+      const uint8_t * asc = st->asc;
+
+      adts[0] = 0xFF;
+      adts[1] = 0xF1; // MPEG-4, no CRC
+      adts[2] = ((asc[0] - 1) << 6) | (asc[1] << 2) | (asc[2] >> 2);
+      adts[3] = ((asc[2] & 0x03) << 6) | ((size >> 11) & 0x03);
+      adts[4] = size >> 3;
+      adts[5] = ((size & 0x07) << 5) | 0x1F;
+      adts[6] = 0xFC;
+
+      seg[nseg++] = (struct tsseg ) { adts, sizeof(adts) };
+    }
+
+    seg[nseg++] = (struct tsseg ) { pkt->data, pkt->size };
+  }
+
+  for ( int i = essize = 0; i < nseg; ++i ) {
+    essize += seg[i].size;
+  }
+
+  /* PES header, timestamps are shifted ahead of PCR */
+  pesh[0] = 0, pesh[1] = 0, pesh[2] = 1;
+  pesh[3] = st->stream_id;
+  pesh[6] = 0x80;
+
+  if ( pts == AV_NOPTS_VALUE ) {
+    pesh[7] = 0x00;
+    pesh[8] = 0;
+  }
+  else if ( pts == dts ) {
+    pesh[7] = 0x80;
+    pesh[8] = 5;
+    put_pes_ts(pesh + 9, 0x02, (pts + TS_DELAY) & 0x1FFFFFFFFLL);
+  }
+  else {
+    pesh[7] = 0xC0;
+    pesh[8] = 10;
+    put_pes_ts(pesh + 9, 0x03, (pts + TS_DELAY) & 0x1FFFFFFFFLL);
+    put_pes_ts(pesh + 14, 0x01, (dts + TS_DELAY) & 0x1FFFFFFFFLL);
+  }
+
+  hdrsize = 9 + pesh[8];
+  total = hdrsize + essize;
+
+  if ( is_video_codec(st->codec_id) || total - 6 > 0xFFFF ) {
+    pesh[4] = pesh[5] = 0; // unbounded
+  }
+  else {
+    pesh[4] = (total - 6) >> 8;
+    pesh[5] = (total - 6);
+  }
+
+  seg[0].size = hdrsize;
+
+  /* PAT / PMT go before video keyframes so that every gop is decodable on its own */
+  if ( ts->has_video ) {
+    psi = key && stidx == ts->pcr_stream;
+  }
+  else if ( dts != AV_NOPTS_VALUE ) {
+    if ( (psi = ts->last_psi == AV_NOPTS_VALUE || dts - ts->last_psi >= TS_PSI_INTERVAL || dts < ts->last_psi) ) {
+      ts->last_psi = dts;
+    }
+  }
+
+  /* All TS packets of this PES go into single buffer */
+  cap = ((total + 8 + TS_PAYLOAD_SIZE - 1) / TS_PAYLOAD_SIZE + 2) * TS_PACKET_SIZE;
+
+  if ( !(frm = calloc(1, sizeof(*frm))) || !(frm->buf = av_malloc(cap)) ) {
+    free(frm);
+    return AVERROR(ENOMEM);
+  }
+
+  frm->data = pkt->data;
+  frm->size = pkt->size;
+  frm->pts = pkt->pts;
+  frm->dts = pkt->dts;
+  frm->stream_index = stidx;
+  frm->refs = 1;
+
+  out = frm->buf;
+
+  if ( psi ) {
+    memcpy(out, ts->psi, sizeof(ts->psi));
+    out[3] = (out[3] & 0xF0) | (ts->pat_cc = (ts->pat_cc + 1) & 0x0F);
+    out[TS_PACKET_SIZE + 3] = (out[TS_PACKET_SIZE + 3] & 0xF0) | (ts->pmt_cc = (ts->pmt_cc + 1) & 0x0F);
+    out += sizeof(ts->psi);
+  }
+
+  for ( written = 0; written < total; out += TS_PACKET_SIZE ) {
+
+    const bool first = written == 0;
+    const bool with_pcr = first && pcr != AV_NOPTS_VALUE;
+    const int aflen = first && (with_pcr || key) ? 2 + (with_pcr ? 6 : 0) : 0;
+    const int payload = FFMIN(total - written, TS_PAYLOAD_SIZE - aflen);
+    int hlen = 4;
+
+    st->cc = (st->cc + 1) & 0x0F;
+
+    out[0] = 0x47;
+    out[1] = (first ? 0x40 : 0x00) | (st->pid >> 8);
+    out[2] = st->pid;
+
+    if ( aflen || payload < TS_PAYLOAD_SIZE ) {
+
+      // adaptation field carries PCR / random access flag and stuffing of the last packet
+      const int L = TS_PAYLOAD_SIZE - payload;
+      uint8_t * p = out + 6;
+
+      out[3] = 0x30 | st->cc;
+      out[4] = L - 1;
+
+      if ( L > 1 ) {
+        out[5] = (first && key ? 0x40 : 0) | (with_pcr ? 0x10 : 0);
+        if ( with_pcr ) {
+          put_pcr(p, pcr);
+          p += 6;
+        }
+        memset(p, 0xFF, out + 4 + L - p);
+      }
+
+      hlen += L;
+    }
+    else {
+      out[3] = 0x10 | st->cc;
+    }
+
+    gather(out + hlen, payload, seg, &k, &off);
+    written += payload;
+  }
+
+  frm->bufsize = out - frm->buf;
+
+  if ( pkt->dts != AV_NOPTS_VALUE ) {
+    st->lastdts = pkt->dts;
+  }
+
+  unref_frame(ts->frames[ts->wpos]);
+  ts->frames[ts->wpos] = frm;
+  ts->wpos = (ts->wpos + 1) % ts->capacity;
+
+  *pfrm = frm;
+
+  return 0;
+}
+
+
+int ffts_send(struct ffts * ts, const AVPacket * pkt,
+    int (*sendpkt)(void * opaque, uint8_t * buf, int buf_size), void * opaque)
+{
+  struct fftsframe * frm = NULL, * f;
+  int status = 0;
+
+  pthread_mutex_lock(&ts->mtx);
+
+  // clients are normally close to the head, so search from newest
+  for ( uint i = 1; i <= ts->capacity; ++i ) {
+    if ( !(f = ts->frames[(ts->wpos + ts->capacity - i) % ts->capacity]) ) {
+      break;
+    }
+    if ( f->data == pkt->data && f->size == pkt->size && f->pts == pkt->pts && f->dts == pkt->dts
+        && f->stream_index == pkt->stream_index ) {
+      frm = f;
+      break;
+    }
+  }
+
+  if ( !frm ) {
+    status = ffts_packetize(ts, pkt, &frm);
+  }
+
+  if ( frm ) {
+    ++frm->refs;
+  }
+
+  pthread_mutex_unlock(&ts->mtx);
+
+  if ( frm ) {
+
+    // sendpkt() may block this coroutine, so the frame is pinned by reference rather than by lock
+    status = sendpkt(opaque, frm->buf, frm->bufsize);
+
+    pthread_mutex_lock(&ts->mtx);
+    unref_frame(frm);
+    pthread_mutex_unlock(&ts->mtx);
+  }
+
+  return status;
+}
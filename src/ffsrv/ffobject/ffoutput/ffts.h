@@ -0,0 +1,63 @@
+/*
+ * ffts.h
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: amyznikov
+ *
+ *  Native MPEG-TS packetizer for gop packets (fmt=mpegts fast path).
+ *  PAT / PMT are precomputed once per source, each source packet is packetized once
+ *  into single contiguous buffer of TS packets which is cached and shared by all clients.
+ *
+ *  hls segments are not served from here: each segments object muxes its source once
+ *  with libavformat mpegts muxer, so there is nothing to share across viewers.
+ *  tools/tsbench (make bench) measures per-packet cost of both packetizers.
+ */
+
+// #pragma once
+
+#ifndef __ffts_h__
+#define __ffts_h__
+
+#include "ffmpeg.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+struct ffts;
+
+
+/* Check if streams can be served by native packetizer:
+ *  H.264, HEVC (AnnexB), AAC, MP2 / MP3 and AC3, up to 8 streams
+ */
+bool ffts_supported(const ffstream * const * iss, uint nb_streams);
+
+/* Get (create on first use) shared packetizer for streams of source.
+ *  capacity : number of source packets kept packetized, normally the gop size
+ */
+int ffts_attach(struct ffts ** ts, const void * source, const ffstream * const * iss, uint nb_streams,
+    uint capacity);
+
+void ffts_detach(struct ffts ** ts);
+
+#define FFTS_HEADER_SIZE  (2 * 188)
+
+/* PAT + PMT stamped with current continuity counters, ready to send.
+ *  The first cached PSI a joining client gets then continues them or repeats them as duplicate packets */
+void ffts_get_header(struct ffts * ts, uint8_t hdr[FFTS_HEADER_SIZE]);
+
+/* Packetize pkt (or reuse cached TS packets) and send them as single sendpkt() call.
+ *  pkt timestamps are in the source stream time base.
+ *  Returns AVERROR(EAGAIN) if pkt is already evicted from the cache: nothing is sent,
+ *  the client must resync at the next key frame.
+ */
+int ffts_send(struct ffts * ts, const AVPacket * pkt,
+    int (*sendpkt)(void * opaque, uint8_t * buf, int buf_size), void * opaque);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __ffts_h__ */
@@ -0,0 +1,534 @@
+/*
+ * ffarchive.c
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: amyznikov
+ */
+
+#define _GNU_SOURCE
+
+#include "ffarchive.h"
+#include "ffsegwriter.h"
+#include "pathfuncs.h"
+#include "debug.h"
+#include <time.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <fnmatch.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+
+#define ARCHIVE_MAX_PENDING   16
+#define ARCHIVE_HOUR_MS       (3600 * 1000LL)
+
+
+// segment archived but not indexed yet: its duration comes with the next playlist update
+struct archive_pending {
+  char * name;
+  int64_t tend;
+  int64_t fileid;
+  uint32_t size;
+};
+
+struct ffarchive {
+  struct ffsegfilter filter; // must be first
+  char * path;
+  char * indexpath;
+  struct archive_pending pending[ARCHIVE_MAX_PENDING]; // ring
+  uint nb_pending;
+  int64_t maxage; // [ms], 0 disables trimming
+  int64_t trimhour; // hour bucket of last trim
+};
+
+// trim job for the writer thread
+struct archive_trim {
+  char * path;
+  int64_t before; // [ms] wall clock
+};
+
+
+
+static int64_t walltime_us(void)
+{
+  struct timespec tm;
+  clock_gettime(CLOCK_REALTIME, &tm);
+  return ((int64_t) tm.tv_sec * 1000000 + (int64_t) tm.tv_nsec / 1000 );
+}
+
+// YYYYMMDD/HH/<fileid>.ts
+static void genfilename(char name[64], int64_t fileid)
+{
+  struct tm tm;
+  time_t t = fileid / 1000;
+  size_t n;
+
+  gmtime_r(&t, &tm);
+  n = strftime(name, 64, "%Y%m%d/%H/", &tm);
+  snprintf(name + n, 64 - n, "%" PRId64 ".ts", fileid);
+}
+
+// first record which ends after t
+static size_t find_record(const struct ffarchive_record * recs, size_t n, int64_t t)
+{
+  size_t lo = 0, hi = n;
+
+  while ( lo < hi ) {
+    size_t mid = lo + (hi - lo) / 2;
+    if ( recs[mid].start + recs[mid].duration * 1000LL <= t ) {
+      lo = mid + 1;
+    }
+    else {
+      hi = mid;
+    }
+  }
+
+  return lo;
+}
+
+static const char * basename_of(const char * path, size_t len)
+{
+  const char * name = path;
+  for ( const char * p = path; p < path + len; ++p ) {
+    if ( *p == '/' ) {
+      name = p + 1;
+    }
+  }
+  return name;
+}
+
+
+// writer thread: drop records which end before the cutoff, the index is replaced atomically
+static void trim_index(const char * path, int64_t before)
+{
+  const struct ffarchive_record * recs = MAP_FAILED;
+  char * indexpath = NULL, * tmp = NULL;
+  struct stat st;
+  FILE * fp = NULL;
+  size_t n = 0, first;
+  int fd = -1;
+
+  if ( asprintf(&indexpath, "%s/%s", path, FFARCHIVE_INDEX_NAME) < 0 || asprintf(&tmp, "%s.tmp", indexpath) < 0 ) {
+    goto end;
+  }
+
+  if ( (fd = open(indexpath, O_RDONLY | O_CLOEXEC)) < 0 || fstat(fd, &st) != 0 ) {
+    goto end;
+  }
+
+  if ( (n = st.st_size / sizeof(*recs)) < 1 ) {
+    goto end;
+  }
+
+  if ( (recs = mmap(NULL, n * sizeof(*recs), PROT_READ, MAP_SHARED, fd, 0)) == MAP_FAILED ) {
+    PDBG("mmap('%s') fails: %s", indexpath, strerror(errno));
+    goto end;
+  }
+
+  if ( (first = find_record(recs, n, before * 1000)) == 0 ) {
+    goto end;
+  }
+
+  if ( !(fp = fopen(tmp, "w")) ) {
+    PDBG("fopen('%s') fails: %s", tmp, strerror(errno));
+    goto end;
+  }
+
+  if ( fwrite(recs + first, sizeof(*recs), n - first, fp) != n - first || fclose(fp) != 0 ) {
+    PDBG("write('%s') fails: %s", tmp, strerror(errno));
+    fp = NULL;
+    unlink(tmp);
+    goto end;
+  }
+
+  fp = NULL;
+
+  if ( rename(tmp, indexpath) != 0 ) {
+    PDBG("rename('%s') fails: %s", tmp, strerror(errno));
+    unlink(tmp);
+  }
+
+end:
+
+  if ( fp ) {
+    fclose(fp);
+    unlink(tmp);
+  }
+
+  if ( recs != MAP_FAILED ) {
+    munmap((void *) recs, n * sizeof(*recs));
+  }
+
+  if ( fd != -1 ) {
+    close(fd);
+  }
+
+  free(tmp);
+  free(indexpath);
+}
+
+
+static int day_filter(const struct dirent * e)
+{
+  return fnmatch("[0-9][0-9][0-9][0-9][0-9][0-9][0-9][0-9]", e->d_name, 0) == 0;
+}
+
+static int hour_filter(const struct dirent * e)
+{
+  return fnmatch("[0-9][0-9]", e->d_name, 0) == 0;
+}
+
+// writer thread: remove YYYYMMDD/HH directories which end before the cutoff
+static void trim_dirs(const char * path, int64_t before)
+{
+  struct dirent ** days = NULL, ** hours = NULL;
+  char dirname[PATH_MAX];
+  struct tm tm;
+  int nd, nh;
+
+  if ( (nd = scandir(path, &days, day_filter, NULL)) < 0 ) {
+    return;
+  }
+
+  for ( int i = 0; i < nd; ++i ) {
+
+    snprintf(dirname, sizeof(dirname), "%s/%s", path, days[i]->d_name);
+
+    memset(&tm, 0, sizeof(tm));
+
+    if ( strptime(days[i]->d_name, "%Y%m%d", &tm) && (nh = scandir(dirname, &hours, hour_filter, NULL)) >= 0 ) {
+
+      for ( int j = 0; j < nh; ++j ) {
+
+        tm.tm_hour = atoi(hours[j]->d_name);
+
+        if ( timegm(&tm) * 1000LL + ARCHIVE_HOUR_MS <= before ) {
+          snprintf(dirname, sizeof(dirname), "%s/%s/%s", path, days[i]->d_name, hours[j]->d_name);
+          unlink_files(dirname, "*");
+          rmdir(dirname);
+        }
+
+        free(hours[j]);
+      }
+
+      free(hours), hours = NULL;
+    }
+
+    // fails while the day still has hours
+    snprintf(dirname, sizeof(dirname), "%s/%s", path, days[i]->d_name);
+    rmdir(dirname);
+
+    free(days[i]);
+  }
+
+  free(days);
+}
+
+static void trim_files(void * arg)
+{
+  struct archive_trim * trim = arg;
+
+  // index first, so playlists never reference removed files
+  trim_index(trim->path, trim->before);
+  trim_dirs(trim->path, trim->before);
+
+  free(trim->path);
+  free(trim);
+}
+
+static void trim_archive(struct ffarchive * archive, int64_t now)
+{
+  struct archive_trim * trim;
+
+  if ( !(trim = calloc(1, sizeof(*trim))) || !(trim->path = strdup(archive->path)) ) {
+    free(trim);
+    return;
+  }
+
+  trim->before = now - archive->maxage;
+
+  if ( ffsegwriter_call(trim_files, trim) ) {
+    free(trim->path);
+    free(trim);
+  }
+}
+
+
+static int archive_segment(struct ffarchive * archive, const char * path, const uint8_t * data, size_t size)
+{
+  struct archive_pending * pnd;
+  char name[64];
+  char * archpath = NULL;
+  int status;
+
+  pnd = &archive->pending[archive->nb_pending++ % ARCHIVE_MAX_PENDING];
+  free(pnd->name);
+
+  pnd->tend = walltime_us();
+  pnd->fileid = pnd->tend / 1000;
+  pnd->size = size;
+
+  if ( !(pnd->name = strdup(basename_of(path, strlen(path)))) ) {
+    return AVERROR(ENOMEM);
+  }
+
+  genfilename(name, pnd->fileid);
+
+  if ( asprintf(&archpath, "%s/%s", archive->path, name) < 0 ) {
+    return AVERROR(ENOMEM);
+  }
+
+  if ( (status = ffsegwriter_put(archpath, data, size)) ) {
+    PDBG("ffsegwriter_put('%s') fails: %s", archpath, av_err2str(status));
+    free(pnd->name), pnd->name = NULL;
+  }
+
+  free(archpath);
+
+  if ( archive->maxage > 0 && pnd->fileid / ARCHIVE_HOUR_MS != archive->trimhour ) {
+    archive->trimhour = pnd->fileid / ARCHIVE_HOUR_MS;
+    trim_archive(archive, pnd->fileid);
+  }
+
+  return status;
+}
+
+
+// index archived segments which got EXTINF in muxer playlist
+static void index_segments(struct ffarchive * archive, const uint8_t * data, size_t size)
+{
+  const char * line, * eol, * end;
+  double duration = -1;
+  char value[32];
+  size_t len;
+
+  for ( line = (const char *) data, end = line + size; line < end; line = eol ) {
+
+    if ( !(eol = memchr(line, '\n', end - line)) ) {
+      eol = end;
+    }
+    else {
+      ++eol;
+    }
+
+    for ( len = 0; line + len < eol && line[len] != '\r' && line[len] != '\n'; ++len ) {
+    }
+
+    if ( len > 8 && memcmp(line, "#EXTINF:", 8) == 0 ) {
+      snprintf(value, sizeof(value), "%.*s", (int) (len - 8), line + 8);
+      duration = strtod(value, NULL);
+    }
+    else if ( len > 0 && *line != '#' ) {
+
+      const char * name = basename_of(line, len);
+      const size_t namelen = line + len - name;
+
+      for ( uint i = 0; duration >= 0 && i < ARCHIVE_MAX_PENDING; ++i ) {
+
+        struct archive_pending * pnd = &archive->pending[i];
+
+        if ( pnd->name && strlen(pnd->name) == namelen && memcmp(pnd->name, name, namelen) == 0 ) {
+
+          const struct ffarchive_record rec = {
+            .start = pnd->tend - (int64_t) (duration * 1000000),
+            .fileid = pnd->fileid,
+            .duration = (uint32_t) (duration * 1000),
+            .size = pnd->size,
+            .flags = FFARCHIVE_KEYFRAME, // muxer cuts segments on key frames
+          };
+
+          ffsegwriter_append(archive->indexpath, &rec, sizeof(rec));
+
+          free(pnd->name), pnd->name = NULL;
+          break;
+        }
+      }
+
+      duration = -1;
+    }
+  }
+}
+
+
+static int apply(struct ffsegfilter * filter, const char * path, uint8_t ** data, size_t * size)
+{
+  struct ffarchive * archive = (struct ffarchive *) filter;
+  const char * ext = strrchr(path, '.');
+
+  if ( ext && strcmp(ext, ".m3u8") == 0 ) {
+    index_segments(archive, *data, *size);
+  }
+  else if ( ext && strcmp(ext, ".ts") == 0 ) {
+    archive_segment(archive, path, *data, *size);
+  }
+
+  return 0; // archive failures never affect live output
+}
+
+
+int ffarchive_create(struct ffarchive ** parchive, const char * path, int maxage)
+{
+  struct ffarchive * archive;
+  int status = 0;
+
+  if ( !(archive = calloc(1, sizeof(*archive))) ) {
+    status = AVERROR(ENOMEM);
+    goto end;
+  }
+
+  archive->filter.apply = apply;
+  archive->maxage = maxage * ARCHIVE_HOUR_MS;
+
+  if ( !(archive->path = strdup(path)) ) {
+    status = AVERROR(ENOMEM);
+    goto end;
+  }
+
+  if ( asprintf(&archive->indexpath, "%s/%s", path, FFARCHIVE_INDEX_NAME) < 0 ) {
+    archive->indexpath = NULL;
+    status = AVERROR(ENOMEM);
+    goto end;
+  }
+
+end:
+
+  if ( status ) {
+    ffarchive_destroy(&archive);
+  }
+
+  *parchive = archive;
+
+  return status;
+}
+
+
+void ffarchive_destroy(struct ffarchive ** archive)
+{
+  if ( archive && *archive ) {
+    for ( uint i = 0; i < ARCHIVE_MAX_PENDING; ++i ) {
+      free((*archive)->pending[i].name);
+    }
+    free((*archive)->indexpath);
+    free((*archive)->path);
+    free(*archive);
+    *archive = NULL;
+  }
+}
+
+
+struct ffsegfilter * ffarchive_get_filter(struct ffarchive * archive)
+{
+  return &archive->filter;
+}
+
+
+
+int ffarchive_get_playlist(const char * path, const char * urlpath, int64_t from, int64_t to,
+    char ** text, size_t * size)
+{
+  const struct ffarchive_record * recs = MAP_FAILED;
+  char * indexpath = NULL;
+  struct stat st;
+  FILE * fp = NULL;
+  size_t n = 0, first, i;
+  uint32_t maxduration = 0;
+  int64_t prevend = AV_NOPTS_VALUE;
+  char name[64];
+  int fd = -1;
+  int status = 0;
+
+  *text = NULL;
+  *size = 0;
+
+  if ( asprintf(&indexpath, "%s/%s", path, FFARCHIVE_INDEX_NAME) < 0 ) {
+    indexpath = NULL;
+    status = AVERROR(ENOMEM);
+    goto end;
+  }
+
+  if ( (fd = open(indexpath, O_RDONLY | O_CLOEXEC)) < 0 || fstat(fd, &st) != 0 ) {
+    status = AVERROR(errno);
+    goto end;
+  }
+
+  // the writer thread may be appending, only whole records are used
+  if ( (n = st.st_size / sizeof(*recs)) < 1 ) {
+    status = AVERROR(ENOENT);
+    goto end;
+  }
+
+  if ( (recs = mmap(NULL, n * sizeof(*recs), PROT_READ, MAP_SHARED, fd, 0)) == MAP_FAILED ) {
+    status = AVERROR(errno);
+    goto end;
+  }
+
+  for ( i = first = find_record(recs, n, from); i < n && recs[i].start < to; ++i ) {
+    maxduration = FFMAX(maxduration, recs[i].duration);
+  }
+
+  if ( i == first ) {
+    status = AVERROR(ENOENT);
+    goto end;
+  }
+
+  if ( !(fp = open_memstream(text, size)) ) {
+    status = AVERROR(errno);
+    goto end;
+  }
+
+  fprintf(fp, "#EXTM3U\n"
+      "#EXT-X-VERSION:3\n"
+      "#EXT-X-TARGETDURATION:%u\n"
+      "#EXT-X-MEDIA-SEQUENCE:0\n"
+      "#EXT-X-PLAYLIST-TYPE:VOD\n",
+      (maxduration + 999) / 1000);
+
+  for ( i = first; i < n && recs[i].start < to; ++i ) {
+
+    // gaps are stream restarts or lost segments
+    if ( prevend != AV_NOPTS_VALUE && llabs(recs[i].start - prevend) > 1000000 ) {
+      fprintf(fp, "#EXT-X-DISCONTINUITY\n");
+    }
+
+    if ( i == first || prevend == AV_NOPTS_VALUE || llabs(recs[i].start - prevend) > 1000000 ) {
+      struct tm tm;
+      time_t t = recs[i].start / 1000000;
+      char date[32];
+      gmtime_r(&t, &tm);
+      strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%S", &tm);
+      fprintf(fp, "#EXT-X-PROGRAM-DATE-TIME:%s.%.3dZ\n", date, (int) ((recs[i].start / 1000) % 1000));
+    }
+
+    genfilename(name, recs[i].fileid);
+    fprintf(fp, "#EXTINF:%.3f,\n%s/%s\n", recs[i].duration / 1000.0, urlpath, name);
+
+    prevend = recs[i].start + recs[i].duration * 1000LL;
+  }
+
+  fprintf(fp, "#EXT-X-ENDLIST\n");
+
+end:
+
+  if ( fp ) {
+    fclose(fp);
+  }
+
+  if ( recs != MAP_FAILED ) {
+    munmap((void *) recs, n * sizeof(*recs));
+  }
+
+  if ( fd != -1 ) {
+    close(fd);
+  }
+
+  free(indexpath);
+
+  if ( status ) {
+    free(*text);
+    *text = NULL;
+    *size = 0;
+  }
+
+  return status;
+}
@@ -0,0 +1,56 @@
+/*
+ * ffarchive.h
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: amyznikov
+ *
+ *  Live-to-VOD archive of hls segments as ffsegfilter: each mpegts segment is copied
+ *  through ffsegwriter into hourly directories archive/YYYYMMDD/HH/<fileid>.ts and indexed
+ *  when the muxer playlist reports its duration. The index is append-only file of fixed
+ *  size records sorted by time, readers mmap() it and binary search the requested window.
+ *  Once per hour bucket, records and hour directories older than maxage are removed on the
+ *  writer thread; the trimmed index replaces the old one via rename(), so readers keep their map.
+ */
+
+// #pragma once
+
+#ifndef __ffarchive_h__
+#define __ffarchive_h__
+
+#include "ffsegfilter.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define FFARCHIVE_INDEX_NAME      "index.bin"
+#define FFARCHIVE_KEYFRAME        0x1   // segment starts with key frame
+
+struct ffarchive_record {
+  int64_t start;      // [us] wall clock time of the first frame
+  int64_t fileid;     // [ms] wall clock time the segment was closed, names YYYYMMDD/HH/<fileid>.ts
+  uint32_t duration;  // [ms]
+  uint32_t size;      // segment file size
+  uint32_t flags;     // FFARCHIVE_*
+  uint32_t reserved;
+};
+
+struct ffarchive;
+
+/* maxage [h], 0 keeps archived segments forever */
+int ffarchive_create(struct ffarchive ** archive, const char * path, int maxage);
+void ffarchive_destroy(struct ffarchive ** archive);
+
+struct ffsegfilter * ffarchive_get_filter(struct ffarchive * archive);
+
+/* VOD playlist for [from, to) wall clock window [us] from archive index in path.
+ *  Segment URIs are urlpath/YYYYMMDD/HH/<fileid>.ts. Returns malloc()-ed text, AVERROR(ENOENT) if window is empty */
+int ffarchive_get_playlist(const char * path, const char * urlpath, int64_t from, int64_t to,
+    char ** text, size_t * size);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __ffarchive_h__ */
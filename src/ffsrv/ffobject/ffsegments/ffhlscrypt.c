@@ -0,0 +1,493 @@
+/*
+ * ffhlscrypt.c
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: amyznikov
+ */
+
+#define _GNU_SOURCE
+
+#include "ffhlscrypt.h"
+#include "ffsegwriter.h"
+#include "debug.h"
+#include <openssl/evp.h>
+#include <openssl/rand.h>
+
+
+#define HLSCRYPT_MAX_PLAYLISTS  16
+
+#define AES128_KEY_SIZE   16
+#define AES128_BLOCK_SIZE 16
+
+
+// encrypted segment, kept until muxer deletes it or drops it from its playlist
+struct hlscrypt_segment {
+  char * name;
+  uint keyidx;
+  uint8_t iv[AES128_BLOCK_SIZE];
+  int playlist; // index in playlists[] of playlist listing the segment, -1 until listed
+  uint listed;  // playlist rewrite which listed the segment last
+};
+
+struct hlscrypt_playlist {
+  char * path;
+  uint rewrites;
+};
+
+struct ffhlscrypt {
+  struct ffsegfilter filter; // must be first
+
+  struct ffsegstore * store;
+  char * keypath;
+  char * keyurl;
+  int rotate;
+
+  EVP_CIPHER_CTX * ctx;
+  uint8_t key[AES128_KEY_SIZE];
+  uint keyidx, oldestkey;
+  int keysegs; // segments encrypted with current key, -1 before the first key
+
+  struct hlscrypt_segment * segments; // oldest first
+  uint nb_segments, capacity;
+
+  struct hlscrypt_playlist playlists[HLSCRYPT_MAX_PLAYLISTS];
+  uint nb_playlists;
+
+  // encryption throughput stats
+  int64_t bytes, usec;
+};
+
+
+static bool is_playlist(const char * path)
+{
+  const char * ext = strrchr(path, '.');
+  return ext && strcmp(ext, ".m3u8") == 0;
+}
+
+// fmp4 init sections are not segments, EXT-X-MAP is left unencrypted
+static bool is_init_section(const char * path)
+{
+  const char * ext = strrchr(path, '.');
+  return ext && strcmp(ext, ".mp4") == 0;
+}
+
+static const char * filename(const char * path)
+{
+  const char * p = strrchr(path, '/');
+  return p ? p + 1 : path;
+}
+
+
+static char * genkeypath(const struct ffhlscrypt * crypt, uint keyidx)
+{
+  char * path = NULL;
+  if ( asprintf(&path, "%skey-%u.key", crypt->keypath, keyidx) < 0 ) {
+    path = NULL;
+  }
+  return path;
+}
+
+static int put_file(const struct ffhlscrypt * crypt, const char * path, const void * data, size_t size)
+{
+  return crypt->store ? ffsegstore_put(crypt->store, path, data, size) : ffsegwriter_put(path, data, size);
+}
+
+static void remove_file(const struct ffhlscrypt * crypt, const char * path)
+{
+  if ( crypt->store ) {
+    ffsegstore_remove(crypt->store, path);
+  }
+  else {
+    ffsegwriter_unlink(path);
+  }
+}
+
+
+static int new_key(struct ffhlscrypt * crypt)
+{
+  char * path;
+  int status;
+
+  if ( RAND_bytes(crypt->key, sizeof(crypt->key)) != 1 ) {
+    PDBG("RAND_bytes() fails");
+    return AVERROR_EXTERNAL;
+  }
+
+  if ( crypt->keysegs >= 0 ) {
+    ++crypt->keyidx;
+  }
+
+  if ( !(path = genkeypath(crypt, crypt->keyidx)) ) {
+    return AVERROR(ENOMEM);
+  }
+
+  // key must be reachable before any playlist references it
+  if ( (status = put_file(crypt, path, crypt->key, sizeof(crypt->key))) ) {
+    PDBG("put_file('%s') fails: %s", path, av_err2str(status));
+  }
+
+  free(path);
+
+  crypt->keysegs = 0;
+
+  return status;
+}
+
+
+static int encrypt_segment(struct ffhlscrypt * crypt, const char * path, uint8_t ** data, size_t * size)
+{
+  struct hlscrypt_segment * seg;
+  uint8_t * out = NULL;
+  uint capacity;
+  int64_t t0;
+  int n1 = 0, n2 = 0;
+  int status = 0;
+
+  if ( crypt->keysegs < 0 || (crypt->rotate > 0 && crypt->keysegs >= crypt->rotate) ) {
+    if ( (status = new_key(crypt)) ) {
+      return status;
+    }
+  }
+
+  if ( crypt->nb_segments == crypt->capacity ) {
+
+    capacity = crypt->capacity ? 2 * crypt->capacity : 64;
+
+    if ( !(seg = realloc(crypt->segments, capacity * sizeof(*seg))) ) {
+      return AVERROR(ENOMEM);
+    }
+
+    crypt->segments = seg;
+    crypt->capacity = capacity;
+  }
+
+  seg = &crypt->segments[crypt->nb_segments];
+  seg->playlist = -1;
+  seg->listed = 0;
+
+  if ( !(seg->name = strdup(filename(path))) ) {
+    return AVERROR(ENOMEM);
+  }
+
+  if ( RAND_bytes(seg->iv, sizeof(seg->iv)) != 1 ) {
+    PDBG("RAND_bytes() fails");
+    status = AVERROR_EXTERNAL;
+    goto end;
+  }
+
+  seg->keyidx = crypt->keyidx;
+
+  if ( *size > INT_MAX - AES128_BLOCK_SIZE || !(out = av_malloc(*size + AES128_BLOCK_SIZE)) ) {
+    status = AVERROR(ENOMEM);
+    goto end;
+  }
+
+  t0 = ffmpeg_gettime_us();
+
+  if ( EVP_EncryptInit_ex(crypt->ctx, EVP_aes_128_cbc(), NULL, crypt->key, seg->iv) != 1 ||
+      EVP_EncryptUpdate(crypt->ctx, out, &n1, *data, (int) *size) != 1 ||
+      EVP_EncryptFinal_ex(crypt->ctx, out + n1, &n2) != 1 ) {
+    PDBG("EVP_Encrypt('%s') fails", path);
+    status = AVERROR_EXTERNAL;
+    goto end;
+  }
+
+  crypt->usec += ffmpeg_gettime_us() - t0;
+  crypt->bytes += *size;
+
+  av_free(*data);
+  *data = out, out = NULL;
+  *size = n1 + n2;
+
+  ++crypt->nb_segments;
+  ++crypt->keysegs;
+
+end:
+
+  if ( status ) {
+    free(seg->name);
+    seg->name = NULL;
+  }
+
+  av_free(out);
+
+  return status;
+}
+
+
+// playlists list segments in encryption order, search starts after the previous match
+static struct hlscrypt_segment * find_segment(struct ffhlscrypt * crypt, const char * name, size_t len, uint * pos)
+{
+  for ( uint i = 0; i < crypt->nb_segments; ++i ) {
+    struct hlscrypt_segment * seg = &crypt->segments[(*pos + i) % crypt->nb_segments];
+    if ( strlen(seg->name) == len && memcmp(seg->name, name, len) == 0 ) {
+      *pos = seg - crypt->segments + 1;
+      return seg;
+    }
+  }
+
+  return NULL;
+}
+
+static void remove_segment(struct ffhlscrypt * crypt, uint i)
+{
+  free(crypt->segments[i].name);
+  memmove(&crypt->segments[i], &crypt->segments[i + 1], (--crypt->nb_segments - i) * sizeof(*crypt->segments));
+}
+
+static int get_playlist(struct ffhlscrypt * crypt, const char * path)
+{
+  for ( uint i = 0; i < crypt->nb_playlists; ++i ) {
+    if ( strcmp(crypt->playlists[i].path, path) == 0 ) {
+      return i;
+    }
+  }
+
+  if ( crypt->nb_playlists == HLSCRYPT_MAX_PLAYLISTS || !(crypt->playlists[crypt->nb_playlists].path = strdup(path)) ) {
+    return -1;
+  }
+
+  return crypt->nb_playlists++;
+}
+
+
+// forget keys no remaining segment is encrypted with, one previous key is kept for late clients
+static void remove_old_keys(struct ffhlscrypt * crypt)
+{
+  uint minkey = crypt->keyidx;
+  char * path;
+
+  for ( uint i = 0; i < crypt->nb_segments; ++i ) {
+    minkey = FFMIN(minkey, crypt->segments[i].keyidx);
+  }
+
+  while ( crypt->oldestkey + 1 < minkey ) {
+    if ( (path = genkeypath(crypt, crypt->oldestkey)) ) {
+      remove_file(crypt, path);
+      free(path);
+    }
+    ++crypt->oldestkey;
+  }
+}
+
+
+// EXT-X-KEY is inserted before each segment URI
+static int rewrite_playlist(struct ffhlscrypt * crypt, const char * path, uint8_t ** data, size_t * size)
+{
+  struct hlscrypt_segment * seg;
+  const char * line, * eol, * end;
+  FILE * fp = NULL;
+  char * text = NULL;
+  size_t len, textsize = 0;
+  uint pos = 0, rewrite = 0;
+  bool encrypted = false;
+  int pl, status = 0;
+
+  if ( !(fp = open_memstream(&text, &textsize)) ) {
+    return AVERROR(errno);
+  }
+
+  if ( (pl = get_playlist(crypt, path)) >= 0 ) {
+    rewrite = ++crypt->playlists[pl].rewrites;
+  }
+
+  for ( line = (const char *) *data, end = line + *size; line < end; line = eol ) {
+
+    if ( !(eol = memchr(line, '\n', end - line)) ) {
+      eol = end;
+    }
+    else {
+      ++eol;
+    }
+
+    // data is not nul-terminated
+    for ( len = 0; line + len < eol && line[len] != '\r' && line[len] != '\n'; ++len ) {
+    }
+
+    if ( *line != '#' && len > 0 ) {
+
+      const char * name = line;
+      for ( const char * p = line; p < line + len; ++p ) {
+        if ( *p == '/' ) {
+          name = p + 1;
+        }
+      }
+
+      if ( (seg = find_segment(crypt, name, line + len - name, &pos)) ) {
+
+        if ( pl >= 0 ) {
+          seg->playlist = pl;
+          seg->listed = rewrite;
+        }
+
+        fprintf(fp, "#EXT-X-KEY:METHOD=AES-128,URI=\"%s%skey-%u.key\",IV=0x",
+            crypt->keyurl ? crypt->keyurl : "",
+            filename(crypt->keypath),
+            seg->keyidx);
+
+        for ( uint i = 0; i < sizeof(seg->iv); ++i ) {
+          fprintf(fp, "%.2X", seg->iv[i]);
+        }
+
+        fputc('\n', fp);
+
+        encrypted = true;
+      }
+      else if ( encrypted ) {
+        fprintf(fp, "#EXT-X-KEY:METHOD=NONE\n");
+        encrypted = false;
+      }
+    }
+
+    fwrite(line, 1, eol - line, fp);
+  }
+
+  fclose(fp);
+
+  if ( !text ) {
+    return AVERROR(ENOMEM);
+  }
+
+  av_free(*data);
+
+  if ( !(*data = av_malloc(FFMAX(textsize, 1))) ) {
+    *size = 0;
+    status = AVERROR(ENOMEM);
+  }
+  else {
+    memcpy(*data, text, *size = textsize);
+  }
+
+  free(text);
+
+  if ( !status && pl >= 0 ) {
+
+    // muxer without delete_segments flag just stops listing old segments
+    for ( uint i = 0; i < crypt->nb_segments; ) {
+      if ( crypt->segments[i].playlist == pl && crypt->segments[i].listed != rewrite ) {
+        remove_segment(crypt, i);
+      }
+      else {
+        ++i;
+      }
+    }
+
+    remove_old_keys(crypt);
+  }
+
+  return status;
+}
+
+
+static int apply(struct ffsegfilter * filter, const char * path, uint8_t ** data, size_t * size)
+{
+  struct ffhlscrypt * crypt = (struct ffhlscrypt *) filter;
+
+  if ( is_playlist(path) ) {
+    return rewrite_playlist(crypt, path, data, size);
+  }
+
+  if ( is_init_section(path) ) {
+    return 0;
+  }
+
+  return encrypt_segment(crypt, path, data, size);
+}
+
+static void remove_path(struct ffsegfilter * filter, const char * path)
+{
+  struct ffhlscrypt * crypt = (struct ffhlscrypt *) filter;
+  const char * name = filename(path);
+
+  for ( uint i = 0; i < crypt->nb_segments; ++i ) {
+    if ( strcmp(crypt->segments[i].name, name) == 0 ) {
+      remove_segment(crypt, i);
+      break;
+    }
+  }
+}
+
+
+int ffhlscrypt_create(struct ffhlscrypt ** pcrypt, const struct ffhlscrypt_params * params)
+{
+  struct ffhlscrypt * crypt;
+  int status = 0;
+
+  if ( !(crypt = calloc(1, sizeof(*crypt))) ) {
+    status = AVERROR(ENOMEM);
+    goto end;
+  }
+
+  crypt->filter.apply = apply;
+  crypt->filter.remove = remove_path;
+  crypt->store = params->store;
+  crypt->rotate = params->rotate;
+  crypt->keysegs = -1;
+
+  if ( !(crypt->keypath = strdup(params->keypath)) ) {
+    status = AVERROR(ENOMEM);
+    goto end;
+  }
+
+  if ( params->keyurl && *params->keyurl && !(crypt->keyurl = strdup(params->keyurl)) ) {
+    status = AVERROR(ENOMEM);
+    goto end;
+  }
+
+  if ( !(crypt->ctx = EVP_CIPHER_CTX_new()) ) {
+    status = AVERROR(ENOMEM);
+    goto end;
+  }
+
+end:
+
+  if ( status ) {
+    ffhlscrypt_destroy(&crypt);
+  }
+
+  *pcrypt = crypt;
+
+  return status;
+}
+
+
+void ffhlscrypt_destroy(struct ffhlscrypt ** crypt)
+{
+  if ( crypt && *crypt ) {
+
+    struct ffhlscrypt * c = *crypt;
+
+    if ( c->usec > 0 ) {
+      PDBG("encrypted %" PRId64 " bytes in %" PRId64 " us: %g MB/s", c->bytes, c->usec,
+          (double) c->bytes / c->usec);
+    }
+
+    for ( uint i = 0; i < c->nb_segments; ++i ) {
+      free(c->segments[i].name);
+    }
+
+    free(c->segments);
+
+    for ( uint i = 0; i < c->nb_playlists; ++i ) {
+      free(c->playlists[i].path);
+    }
+
+    if ( c->ctx ) {
+      EVP_CIPHER_CTX_free(c->ctx);
+    }
+
+    OPENSSL_cleanse(c->key, sizeof(c->key));
+
+    free(c->keypath);
+    free(c->keyurl);
+    free(c);
+
+    *crypt = NULL;
+  }
+}
+
+
+struct ffsegfilter * ffhlscrypt_get_filter(struct ffhlscrypt * crypt)
+{
+  return &crypt->filter;
+}
@@ -0,0 +1,46 @@
+/*
+ * ffhlscrypt.h
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: amyznikov
+ *
+ *  HLS AES-128 segment encryption as ffsegfilter: each segment is encrypted once when
+ *  the muxer closes it (AES-CBC through OpenSSL EVP, per-segment random IV), ciphertext
+ *  is what the store or disk keeps for all viewers. Playlists are rewritten with
+ *  EXT-X-KEY tags, keys are rotated every `rotate` segments and written as
+ *  ${prefix}key-N.key next to the segments. IV and key of a segment are kept while
+ *  the muxer lists it, key files are removed when no remaining segment uses them.
+ */
+
+// #pragma once
+
+#ifndef __ffhlscrypt_h__
+#define __ffhlscrypt_h__
+
+#include "ffsegfilter.h"
+#include "ffsegstore.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct ffhlscrypt;
+
+struct ffhlscrypt_params {
+  struct ffsegstore * store;  // NULL when files are persisted through ffsegwriter
+  const char * keypath;       // key files path prefix: playlistpath/${prefix}
+  const char * keyurl;        // key URI prefix in playlists, NULL for names relative to playlist
+  int rotate;                 // segments per key, 0 never rotates
+};
+
+int ffhlscrypt_create(struct ffhlscrypt ** crypt, const struct ffhlscrypt_params * params);
+void ffhlscrypt_destroy(struct ffhlscrypt ** crypt);
+
+struct ffsegfilter * ffhlscrypt_get_filter(struct ffhlscrypt * crypt);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __ffhlscrypt_h__ */
@@ -0,0 +1,543 @@
+/*
+ * ffllhls.c
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: amyznikov
+ */
+
+#define _GNU_SOURCE
+
+#include "ffllhls.h"
+#include "strfuncs.h"
+#include "debug.h"
+#include <math.h>
+
+#define LLHLS_IO_BUF_SIZE   (32*1024)
+#define LLHLS_MAX_PARTS     128
+#define LLHLS_TARGET_HEADROOM 1   // [s] EXT-X-TARGETDURATION above segtime for late key frames
+
+
+struct llhls_part {
+  int64_t duration; // [us]
+  bool independent;
+};
+
+struct llhls_segment {
+  int64_t msn;
+  int64_t duration; // [us]
+  struct llhls_part parts[LLHLS_MAX_PARTS];
+  uint nb_parts;
+  bool parts_removed;
+};
+
+struct ffllhls {
+  struct ffsegstore * store;
+  char * dirpath;
+  char * playlist;
+  char * prefix;
+
+  const ffstream * const * iss;
+  uint nb_streams;
+  int refidx;
+
+  AVFormatContext * oc;
+
+  // muxer output of current part and current segment
+  uint8_t * buf, * segbuf;
+  size_t size, capacity, segsize, segcapacity;
+
+  struct llhls_segment * segs; // ring [nb_segs], indexed by msn
+  uint nb_segs;
+  int64_t first_msn;  // oldest segment in the playlist
+  int64_t msn;        // segment being written
+
+  int64_t segtime, parttime; // [us]
+  int listsize;
+  int targetduration; // [s]
+
+  int64_t seg_t0, part_t0, reflastts, refdelta; // [us]
+  bool started, has_data, independent;
+
+  struct {
+    int64_t lastdts;
+    int64_t lastdelta;
+  } * st; // [nb_streams]
+};
+
+
+static inline struct llhls_segment * get_segment(const struct ffllhls * hls, int64_t msn)
+{
+  return &hls->segs[msn % hls->nb_segs];
+}
+
+
+static int append(uint8_t ** buf, size_t * size, size_t * capacity, const uint8_t * data, size_t n)
+{
+  size_t need;
+
+  if ( (need = *size + n) > *capacity ) {
+
+    size_t cap = FFMAX(need, FFMAX(2 * *capacity, 64 * 1024));
+    uint8_t * p;
+
+    if ( !(p = realloc(*buf, cap)) ) {
+      return AVERROR(ENOMEM);
+    }
+
+    *buf = p;
+    *capacity = cap;
+  }
+
+  memcpy(*buf + *size, data, n);
+  *size = need;
+
+  return 0;
+}
+
+// AVIO write callback of the mp4 muxer
+static int llhls_capture(void * opaque, uint8_t * buf, int buf_size)
+{
+  struct ffllhls * hls = opaque;
+  return append(&hls->buf, &hls->size, &hls->capacity, buf, buf_size);
+}
+
+
+static char * genpath(const struct ffllhls * hls, const char * format, ...)
+  __attribute__ ((__format__ (__printf__, 2, 3)));
+
+// dirpath/${prefix}name
+static char * genpath(const struct ffllhls * hls, const char * format, ...)
+{
+  va_list arglist;
+  char * name = NULL, * path = NULL;
+
+  va_start(arglist, format);
+  if ( vasprintf(&name, format, arglist) < 0 ) {
+    name = NULL;
+  }
+  va_end(arglist);
+
+  if ( name ) {
+    path = strmkpath("%s/%s%s", hls->dirpath, hls->prefix, name);
+    free(name);
+  }
+
+  return path;
+}
+
+static void remove_file(struct ffllhls * hls, char * path)
+{
+  if ( path ) {
+    ffsegstore_remove(hls->store, path);
+    free(path);
+  }
+}
+
+static int put_file(struct ffllhls * hls, char * path, const uint8_t * data, size_t size)
+{
+  int status;
+
+  if ( !path ) {
+    return AVERROR(ENOMEM);
+  }
+
+  if ( (status = ffsegstore_put(hls->store, path, data, size)) ) {
+    PDBG("ffsegstore_put('%s') fails: %s", path, av_err2str(status));
+  }
+
+  free(path);
+
+  return status;
+}
+
+
+
+static int write_playlist(struct ffllhls * hls)
+{
+  const struct llhls_segment * seg;
+  FILE * fp = NULL;
+  char * text = NULL, * hint;
+  size_t size = 0;
+  int status = 0;
+
+  if ( !(fp = open_memstream(&text, &size)) ) {
+    return AVERROR(errno);
+  }
+
+  fprintf(fp, "#EXTM3U\n"
+      "#EXT-X-VERSION:6\n"
+      "#EXT-X-TARGETDURATION:%d\n"
+      "#EXT-X-PART-INF:PART-TARGET=%.3f\n"
+      "#EXT-X-SERVER-CONTROL:CAN-BLOCK-RELOAD=YES,PART-HOLD-BACK=%.3f\n"
+      "#EXT-X-MEDIA-SEQUENCE:%" PRId64 "\n"
+      "#EXT-X-MAP:URI=\"%sinit.mp4\"\n",
+      hls->targetduration,
+      hls->parttime * 1e-6,
+      3 * hls->parttime * 1e-6,
+      hls->first_msn,
+      hls->prefix);
+
+  for ( int64_t msn = hls->first_msn; msn <= hls->msn; ++msn ) {
+
+    seg = get_segment(hls, msn);
+
+    if ( !seg->parts_removed ) {
+      for ( uint i = 0; i < seg->nb_parts; ++i ) {
+        fprintf(fp, "#EXT-X-PART:DURATION=%.5f,URI=\"%s%" PRId64 ".%u.m4s\"%s\n",
+            seg->parts[i].duration * 1e-6, hls->prefix, msn, i,
+            seg->parts[i].independent ? ",INDEPENDENT=YES" : "");
+      }
+    }
+
+    if ( msn < hls->msn ) {
+      fprintf(fp, "#EXTINF:%.5f,\n%s%" PRId64 ".m4s\n", seg->duration * 1e-6, hls->prefix, msn);
+    }
+  }
+
+  seg = get_segment(hls, hls->msn);
+  fprintf(fp, "#EXT-X-PRELOAD-HINT:TYPE=PART,URI=\"%s%" PRId64 ".%u.m4s\"\n", hls->prefix, hls->msn, seg->nb_parts);
+
+  fclose(fp);
+
+  status = ffsegstore_put(hls->store, hls->playlist, text, size);
+  free(text);
+
+  hint = genpath(hls, "%" PRId64 ".%u.m4s", hls->msn, seg->nb_parts);
+  ffsegstore_set_hint(hls->store, hint, ffllhls_get_block_timeout(hls));
+  free(hint);
+
+  return status;
+}
+
+
+// muxed samples before time t become the next part of current segment
+static int close_part(struct ffllhls * hls, int64_t t)
+{
+  struct llhls_segment * seg = get_segment(hls, hls->msn);
+  struct llhls_part * part;
+  int status;
+
+  if ( (status = av_write_frame(hls->oc, NULL)) < 0 ) {
+    PDBG("av_write_frame(NULL) fails: %s", av_err2str(status));
+    return status;
+  }
+
+  avio_flush(hls->oc->pb);
+
+  part = &seg->parts[seg->nb_parts];
+  part->duration = t - hls->part_t0;
+  part->independent = hls->independent;
+
+  if ( (status = put_file(hls, genpath(hls, "%" PRId64 ".%u.m4s", hls->msn, seg->nb_parts), hls->buf, hls->size)) ) {
+    return status;
+  }
+
+  if ( (status = append(&hls->segbuf, &hls->segsize, &hls->segcapacity, hls->buf, hls->size)) ) {
+    return status;
+  }
+
+  ++seg->nb_parts;
+  seg->duration += part->duration;
+
+  hls->size = 0;
+  hls->has_data = false;
+
+  return 0;
+}
+
+
+static void remove_parts(struct ffllhls * hls, struct llhls_segment * seg)
+{
+  if ( !seg->parts_removed ) {
+    for ( uint i = 0; i < seg->nb_parts; ++i ) {
+      remove_file(hls, genpath(hls, "%" PRId64 ".%u.m4s", seg->msn, i));
+    }
+    seg->parts_removed = true;
+  }
+}
+
+static int close_segment(struct ffllhls * hls)
+{
+  struct llhls_segment * seg = get_segment(hls, hls->msn);
+  int64_t elapsed = 0;
+  int status;
+
+  if ( (status = put_file(hls, genpath(hls, "%" PRId64 ".m4s", hls->msn), hls->segbuf, hls->segsize)) ) {
+    return status;
+  }
+
+  hls->segsize = 0;
+
+  ++hls->msn;
+
+  // the oldest segment goes away before its ring slot is reused
+  while ( hls->msn - hls->first_msn > hls->listsize ) {
+    remove_parts(hls, get_segment(hls, hls->first_msn));
+    remove_file(hls, genpath(hls, "%" PRId64 ".m4s", hls->first_msn));
+    ++hls->first_msn;
+  }
+
+  seg = get_segment(hls, hls->msn);
+  memset(seg, 0, sizeof(*seg));
+  seg->msn = hls->msn;
+
+  // parts are listed only for the last three target durations
+  for ( int64_t msn = hls->msn - 1; msn >= hls->first_msn; --msn ) {
+    seg = get_segment(hls, msn);
+    if ( elapsed > 3 * hls->targetduration * 1000000LL ) {
+      remove_parts(hls, seg);
+    }
+    elapsed += seg->duration;
+  }
+
+  return 0;
+}
+
+
+
+int ffllhls_create(struct ffllhls ** phls, const struct ffllhls_params * params)
+{
+  struct ffllhls * hls = NULL;
+  AVDictionary * opts = NULL;
+  uint8_t * iobuf = NULL;
+  int status = 0;
+
+  if ( !(hls = calloc(1, sizeof(*hls))) ) {
+    status = AVERROR(ENOMEM);
+    goto end;
+  }
+
+  hls->store = params->store;
+  hls->iss = params->iss;
+  hls->nb_streams = params->nb_streams;
+  hls->segtime = params->segtime * 1e6;
+  hls->parttime = params->parttime * 1e6;
+  hls->listsize = FFMAX(params->listsize, 2);
+  // EXT-X-TARGETDURATION can't change during the stream, segments are force-cut before overrun
+  hls->targetduration = (int) ceil(params->segtime) + LLHLS_TARGET_HEADROOM;
+  hls->nb_segs = hls->listsize + 1;
+  hls->refidx = 0;
+  hls->reflastts = AV_NOPTS_VALUE;
+
+  for ( uint i = 0; i < hls->nb_streams; ++i ) {
+    if ( hls->iss[i]->codecpar->codec_type == AVMEDIA_TYPE_VIDEO ) {
+      hls->refidx = i;
+      break;
+    }
+  }
+
+  if ( !(hls->playlist = strdup(params->playlist)) || !(hls->prefix = strdup(params->prefix))
+      || !(hls->dirpath = strdirname(params->playlist)) ) {
+    status = AVERROR(ENOMEM);
+    goto end;
+  }
+
+  if ( !(hls->segs = calloc(hls->nb_segs, sizeof(*hls->segs))) || !(hls->st = calloc(hls->nb_streams, sizeof(*hls->st))) ) {
+    status = AVERROR(ENOMEM);
+    goto end;
+  }
+
+  for ( uint i = 0; i < hls->nb_streams; ++i ) {
+    hls->st[i].lastdts = AV_NOPTS_VALUE;
+  }
+
+  if ( (status = avformat_alloc_output_context2(&hls->oc, NULL, "mp4", NULL)) ) {
+    PDBG("avformat_alloc_output_context2() fails: %s", av_err2str(status));
+    goto end;
+  }
+
+  hls->oc->flags |= AVFMT_FLAG_CUSTOM_IO;
+
+  if ( !(iobuf = av_malloc(LLHLS_IO_BUF_SIZE)) ) {
+    status = AVERROR(ENOMEM);
+    goto end;
+  }
+
+  if ( !(hls->oc->pb = avio_alloc_context(iobuf, LLHLS_IO_BUF_SIZE, true, hls, NULL, llhls_capture, NULL)) ) {
+    av_free(iobuf);
+    status = AVERROR(ENOMEM);
+    goto end;
+  }
+
+  if ( (status = ffstreams_to_context(hls->iss, hls->nb_streams, hls->oc)) ) {
+    PDBG("ffstreams_to_context() fails: %s", av_err2str(status));
+    goto end;
+  }
+
+  // moov without samples, then exactly one moof + mdat per part
+  av_dict_set(&opts, "movflags", "frag_custom+empty_moov+default_base_moof", 0);
+
+  if ( (status = avformat_write_header(hls->oc, &opts)) < 0 ) {
+    PDBG("avformat_write_header() fails: %s", av_err2str(status));
+    goto end;
+  }
+
+  avio_flush(hls->oc->pb);
+
+  ffsegstore_set_pinning(hls->store, true);
+  status = put_file(hls, genpath(hls, "init.mp4"), hls->buf, hls->size);
+  ffsegstore_set_pinning(hls->store, false);
+
+  hls->size = 0;
+
+end:
+
+  av_dict_free(&opts);
+
+  if ( status ) {
+    ffllhls_destroy(&hls);
+  }
+
+  *phls = hls;
+
+  return status;
+}
+
+
+void ffllhls_destroy(struct ffllhls ** phls)
+{
+  struct ffllhls * hls;
+
+  if ( phls && (hls = *phls) ) {
+
+    if ( hls->oc ) {
+      if ( hls->oc->pb ) {
+        av_freep(&hls->oc->pb->buffer);
+        av_freep(&hls->oc->pb);
+      }
+      avformat_free_context(hls->oc);
+    }
+
+    free(hls->buf);
+    free(hls->segbuf);
+    free(hls->segs);
+    free(hls->st);
+    free(hls->playlist);
+    free(hls->prefix);
+    free(hls->dirpath);
+    free(hls);
+
+    *phls = NULL;
+  }
+}
+
+
+int ffllhls_write_packet(struct ffllhls * hls, const AVPacket * pkt)
+{
+  const AVRational utb = (AVRational ) { 1, 1000000 };
+  const ffstream * is;
+  AVStream * os;
+  AVPacket opkt;
+  int64_t ts = AV_NOPTS_VALUE;
+  bool isref, key;
+  int stidx;
+  int status = 0;
+
+  if ( (stidx = pkt->stream_index) < 0 || stidx >= (int) hls->nb_streams ) {
+    return AVERROR(EINVAL);
+  }
+
+  is = hls->iss[stidx];
+  os = hls->oc->streams[stidx];
+
+  if ( pkt->dts != AV_NOPTS_VALUE ) {
+    if ( hls->st[stidx].lastdts != AV_NOPTS_VALUE && pkt->dts <= hls->st[stidx].lastdts ) {
+      return 0; // the muxer can't go back
+    }
+    ts = av_rescale_q(pkt->dts, is->time_base, utb);
+  }
+
+  isref = (stidx == hls->refidx);
+  key = isref && ((pkt->flags & AV_PKT_FLAG_KEY) || is->codecpar->codec_type != AVMEDIA_TYPE_VIDEO);
+
+  if ( !hls->started ) {
+    // segments must start on key frame of reference stream
+    if ( !key || ts == AV_NOPTS_VALUE ) {
+      return 0;
+    }
+    hls->started = true;
+    hls->seg_t0 = ts;
+    get_segment(hls, hls->msn)->msn = hls->msn;
+  }
+
+  if ( isref && ts != AV_NOPTS_VALUE ) {
+
+    if ( hls->reflastts != AV_NOPTS_VALUE && ts > hls->reflastts ) {
+      hls->refdelta = ts - hls->reflastts;
+    }
+    hls->reflastts = ts;
+
+    if ( hls->has_data ) {
+
+      if ( (key && ts - hls->seg_t0 >= hls->segtime)
+          || ts - hls->seg_t0 + hls->refdelta > hls->targetduration * 1000000LL ) {
+        if ( (status = close_part(hls, ts)) || (status = close_segment(hls)) || (status = write_playlist(hls)) ) {
+          return status;
+        }
+        hls->seg_t0 = ts;
+      }
+      // cut before the part would overrun PART-TARGET
+      else if ( ts - hls->part_t0 + hls->refdelta > hls->parttime
+          && get_segment(hls, hls->msn)->nb_parts < LLHLS_MAX_PARTS - 1 ) {
+        if ( (status = close_part(hls, ts)) || (status = write_playlist(hls)) ) {
+          return status;
+        }
+      }
+    }
+  }
+
+  if ( !hls->has_data ) {
+    hls->part_t0 = ts != AV_NOPTS_VALUE ? ts : hls->reflastts;
+    hls->independent = key;
+  }
+
+  opkt = *pkt;
+
+  // trun needs the sample duration at part flush, the next packet is not known yet
+  if ( opkt.duration <= 0 && hls->st[stidx].lastdelta > 0 ) {
+    opkt.duration = hls->st[stidx].lastdelta;
+  }
+
+  av_packet_rescale_ts(&opkt, is->time_base, os->time_base);
+
+  if ( (status = av_write_frame(hls->oc, &opkt)) < 0 ) {
+    PDBG("av_write_frame() fails: %s", av_err2str(status));
+    return status;
+  }
+
+  if ( pkt->dts != AV_NOPTS_VALUE ) {
+    if ( hls->st[stidx].lastdts != AV_NOPTS_VALUE ) {
+      hls->st[stidx].lastdelta = pkt->dts - hls->st[stidx].lastdts;
+    }
+    hls->st[stidx].lastdts = pkt->dts;
+  }
+
+  hls->has_data = true;
+
+  return 0;
+}
+
+
+int ffllhls_check_part(const struct ffllhls * hls, int64_t msn, int part)
+{
+  // last complete segment is hls->msn - 1, requests beyond it plus two are rejected
+  if ( msn > hls->msn + 1 ) {
+    return AVERROR(EINVAL);
+  }
+
+  if ( msn < hls->msn ) {
+    return 1;
+  }
+
+  if ( msn == hls->msn && part >= 0 && (uint) part < get_segment(hls, msn)->nb_parts ) {
+    return 1;
+  }
+
+  return 0;
+}
+
+
+int ffllhls_get_block_timeout(const struct ffllhls * hls)
+{
+  return 3 * hls->targetduration * 1000;
+}
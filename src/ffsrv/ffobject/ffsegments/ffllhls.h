@@ -0,0 +1,60 @@
+/*
+ * ffllhls.h
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: amyznikov
+ *
+ *  Low-Latency HLS packager: fMP4 partial segments (EXT-X-PART) cut from single mp4 muxer,
+ *  full segments are concatenations of their parts. Init segment, parts, segments and the
+ *  playlist are committed into ffsegstore, the next part is announced as EXT-X-PRELOAD-HINT
+ *  and as store hint, so both hinted part requests and blocking playlist reloads
+ *  (_HLS_msn / _HLS_part) wait on store commits instead of client polling.
+ */
+
+// #pragma once
+
+#ifndef __ffllhls_h__
+#define __ffllhls_h__
+
+#include "ffmpeg.h"
+#include "ffsegstore.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct ffllhls;
+
+struct ffllhls_params {
+  struct ffsegstore * store;
+  const char * playlist;  // playlist absolute path, other files are created in the same directory
+  const char * prefix;    // file names prefix
+  const ffstream * const * iss;
+  uint nb_streams;
+  double segtime;         // [s] target segment duration, segments are cut on reference stream key frames,
+                          //     or forced before they exceed ceil(segtime) + 1 s target duration
+  double parttime;        // [s] part target duration
+  int listsize;           // complete segments kept in the playlist
+};
+
+
+int ffllhls_create(struct ffllhls ** hls, const struct ffllhls_params * params);
+void ffllhls_destroy(struct ffllhls ** hls);
+
+/* pkt is in input stream time base */
+int ffllhls_write_packet(struct ffllhls * hls, const AVPacket * pkt);
+
+/* Blocking playlist reload support:
+ *  returns 1 if part (or whole segment msn if part < 0) is in the playlist, 0 if not yet,
+ *  AVERROR(EINVAL) if the request is too far ahead of live edge */
+int ffllhls_check_part(const struct ffllhls * hls, int64_t msn, int part);
+
+/* [ms] blocking reload timeout: 3 target durations */
+int ffllhls_get_block_timeout(const struct ffllhls * hls);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __ffllhls_h__ */
@@ -0,0 +1,55 @@
+/*
+ * ffsegfilter.h
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: amyznikov
+ *
+ *  Transform of complete hls/dash files written by muxers (segment encryption,
+ *  playlist rewriting), applied once by ffsegstore / ffsegwriter before the file
+ *  becomes visible to http clients.
+ */
+
+// #pragma once
+
+#ifndef __ffsegfilter_h__
+#define __ffsegfilter_h__
+
+#include "ffmpeg.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+struct ffsegfilter {
+  /* data is av_malloc()-ed and may be replaced, negative return drops the file */
+  int (*apply)(struct ffsegfilter * filter, const char * path, uint8_t ** data, size_t * size);
+  /* optional, muxer deletes the file */
+  void (*remove)(struct ffsegfilter * filter, const char * path);
+  struct ffsegfilter * next; // applied to the output of this one
+};
+
+static inline int ffsegfilter_apply(struct ffsegfilter * filter, const char * path, uint8_t ** data, size_t * size)
+{
+  int status = 0;
+  for ( ; filter && status >= 0; filter = filter->next ) {
+    status = filter->apply(filter, path, data, size);
+  }
+  return status;
+}
+
+static inline void ffsegfilter_remove(struct ffsegfilter * filter, const char * path)
+{
+  for ( ; filter; filter = filter->next ) {
+    if ( filter->remove ) {
+      filter->remove(filter, path);
+    }
+  }
+}
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __ffsegfilter_h__ */
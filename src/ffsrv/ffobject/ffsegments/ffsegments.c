@@ -8,13 +8,21 @@
 #define _GNU_SOURCE
 
 #include "ffsegments.h"
+#include "ffsegstore.h"
+#include "ffsegwriter.h"
+#include "ffllhls.h"
+#include "ffhlscrypt.h"
+#include "ffarchive.h"
+#include "ffsegmeter.h"
 #include "ffcfg.h"
 #include "ffgop.h"
+#include "ffinterleaver.h"
 #include "strfuncs.h"
 #include "hashfuncs.h"
 #include "pathfuncs.h"
 #include "debug.h"
 #include <search.h>
+#include <math.h>
 
 
 #define SEGMENTS_THREAD_STACK_SIZE  (ffsrv.mem.ffsegments)
@@ -26,7 +34,9 @@
 enum ofmt {
   ofmt_unknown = -1,
   ofmt_dash,
-  ofmt_hls
+  ofmt_hls,
+  ofmt_llhls,
+  ofmt_cmaf,
 };
 
 enum {
@@ -38,7 +48,11 @@ enum {
 
 struct ffsegments {
   struct ffobject base;
-  struct ffobject * source;
+
+  // several sources (encoder ladder) are read as one, their streams are concatenated into iss
+  struct ffobject ** sources; // [nb_sources]
+  uint nb_sources;
+  uint * sstart; // [nb_sources + 1] index of the first input stream of each source
 
   // absolute path to this object
   char * basepath;
@@ -53,14 +67,35 @@ struct ffsegments {
   char * playlist;
   const char * mime_type;
 
+  // f=cmaf: hls master playlist written by dash muxer for the same fragments
+  char * hlsplaylist;
+
   // sub playlists absolute pathnames
   char ** subplaylists; // [nb_outputs]
 
   // playlistpath access hook ticket
   void * ticket;
 
+  // in-memory segments and playlists, NULL when files are persisted under db.root
+  struct ffsegstore * store;
+
+  // LL-HLS packager, replaces libavformat muxers for f=llhls
+  struct ffllhls * llhls;
+
+  // hls AES-128 segment encryption, NULL when disabled
+  struct ffhlscrypt * crypt;
+
+  // hls live-to-vod archive, NULL when disabled
+  struct ffarchive * archive;
+
+  // measured variant bitrates for hls master playlist, NULL for single output
+  struct ffsegmeter * meter;
+
+  // muxer files filter chain: archive -> crypt -> meter
+  struct ffsegfilter * filter;
+
   uint nb_input_streams;
-  const struct ffstream * const * iss;    // [nb_input_streams]
+  const struct ffstream ** iss;    // [nb_input_streams]
 
   uint nb_outputs;
   AVFormatContext ** oc;    // [nb_outputs]
@@ -71,6 +106,10 @@ struct ffsegments {
   int itmo, rtmo;
   int stream_state;
 
+  // set when all playlists have been written at least once
+  coevent * readyev;
+  bool playlists_ready;
+
   int64_t idletimeout;
 };
 
@@ -87,6 +126,8 @@ static void on_destroy_segments_stream(void * ffobject)
     obj->playlist = NULL;
   }
 
+  free(obj->hlsplaylist);
+
   if ( obj->nb_outputs > 1 && obj->subplaylists ) {
     for ( uint i = 0; i < obj->nb_outputs; ++i ) {
       free(obj->subplaylists[i]);
@@ -102,6 +143,14 @@ static void on_destroy_segments_stream(void * ffobject)
     obj->oc = NULL;
   }
 
+  ffllhls_destroy(&obj->llhls);
+  ffsegstore_destroy(&obj->store);
+  ffhlscrypt_destroy(&obj->crypt);
+  ffarchive_destroy(&obj->archive);
+  ffsegmeter_destroy(&obj->meter);
+
+  coevent_delete(&obj->readyev);
+
   if ( obj->bitrates ) {
     free(obj->bitrates);
     obj->bitrates = NULL;
@@ -112,8 +161,16 @@ static void on_destroy_segments_stream(void * ffobject)
     obj->ocsmap = NULL;
   }
 
-  release_object(obj->source);
-  obj->source = NULL;
+  if ( obj->sources ) {
+    for ( uint i = 0; i < obj->nb_sources; ++i ) {
+      release_object(obj->sources[i]);
+    }
+    free(obj->sources);
+    obj->sources = NULL;
+  }
+
+  free(obj->sstart);
+  free(obj->iss);
 }
 
 
@@ -177,6 +234,37 @@ static char * getplaylistpath(const char * basepath, const char * playlist)
   return playlistpath;
 }
 
+// basepath/playlistpath/${prefix}manifestbasename.m3u8
+static char * genhlsplaylistfilename(const struct ffsegments * seg, const char * manifest)
+{
+  char * name, * path = NULL;
+
+  if ( (name = strbasename(manifest)) ) {
+    path = strmkpath("%s/%s%s.m3u8", seg->playlistpath, seg->prefix, name);
+    free(name);
+  }
+
+  return path;
+}
+
+// muxer url for the file path: files go through store or disk writer io, takes ownership of path
+static char * genmuxerurl(const struct ffsegments * seg, char * path)
+{
+  char * url = NULL;
+
+  if ( !path ) {
+    return NULL;
+  }
+
+  if ( asprintf(&url, "%s%s", seg->store ? FFSEGSTORE_URL_PREFIX : FFSEGWRITER_URL_PREFIX, path) < 0 ) {
+    url = NULL;
+  }
+
+  free(path);
+
+  return url;
+}
+
 // basepath/playlistpath/${prefix}playlistname-stream_index.m3u8
 static char * genplaylistfilename(const char * basepath, const char * playlist, const char * prefix, int stream_index)
 {
@@ -247,7 +335,110 @@ static char * gensegmenttemplate(const struct ffsegments * seg, const char * tem
   free(path);
   free(name);
 
-  return segments_template;
+  return genmuxerurl(seg, segments_template);
+}
+
+
+// concatenate streams of all sources, packets of source k get stream_index + sstart[k]
+static int get_input_streams(struct ffsegments * seg, struct ffobject * const * sources, uint nb_sources)
+{
+  const ffstream * const * streams;
+  uint nb_streams;
+  int status;
+
+  if ( !(seg->sstart = calloc(nb_sources + 1, sizeof(*seg->sstart))) ) {
+    return AVERROR(ENOMEM);
+  }
+
+  for ( uint k = 0; k < nb_sources; ++k ) {
+
+    if ( (status = get_streams(sources[k], &streams, &nb_streams)) ) {
+      PDBG("[%s] get_streams(source=%s) fails: %s", objname(seg), get_object_name(sources[k]), av_err2str(status));
+      return status;
+    }
+
+    if ( nb_streams > 0 ) {
+
+      const ffstream ** iss = realloc(seg->iss, (seg->nb_input_streams + nb_streams) * sizeof(*iss));
+      if ( !iss ) {
+        return AVERROR(ENOMEM);
+      }
+
+      seg->iss = iss;
+
+      for ( uint i = 0; i < nb_streams; ++i ) {
+        seg->iss[seg->nb_input_streams++] = streams[i];
+      }
+    }
+
+    seg->sstart[k + 1] = seg->nb_input_streams;
+  }
+
+  seg->nb_sources = nb_sources;
+
+  return 0;
+}
+
+static uint get_stream_source(const struct ffsegments * seg, uint isidx)
+{
+  uint k = 0;
+  while ( k + 1 < seg->nb_sources && isidx >= seg->sstart[k + 1] ) {
+    ++k;
+  }
+  return k;
+}
+
+
+// archive sees plain segments, meter sees bytes as they are served
+static void link_filters(struct ffsegments * seg)
+{
+  struct ffsegfilter * chain[3];
+  uint n = 0;
+
+  if ( seg->archive ) {
+    chain[n++] = ffarchive_get_filter(seg->archive);
+  }
+  if ( seg->crypt ) {
+    chain[n++] = ffhlscrypt_get_filter(seg->crypt);
+  }
+  if ( seg->meter ) {
+    chain[n++] = ffsegmeter_get_filter(seg->meter);
+  }
+
+  for ( uint i = 0; i + 1 < n; ++i ) {
+    chain[i]->next = chain[i + 1];
+  }
+
+  seg->filter = n ? chain[0] : NULL;
+
+  if ( seg->store ) {
+    ffsegstore_set_filter(seg->store, seg->filter);
+  }
+}
+
+
+static int alloc_output_context(const struct ffsegments * seg, AVFormatContext ** oc, AVOutputFormat * ofmt, const char * path)
+{
+  char * url;
+  int status;
+
+  if ( !(url = genmuxerurl(seg, strdup(path))) ) {
+    return AVERROR(ENOMEM);
+  }
+
+  if ( (status = avformat_alloc_output_context2(oc, ofmt, NULL, url)) >= 0 ) {
+    status = 0;
+    if ( seg->store ) {
+      ffsegstore_attach_context(seg->store, *oc);
+    }
+    else {
+      ffsegwriter_attach_context(*oc, seg->filter);
+    }
+  }
+
+  free(url);
+
+  return status;
 }
 
 
@@ -256,10 +447,14 @@ static int write_hls_playlist(struct ffsegments * seg)
   FILE * fp;
   const char * p;
   size_t rlen;
+  int64_t peak = 0, average = 0;
+
+  char * buf = NULL;
+  size_t size = 0;
 
   int status = 0;
 
-  if ( !(fp = fopen(seg->playlist,"w")) ) {
+  if ( !(fp = open_memstream(&buf, &size)) ) {
     status = AVERROR(errno);
     PDBG("[%s] can not write '%s': %s", objname(seg), seg->playlist, av_err2str(status));
     goto end;
@@ -271,7 +466,18 @@ static int write_hls_playlist(struct ffsegments * seg)
   for ( uint i = 0; i < seg->nb_outputs; ++i ) {
     p = seg->subplaylists[i] + rlen;
     PDBG("seg->submanifests[%u]=%s p=%s", i, seg->subplaylists[i], p );
-    fprintf(fp, "#EXT-X-STREAM-INF:PROGRAM-ID=%u,BANDWIDTH=%"PRId64"\n%s\n", i, seg->bitrates[i], p);
+
+    // codec bit_rate is only a guess until the first segments of the variant are measured
+    if ( seg->meter ) {
+      ffsegmeter_get_bitrate(seg->meter, i, &peak, &average);
+    }
+
+    if ( peak > 0 ) {
+      fprintf(fp, "#EXT-X-STREAM-INF:PROGRAM-ID=%u,BANDWIDTH=%"PRId64",AVERAGE-BANDWIDTH=%"PRId64"\n%s\n", i, peak, average, p);
+    }
+    else {
+      fprintf(fp, "#EXT-X-STREAM-INF:PROGRAM-ID=%u,BANDWIDTH=%"PRId64"\n%s\n", i, seg->bitrates[i], p);
+    }
   }
 
 end:
@@ -280,15 +486,104 @@ end:
     fclose(fp);
   }
 
+  if ( buf ) {
+    if ( !status ) {
+      status = seg->store ? ffsegstore_put(seg->store, seg->playlist, buf, size) :
+          ffsegwriter_put(seg->playlist, buf, size);
+      if ( status ) {
+        PDBG("[%s] can not store '%s': %s", objname(seg), seg->playlist, av_err2str(status));
+      }
+    }
+    free(buf);
+  }
+
   return status;
 }
 
+// master playlist with measured variant bitrates, pinned in store like the initial one
+static void update_hls_playlist(struct ffsegments * seg)
+{
+  int status;
+
+  if ( seg->store ) {
+    ffsegstore_set_pinning(seg->store, true);
+  }
+
+  if ( (status = write_hls_playlist(seg)) ) {
+    PDBG("[%s] write_hls_playlist() fails: %s", objname(seg), av_err2str(status));
+  }
+
+  if ( seg->store ) {
+    ffsegstore_set_pinning(seg->store, false);
+  }
+}
+
 static void cleanup_segment_files(struct ffsegments * seg)
 {
-  if ( seg->prefix && *seg->prefix && seg->playlistpath ) {
+  if ( !seg->store && seg->prefix && *seg->prefix && seg->playlistpath ) {
     char mask[128];
     sprintf(mask,"%s*", seg->prefix);
-    unlink_files(seg->playlistpath, mask);
+    ffsegwriter_unlink_files(seg->playlistpath, mask);
+  }
+}
+
+
+static bool playlist_exists(const struct ffsegments * seg, const char * path)
+{
+  return seg->store ? ffsegstore_exists(seg->store, path) : ffsegwriter_exists(path);
+}
+
+// signal waiting http clients once main playlist and all variant playlists are there
+static void update_playlists_ready(struct ffsegments * seg)
+{
+  if ( !playlist_exists(seg, seg->playlist) ) {
+    return;
+  }
+
+  if ( seg->hlsplaylist && !playlist_exists(seg, seg->hlsplaylist) ) {
+    return;
+  }
+
+  if ( seg->nb_outputs > 1 ) {
+    for ( uint i = 0; i < seg->nb_outputs; ++i ) {
+      if ( !playlist_exists(seg, seg->subplaylists[i]) ) {
+        return;
+      }
+    }
+  }
+
+  seg->playlists_ready = true;
+  coevent_set(seg->readyev);
+}
+
+
+// packets of several sources are taken in turn, all source gops signal the one event waited by w
+static int get_source_pkt(const struct ffsegments * seg, struct ffgoplistener ** gl, struct coevent_waiter * w,
+    uint * next, AVPacket * pkt)
+{
+  uint k;
+  int status;
+
+  if ( seg->nb_sources == 1 ) {
+    return ffgop_get_pkt(gl[0], pkt);
+  }
+
+  while ( 42 ) {
+
+    for ( uint i = 0; i < seg->nb_sources; ++i ) {
+
+      k = (*next + i) % seg->nb_sources;
+
+      if ( (status = ffgop_poll_pkt(gl[k], pkt)) != AVERROR(EAGAIN) ) {
+        if ( status == 0 ) {
+          pkt->stream_index += seg->sstart[k];
+          *next = k + 1;
+        }
+        return status;
+      }
+    }
+
+    coevent_wait(w, -1);
   }
 }
 
@@ -297,9 +592,13 @@ static void segments_thread(void * arg)
 {
   struct ffsegments * seg = arg;
   struct ffgop * gop = NULL;
-  struct ffgoplistener * gl = NULL;
+  struct ffgoplistener ** gl = NULL;
+  struct ffinterleaver ** il = NULL;
+  struct coevent * srcev = NULL;
+  struct coevent_waiter * srcw = NULL;
+  uint nextsource = 0;
 
-  AVPacket pkt;
+  AVPacket pkt, ipkt;
 
   int64_t firstdts = AV_NOPTS_VALUE;
   int64_t * tsoffset = NULL;
@@ -311,21 +610,41 @@ static void segments_thread(void * arg)
   av_init_packet(&pkt);
   pkt.data = NULL, pkt.size = 0;
 
+  av_init_packet(&ipkt);
+  ipkt.data = NULL, ipkt.size = 0;
 
-  if ( !(gop = get_gop(seg->source)) || ffgop_get_type(gop) != ffgop_pkt ) {
-    PDBG("[%s] get_gop() fails", objname(seg));
-    status = AVERROR(EINVAL);
+  il = alloca(seg->nb_outputs * sizeof(*il));
+  memset(il, 0, seg->nb_outputs * sizeof(*il));
+
+
+  gl = alloca(seg->nb_sources * sizeof(*gl));
+  memset(gl, 0, seg->nb_sources * sizeof(*gl));
+
+  // waiter is registered before the first poll, so no put is missed
+  if ( seg->nb_sources > 1 && (!(srcev = coevent_create()) || !(srcw = coevent_add_waiter(srcev))) ) {
+    status = AVERROR(ENOMEM);
+    PDBG("[%s] coevent_create() fails: %s", objname(seg), av_err2str(status));
     goto end;
   }
 
-  status = ffgop_create_listener(gop, &gl, &(struct ffgop_create_listener_args ) {
-        .getoutspc = NULL,
-        .cookie = NULL
-      });
+  for ( uint k = 0; k < seg->nb_sources; ++k ) {
 
-  if ( status ) {
-    PDBG("[%s] ffgop_create_listener() fails: %s", objname(seg), av_err2str(status));
-    goto end;
+    if ( !(gop = get_gop(seg->sources[k])) || ffgop_get_type(gop) != ffgop_pkt ) {
+      PDBG("[%s] get_gop(%s) fails", objname(seg), get_object_name(seg->sources[k]));
+      status = AVERROR(EINVAL);
+      goto end;
+    }
+
+    status = ffgop_create_listener(gop, &gl[k], &(struct ffgop_create_listener_args ) {
+          .getoutspc = NULL,
+          .cookie = NULL,
+          .notify = srcev,
+        });
+
+    if ( status ) {
+      PDBG("[%s] ffgop_create_listener() fails: %s", objname(seg), av_err2str(status));
+      goto end;
+    }
   }
 
   tsoffset = alloca(seg->nb_input_streams * sizeof(*tsoffset));
@@ -333,6 +652,11 @@ static void segments_thread(void * arg)
     tsoffset[i] = AV_NOPTS_VALUE;
   }
 
+  if ( seg->store ) {
+    // master playlist and init segments are written once and never evicted from the store
+    ffsegstore_set_pinning(seg->store, true);
+  }
+
   if ( seg->ofmt == ofmt_hls && seg->nb_outputs > 1 ) {
     if ( (status = write_hls_playlist(seg)) ) {
       PDBG("[%s] write_hls_playlist() fails: %s", objname(seg), av_err2str(status));
@@ -349,6 +673,25 @@ static void segments_thread(void * arg)
       PDBG("[%s] avformat_write_header() fails: %s", objname(seg), av_err2str(status));
       goto end;
     }
+
+    if ( seg->oc[i]->nb_streams > 1 && ffsrv.interleave.bounded ) {
+
+      AVRational * tbs = alloca(seg->oc[i]->nb_streams * sizeof(*tbs));
+
+      for ( uint j = 0; j < seg->oc[i]->nb_streams; ++j ) {
+        tbs[j] = seg->oc[i]->streams[j]->time_base;
+      }
+
+      status = ffinterleaver_create(&il[i], tbs, seg->oc[i]->nb_streams, ffsrv.interleave.maxskew * 1000LL);
+      if ( status ) {
+        PDBG("[%s] ffinterleaver_create() fails: %s", objname(seg), av_err2str(status));
+        goto end;
+      }
+    }
+  }
+
+  if ( seg->store ) {
+    ffsegstore_set_pinning(seg->store, false);
   }
 
   seg->stream_state = ffsegments_state_streaming;
@@ -372,11 +715,23 @@ static void segments_thread(void * arg)
       break;
     }
 
-    if ( (status = ffgop_get_pkt(gl, &pkt)) ) {
-      PDBG("[%s] ffgop_get_pkt() fails: %s", objname(seg), av_err2str(status));
+    if ( (status = get_source_pkt(seg, gl, srcw, &nextsource, &pkt)) ) {
+      PDBG("[%s] get_source_pkt() fails: %s", objname(seg), av_err2str(status));
       break;
     }
 
+    if ( seg->llhls ) {
+      if ( (status = ffllhls_write_packet(seg->llhls, &pkt)) < 0 ) {
+        PDBG("[%s] ffllhls_write_packet() fails: %s", objname(seg), av_err2str(status));
+      }
+      if ( !seg->playlists_ready ) {
+        update_playlists_ready(seg);
+      }
+      av_packet_unref(&pkt);
+      co_yield();
+      continue;
+    }
+
     is = seg->iss[isidx = pkt.stream_index];
     pkt_pts = pkt.pts;
     pkt_dts = pkt.dts;
@@ -414,7 +769,14 @@ static void segments_thread(void * arg)
         av_packet_rescale_ts(&pkt, is->time_base, os->time_base);
       }
 
-      if ( oc->nb_streams > 1 ) {
+      if ( il[i] ) {
+        // pkt is shared between outputs, the interleaver takes its own reference
+        if ( (status = av_packet_ref(&ipkt, &pkt)) >= 0 && (status = ffinterleaver_write_frame(il[i], oc, &ipkt)) < 0 ) {
+          PDBG("[%s] ffinterleaver_write_frame() fails: %s", objname(seg), av_err2str(status));
+        }
+        av_packet_unref(&ipkt);
+      }
+      else if ( oc->nb_streams > 1 ) {
         if ( (status = av_interleaved_write_frame(oc, &pkt)) < 0 ) {
           PDBG("[%s] av_interleaved_write_frame() fails: %s", objname(seg), av_err2str(status));
         }
@@ -424,6 +786,14 @@ static void segments_thread(void * arg)
       }
     }
 
+    if ( !seg->playlists_ready ) {
+      update_playlists_ready(seg);
+    }
+
+    if ( seg->meter && ffsegmeter_check_update(seg->meter) ) {
+      update_hls_playlist(seg);
+    }
+
     av_packet_unref(&pkt);
     co_yield();
   }
@@ -431,14 +801,31 @@ static void segments_thread(void * arg)
 end:
 
   seg->stream_state = ffsegments_state_stopping;
+  coevent_set(seg->readyev);
 
   for ( uint i = 0; i < seg->nb_outputs; ++i ) {
+    if ( il && il[i] ) {
+      int64_t avg, max;
+      ffinterleaver_write_frame(il[i], seg->oc[i], NULL);
+      ffinterleaver_get_delay(il[i], &avg, &max);
+      PDBG("[%s] output %u interleaver delay: avg=%" PRId64 " max=%" PRId64 " ms", objname(seg), i, avg / 1000, max / 1000);
+      ffinterleaver_destroy(&il[i]);
+    }
     av_write_trailer(seg->oc[i]);
   }
 
   seg->stream_state = ffsegments_state_idle;
 
-  ffgop_delete_listener(&gl);
+  for ( uint k = 0; gl && k < seg->nb_sources; ++k ) {
+    ffgop_delete_listener(&gl[k]);
+  }
+
+  if ( srcev ) {
+    if ( srcw ) {
+      coevent_remove_waiter(srcev, srcw);
+    }
+    coevent_delete(&srcev);
+  }
 
   cleanup_segment_files(seg);
 
@@ -447,32 +834,214 @@ end:
 
 }
 
-int ff_get_segments_playlist_filename(struct ffsegments * seg, const char ** playlist, const char ** mimetype)
+static inline bool is_stream_active(const struct ffsegments * seg)
 {
-  uint i;
+  return seg->stream_state == ffsegments_state_starting || seg->stream_state == ffsegments_state_streaming;
+}
 
-  while ( seg->stream_state == ffsegments_state_starting ) {
-    co_sleep(100 * 1000);
-  }
+int ff_get_segments_playlist_filename(struct ffsegments * seg, const char * format, const char ** playlist, const char ** mimetype)
+{
+  struct coevent_waiter * w;
+  int64_t left, deadline;
+  int status = 0;
 
-  if ( seg->nb_outputs > 1 ) {
-    while ( seg->stream_state == ffsegments_state_streaming ) {
+  if ( !seg->playlists_ready ) {
 
-      for ( i = 0; i < seg->nb_outputs; ++i ) {
-        if ( access(seg->subplaylists[i], F_OK) != 0 ) {
-          break;
-        }
-      }
-      if ( i == seg->nb_outputs ) {
+    if ( !(w = coevent_add_waiter(seg->readyev)) ) {
+      return AVERROR(ENOMEM);
+    }
+
+    deadline = ffmpeg_gettime_us() + seg->rtmo * FFMPEG_TIME_SCALE;
+
+    while ( !seg->playlists_ready && is_stream_active(seg) ) {
+      if ( (left = deadline - ffmpeg_gettime_us()) <= 0 ) {
         break;
       }
-      co_sleep(100 * 1000);
+      coevent_wait(w, (int) ((left + 999) / 1000));
+    }
+
+    coevent_remove_waiter(seg->readyev, w);
+
+    if ( !seg->playlists_ready ) {
+      status = is_stream_active(seg) ? AVERROR(ETIMEDOUT) : AVERROR_EOF;
     }
   }
 
-  * playlist = seg->playlist;
-  * mimetype = seg->mime_type;
-  return 0;
+  if ( seg->hlsplaylist && format && (strcmp(format, "hls") == 0 || strcmp(format, "m3u8") == 0) ) {
+    * playlist = seg->hlsplaylist;
+    * mimetype = get_mime_type("hls");
+  }
+  else {
+    * playlist = seg->playlist;
+    * mimetype = seg->mime_type;
+  }
+
+  return status;
+}
+
+
+
+struct llhls_wait_args {
+  const struct ffsegments * seg;
+  int64_t msn;
+  int part;
+  int status;
+};
+
+static bool is_llhls_part_ready(void * arg)
+{
+  struct llhls_wait_args * args = arg;
+
+  if ( args->seg->stream_state != ffsegments_state_streaming ) {
+    args->status = 1; // nothing more will come, serve what we have
+  }
+  else {
+    args->status = ffllhls_check_part(args->seg->llhls, args->msn, args->part);
+  }
+
+  return args->status != 0;
+}
+
+int ff_wait_segments_playlist(struct ffsegments * seg, int64_t msn, int part)
+{
+  struct llhls_wait_args args = {
+    .seg = seg,
+    .msn = msn,
+    .part = part,
+    .status = 0,
+  };
+
+  if ( !seg->llhls ) {
+    return 0; // regular playlists are not blocking
+  }
+
+  ffsegstore_wait(seg->store, is_llhls_part_ready, &args, ffllhls_get_block_timeout(seg->llhls));
+
+  return args.status > 0 ? 0 : args.status == 0 ? AVERROR(ETIMEDOUT) : args.status;
+}
+
+
+int ff_get_segments_archive_playlist(const char * urlpath, int64_t from, int64_t to,
+    char ** text, size_t * size)
+{
+  enum ffobjtype objtype = ffobjtype_unknown;
+  ffobjparams objparams;
+  AVDictionary * opts = NULL;
+  AVDictionaryEntry * e;
+  char * basepath = NULL;
+  char * archivepath = NULL;
+  int status = 0;
+
+  // the archive is read from disk, live object and its sources are not started
+  if ( !ffdb_load_object_params(urlpath, &objtype, &objparams) || objtype != ffobjtype_segments ) {
+    status = AVERROR(ENOENT);
+    goto end;
+  }
+
+  if ( (status = ffmpeg_parse_options(objparams.segments.opts, true, &opts)) ) {
+    PDBG("[%s] ffmpeg_parse_options('%s') fails: %s", urlpath, objparams.segments.opts, av_err2str(status));
+    goto end;
+  }
+
+  if ( !(e = av_dict_get(opts, "hls_archive", NULL, 0)) ) {
+    status = AVERROR(ENOENT);
+    goto end;
+  }
+
+  if ( !(basepath = getobjpath(urlpath)) || !(archivepath = strmkpath("%s/%s", basepath, e->value)) ) {
+    status = AVERROR(ENOMEM);
+    goto end;
+  }
+
+  status = ffarchive_get_playlist(archivepath, e->value, from, to, text, size);
+
+end:
+
+  free(archivepath);
+  free(basepath);
+  av_dict_free(&opts);
+  ffdb_cleanup_object_params(objtype, &objparams);
+
+  return status;
+}
+
+
+// Files kept per rendition: playlist window, expired segments the muxer deletes later,
+// segment being written, init segment and media playlists. hls muxes all streams of an output
+// into single segments, dash writes segments per stream. Playlists without window keep
+// segments.maxfiles files per rendition.
+static uint get_store_maxfiles(const struct ffsegments * seg, const AVDictionary * opts)
+{
+  const AVDictionaryEntry * e;
+  int window, extra;
+  uint renditions = 0;
+
+  if ( seg->ofmt == ofmt_hls ) {
+    window = (e = av_dict_get(opts, "hls_list_size", NULL, 0)) ? atoi(e->value) : 5;
+    extra = (e = av_dict_get(opts, "hls_delete_threshold", NULL, 0)) ? atoi(e->value) : 1;
+  }
+  else {
+    window = (e = av_dict_get(opts, "window_size", NULL, 0)) ? atoi(e->value) : 0;
+    extra = (e = av_dict_get(opts, "extra_window_size", NULL, 0)) ? atoi(e->value) : 5;
+  }
+
+  for ( uint i = 0; i < seg->nb_outputs; ++i ) {
+    renditions += seg->ofmt == ofmt_hls ? 1 : seg->oc[i]->nb_streams;
+  }
+
+  // master playlist and encryption keys are shared by renditions
+  return renditions * (uint) (window > 0 ? window + FFMAX(extra, 0) + 4 : ffsrv.segments.maxfiles) + 4;
+}
+
+
+static int start_llhls(struct ffsegments * seg, AVDictionary * opts)
+{
+  AVDictionaryEntry * e;
+  double segtime = 2, parttime = 0.2;
+  int listsize = 5;
+  int maxfiles;
+  int status;
+
+  if ( (e = av_dict_get(opts, "hls_time", NULL, 0)) && (segtime = av_strtod(e->value, NULL)) <= 0 ) {
+    PDBG("[%s] Invalid hls_time=%s", objname(seg), e->value);
+    return AVERROR(EINVAL);
+  }
+
+  if ( (e = av_dict_get(opts, "hls_part_time", NULL, 0)) && ((parttime = av_strtod(e->value, NULL)) <= 0 || parttime > segtime) ) {
+    PDBG("[%s] Invalid hls_part_time=%s", objname(seg), e->value);
+    return AVERROR(EINVAL);
+  }
+
+  if ( (e = av_dict_get(opts, "hls_list_size", NULL, 0)) && (listsize = atoi(e->value)) < 1 ) {
+    PDBG("[%s] Invalid hls_list_size=%s", objname(seg), e->value);
+    return AVERROR(EINVAL);
+  }
+
+  // blocking reload and preload hints need the store, so llhls is never persisted.
+  // parts of about four target durations are kept besides the segments
+  maxfiles = FFMAX(ffsrv.segments.maxfiles, listsize + 8 + (int) (4 * ceil(segtime) / parttime));
+
+  if ( (status = ffsegstore_create(&seg->store, seg->playlistpath, maxfiles)) ) {
+    PDBG("[%s] ffsegstore_create() fails: %s", objname(seg), av_err2str(status));
+    return status;
+  }
+
+  status = ffllhls_create(&seg->llhls, &(struct ffllhls_params ) {
+        .store = seg->store,
+        .playlist = seg->playlist,
+        .prefix = seg->prefix,
+        .iss = seg->iss,
+        .nb_streams = seg->nb_input_streams,
+        .segtime = segtime,
+        .parttime = parttime,
+        .listsize = listsize,
+      });
+
+  if ( status ) {
+    PDBG("[%s] ffllhls_create() fails: %s", objname(seg), av_err2str(status));
+  }
+
+  return status;
 }
 
 
@@ -482,6 +1051,10 @@ static int start_segments(struct ffsegments * seg, const struct ff_create_segmen
   AVDictionaryEntry * e = NULL;
   AVOutputFormat * ofmt = NULL;
   char * segment_template_opt = NULL;
+  char * keyurl_opt = NULL;
+  char * archive_opt = NULL;
+  bool encrypt = false;
+  int rotate = 0;
   AVStream * os;
   int osidx;
 
@@ -511,7 +1084,18 @@ static int start_segments(struct ffsegments * seg, const struct ff_create_segmen
     goto end;
   }
 
-  if ( !(ofmt = av_guess_format(e->value, NULL, NULL)) ) {
+  if ( strcmp(e->value, "llhls") == 0 ) {
+    seg->ofmt = ofmt_llhls; // packaged by ffllhls, no libavformat muxer
+  }
+  else if ( strcmp(e->value, "cmaf") == 0 ) {
+    seg->ofmt = ofmt_cmaf; // dash muxer, fragments are shared by mpd and m3u8
+    if ( !(ofmt = av_guess_format("dash", NULL, NULL)) ) {
+      status = AVERROR_MUXER_NOT_FOUND;
+      PDBG("[%s] dash muxer is required for cmaf: %s", objname(seg), av_err2str(status));
+      goto end;
+    }
+  }
+  else if ( !(ofmt = av_guess_format(e->value, NULL, NULL)) ) {
     status = AVERROR_MUXER_NOT_FOUND;
     PDBG("[%s] Not supported output format '%s': %s", objname(seg), e->value, av_err2str(status));
     goto end;
@@ -522,15 +1106,54 @@ static int start_segments(struct ffsegments * seg, const struct ff_create_segmen
 
 
 
-  if ( strcmp(ofmt->name, "dash") == 0 ) {
+  if ( seg->ofmt == ofmt_cmaf ) {
+    av_dict_set(&opts, "segment_type", "mp4", 0);
+    av_dict_set(&opts, "hls_playlist", "1", 0);
+  }
+  else if ( ofmt && strcmp(ofmt->name, "dash") == 0 ) {
     seg->ofmt = ofmt_dash;
   }
-  else if ( strcmp(ofmt->name, "hls") == 0 ) {
+  else if ( ofmt && strcmp(ofmt->name, "hls") == 0 ) {
     seg->ofmt = ofmt_hls;
     if ( (e = av_dict_get(opts, "hls_segment_filename", NULL, 0)) ) {
       segment_template_opt = strdup(e->value);
       av_dict_set(&opts, "hls_segment_filename", NULL, 0);
     }
+
+    // encryption is done by ffhlscrypt, muxer crypto:// output would bypass our io
+    // only full segment AES-128 is done, SAMPLE-AES would need per-NAL / per-ADTS frame encryption
+    if ( (e = av_dict_get(opts, "hls_enc", NULL, 0)) ) {
+      if ( strcmp(e->value, "0") == 0 ) {
+        encrypt = false;
+      }
+      else if ( strcmp(e->value, "1") == 0 || strcasecmp(e->value, "aes-128") == 0 ) {
+        encrypt = true;
+      }
+      else {
+        status = AVERROR(EINVAL);
+        PDBG("[%s] Unsupported hls_enc=%s, expected 0, 1 or aes-128", objname(seg), e->value);
+        goto end;
+      }
+      av_dict_set(&opts, "hls_enc", NULL, 0);
+    }
+    if ( (e = av_dict_get(opts, "hls_enc_key_url", NULL, 0)) ) {
+      keyurl_opt = strdup(e->value);
+      av_dict_set(&opts, "hls_enc_key_url", NULL, 0);
+    }
+    if ( (e = av_dict_get(opts, "hls_key_rotate", NULL, 0)) ) {
+      if ( (rotate = atoi(e->value)) < 0 ) {
+        status = AVERROR(EINVAL);
+        PDBG("[%s] Invalid hls_key_rotate=%s", objname(seg), e->value);
+        goto end;
+      }
+      av_dict_set(&opts, "hls_key_rotate", NULL, 0);
+    }
+
+    // archive directory relative to object path, see ffarchive.h
+    if ( (e = av_dict_get(opts, "hls_archive", NULL, 0)) ) {
+      archive_opt = strdup(e->value);
+      av_dict_set(&opts, "hls_archive", NULL, 0);
+    }
   }
 
 
@@ -562,11 +1185,64 @@ static int start_segments(struct ffsegments * seg, const struct ff_create_segmen
     goto end;
   }
 
+  if ( seg->ofmt == ofmt_cmaf ) {
+
+    if ( !(seg->hlsplaylist = genhlsplaylistfilename(seg, args->params->manifest)) ) {
+      status = AVERROR(errno);
+      PDBG("[%s] genhlsplaylistfilename() fails: %s", objname(seg), av_err2str(status));
+      goto end;
+    }
+
+    av_dict_set(&opts, "hls_master_name", strrchr(seg->hlsplaylist, '/') + 1, 0);
+  }
+
+  if ( !ffsrv.segments.persist && seg->ofmt != ofmt_llhls ) {
+
+    // the limit is raised to the playlist windows of all renditions once outputs are created
+    if ( (status = ffsegstore_create(&seg->store, seg->playlistpath, ffsrv.segments.maxfiles)) ) {
+      PDBG("[%s] ffsegstore_create() fails: %s", objname(seg), av_err2str(status));
+      goto end;
+    }
+
+    if ( seg->ofmt == ofmt_dash || seg->ofmt == ofmt_cmaf ) {
+      // chunked CMAF: moof/mdat per frame, in-progress segments are served with chunked transfer
+      av_dict_set(&opts, "streaming", "1", AV_DICT_DONT_OVERWRITE);
+    }
+  }
+
+  if ( encrypt ) {
+
+    char * keypath;
+
+    if ( !(keypath = strmkpath("%s/%s", seg->playlistpath, seg->prefix)) ) {
+      status = AVERROR(ENOMEM);
+      goto end;
+    }
+
+    status = ffhlscrypt_create(&seg->crypt, &(struct ffhlscrypt_params ) {
+          .store = seg->store,
+          .keypath = keypath,
+          .keyurl = keyurl_opt,
+          .rotate = rotate,
+        });
+
+    free(keypath);
+
+    if ( status ) {
+      PDBG("[%s] ffhlscrypt_create() fails: %s", objname(seg), av_err2str(status));
+      goto end;
+    }
+  }
+
+  // hls and dash send deletes of expired segments through io_open() only for non-file protocols with method set,
+  // both store and disk writer io rely on it
+  av_dict_set(&opts, "method", "PUT", AV_DICT_DONT_OVERWRITE);
+
   //
   // Get input streams
   //
-  if ( (status = get_streams(args->source, &seg->iss, &seg->nb_input_streams)) ) {
-    PDBG("[%s] get_streams(source=%p) fails: %s", objname(seg), args->source, av_err2str(status));
+  if ( (status = get_input_streams(seg, args->sources, args->nb_sources)) ) {
+    PDBG("[%s] get_input_streams() fails: %s", objname(seg), av_err2str(status));
     goto end;
   }
 
@@ -582,10 +1258,60 @@ static int start_segments(struct ffsegments * seg, const struct ff_create_segmen
     }
   }
 
+  if ( archive_opt ) {
+
+    char * archivepath;
+
+    // archive is written before encryption and served as plain files
+    if ( encrypt ) {
+      status = AVERROR(EINVAL);
+      PDBG("[%s] hls_archive can not be combined with hls_enc", objname(seg));
+      goto end;
+    }
+
+    // index has single timeline, variant streams would need one archive per output
+    if ( nb_input_video_streams > 1 ) {
+      status = AVERROR(EINVAL);
+      PDBG("[%s] hls_archive is not supported for multiple video streams", objname(seg));
+      goto end;
+    }
+
+    if ( !(archivepath = strmkpath("%s/%s", seg->basepath, archive_opt)) ) {
+      status = AVERROR(ENOMEM);
+      goto end;
+    }
+
+    status = ffarchive_create(&seg->archive, archivepath, ffsrv.segments.archive_maxage);
+
+    free(archivepath);
+
+    if ( status ) {
+      PDBG("[%s] ffarchive_create() fails: %s", objname(seg), av_err2str(status));
+      goto end;
+    }
+  }
+
+
+
+  link_filters(seg);
+
+  if ( seg->ofmt == ofmt_llhls ) {
+
+    if ( seg->nb_sources > 1 ) {
+      status = AVERROR(EINVAL);
+      PDBG("[%s] llhls supports single source only", objname(seg));
+      goto end;
+    }
+
+    if ( (status = start_llhls(seg, opts)) ) {
+      goto end;
+    }
 
+    seg->nb_outputs = 0;
+  }
 
   // for hls we will send each video stream to separate output
-  if ( seg->ofmt != ofmt_hls || nb_input_video_streams < 2 ) {
+  else if ( seg->ofmt != ofmt_hls || nb_input_video_streams < 2 ) {
 
     seg->nb_outputs = 1;
 
@@ -608,8 +1334,8 @@ static int start_segments(struct ffsegments * seg, const struct ff_create_segmen
       goto end;
     }
 
-    if ( (status = avformat_alloc_output_context2(&seg->oc[0], ofmt, NULL, seg->playlist)) ) {
-      PDBG("avformat_alloc_output_context2('%s': '%s') fails: %s", ofmt->name, seg->playlist, av_err2str(status));
+    if ( (status = alloc_output_context(seg, &seg->oc[0], ofmt, seg->playlist)) ) {
+      PDBG("alloc_output_context('%s': '%s') fails: %s", ofmt->name, seg->playlist, av_err2str(status));
       goto end;
     }
 
@@ -626,8 +1352,13 @@ static int start_segments(struct ffsegments * seg, const struct ff_create_segmen
   }
   else {
 
+    uint * vsrc, * nbos;
+
     seg->nb_outputs = nb_input_video_streams;
 
+    vsrc = alloca(seg->nb_outputs * sizeof(*vsrc)); // source of output video stream
+    nbos = alloca(seg->nb_outputs * sizeof(*nbos)); // number of output streams
+
     if ( !(seg->ocsmap = calloc(seg->nb_input_streams * seg->nb_outputs, sizeof(seg->ocsmap[0]))) ) {
       status = AVERROR(errno);
       PDBG("[%s] calloc(seg->ocsmap) fails: %s", objname(seg), av_err2str(status));
@@ -669,31 +1400,60 @@ static int start_segments(struct ffsegments * seg, const struct ff_create_segmen
     //    4  [ -1  0 ]
     //    5  [  4  4 ]
 
-    for ( uint i = 0, v = 0, a = 1; i < seg->nb_input_streams; ++i ) {
+    // With several sources (encoder ladder) audio and data streams go only to the outputs
+    // of video streams from the same source; streams of sources without video go to all outputs.
+
+    for ( uint i = 0, v = 0; i < seg->nb_input_streams; ++i ) {
+      if ( seg->iss[i]->codecpar->codec_type == AVMEDIA_TYPE_VIDEO ) {
+        vsrc[v] = get_stream_source(seg, i);
+        nbos[v++] = 1;
+      }
+    }
+
+    for ( uint i = 0, v = 0; i < seg->nb_input_streams; ++i ) {
+
+      const uint src = get_stream_source(seg, i);
+      bool shared = true;
+
       if ( seg->iss[i]->codecpar->codec_type == AVMEDIA_TYPE_VIDEO ) {
         for ( uint k = 0; k < seg->nb_outputs; ++k ) {
           seg->ocsmap[i * seg->nb_outputs + k] = k == v ? 0 : -1;
         }
         ++v;
+        continue;
       }
-      else {
-        for ( uint k = 0; k < seg->nb_outputs; ++k ) {
-          seg->ocsmap[i * seg->nb_outputs + k] = a;
+
+      for ( uint k = 0; k < seg->nb_outputs; ++k ) {
+        if ( vsrc[k] == src ) {
+          shared = false;
         }
-        ++a;
+      }
+
+      for ( uint k = 0; k < seg->nb_outputs; ++k ) {
+        seg->ocsmap[i * seg->nb_outputs + k] = shared || vsrc[k] == src ? (int) nbos[k]++ : -1;
       }
     }
 
     for ( uint i = 0; i < seg->nb_outputs; ++i ) {
-
       if ( !(seg->subplaylists[i] = genplaylistfilename(seg->basepath, args->params->manifest, seg->prefix, i)) ) {
         status = AVERROR(errno);
         PDBG("[%s] genplaylistfilename() fails: %s", objname(seg), av_err2str(status));
         goto end;
       }
+    }
+
+    // BANDWIDTH of master playlist is measured from served bytes, meter joins the filter chain
+    if ( (status = ffsegmeter_create(&seg->meter, (const char * const *) seg->subplaylists, seg->nb_outputs)) ) {
+      PDBG("[%s] ffsegmeter_create() fails: %s", objname(seg), av_err2str(status));
+      goto end;
+    }
+
+    link_filters(seg);
 
-      if ( (status = avformat_alloc_output_context2(&seg->oc[i], ofmt, NULL, seg->subplaylists[i])) ) {
-        PDBG("[%s] avformat_alloc_output_context2('%s': '%s') fails: %s", objname(seg), ofmt->name, seg->subplaylists[i], av_err2str(status));
+    for ( uint i = 0; i < seg->nb_outputs; ++i ) {
+
+      if ( (status = alloc_output_context(seg, &seg->oc[i], ofmt, seg->subplaylists[i])) ) {
+        PDBG("[%s] alloc_output_context('%s': '%s') fails: %s", objname(seg), ofmt->name, seg->subplaylists[i], av_err2str(status));
         goto end;
       }
 
@@ -714,7 +1474,7 @@ static int start_segments(struct ffsegments * seg, const struct ff_create_segmen
         goto end;
       }
 
-      for ( uint j = 0; j < seg->nb_input_streams - nb_input_video_streams + 1; ++j ) {
+      for ( uint j = 0; j < nbos[i]; ++j ) {
         if ( !(os = avformat_new_stream(seg->oc[i], NULL)) ) {
           status = AVERROR(ENOMEM);
           PDBG("[%s] avformat_new_stream() fails: %s", objname(seg), av_err2str(status));
@@ -780,7 +1540,7 @@ static int start_segments(struct ffsegments * seg, const struct ff_create_segmen
     }
   }
 
-  if ( !(seg->bitrates = calloc(seg->nb_outputs, sizeof(seg->bitrates[0]))) ) {
+  if ( seg->nb_outputs && !(seg->bitrates = calloc(seg->nb_outputs, sizeof(seg->bitrates[0]))) ) {
     status = AVERROR(ENOMEM);
     PDBG("[%s] calloc(seg->bitrates) fails: %s", objname(seg), av_err2str(status));
     goto end;
@@ -795,8 +1555,19 @@ static int start_segments(struct ffsegments * seg, const struct ff_create_segmen
   }
 
 
-  seg->mime_type = get_mime_type(ofmt->name);
-  seg->source = args->source;
+  if ( seg->store && seg->nb_outputs && (status = ffsegstore_set_maxfiles(seg->store, get_store_maxfiles(seg, opts))) ) {
+    PDBG("[%s] ffsegstore_set_maxfiles() fails: %s", objname(seg), av_err2str(status));
+    goto end;
+  }
+
+  seg->mime_type = get_mime_type(ofmt ? ofmt->name : "hls");
+  if ( !(seg->sources = calloc(args->nb_sources, sizeof(*seg->sources))) ) {
+    status = AVERROR(ENOMEM);
+    goto end;
+  }
+
+  memcpy(seg->sources, args->sources, args->nb_sources * sizeof(*seg->sources));
+
   seg->itmo = args->params->itmo > 0 ? args->params->itmo : 20;
   seg->rtmo = args->params->rtmo > 0 ? args->params->rtmo : 20;
   seg->idletimeout = ffmpeg_gettime_us() + (seg->itmo + 4) * FFMPEG_TIME_SCALE;
@@ -805,6 +1576,8 @@ static int start_segments(struct ffsegments * seg, const struct ff_create_segmen
 end:
 
   free(segment_template_opt);
+  free(keyurl_opt);
+  free(archive_opt);
 
   if ( opts ) {
     av_dict_free(&opts);
@@ -827,7 +1600,7 @@ int ff_create_segments_stream(struct ffobject ** obj, const struct ff_create_seg
 
   int status = 0;
 
-  if ( !args || !args->name || !args->source || !args->params ) {
+  if ( !args || !args->name || !args->sources || args->nb_sources < 1 || !args->params ) {
     PDBG("Invalid args");
     status = AVERROR(EINVAL);
     goto end;
@@ -853,6 +1626,12 @@ int ff_create_segments_stream(struct ffobject ** obj, const struct ff_create_seg
 
   seg->stream_state = ffsegments_state_starting;
 
+  if ( !(seg->readyev = coevent_create()) ) {
+    status = AVERROR(errno);
+    PDBG("[%s] coevent_create() fails: %s", objname(seg), av_err2str(status));
+    goto end;
+  }
+
   if ( (status = start_segments(seg, args)) ) {
     PDBG("[%s] start_segments() fails: %s", objname(seg), av_err2str(status));
     goto end;
@@ -19,13 +19,30 @@ extern "C" {
 struct ffsegments;
 struct ff_create_segments_args {
   const char * name;
-  struct ffobject * source;
+  struct ffobject ** sources; // [nb_sources], references are taken over on success
+  uint nb_sources;
   const struct ffsegments_params * params;
 };
 
 
 int ff_create_segments_stream(struct ffobject ** obj, const struct ff_create_segments_args * args);
-int ff_get_segments_playlist_filename(struct ffsegments * seg, const char ** manifestname, const char ** mimetype);
+
+/* Waits up to rtmo seconds until all playlists have been written once.
+ *  format "hls" selects m3u8 playlist of f=cmaf objects, NULL for the default manifest.
+ *  Returns AVERROR(ETIMEDOUT) on timeout, AVERROR_EOF if the stream has stopped */
+int ff_get_segments_playlist_filename(struct ffsegments * seg, const char * format,
+    const char ** manifestname, const char ** mimetype);
+
+/* LL-HLS blocking playlist reload (_HLS_msn, _HLS_part < 0 if not given).
+ *  Returns 0 when the playlist can be sent, AVERROR(EINVAL) for requests too far ahead,
+ *  AVERROR(ETIMEDOUT) if the part did not appear in 3 target durations */
+int ff_wait_segments_playlist(struct ffsegments * seg, int64_t msn, int part);
+
+/* VOD playlist of archived segments of object urlpath for [from, to) wall clock window [us],
+ *  opts hls_archive=<dir>. Reads the archive index only, works while the object is not running.
+ *  Returns malloc()-ed text, AVERROR(ENOENT) if there is no archive or the window is empty */
+int ff_get_segments_archive_playlist(const char * urlpath, int64_t from, int64_t to,
+    char ** text, size_t * size);
 //int ff_get_segments_stream_state(struct ffsegments * seg);
 
 #ifdef __cplusplus
@@ -0,0 +1,231 @@
+/*
+ * ffsegmeter.c
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: amyznikov
+ */
+
+#define _GNU_SOURCE
+
+#include "ffsegmeter.h"
+#include "debug.h"
+
+
+#define SEGMETER_MAX_SEGMENTS   256
+
+// published rate is updated when measured peak differs by more than 1/SEGMETER_HYSTERESIS
+#define SEGMETER_HYSTERESIS     10
+
+
+struct segmeter_segment {
+  char * name;
+  size_t size;
+};
+
+struct segmeter_output {
+  char * playlist;
+  int64_t peak, average; // [bits/s] published
+};
+
+struct ffsegmeter {
+  struct ffsegfilter filter; // must be first
+
+  struct segmeter_segment segments[SEGMETER_MAX_SEGMENTS]; // ring
+  uint nb_segments;
+
+  struct segmeter_output * outputs;
+  uint nb_outputs;
+
+  bool updated;
+};
+
+
+static const char * basename_of(const char * path, size_t len)
+{
+  const char * name = path;
+  for ( const char * p = path; p < path + len; ++p ) {
+    if ( *p == '/' ) {
+      name = p + 1;
+    }
+  }
+  return name;
+}
+
+static const struct segmeter_segment * find_segment(const struct ffsegmeter * meter, const char * name, size_t len)
+{
+  const uint n = FFMIN(meter->nb_segments, SEGMETER_MAX_SEGMENTS);
+
+  for ( uint i = 1; i <= n; ++i ) {
+    const struct segmeter_segment * seg = &meter->segments[(meter->nb_segments - i) % SEGMETER_MAX_SEGMENTS];
+    if ( seg->name && strlen(seg->name) == len && memcmp(seg->name, name, len) == 0 ) {
+      return seg;
+    }
+  }
+
+  return NULL;
+}
+
+
+static void add_segment(struct ffsegmeter * meter, const char * path, size_t size)
+{
+  struct segmeter_segment * seg = &meter->segments[meter->nb_segments % SEGMETER_MAX_SEGMENTS];
+
+  free(seg->name);
+
+  if ( (seg->name = strdup(basename_of(path, strlen(path)))) ) {
+    seg->size = size;
+    ++meter->nb_segments;
+  }
+}
+
+
+// rates over segments listed in variant playlist
+static void measure_playlist(struct ffsegmeter * meter, struct segmeter_output * out, const uint8_t * data, size_t size)
+{
+  const struct segmeter_segment * seg;
+  const char * line, * eol, * end;
+  double duration = -1, totdur = 0;
+  int64_t totbytes = 0, peak = 0, rate;
+  char value[32];
+  size_t len;
+
+  for ( line = (const char *) data, end = line + size; line < end; line = eol ) {
+
+    if ( !(eol = memchr(line, '\n', end - line)) ) {
+      eol = end;
+    }
+    else {
+      ++eol;
+    }
+
+    for ( len = 0; line + len < eol && line[len] != '\r' && line[len] != '\n'; ++len ) {
+    }
+
+    if ( len > 8 && memcmp(line, "#EXTINF:", 8) == 0 ) {
+      snprintf(value, sizeof(value), "%.*s", (int) (len - 8), line + 8);
+      duration = strtod(value, NULL);
+    }
+    else if ( len > 0 && *line != '#' ) {
+
+      const char * name = basename_of(line, len);
+
+      if ( duration > 0 && (seg = find_segment(meter, name, line + len - name)) ) {
+        rate = (int64_t) (seg->size * 8 / duration);
+        peak = FFMAX(peak, rate);
+        totbytes += seg->size;
+        totdur += duration;
+      }
+
+      duration = -1;
+    }
+  }
+
+  if ( totdur > 0 && (!out->peak || llabs(peak - out->peak) * SEGMETER_HYSTERESIS > out->peak) ) {
+    out->peak = peak;
+    out->average = (int64_t) (totbytes * 8 / totdur);
+    meter->updated = true;
+  }
+}
+
+
+static int apply(struct ffsegfilter * filter, const char * path, uint8_t ** data, size_t * size)
+{
+  struct ffsegmeter * meter = (struct ffsegmeter *) filter;
+  const char * ext = strrchr(path, '.');
+
+  if ( !ext || strcmp(ext, ".m3u8") != 0 ) {
+    add_segment(meter, path, *size);
+  }
+  else {
+    for ( uint i = 0; i < meter->nb_outputs; ++i ) {
+      if ( strcmp(meter->outputs[i].playlist, path) == 0 ) {
+        measure_playlist(meter, &meter->outputs[i], *data, *size);
+        break;
+      }
+    }
+  }
+
+  return 0;
+}
+
+
+int ffsegmeter_create(struct ffsegmeter ** pmeter, const char * const * playlists, uint nb_playlists)
+{
+  struct ffsegmeter * meter;
+  int status = 0;
+
+  if ( !(meter = calloc(1, sizeof(*meter))) ) {
+    status = AVERROR(ENOMEM);
+    goto end;
+  }
+
+  meter->filter.apply = apply;
+
+  if ( !(meter->outputs = calloc(nb_playlists, sizeof(*meter->outputs))) ) {
+    status = AVERROR(ENOMEM);
+    goto end;
+  }
+
+  for ( meter->nb_outputs = 0; meter->nb_outputs < nb_playlists; ++meter->nb_outputs ) {
+    if ( !(meter->outputs[meter->nb_outputs].playlist = strdup(playlists[meter->nb_outputs])) ) {
+      status = AVERROR(ENOMEM);
+      goto end;
+    }
+  }
+
+end:
+
+  if ( status ) {
+    ffsegmeter_destroy(&meter);
+  }
+
+  *pmeter = meter;
+
+  return status;
+}
+
+
+void ffsegmeter_destroy(struct ffsegmeter ** meter)
+{
+  if ( meter && *meter ) {
+
+    struct ffsegmeter * m = *meter;
+
+    for ( uint i = 0; i < SEGMETER_MAX_SEGMENTS; ++i ) {
+      free(m->segments[i].name);
+    }
+
+    if ( m->outputs ) {
+      for ( uint i = 0; i < m->nb_outputs; ++i ) {
+        PDBG("output %u: peak=%" PRId64 " average=%" PRId64 " bits/s", i, m->outputs[i].peak, m->outputs[i].average);
+        free(m->outputs[i].playlist);
+      }
+      free(m->outputs);
+    }
+
+    free(m);
+
+    *meter = NULL;
+  }
+}
+
+
+struct ffsegfilter * ffsegmeter_get_filter(struct ffsegmeter * meter)
+{
+  return &meter->filter;
+}
+
+
+void ffsegmeter_get_bitrate(const struct ffsegmeter * meter, uint output, int64_t * peak, int64_t * average)
+{
+  *peak = meter->outputs[output].peak;
+  *average = meter->outputs[output].average;
+}
+
+
+bool ffsegmeter_check_update(struct ffsegmeter * meter)
+{
+  const bool updated = meter->updated;
+  meter->updated = false;
+  return updated;
+}
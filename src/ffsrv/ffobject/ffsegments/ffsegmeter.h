@@ -0,0 +1,43 @@
+/*
+ * ffsegmeter.h
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: amyznikov
+ *
+ *  Bitrate of hls variant streams measured from the bytes of segments as they are
+ *  served, as ffsegfilter at the end of the filter chain. Segment durations come
+ *  from EXTINF of variant playlists, rates are computed over the playlist window:
+ *  peak segment rate for BANDWIDTH, average for AVERAGE-BANDWIDTH of master playlist.
+ */
+
+// #pragma once
+
+#ifndef __ffsegmeter_h__
+#define __ffsegmeter_h__
+
+#include "ffsegfilter.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct ffsegmeter;
+
+/* playlists[i] is the variant playlist path of output i */
+int ffsegmeter_create(struct ffsegmeter ** meter, const char * const * playlists, uint nb_playlists);
+void ffsegmeter_destroy(struct ffsegmeter ** meter);
+
+struct ffsegfilter * ffsegmeter_get_filter(struct ffsegmeter * meter);
+
+/* Last published rates of output [bits/s], 0 if not measured yet */
+void ffsegmeter_get_bitrate(const struct ffsegmeter * meter, uint output, int64_t * peak, int64_t * average);
+
+/* true once after published rates have changed, master playlist must be rewritten */
+bool ffsegmeter_check_update(struct ffsegmeter * meter);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __ffsegmeter_h__ */
@@ -0,0 +1,893 @@
+/*
+ * ffsegstore.c
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: amyznikov
+ */
+
+#include "ffsegstore.h"
+#include "co-scheduler.h"
+#include "hashfuncs.h"
+#include "debug.h"
+#include <pthread.h>
+
+
+#define FFSEGSTORE_IO_BUF_SIZE  (32*1024)
+#define FFSEGSTORE_DIR_BUCKETS  64
+
+
+struct ffsegfile_item {
+  struct ffsegfile file; // must be first
+  struct ffsegfile_item * next;  // store order
+  struct ffsegfile_item * hnext; // store path index chain
+  uint32_t hash;
+  char * path;
+  size_t capacity;
+  int refs; // atomic, http clients release files without any store lock
+  bool pinned;
+
+  // still written by muxer: data, size and growing are guarded by the item mutex,
+  // chunked readers of this file wait on its own event
+  bool growing;
+  pthread_mutex_t mtx;
+  struct coevent * dataev;
+};
+
+// file currently being written by muxer
+struct ffsegopen {
+  struct ffsegopen * next;
+  AVIOContext * pb;
+  struct ffsegfile_item * item; // NULL for DELETE requests
+  bool published; // media files are visible while growing, playlists replace old ones on close
+};
+
+struct ffsegstore {
+  struct ffsegstore * next; // directory index chain
+  char * dir;               // playlist directory, files may be in its subdirectories
+  uint32_t dirhash;
+
+  // files, index, opened and hint are guarded by the store mutex
+  pthread_mutex_t mtx;
+  struct ffsegfile_item * files; // oldest first
+  struct ffsegfile_item ** index; // [nb_buckets] files by path
+  uint nb_buckets;
+  struct ffsegopen * opened;
+  uint nb_files, maxfiles;
+  bool pinning;
+
+  // set on every commit into this store; waiters hold store reference, so it outlives destroy
+  struct coevent * commitev;
+  int refs; // atomic
+
+  struct ffsegfilter * filter;
+
+  char * hint;
+  int hinttmo;
+};
+
+
+// stores by directory: http lookups take it shared, only create / destroy take it exclusive
+static struct ffsegstore * g_dirs[FFSEGSTORE_DIR_BUCKETS];
+static pthread_rwlock_t g_dirs_lock = PTHREAD_RWLOCK_INITIALIZER;
+
+
+
+static inline void lock(struct ffsegstore * store)
+{
+  pthread_mutex_lock(&store->mtx);
+}
+
+static inline void unlock(struct ffsegstore * store)
+{
+  pthread_mutex_unlock(&store->mtx);
+}
+
+
+static const char * get_mime_type(const char * path)
+{
+  static const struct {
+    const char * ext;
+    const char * mime;
+  } mimes[] = {
+    { ".m3u8", "application/x-mpeg"   },
+    { ".ts",   "video/MP2T"           },
+    { ".mpd",  "application/dash+xml" },
+    { ".m4s",  "video/mp4"            },
+    { ".mp4",  "video/mp4"            },
+    { ".m4a",  "audio/mp4"            },
+    { ".aac",  "audio/aac"            },
+    { ".vtt",  "text/vtt"             },
+  };
+
+  const char * ext;
+
+  if ( (ext = strrchr(path, '.')) ) {
+    for ( uint i = 0; i < sizeof(mimes) / sizeof(mimes[0]); ++i ) {
+      if ( strcmp(ext, mimes[i].ext) == 0 ) {
+        return mimes[i].mime;
+      }
+    }
+  }
+
+  return "application/octet-stream";
+}
+
+
+static inline void ref_file(struct ffsegfile_item * item)
+{
+  __atomic_add_fetch(&item->refs, 1, __ATOMIC_RELAXED);
+}
+
+static void unref_file(struct ffsegfile_item * item)
+{
+  if ( __atomic_sub_fetch(&item->refs, 1, __ATOMIC_ACQ_REL) == 0 ) {
+    coevent_delete(&item->dataev);
+    pthread_mutex_destroy(&item->mtx);
+    av_free(item->file.data);
+    free(item->path);
+    free(item);
+  }
+}
+
+static inline void ref_store(struct ffsegstore * store)
+{
+  __atomic_add_fetch(&store->refs, 1, __ATOMIC_RELAXED);
+}
+
+static void unref_store(struct ffsegstore * store)
+{
+  if ( __atomic_sub_fetch(&store->refs, 1, __ATOMIC_ACQ_REL) == 0 ) {
+    coevent_delete(&store->commitev);
+    pthread_mutex_destroy(&store->mtx);
+    free(store->index);
+    free(store->dir);
+    free(store->hint);
+    free(store);
+  }
+}
+
+static void end_growing(struct ffsegfile_item * item)
+{
+  pthread_mutex_lock(&item->mtx);
+  item->growing = false;
+  pthread_mutex_unlock(&item->mtx);
+  coevent_set(item->dataev);
+}
+
+// the following must be called under store lock
+
+static struct ffsegfile_item * lookup_file(struct ffsegstore * store, const char * path, uint32_t hash)
+{
+  struct ffsegfile_item * item;
+
+  for ( item = store->index[hash % store->nb_buckets]; item; item = item->hnext ) {
+    if ( item->hash == hash && strcmp(item->path, path) == 0 ) {
+      break;
+    }
+  }
+
+  return item;
+}
+
+static void index_file(struct ffsegstore * store, struct ffsegfile_item * item)
+{
+  struct ffsegfile_item ** bucket = &store->index[item->hash % store->nb_buckets];
+  item->hnext = *bucket;
+  *bucket = item;
+}
+
+static void unindex_file(struct ffsegstore * store, struct ffsegfile_item * item)
+{
+  struct ffsegfile_item ** pp;
+
+  for ( pp = &store->index[item->hash % store->nb_buckets]; *pp; pp = &(*pp)->hnext ) {
+    if ( *pp == item ) {
+      *pp = item->hnext;
+      break;
+    }
+  }
+}
+
+// grow path index to keep chains short for up to maxfiles files
+static int resize_index(struct ffsegstore * store, uint maxfiles)
+{
+  struct ffsegfile_item ** index, * item;
+  uint nb_buckets = 16;
+
+  while ( nb_buckets < maxfiles ) {
+    nb_buckets *= 2;
+  }
+
+  if ( nb_buckets <= store->nb_buckets ) {
+    return 0;
+  }
+
+  if ( !(index = calloc(nb_buckets, sizeof(*index))) ) {
+    return AVERROR(ENOMEM);
+  }
+
+  free(store->index);
+  store->index = index;
+  store->nb_buckets = nb_buckets;
+
+  for ( item = store->files; item; item = item->next ) {
+    index_file(store, item);
+  }
+
+  return 0;
+}
+
+static void remove_file(struct ffsegstore * store, const char * path)
+{
+  struct ffsegfile_item * item, ** pp;
+
+  if ( (item = lookup_file(store, path, djb2_s(path))) ) {
+
+    unindex_file(store, item);
+
+    for ( pp = &store->files; *pp; pp = &(*pp)->next ) {
+      if ( *pp == item ) {
+        *pp = item->next;
+        break;
+      }
+    }
+
+    --store->nb_files;
+    unref_file(item);
+  }
+}
+
+// drop oldest not pinned files above maxfiles
+static void evict_files(struct ffsegstore * store)
+{
+  struct ffsegfile_item * item, ** pp;
+
+  for ( pp = &store->files; store->nb_files > store->maxfiles && (item = *pp); ) {
+    if ( item->pinned ) {
+      pp = &item->next;
+    }
+    else {
+      *pp = item->next;
+      unindex_file(store, item);
+      --store->nb_files;
+      unref_file(item);
+    }
+  }
+}
+
+static bool is_playlist(const char * path)
+{
+  const char * ext = strrchr(path, '.');
+  return ext && (strcmp(ext, ".m3u8") == 0 || strcmp(ext, ".mpd") == 0);
+}
+
+
+static struct ffsegfile_item * create_item(const char * path, bool pinned)
+{
+  struct ffsegfile_item * item;
+
+  if ( !(item = calloc(1, sizeof(*item))) || !(item->path = strdup(path)) ) {
+    free(item);
+    return NULL;
+  }
+
+  item->file.mime = get_mime_type(item->path);
+  item->hash = djb2_s(item->path);
+  item->refs = 1;
+  item->pinned = pinned;
+  pthread_mutex_init(&item->mtx, NULL);
+
+  return item;
+}
+
+// replaces file with the same path, the store takes the item reference
+static void insert_item(struct ffsegstore * store, struct ffsegfile_item * item)
+{
+  struct ffsegfile_item ** pp;
+
+  remove_file(store, item->path);
+
+  for ( pp = &store->files; *pp; pp = &(*pp)->next ) {
+  }
+
+  *pp = item;
+  index_file(store, item);
+  ++store->nb_files;
+
+  evict_files(store);
+
+  coevent_set(store->commitev);
+}
+
+// takes ownership of av_malloc()-ed data
+static int commit_file(struct ffsegstore * store, const char * path, uint8_t * data, size_t size, bool pinned)
+{
+  struct ffsegfile_item * item;
+
+  if ( !(item = create_item(path, pinned)) ) {
+    av_free(data);
+    return AVERROR(ENOMEM);
+  }
+
+  item->file.data = data;
+  item->file.size = item->capacity = size;
+
+  insert_item(store, item);
+
+  return 0;
+}
+
+
+
+// AVIO write callback: muxer output is appended to the file, published files under the item lock
+static int store_io_write(void * opaque, uint8_t * buf, int buf_size)
+{
+  struct ffsegopen * op = opaque;
+  struct ffsegfile_item * item;
+  int status = 0;
+
+  if ( !(item = op->item) ) {
+    return 0;
+  }
+
+  if ( op->published ) {
+    pthread_mutex_lock(&item->mtx);
+  }
+
+  if ( item->file.size + buf_size > item->capacity ) {
+
+    size_t capacity = FFMAX(item->file.size + buf_size, FFMAX(2 * item->capacity, 64 * 1024));
+    uint8_t * p;
+
+    if ( !(p = av_realloc(item->file.data, capacity)) ) {
+      status = AVERROR(ENOMEM);
+      goto end;
+    }
+
+    item->file.data = p;
+    item->capacity = capacity;
+  }
+
+  memcpy(item->file.data + item->file.size, buf, buf_size);
+  item->file.size += buf_size;
+
+end:
+
+  if ( op->published ) {
+    pthread_mutex_unlock(&item->mtx);
+    coevent_set(item->dataev); // wake chunked readers of this file
+  }
+
+  return status;
+}
+
+
+static void free_open(struct ffsegopen * op)
+{
+  if ( op->pb ) {
+    av_freep(&op->pb->buffer);
+    av_freep(&op->pb);
+  }
+  if ( op->item ) {
+    unref_file(op->item);
+  }
+  free(op);
+}
+
+
+static int store_io_open(AVFormatContext * s, AVIOContext ** pb, const char * url, int flags, AVDictionary ** options)
+{
+  struct ffsegstore * store = s->opaque;
+  struct ffsegopen * op = NULL;
+  AVDictionaryEntry * e;
+  uint8_t * iobuf = NULL;
+  bool delete = false, publish;
+  int status = 0;
+
+  *pb = NULL;
+
+  if ( strncmp(url, FFSEGSTORE_URL_PREFIX, sizeof(FFSEGSTORE_URL_PREFIX) - 1) == 0 ) {
+    url += sizeof(FFSEGSTORE_URL_PREFIX) - 1;
+  }
+
+  if ( flags & AVIO_FLAG_READ ) {
+    return AVERROR(ENOENT);
+  }
+
+  if ( options && *options && (e = av_dict_get(*options, "method", NULL, 0)) && strcmp(e->value, "DELETE") == 0 ) {
+    delete = true;
+  }
+
+  // chunked readers may follow media segments while they are written
+  publish = !delete && !is_playlist(url) && !store->filter;
+
+  if ( !(op = calloc(1, sizeof(*op))) || (!delete && !(op->item = create_item(url, store->pinning))) ) {
+    status = AVERROR(ENOMEM);
+    goto end;
+  }
+
+  if ( publish && !(op->item->dataev = coevent_create()) ) {
+    status = AVERROR(ENOMEM);
+    goto end;
+  }
+
+  if ( !(iobuf = av_malloc(FFSEGSTORE_IO_BUF_SIZE)) ) {
+    status = AVERROR(ENOMEM);
+    goto end;
+  }
+
+  if ( !(op->pb = avio_alloc_context(iobuf, FFSEGSTORE_IO_BUF_SIZE, true, op, NULL, store_io_write, NULL)) ) {
+    av_free(iobuf);
+    status = AVERROR(ENOMEM);
+    goto end;
+  }
+
+  if ( delete ) {
+    ffsegfilter_remove(store->filter, url);
+  }
+
+  lock(store);
+
+  if ( delete ) {
+    remove_file(store, url);
+  }
+  else if ( publish ) {
+    op->item->growing = true;
+    op->published = true;
+    ref_file(op->item);
+    insert_item(store, op->item);
+  }
+
+  op->next = store->opened;
+  store->opened = op;
+
+  unlock(store);
+
+  *pb = op->pb;
+
+end:
+
+  if ( status && op ) {
+    free_open(op);
+  }
+
+  return status;
+}
+
+
+static void store_io_close(AVFormatContext * s, AVIOContext * pb)
+{
+  struct ffsegstore * store = s->opaque;
+  struct ffsegopen * op, ** pp;
+
+  lock(store);
+
+  for ( pp = &store->opened; (op = *pp); pp = &op->next ) {
+    if ( op->pb == pb ) {
+      *pp = op->next;
+      break;
+    }
+  }
+
+  unlock(store);
+
+  if ( !op ) {
+    avio_close(pb);
+    return;
+  }
+
+  avio_flush(pb);
+
+  if ( op->item && !op->published && store->filter ) {
+    // not visible yet, no lock needed
+    struct ffsegfile_item * item = op->item;
+    int status;
+
+    if ( (status = ffsegfilter_apply(store->filter, item->path, &item->file.data, &item->file.size)) < 0 ) {
+      PDBG("filter('%s') fails: %s", item->path, av_err2str(status));
+      item->file.size = 0;
+    }
+
+    item->capacity = item->file.size;
+  }
+
+  lock(store);
+
+  if ( op->item ) {
+    if ( op->published ) {
+      end_growing(op->item);
+    }
+    else {
+      ref_file(op->item);
+      insert_item(store, op->item);
+    }
+  }
+
+  free_open(op);
+
+  unlock(store);
+}
+
+
+
+int ffsegstore_create(struct ffsegstore ** pstore, const char * dir, uint maxfiles)
+{
+  struct ffsegstore * store;
+  struct ffsegstore ** bucket;
+  size_t n;
+  int status = 0;
+
+  if ( !(store = calloc(1, sizeof(*store))) ) {
+    status = AVERROR(ENOMEM);
+    goto end;
+  }
+
+  pthread_mutex_init(&store->mtx, NULL);
+  store->maxfiles = maxfiles;
+  store->refs = 1;
+
+  if ( !(store->dir = strdup(dir)) || !(store->commitev = coevent_create()) ) {
+    status = AVERROR(ENOMEM);
+    goto end;
+  }
+
+  for ( n = strlen(store->dir); n > 1 && store->dir[n - 1] == '/'; ) {
+    store->dir[--n] = 0;
+  }
+
+  store->dirhash = djb2(store->dir, n);
+
+  if ( (status = resize_index(store, maxfiles)) ) {
+    goto end;
+  }
+
+  pthread_rwlock_wrlock(&g_dirs_lock);
+  bucket = &g_dirs[store->dirhash % FFSEGSTORE_DIR_BUCKETS];
+  store->next = *bucket;
+  *bucket = store;
+  pthread_rwlock_unlock(&g_dirs_lock);
+
+end:
+
+  if ( status && store ) {
+    unref_store(store);
+    store = NULL;
+  }
+
+  *pstore = store;
+
+  return status;
+}
+
+
+void ffsegstore_destroy(struct ffsegstore ** pstore)
+{
+  struct ffsegstore * store, ** pp;
+  struct ffsegfile_item * item;
+  struct ffsegopen * op;
+
+  if ( pstore && (store = *pstore) ) {
+
+    pthread_rwlock_wrlock(&g_dirs_lock);
+
+    for ( pp = &g_dirs[store->dirhash % FFSEGSTORE_DIR_BUCKETS]; *pp; pp = &(*pp)->next ) {
+      if ( *pp == store ) {
+        *pp = store->next;
+        break;
+      }
+    }
+
+    pthread_rwlock_unlock(&g_dirs_lock);
+
+    lock(store);
+
+    // release chunked readers
+    while ( (item = store->files) ) {
+      store->files = item->next;
+      if ( item->dataev ) {
+        end_growing(item);
+      }
+      unref_file(item);
+    }
+
+    memset(store->index, 0, store->nb_buckets * sizeof(*store->index));
+    store->nb_files = 0;
+
+    while ( (op = store->opened) ) {
+      store->opened = op->next;
+      if ( op->published ) {
+        end_growing(op->item);
+      }
+      free_open(op);
+    }
+
+    unlock(store);
+
+    coevent_set(store->commitev);
+    unref_store(store);
+
+    *pstore = NULL;
+  }
+}
+
+
+void ffsegstore_attach_context(struct ffsegstore * store, AVFormatContext * oc)
+{
+  oc->opaque = store;
+  oc->io_open = store_io_open;
+  oc->io_close = store_io_close;
+}
+
+
+void ffsegstore_set_filter(struct ffsegstore * store, struct ffsegfilter * filter)
+{
+  store->filter = filter;
+}
+
+
+void ffsegstore_set_pinning(struct ffsegstore * store, bool pinning)
+{
+  store->pinning = pinning;
+}
+
+
+int ffsegstore_set_maxfiles(struct ffsegstore * store, uint maxfiles)
+{
+  int status;
+
+  lock(store);
+
+  if ( (status = resize_index(store, maxfiles)) == 0 ) {
+    store->maxfiles = maxfiles;
+    evict_files(store);
+  }
+
+  unlock(store);
+
+  return status;
+}
+
+
+int ffsegstore_put(struct ffsegstore * store, const char * path, const void * data, size_t size)
+{
+  uint8_t * copy;
+  int status;
+
+  if ( !(copy = av_malloc(FFMAX(size, 1))) ) {
+    return AVERROR(ENOMEM);
+  }
+
+  memcpy(copy, data, size);
+
+  lock(store);
+  status = commit_file(store, path, copy, size, store->pinning);
+  unlock(store);
+
+  return status;
+}
+
+
+void ffsegstore_remove(struct ffsegstore * store, const char * path)
+{
+  lock(store);
+  remove_file(store, path);
+  unlock(store);
+}
+
+
+void ffsegstore_set_hint(struct ffsegstore * store, const char * path, int tmo_ms)
+{
+  char * hint = path ? strdup(path) : NULL;
+
+  lock(store);
+  free(store->hint);
+  store->hint = hint;
+  store->hinttmo = tmo_ms;
+  unlock(store);
+}
+
+
+bool ffsegstore_exists(struct ffsegstore * store, const char * path)
+{
+  const struct ffsegfile_item * item;
+
+  lock(store);
+  item = lookup_file(store, path, djb2_s(path));
+  unlock(store);
+
+  return item != NULL;
+}
+
+
+// stores of each parent directory of path are checked, nearest first; hint store is returned referenced
+static struct ffsegfile_item * find_file(const char * path, struct ffsegstore ** hintstore)
+{
+  struct ffsegstore * store;
+  struct ffsegfile_item * item = NULL;
+  const uint32_t hash = djb2_s(path);
+  uint32_t dirhash;
+  size_t n = strlen(path);
+
+  pthread_rwlock_rdlock(&g_dirs_lock);
+
+  while ( !item && n > 0 ) {
+
+    while ( n > 0 && path[--n] != '/' ) {
+    }
+
+    if ( n == 0 ) {
+      break;
+    }
+
+    dirhash = djb2(path, n);
+
+    for ( store = g_dirs[dirhash % FFSEGSTORE_DIR_BUCKETS]; store && !item; store = store->next ) {
+
+      if ( store->dirhash != dirhash || strncmp(store->dir, path, n) != 0 || store->dir[n] ) {
+        continue;
+      }
+
+      lock(store);
+
+      if ( (item = lookup_file(store, path, hash)) ) {
+        ref_file(item);
+      }
+      else if ( hintstore && !*hintstore && store->hint && store->hinttmo > 0 && strcmp(store->hint, path) == 0 ) {
+        ref_store(store);
+        *hintstore = store;
+      }
+
+      unlock(store);
+    }
+  }
+
+  pthread_rwlock_unlock(&g_dirs_lock);
+
+  return item;
+}
+
+
+struct find_file_args {
+  const char * path;
+  struct ffsegfile_item * item;
+};
+
+static bool is_file_ready(void * arg)
+{
+  struct find_file_args * args = arg;
+  args->item = find_file(args->path, NULL);
+  return args->item != NULL;
+}
+
+
+static bool wait_store(struct ffsegstore * store, bool (*ready)(void * arg), void * arg, int tmo_ms);
+
+const struct ffsegfile * ffsegstore_get_file(const char * path)
+{
+  struct find_file_args args = { .path = path, .item = NULL };
+  struct ffsegstore * hintstore = NULL;
+
+  args.item = find_file(path, &hintstore);
+
+  if ( hintstore ) {
+
+    if ( !args.item ) {
+      wait_store(hintstore, is_file_ready, &args, hintstore->hinttmo);
+    }
+
+    unref_store(hintstore);
+  }
+
+  return args.item ? &args.item->file : NULL;
+}
+
+
+bool ffsegstore_is_growing(const struct ffsegfile * file)
+{
+  struct ffsegfile_item * item = (struct ffsegfile_item *) file;
+  bool growing;
+
+  pthread_mutex_lock(&item->mtx);
+  growing = item->growing;
+  pthread_mutex_unlock(&item->mtx);
+
+  return growing;
+}
+
+
+// copy available bytes under the item lock, false if nothing yet and the file is still growing
+static bool read_data(struct ffsegfile_item * item, size_t offset, void * buf, size_t size, ssize_t * n)
+{
+  bool ready;
+
+  pthread_mutex_lock(&item->mtx);
+
+  if ( offset < item->file.size ) {
+    memcpy(buf, item->file.data + offset, *n = FFMIN(size, item->file.size - offset));
+    ready = true;
+  }
+  else {
+    *n = 0;
+    ready = !item->growing;
+  }
+
+  pthread_mutex_unlock(&item->mtx);
+
+  return ready;
+}
+
+ssize_t ffsegstore_read(const struct ffsegfile * file, size_t offset, void * buf, size_t size, int tmo_ms)
+{
+  struct ffsegfile_item * item = (struct ffsegfile_item *) file;
+  struct coevent_waiter * w;
+  int64_t deadline, left;
+  ssize_t n = 0;
+  bool fok;
+
+  if ( (fok = read_data(item, offset, buf, size, &n)) || !item->dataev ) {
+    return n;
+  }
+
+  if ( !(w = coevent_add_waiter(item->dataev)) ) {
+    return AVERROR(ENOMEM);
+  }
+
+  deadline = ffmpeg_gettime_us() + tmo_ms * 1000LL;
+
+  // waiter is registered before the check, so a write in between is not missed
+  while ( !(fok = read_data(item, offset, buf, size, &n)) && (left = deadline - ffmpeg_gettime_us()) > 0 ) {
+    coevent_wait(w, (int) ((left + 999) / 1000));
+  }
+
+  coevent_remove_waiter(item->dataev, w);
+
+  return fok ? n : AVERROR(ETIMEDOUT);
+}
+
+
+void ffsegstore_release_file(const struct ffsegfile ** file)
+{
+  if ( file && *file ) {
+    unref_file((struct ffsegfile_item *) *file);
+    *file = NULL;
+  }
+}
+
+
+// caller holds store reference
+static bool wait_store(struct ffsegstore * store, bool (*ready)(void * arg), void * arg, int tmo_ms)
+{
+  struct coevent_waiter * w;
+  int64_t deadline, left;
+  bool fok;
+
+  if ( (fok = ready(arg)) ) {
+    return fok;
+  }
+
+  if ( !(w = coevent_add_waiter(store->commitev)) ) {
+    return false;
+  }
+
+  deadline = ffmpeg_gettime_us() + tmo_ms * 1000LL;
+
+  // waiter is registered before the check, so a commit in between is not missed
+  while ( !(fok = ready(arg)) && (left = deadline - ffmpeg_gettime_us()) > 0 ) {
+    coevent_wait(w, (int) ((left + 999) / 1000));
+  }
+
+  coevent_remove_waiter(store->commitev, w);
+
+  return fok;
+}
+
+bool ffsegstore_wait(struct ffsegstore * store, bool (*ready)(void * arg), void * arg, int tmo_ms)
+{
+  bool fok;
+
+  ref_store(store);
+  fok = wait_store(store, ready, arg, tmo_ms);
+  unref_store(store);
+
+  return fok;
+}
@@ -0,0 +1,87 @@
+/*
+ * ffsegstore.h
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: amyznikov
+ *
+ *  In-memory store of hls/dash segments and playlists.
+ *  The store is owned by ffsegments object and attached to its muxer contexts through
+ *  custom io_open()/io_close(), so libavformat never touches the disk. Files are looked up
+ *  by absolute path (as if they were under db.root) and reference counted, so a file being
+ *  sent to http client survives its replacement or deletion by muxer.
+ *  Stores are indexed by their playlist directory and files by path inside each store,
+ *  so http lookups never scan files and never serialize on a global lock.
+ */
+
+// #pragma once
+
+#ifndef __ffsegstore_h__
+#define __ffsegstore_h__
+
+#include "ffmpeg.h"
+#include "ffsegfilter.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+/* Muxer url prefix for in-memory files: unknown protocol keeps hls/dash off the
+ * rename/unlink file paths and routes everything through io_open() */
+#define FFSEGSTORE_URL_PREFIX  "mem:"
+
+struct ffsegstore;
+
+/* data and size may be used directly only when the file is not growing */
+struct ffsegfile {
+  uint8_t * data;
+  size_t size;
+  const char * mime;
+};
+
+
+/* dir : playlist directory, all files of the store are created in it or in its subdirectories */
+int ffsegstore_create(struct ffsegstore ** store, const char * dir, uint maxfiles);
+void ffsegstore_destroy(struct ffsegstore ** store);
+
+/* Redirect muxer file io into the store */
+void ffsegstore_attach_context(struct ffsegstore * store, AVFormatContext * oc);
+
+/* Muxer files are passed through the filter on close and become visible only when complete */
+void ffsegstore_set_filter(struct ffsegstore * store, struct ffsegfilter * filter);
+
+/* Files created while pinning is on (init segments) are never evicted by maxfiles limit */
+void ffsegstore_set_pinning(struct ffsegstore * store, bool pinning);
+
+/* Change the file limit once the muxer outputs are known, oldest files above it are dropped */
+int ffsegstore_set_maxfiles(struct ffsegstore * store, uint maxfiles);
+
+int ffsegstore_put(struct ffsegstore * store, const char * path, const void * data, size_t size);
+void ffsegstore_remove(struct ffsegstore * store, const char * path);
+bool ffsegstore_exists(struct ffsegstore * store, const char * path);
+
+/* Announce the file to be committed next (LL-HLS preload hint):
+ *  lookups of this path wait up to tmo_ms for it instead of failing */
+void ffsegstore_set_hint(struct ffsegstore * store, const char * path, int tmo_ms);
+
+/* Lookup over all stores, the returned file must be released */
+const struct ffsegfile * ffsegstore_get_file(const char * path);
+void ffsegstore_release_file(const struct ffsegfile ** file);
+
+/* True while muxer still writes the file */
+bool ffsegstore_is_growing(const struct ffsegfile * file);
+
+/* Copy file bytes from offset, waiting up to tmo_ms for growing file data.
+ *  Returns number of bytes copied, 0 at the end of complete file, AVERROR(ETIMEDOUT) */
+ssize_t ffsegstore_read(const struct ffsegfile * file, size_t offset, void * buf, size_t size, int tmo_ms);
+
+/* Block calling coroutine until ready(arg) returns true, re-checked on each commit to the store.
+ * Returns false on timeout */
+bool ffsegstore_wait(struct ffsegstore * store, bool (*ready)(void * arg), void * arg, int tmo_ms);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __ffsegstore_h__ */
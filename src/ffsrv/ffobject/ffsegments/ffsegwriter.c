@@ -0,0 +1,577 @@
+/*
+ * ffsegwriter.c
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: amyznikov
+ */
+
+#define _GNU_SOURCE
+
+#include "ffsegwriter.h"
+#include "ffcfg.h"
+#include "co-scheduler.h"
+#include "pathfuncs.h"
+#include "strfuncs.h"
+#include "debug.h"
+#include <pthread.h>
+#include <fcntl.h>
+#include <fnmatch.h>
+#include <unistd.h>
+
+
+enum segjob_type {
+  segjob_write,
+  segjob_append,
+  segjob_unlink,
+  segjob_unlink_files,
+  segjob_call,
+};
+
+struct segjob {
+  struct segjob * next;
+  enum segjob_type type;
+  char * path;
+  char * wildcard;
+  uint8_t * data; // av_malloc()-ed
+  size_t size;
+  void (*fn)(void * arg);
+  void * arg;
+};
+
+// file currently being written by muxer
+struct segopen {
+  struct segopen * next;
+  AVIOContext * pb;
+  char * path; // NULL for DELETE requests
+};
+
+// playlist written to disk
+struct segplaylist {
+  struct segplaylist * next;
+  char * path;
+};
+
+
+static struct segjob * g_jobs = NULL, ** g_jobs_tail = &g_jobs;
+static uint g_nb_jobs = 0;
+static struct segopen * g_opened = NULL;
+static struct segplaylist * g_playlists = NULL;
+static bool g_started = false;
+
+static pthread_mutex_t g_mtx = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t g_cond = PTHREAD_COND_INITIALIZER;
+
+
+static inline void lock(void)
+{
+  pthread_mutex_lock(&g_mtx);
+}
+
+static inline void unlock(void)
+{
+  pthread_mutex_unlock(&g_mtx);
+}
+
+
+static bool is_playlist(const char * path)
+{
+  const char * ext = strrchr(path, '.');
+  return ext && (strcmp(ext, ".m3u8") == 0 || strcmp(ext, ".mpd") == 0);
+}
+
+
+static void free_job(struct segjob * job)
+{
+  av_free(job->data);
+  free(job->path);
+  free(job->wildcard);
+  free(job);
+}
+
+
+// must be called under lock
+static void forget_playlists(const char * pattern)
+{
+  struct segplaylist * pl, ** pp;
+
+  for ( pp = &g_playlists; (pl = *pp); ) {
+    if ( fnmatch(pattern, pl->path, FNM_PATHNAME) != 0 ) {
+      pp = &pl->next;
+    }
+    else {
+      *pp = pl->next;
+      free(pl->path);
+      free(pl);
+    }
+  }
+}
+
+// must be called under lock
+static void remember_playlist(const char * path)
+{
+  struct segplaylist * pl;
+
+  for ( pl = g_playlists; pl; pl = pl->next ) {
+    if ( strcmp(pl->path, path) == 0 ) {
+      return;
+    }
+  }
+
+  if ( (pl = calloc(1, sizeof(*pl))) && (pl->path = strdup(path)) ) {
+    pl->next = g_playlists;
+    g_playlists = pl;
+  }
+  else {
+    free(pl);
+  }
+}
+
+
+// missing parent directories are created (archive time buckets)
+static int open_file(const char * path, int flags)
+{
+  char * dir;
+  int fd;
+
+  if ( (fd = open(path, flags | O_CLOEXEC, 0644)) < 0 && errno == ENOENT && (dir = strdirname(path)) ) {
+    if ( create_path(DEFAULT_MKDIR_MODE, dir) ) {
+      fd = open(path, flags | O_CLOEXEC, 0644);
+    }
+    free(dir);
+  }
+
+  if ( fd < 0 ) {
+    PDBG("open('%s') fails: %s", path, strerror(errno));
+  }
+
+  return fd;
+}
+
+static bool write_all(int fd, const uint8_t * data, size_t size)
+{
+  ssize_t cb;
+
+  while ( size > 0 ) {
+    if ( (cb = write(fd, data, size)) < 0 ) {
+      if ( errno == EINTR ) {
+        continue;
+      }
+      return false;
+    }
+    data += cb;
+    size -= cb;
+  }
+
+  return true;
+}
+
+static bool append_file(const char * path, const uint8_t * data, size_t size)
+{
+  int fd;
+  bool fok;
+
+  if ( (fd = open_file(path, O_WRONLY | O_CREAT | O_APPEND)) < 0 ) {
+    return false;
+  }
+
+  if ( !(fok = write_all(fd, data, size)) ) {
+    PDBG("write('%s') fails: %s", path, strerror(errno));
+  }
+
+  close(fd);
+
+  return fok;
+}
+
+static bool write_file(const char * path, const uint8_t * data, size_t size)
+{
+  char * tmp = NULL;
+  int fd = -1;
+  bool fok = false;
+
+  if ( asprintf(&tmp, "%s.tmp", path) < 0 ) {
+    tmp = NULL;
+    goto end;
+  }
+
+  if ( (fd = open_file(tmp, O_WRONLY | O_CREAT | O_TRUNC)) < 0 ) {
+    goto end;
+  }
+
+  if ( !write_all(fd, data, size) ) {
+    PDBG("write('%s') fails: %s", tmp, strerror(errno));
+    goto end;
+  }
+
+  close(fd), fd = -1;
+
+  if ( rename(tmp, path) != 0 ) {
+    PDBG("rename('%s') fails: %s", tmp, strerror(errno));
+    goto end;
+  }
+
+  fok = true;
+
+end:
+
+  if ( fd != -1 ) {
+    close(fd);
+  }
+
+  if ( tmp ) {
+    if ( !fok ) {
+      unlink(tmp);
+    }
+    free(tmp);
+  }
+
+  return fok;
+}
+
+
+static void * writer_thread(void * arg)
+{
+  struct segjob * job;
+  char * pattern;
+
+  (void) (arg);
+
+  pthread_detach(pthread_self());
+
+  lock();
+
+  while ( 42 ) {
+
+    while ( !(job = g_jobs) ) {
+      pthread_cond_wait(&g_cond, &g_mtx);
+    }
+
+    if ( !(g_jobs = job->next) ) {
+      g_jobs_tail = &g_jobs;
+    }
+
+    --g_nb_jobs;
+    pthread_cond_broadcast(&g_cond);
+
+    unlock();
+
+    switch ( job->type ) {
+
+      case segjob_write :
+        if ( write_file(job->path, job->data, job->size) && is_playlist(job->path) ) {
+          lock();
+          remember_playlist(job->path);
+          unlock();
+        }
+      break;
+
+      case segjob_append :
+        append_file(job->path, job->data, job->size);
+      break;
+
+      case segjob_unlink :
+        lock();
+        forget_playlists(job->path);
+        unlock();
+        unlink(job->path);
+      break;
+
+      case segjob_unlink_files :
+        if ( asprintf(&pattern, "%s/%s", job->path, job->wildcard) >= 0 ) {
+          lock();
+          forget_playlists(pattern);
+          unlock();
+          free(pattern);
+        }
+        unlink_files(job->path, job->wildcard);
+      break;
+
+      case segjob_call :
+        job->fn(job->arg);
+      break;
+    }
+
+    free_job(job);
+
+    lock();
+  }
+
+  unlock();
+
+  return NULL;
+}
+
+
+// must be called from coroutine, yields the core while the queue is full
+static int enqueue(struct segjob * job)
+{
+  const uint maxjobs = FFMAX(ffsrv.segments.ioqueue, 1);
+  pthread_t pid;
+  int status = 0;
+
+  lock();
+
+  if ( !g_started ) {
+    if ( (status = pthread_create(&pid, NULL, writer_thread, NULL)) ) {
+      PDBG("pthread_create(writer_thread) fails: %s", strerror(status));
+      status = AVERROR(status);
+      goto end;
+    }
+    g_started = true;
+  }
+
+  while ( g_nb_jobs >= maxjobs ) {
+    unlock();
+    co_sleep(1000);
+    lock();
+  }
+
+  *g_jobs_tail = job;
+  g_jobs_tail = &job->next;
+  ++g_nb_jobs;
+
+  pthread_cond_broadcast(&g_cond);
+
+end:
+
+  unlock();
+
+  if ( status ) {
+    free_job(job);
+  }
+
+  return status;
+}
+
+
+static int enqueue_write(enum segjob_type type, const char * path, uint8_t * data, size_t size)
+{
+  struct segjob * job;
+
+  if ( !(job = calloc(1, sizeof(*job))) || !(job->path = strdup(path)) ) {
+    free(job);
+    av_free(data);
+    return AVERROR(ENOMEM);
+  }
+
+  job->type = type;
+  job->data = data;
+  job->size = size;
+
+  return enqueue(job);
+}
+
+static int enqueue_unlink(const char * path)
+{
+  struct segjob * job;
+
+  if ( !(job = calloc(1, sizeof(*job))) || !(job->path = strdup(path)) ) {
+    free(job);
+    return AVERROR(ENOMEM);
+  }
+
+  job->type = segjob_unlink;
+
+  return enqueue(job);
+}
+
+
+
+static int writer_io_open(AVFormatContext * s, AVIOContext ** pb, const char * url, int flags, AVDictionary ** options)
+{
+  struct segopen * op = NULL;
+  AVDictionaryEntry * e;
+  bool delete = false;
+  int status;
+
+  *pb = NULL;
+
+  if ( strncmp(url, FFSEGWRITER_URL_PREFIX, sizeof(FFSEGWRITER_URL_PREFIX) - 1) == 0 ) {
+    url += sizeof(FFSEGWRITER_URL_PREFIX) - 1;
+  }
+
+  if ( flags & AVIO_FLAG_READ ) {
+    return AVERROR(ENOENT);
+  }
+
+  if ( options && *options && (e = av_dict_get(*options, "method", NULL, 0)) && strcmp(e->value, "DELETE") == 0 ) {
+    delete = true;
+  }
+
+  if ( !(op = calloc(1, sizeof(*op))) || (!delete && !(op->path = strdup(url))) ) {
+    status = AVERROR(ENOMEM);
+    goto end;
+  }
+
+  if ( (status = avio_open_dyn_buf(&op->pb)) < 0 ) {
+    goto end;
+  }
+
+  if ( delete ) {
+    ffsegfilter_remove(s->opaque, url);
+  }
+
+  if ( delete && (status = enqueue_unlink(url)) ) {
+    uint8_t * data = NULL;
+    avio_close_dyn_buf(op->pb, &data);
+    av_free(data);
+    goto end;
+  }
+
+  lock();
+  op->next = g_opened;
+  g_opened = op;
+  unlock();
+
+  *pb = op->pb;
+  status = 0;
+
+end:
+
+  if ( status && op ) {
+    free(op->path);
+    free(op);
+  }
+
+  return status;
+}
+
+
+static void writer_io_close(AVFormatContext * s, AVIOContext * pb)
+{
+  struct ffsegfilter * filter = s->opaque;
+  struct segopen * op, ** pp;
+  uint8_t * data = NULL;
+  size_t size;
+  int status;
+
+  lock();
+
+  for ( pp = &g_opened; (op = *pp); pp = &op->next ) {
+    if ( op->pb == pb ) {
+      *pp = op->next;
+      break;
+    }
+  }
+
+  unlock();
+
+  if ( !op ) {
+    avio_close(pb);
+    return;
+  }
+
+  if ( (status = avio_close_dyn_buf(pb, &data)) < 0 || !op->path ) {
+    av_free(data);
+  }
+  else {
+
+    size = status;
+
+    if ( filter && (status = ffsegfilter_apply(filter, op->path, &data, &size)) < 0 ) {
+      PDBG("filter('%s') fails: %s", op->path, av_err2str(status));
+      av_free(data);
+    }
+    else {
+      enqueue_write(segjob_write, op->path, data, size);
+    }
+  }
+
+  free(op->path);
+  free(op);
+}
+
+
+
+void ffsegwriter_attach_context(AVFormatContext * oc, struct ffsegfilter * filter)
+{
+  oc->opaque = filter;
+  oc->io_open = writer_io_open;
+  oc->io_close = writer_io_close;
+}
+
+
+int ffsegwriter_put(const char * path, const void * data, size_t size)
+{
+  uint8_t * copy;
+
+  if ( !(copy = av_malloc(FFMAX(size, 1))) ) {
+    return AVERROR(ENOMEM);
+  }
+
+  memcpy(copy, data, size);
+
+  return enqueue_write(segjob_write, path, copy, size);
+}
+
+
+int ffsegwriter_append(const char * path, const void * data, size_t size)
+{
+  uint8_t * copy;
+
+  if ( !(copy = av_malloc(FFMAX(size, 1))) ) {
+    return AVERROR(ENOMEM);
+  }
+
+  memcpy(copy, data, size);
+
+  return enqueue_write(segjob_append, path, copy, size);
+}
+
+
+int ffsegwriter_unlink(const char * path)
+{
+  return enqueue_unlink(path);
+}
+
+
+int ffsegwriter_unlink_files(const char * path, const char * wildcard)
+{
+  struct segjob * job;
+
+  if ( !(job = calloc(1, sizeof(*job))) || !(job->path = strdup(path)) || !(job->wildcard = strdup(wildcard)) ) {
+    if ( job ) {
+      free(job->path);
+      free(job);
+    }
+    return AVERROR(ENOMEM);
+  }
+
+  job->type = segjob_unlink_files;
+
+  return enqueue(job);
+}
+
+
+int ffsegwriter_call(void (*fn)(void * arg), void * arg)
+{
+  struct segjob * job;
+
+  if ( !(job = calloc(1, sizeof(*job))) ) {
+    return AVERROR(ENOMEM);
+  }
+
+  job->type = segjob_call;
+  job->fn = fn;
+  job->arg = arg;
+
+  return enqueue(job);
+}
+
+
+bool ffsegwriter_exists(const char * path)
+{
+  const struct segplaylist * pl;
+
+  lock();
+
+  for ( pl = g_playlists; pl; pl = pl->next ) {
+    if ( strcmp(pl->path, path) == 0 ) {
+      break;
+    }
+  }
+
+  unlock();
+
+  return pl != NULL;
+}
@@ -0,0 +1,58 @@
+/*
+ * ffsegwriter.h
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: amyznikov
+ *
+ *  Asynchronous disk writer for persisted hls/dash files (segments.persist = yes) and archives.
+ *  Muxers write into memory through custom io_open()/io_close(), complete files, deletes
+ *  and cleanups are queued to single I/O thread, so no filesystem syscall runs on
+ *  scheduler cores. The queue is bounded by segments.ioqueue, the muxing coroutine
+ *  yields while it is full.
+ */
+
+// #pragma once
+
+#ifndef __ffsegwriter_h__
+#define __ffsegwriter_h__
+
+#include "ffmpeg.h"
+#include "ffsegfilter.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+/* Muxer url prefix for disk files: unknown protocol routes all io and deletes through io_open() */
+#define FFSEGWRITER_URL_PREFIX  "aio:"
+
+
+/* Redirect muxer file io to the writer thread, files are passed through optional filter on close */
+void ffsegwriter_attach_context(AVFormatContext * oc, struct ffsegfilter * filter);
+
+/* Queue file write, data is copied. The file is replaced atomically via rename() */
+int ffsegwriter_put(const char * path, const void * data, size_t size);
+
+/* Queue append to file (archive index), data is copied */
+int ffsegwriter_append(const char * path, const void * data, size_t size);
+
+/* Queue file removal */
+int ffsegwriter_unlink(const char * path);
+
+/* Queue removal of files matching wildcard in directory path */
+int ffsegwriter_unlink_files(const char * path, const char * wildcard);
+
+/* Queue fn(arg) call on the I/O thread, after all files queued before (archive cleanup).
+ *  On failure fn is not called and arg stays with the caller */
+int ffsegwriter_call(void (*fn)(void * arg), void * arg);
+
+/* True once the playlist (.m3u8, .mpd) has been written to disk by the writer thread */
+bool ffsegwriter_exists(const char * path);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __ffsegwriter_h__ */
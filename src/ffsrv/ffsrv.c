@@ -10,6 +10,7 @@
 #include "ffobject.h"
 #include "http-port.h"
 #include "rtsp-port.h"
+#include "rtmp-port.h"
 #include "ipaddrs.h"
 #include "co-scheduler.h"
 #include "debug.h"
@@ -74,6 +75,13 @@ bool ffsrv_start(void)
     }
   }
 
+  for ( size_t i = 0, n = ccarray_size(&ffsrv.rtmp.faces); i < n; ++i ) {
+    if ( !ffsrv_add_rtmp_port(ccarray_peek(&ffsrv.rtmp.faces, i)) ) {
+      PDBG("ffsrv_add_rtmp_port(%s) fails: %s", sa2str(ccarray_peek(&ffsrv.rtmp.faces, i)), strerror(errno));
+      return false;
+    }
+  }
+
   return true;
 }
 
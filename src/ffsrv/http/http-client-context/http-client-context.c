@@ -17,17 +17,21 @@
 #include "ffobject.h"
 #include "http-client-context.h"
 #include "http-get-online-stream.h"
+#include "http-ws-online-stream.h"
 #include "http-get-segments.h"
 #include "http-post-online-stream.h"
 #include "http-get-file.h"
 #include "http-get-directory.h"
 #include "http-byte-range.h"
+#include "ffsegstore.h"
 #include "sockopt.h"
 #include "strfuncs.h"
 #include "debug.h"
 
 
 #define HTTP_RXBUF_SIZE (4*1024)
+#define HTTP_CHUNK_HEADROOM     10            // "%zx\r\n" of chunk size
+#define HTTP_CHUNK_COALESCE_SIZE  (64*1024)   // don't emit smaller chunks unless forced
 #define HTTP_CLIENT_STACK_SIZE (HTTP_RXBUF_SIZE + ffsrv.mem.http_client)
 
 
@@ -145,6 +149,7 @@ void destroy_http_client_context(struct http_client_ctx * client_ctx)
     co_ssl_free(&client_ctx->ssl);
     cosocket_delete(&client_ctx->cosock);
     http_request_cleanup(&client_ctx->req);
+    free(client_ctx->chunked.buf);
 //    free(client_ctx->body);
     free(client_ctx);
 
@@ -189,6 +194,85 @@ ssize_t http_write(struct http_client_ctx * client_ctx, const void * buf, size_t
 }
 
 
+
+/*
+ * Chunked body: data accumulates behind HTTP_CHUNK_HEADROOM bytes of headroom,
+ * so that the chunk size line and trailing CRLF go out with the data in single write
+ */
+ssize_t http_write_chunked(struct http_client_ctx * client_ctx, const void * buf, size_t size)
+{
+  size_t need;
+
+  if ( !client_ctx->chunked.enabled ) {
+    return http_write(client_ctx, buf, size);
+  }
+
+  if ( (need = HTTP_CHUNK_HEADROOM + client_ctx->chunked.size + size + 2) > client_ctx->chunked.capacity ) {
+
+    size_t capacity = FFMAX(need, FFMAX(2 * client_ctx->chunked.capacity, HTTP_CHUNK_COALESCE_SIZE + HTTP_CHUNK_HEADROOM + 2));
+    uint8_t * p;
+
+    if ( !(p = realloc(client_ctx->chunked.buf, capacity)) ) {
+      errno = ENOMEM;
+      return -1;
+    }
+
+    client_ctx->chunked.buf = p;
+    client_ctx->chunked.capacity = capacity;
+  }
+
+  memcpy(client_ctx->chunked.buf + HTTP_CHUNK_HEADROOM + client_ctx->chunked.size, buf, size);
+  client_ctx->chunked.size += size;
+
+  return size;
+}
+
+/*
+ * Emit accumulated data as one chunk, unless less than HTTP_CHUNK_COALESCE_SIZE is pending and not forced
+ */
+bool http_flush_chunk(struct http_client_ctx * client_ctx, bool force)
+{
+  char hdr[HTTP_CHUNK_HEADROOM + 1];
+  uint8_t * p;
+  size_t size, n;
+
+  if ( !client_ctx->chunked.enabled || !(size = client_ctx->chunked.size) ) {
+    return true;
+  }
+
+  if ( !force && size < HTTP_CHUNK_COALESCE_SIZE ) {
+    return true;
+  }
+
+  n = snprintf(hdr, sizeof(hdr), "%zx\r\n", size);
+  p = client_ctx->chunked.buf + HTTP_CHUNK_HEADROOM - n;
+  memcpy(p, hdr, n);
+  memcpy(p + n + size, "\r\n", 2);
+
+  client_ctx->chunked.size = 0;
+
+  return http_write(client_ctx, p, n + size + 2) == (ssize_t) (n + size + 2);
+}
+
+/*
+ * Flush pending data and write last-chunk, the connection stays reusable
+ */
+bool http_end_chunked(struct http_client_ctx * client_ctx)
+{
+  bool fok = true;
+
+  if ( client_ctx->chunked.enabled ) {
+    if ( (fok = http_flush_chunk(client_ctx, true)) ) {
+      fok = http_write(client_ctx, "0\r\n\r\n", 5) == 5;
+    }
+    client_ctx->chunked.enabled = false;
+    client_ctx->chunked.size = 0;
+  }
+
+  return fok;
+}
+
+
 bool http_vssend(struct http_client_ctx * client_ctx, const char * format, va_list arglist)
 {
   char * msg = NULL;
@@ -415,6 +499,41 @@ bool http_send_200_OK_ncl(struct http_client_ctx * client_ctx, const char * cont
       hdrs ? hdrs : "");
 }
 
+/*
+ * HTTP/1.1 clients get chunked body of unknown length, so the connection can be reused
+ * after the stream ends. HTTP/1.0 falls back to the body delimited by connection close.
+ */
+bool http_send_200_OK_chunked(struct http_client_ctx * client_ctx, const char * content_type, const char * hdrs)
+{
+  if ( strcmp(client_ctx->req.proto, "HTTP/1.1") != 0 ) {
+    return http_ssend(client_ctx,
+        "%s 200 OK\r\n"
+            "Content-Type: %s\r\n"
+            "Connection: close\r\n"
+            "Server: ffsrv\r\n"
+            "%s"
+            "\r\n",
+        client_ctx->req.proto,
+        content_type,
+        hdrs ? hdrs : "");
+  }
+
+  client_ctx->chunked.enabled = true;
+  client_ctx->chunked.size = 0;
+
+  return http_ssend(client_ctx,
+      "%s 200 OK\r\n"
+          "Content-Type: %s\r\n"
+          "Transfer-Encoding: chunked\r\n"
+          "Connection: keep-alive\r\n"
+          "Server: ffsrv\r\n"
+          "%s"
+          "\r\n",
+      client_ctx->req.proto,
+      content_type,
+      hdrs ? hdrs : "");
+}
+
 
 bool http_send_206_partial_content(struct http_client_ctx * client_ctx, const char * content_type,
     size_t content_range_start, size_t content_range_end, size_t full_content_size)
@@ -521,6 +640,7 @@ static bool create_http_request_handler(struct http_client_ctx * client_ctx)
   char * mime = NULL;
 
   enum ffmagic objtype = ffmagic_unknown;
+  const struct ffsegfile * segfile = NULL;
 
   bool fok = true;
 
@@ -550,6 +670,20 @@ static bool create_http_request_handler(struct http_client_ctx * client_ctx)
 
 //  PDBG("uname=%s urlpath=%s", uname, urlpath);
 
+  // in-memory hls/dash files are served without touching the filesystem
+  if ( (abspath = strmkpath("%s/%s", ffsrv.db.root, urlpath)) && (segfile = ffsegstore_get_file(abspath)) ) {
+    if ( strcmp(q->method, "GET") == 0 ) {
+      fok = http_get_segments_file(&client_ctx->qh, client_ctx, abspath, segfile);
+    }
+    else {
+      http_send_405_not_allowed(client_ctx);
+    }
+    ffsegstore_release_file(&segfile);
+    goto end;
+  }
+
+  free(abspath), abspath = NULL;
+
   if ( !ffurl_magic(urlpath, &abspath, &objtype, &mime) ) {
     http_send_404_not_found(client_ctx);
     goto end;
@@ -563,6 +697,9 @@ static bool create_http_request_handler(struct http_client_ctx * client_ctx)
       if ( strcmp(q->method, "POST") == 0 ) {
         fok = http_post_online_stream(&client_ctx->qh, client_ctx, urlpath, urlargs);
       }
+      else if ( strcmp(q->method, "GET") == 0 && http_is_websocket_upgrade(client_ctx) ) {
+        fok = http_ws_online_stream(&client_ctx->qh, client_ctx, urlpath, urlargs);
+      }
       else if ( strcmp(q->method, "GET") == 0 ) {
         fok = http_get_online_stream(&client_ctx->qh, client_ctx, urlpath, urlargs);
       }
@@ -573,7 +710,10 @@ static bool create_http_request_handler(struct http_client_ctx * client_ctx)
 
 
     case ffmagic_enc:
-      if ( strcmp(q->method, "GET") == 0 ) {
+      if ( strcmp(q->method, "GET") == 0 && http_is_websocket_upgrade(client_ctx) ) {
+        fok = http_ws_online_stream(&client_ctx->qh, client_ctx, urlpath, urlargs);
+      }
+      else if ( strcmp(q->method, "GET") == 0 ) {
         fok = http_get_online_stream(&client_ctx->qh, client_ctx, urlpath, urlargs);
       }
       else {
@@ -724,3 +864,52 @@ end:
 
   return fok;
 }
+
+
+bool http_send_buffer(struct http_client_ctx * cctx, const void * data, size_t size, const char * mime_type, const char * range)
+{
+  const size_t maxranges = 256;
+  struct http_byte_range ranges[maxranges];
+  int numranges = 0;
+  static const char boundary[] = "--THIS_STRING_SEPARATES";
+
+  bool fok = false;
+
+  if ( range && *range && (numranges = http_parse_byte_range(range, size, ranges, maxranges)) < 0 ) {
+    return http_send_error(cctx, HTTP_416_RangeNotSatisfiable, NULL);
+  }
+
+  if ( numranges == 0 ) {
+    if ( (fok = http_send_200_OK(cctx, mime_type, size, NULL)) ) {
+      fok = http_write(cctx, data, size) == (ssize_t) size;
+    }
+  }
+  else if ( numranges == 1 ) {
+    if ( (fok = http_send_206_partial_content(cctx, mime_type, ranges[0].firstpos, ranges[0].lastpos, size)) ) {
+      size_t n = ranges[0].lastpos - ranges[0].firstpos + 1;
+      fok = http_write(cctx, (const uint8_t *) data + ranges[0].firstpos, n) == (ssize_t) n;
+    }
+  }
+  else if ( (fok = http_send_206_multipart_byteranges(cctx, boundary)) ) {
+
+    for ( int i = 0; i < numranges && fok; ++i ) {
+
+      size_t n = ranges[i].lastpos - ranges[i].firstpos + 1;
+
+      fok = http_ssend(cctx, "%s\r\n"
+          "Content-Type: %s\r\n"
+          "Content-Range: bytes %zd-%zd/%zu\r\n\r\n",
+          boundary,
+          mime_type,
+          ranges[i].firstpos,
+          ranges[i].lastpos,
+          size);
+
+      if ( fok ) {
+        fok = http_write(cctx, (const uint8_t *) data + ranges[i].firstpos, n) == (ssize_t) n;
+      }
+    }
+  }
+
+  return fok;
+}
@@ -54,6 +54,13 @@ struct http_client_ctx {
   int status;
   int so;
   int txbufsize;
+
+  // Transfer-Encoding: chunked response body
+  struct {
+    uint8_t * buf;
+    size_t size, capacity;
+    bool enabled;
+  } chunked;
 };
 
 
@@ -71,12 +78,18 @@ bool http_ssend(struct http_client_ctx * client_ctx, const char * format, ...)
 
 
 bool http_send_file(struct http_client_ctx * client_ctx, const char * fname, const char * mime_type, const char * range);
+bool http_send_buffer(struct http_client_ctx * client_ctx, const void * data, size_t size, const char * mime_type, const char * range);
 
 bool http_send_error(struct http_client_ctx * client_ctx, int status_code, const char * format, ...);
 bool http_send_error_v(struct http_client_ctx * client_ctx, int status_code, const char * format, va_list arglist);
 
 bool http_send_200_OK(struct http_client_ctx * client_ctx, const char * content_type, size_t content_length, const char * hdrs);
 bool http_send_200_OK_ncl(struct http_client_ctx * client_ctx, const char * content_type, const char * hdrs);
+bool http_send_200_OK_chunked(struct http_client_ctx * client_ctx, const char * content_type, const char * hdrs);
+
+ssize_t http_write_chunked(struct http_client_ctx * client_ctx, const void * buf, size_t size);
+bool http_flush_chunk(struct http_client_ctx * client_ctx, bool force);
+bool http_end_chunked(struct http_client_ctx * client_ctx);
 bool http_send_403_forbidden(struct http_client_ctx * client_ctx);
 bool http_send_404_not_found(struct http_client_ctx * client_ctx);
 bool http_send_405_not_allowed(struct http_client_ctx * client_ctx);
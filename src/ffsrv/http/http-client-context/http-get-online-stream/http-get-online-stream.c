@@ -8,7 +8,9 @@
 
 #include "http-get-online-stream.h"
 #include "ffoutput.h"
+#include "sockopt.h"
 #include "debug.h"
+#include <sys/socket.h>
 
 struct http_get_video_stream_context {
   struct http_request_handler base;
@@ -20,8 +22,20 @@ struct http_get_video_stream_context {
 static void on_http_get_online_stream_run(void * cookie)
 {
   struct http_get_video_stream_context * cc = cookie;
+  struct http_client_ctx * client_ctx = cc->client_ctx;
+
   if ( cc->output ) {
+
     ff_run_output_stream(cc->output);
+
+    // keep-alive: next response on this connection must not stay throttled to the stream bitrate
+    so_set_max_pacing_rate(client_ctx->so, 0);
+
+    // chunked response is complete and the connection can serve next request,
+    // otherwise the client can detect end of body only by connection close
+    if ( !client_ctx->chunked.enabled || !http_end_chunked(client_ctx) ) {
+      shutdown(client_ctx->so, SHUT_RDWR);
+    }
   }
 }
 
@@ -35,10 +49,30 @@ static int on_http_sendpkt(void * cookie, int stream_index, uint8_t * buf, int b
 {
   (void) (stream_index);
   struct http_client_ctx * client_ctx = ((struct http_get_video_stream_context *) cookie)->client_ctx;
-  ssize_t size = http_write(client_ctx, buf, buf_size);
+  ssize_t size = http_write_chunked(client_ctx, buf, buf_size);
   return (size == (ssize_t) buf_size ? 0 : AVERROR(errno));
 }
 
+// muxer flush boundary: cut chunk if enough data is coalesced
+static int on_http_flushpkts(void * cookie)
+{
+  struct http_client_ctx * client_ctx = ((struct http_get_video_stream_context *) cookie)->client_ctx;
+  return http_flush_chunk(client_ctx, false) ? 0 : AVERROR(errno);
+}
+
+// source has nothing pending: don't hold back the tail
+static void on_http_onidle(void * cookie)
+{
+  struct http_client_ctx * client_ctx = ((struct http_get_video_stream_context *) cookie)->client_ctx;
+  http_flush_chunk(client_ctx, true);
+}
+
+static int on_http_set_pacing_rate(void * cookie, uint32_t bytes_per_sec)
+{
+  struct http_client_ctx * client_ctx = ((struct http_get_video_stream_context *) cookie)->client_ctx;
+  return so_set_max_pacing_rate(client_ctx->so, bytes_per_sec) == 0 ? 0 : AVERROR(errno);
+}
+
 bool on_http_getoutspc(void * cookie, int * outspc, int * maxspc)
 {
   struct http_get_video_stream_context * cc = cookie;
@@ -86,7 +120,10 @@ bool http_get_online_stream(struct http_request_handler ** pqh,
       &(struct create_output_args ) {
             .format = ofmt && *ofmt ? ofmt : "matroska",
             .send_pkt = on_http_sendpkt,
+            .flush_pkts = on_http_flushpkts,
+            .onidle = on_http_onidle,
             .getoutspc = on_http_getoutspc,
+            .set_pacing_rate = on_http_set_pacing_rate,
             .cookie = cc,
           });
 
@@ -115,7 +152,7 @@ bool http_get_online_stream(struct http_request_handler ** pqh,
     goto end;
   }
 
-  http_send_200_OK_ncl(client_ctx, ff_get_output_mime_type(cc->output),
+  http_send_200_OK_chunked(client_ctx, ff_get_output_mime_type(cc->output),
       "Cache-Control: no-cache, no-store, must-revalidate\r\n"
           "Pragma: no-cache\r\n"
           "Expires: 0\r\n");
@@ -7,30 +7,90 @@
 
 #include "http-get-segments.h"
 #include "ffsegments.h"
+#include "strfuncs.h"
 #include "debug.h"
+#include <sys/socket.h>
 
 bool http_get_segments_stream(struct http_request_handler ** pqh,
     struct http_client_ctx * client_ctx,
     const char * urlpath,
     const char * urlargs)
 {
-  (void)(urlargs);
-
   struct ffsegments * seg = NULL;
 
   const char * manifestname = NULL;
   const char * mimetype = NULL;
+  const struct ffsegfile * file = NULL;
+
+  char format[16] = "";
+  char value[32];
+  int64_t msn = -1;
+  int part = -1;
+  int64_t from = -1, to = INT64_MAX;
+  char * text = NULL;
+  size_t size = 0;
 
   bool fok = true;
   int status = 0;
 
   *pqh = NULL;
 
-  status = create_segments_stream(&seg, urlpath);
+  // f=cmaf objects serve both manifests, ?fmt=hls selects the m3u8
+  get_url_arg(urlargs, "fmt", format, sizeof(format));
+
+  // LL-HLS blocking playlist reload
+  if ( get_url_arg(urlargs, "_HLS_msn", value, sizeof(value)) ) {
+    msn = strtoll(value, NULL, 10);
+    if ( get_url_arg(urlargs, "_HLS_part", value, sizeof(value)) ) {
+      part = atoi(value);
+    }
+  }
+
+  // archive VOD window, unix time seconds: ?from=<t0>[&to=<t1>]
+  if ( get_url_arg(urlargs, "from", value, sizeof(value)) ) {
+    from = (int64_t) (strtod(value, NULL) * 1000000);
+    if ( get_url_arg(urlargs, "to", value, sizeof(value)) ) {
+      to = (int64_t) (strtod(value, NULL) * 1000000);
+    }
+  }
+
+  // archive VOD does not need the live object
+  if ( from >= 0 ) {
+    if ( (status = ff_get_segments_archive_playlist(urlpath, from, to, &text, &size)) == 0 ) {
+      fok = http_send_buffer(client_ctx, text, size, "application/x-mpeg", NULL);
+    }
+    else {
+      PDBG("ff_get_segments_archive_playlist() fails: %s", av_err2str(status));
+      fok = status == AVERROR(ENOENT) ?
+          http_send_404_not_found(client_ctx) :
+          http_send_500_internal_server_error(client_ctx,
+              "<h1>ff_get_segments_archive_playlist('%s') fails</h1>\r\n"
+              "<p>status=%d (%s)</p>",
+              urlpath, status, av_err2str(status));
+    }
+    free(text);
+    return fok;
+  }
+
+  if ( (status = create_segments_stream(&seg, urlpath)) == 0 ) {
+    if ( (status = ff_get_segments_playlist_filename(seg, *format ? format : NULL, &manifestname, &mimetype)) ) {
+      PDBG("ff_get_segments_playlist_filename() fails: %s", av_err2str(status));
+    }
+  }
 
-  if ( status ==  0 ) {
-    ff_get_segments_playlist_filename(seg, &manifestname, &mimetype);
-    if ( (fok = http_send_file(client_ctx, manifestname, mimetype, NULL)) ) {
+  if ( status == 0 ) {
+
+    if ( msn >= 0 && (status = ff_wait_segments_playlist(seg, msn, part)) ) {
+      PDBG("ff_wait_segments_playlist(msn=%" PRId64 " part=%d) fails: %s", msn, part, av_err2str(status));
+      fok = status == AVERROR(EINVAL) ?
+          http_send_error(client_ctx, HTTP_400_BadRequest, NULL) :
+          http_send_error(client_ctx, HTTP_503_ServiceUnavailable, NULL);
+    }
+    else if ( (file = ffsegstore_get_file(manifestname)) ) {
+      fok = http_get_segments_file(pqh, client_ctx, manifestname, file);
+      ffsegstore_release_file(&file);
+    }
+    else if ( (fok = http_send_file(client_ctx, manifestname, mimetype, NULL)) ) {
       PDBG("http_send_file(%s %s) OK", mimetype, manifestname );
     }
     else {
@@ -52,6 +112,10 @@ bool http_get_segments_stream(struct http_request_handler ** pqh,
         fok = http_send_405_not_allowed(client_ctx);
       break;
 
+      case AVERROR(ETIMEDOUT) :
+        fok = http_send_error(client_ctx, HTTP_503_ServiceUnavailable, NULL);
+      break;
+
       default :
         fok = http_send_500_internal_server_error(client_ctx, false,
             "<h1>create_segments_stream('%s') fails</h1>\r\n"
@@ -65,3 +129,77 @@ bool http_get_segments_stream(struct http_request_handler ** pqh,
 
   return fok;
 }
+
+
+// max wait for the next chunk of in-progress segment
+#define SEGMENT_CHUNK_TIMEOUT_MS  10000
+#define SEGMENT_CHUNK_SIZE        (16*1024)
+
+static bool send_growing_file(struct http_client_ctx * client_ctx, const struct ffsegfile * file)
+{
+  uint8_t * buf = NULL;
+  size_t offset = 0;
+  ssize_t size;
+  bool fok = false;
+
+  // coroutine stack is small
+  if ( !(buf = malloc(SEGMENT_CHUNK_SIZE)) ) {
+    errno = ENOMEM;
+    goto end;
+  }
+
+  if ( !http_send_200_OK_chunked(client_ctx, file->mime, NULL) ) {
+    goto end;
+  }
+
+  while ( (size = ffsegstore_read(file, offset, buf, SEGMENT_CHUNK_SIZE, SEGMENT_CHUNK_TIMEOUT_MS)) > 0 ) {
+    if ( http_write_chunked(client_ctx, buf, size) < 0 || !http_flush_chunk(client_ctx, true) ) {
+      goto end;
+    }
+    offset += size;
+  }
+
+  if ( size < 0 ) {
+    PDBG("ffsegstore_read() fails: %s", av_err2str(size));
+    goto end;
+  }
+
+  if ( client_ctx->chunked.enabled ) {
+    fok = http_end_chunked(client_ctx);
+  }
+  else {
+    // HTTP/1.0: the body is delimited by connection close
+    fok = shutdown(client_ctx->so, SHUT_WR) == 0;
+  }
+
+end:
+
+  free(buf);
+
+  return fok;
+}
+
+
+bool http_get_segments_file(struct http_request_handler ** pqh,
+    struct http_client_ctx * client_ctx,
+    const char * abspath,
+    const struct ffsegfile * file)
+{
+  bool fok;
+
+  *pqh = NULL;
+
+  processaccesshooks(abspath);
+
+  if ( ffsegstore_is_growing(file) ) {
+    // chunked CMAF: forward segment bytes as muxer writes them
+    if ( !(fok = send_growing_file(client_ctx, file)) ) {
+      PDBG("send_growing_file(%s %s) fails: %s", abspath, file->mime, strerror(errno));
+    }
+  }
+  else if ( !(fok = http_send_buffer(client_ctx, file->data, file->size, file->mime, csmap_get(&client_ctx->req.parms, "Range"))) ) {
+    PDBG("http_send_buffer(%s %s %zu bytes) fails: %s", abspath, file->mime, file->size, strerror(errno));
+  }
+
+  return fok;
+}
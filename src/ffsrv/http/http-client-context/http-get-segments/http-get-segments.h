@@ -11,6 +11,7 @@
 #define __http_get_segments_h__
 
 #include "http-client-context.h"
+#include "ffsegstore.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -22,6 +23,11 @@ bool http_get_segments_stream(struct http_request_handler ** pqh,
     const char * urlpath,
     const char * urlargs);
 
+bool http_get_segments_file(struct http_request_handler ** pqh,
+    struct http_client_ctx * client_ctx,
+    const char * abspath,
+    const struct ffsegfile * file);
+
 
 #ifdef __cplusplus
 }
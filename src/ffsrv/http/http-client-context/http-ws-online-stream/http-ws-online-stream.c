@@ -0,0 +1,303 @@
+/*
+ * http-ws-online-stream.c
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: amyznikov
+ */
+
+#define _GNU_SOURCE
+#include <string.h>
+#include <sys/socket.h>
+#include <openssl/sha.h>
+#include <openssl/evp.h>
+
+#include "http-ws-online-stream.h"
+#include "ffoutput.h"
+#include "sockopt.h"
+#include "debug.h"
+
+#define WS_GUID             "258EAFA5-E914-47DA-95CA-C5AB0DC85B11"
+#define WS_FRAME_HEADROOM   10      // 2 + 8 bytes of extended payload length
+#define WS_OPCODE_BINARY    0x2
+#define WS_OPCODE_CLOSE     0x8
+#define WS_FIN              0x80
+
+
+struct http_ws_online_stream_context {
+  struct http_request_handler base;
+  struct http_client_ctx * client_ctx;
+  struct ffoutput * output;
+
+  // message payload accumulates behind WS_FRAME_HEADROOM bytes of headroom
+  uint8_t * buf;
+  size_t size, capacity;
+};
+
+
+
+// http header names are case-insensitive, but request parms are stored as sent by client
+static const char * get_header(const struct http_client_ctx * client_ctx, const char * name)
+{
+  const csmap * parms = &client_ctx->req.parms;
+
+  for ( size_t i = 0; i < parms->size; ++i ) {
+    if ( strcasecmp(parms->items[i].key, name) == 0 ) {
+      return parms->items[i].value;
+    }
+  }
+
+  return NULL;
+}
+
+
+bool http_is_websocket_upgrade(const struct http_client_ctx * client_ctx)
+{
+  const char * upgrade = get_header(client_ctx, "Upgrade");
+  return upgrade && strcasecmp(upgrade, "websocket") == 0;
+}
+
+
+
+static bool ws_send_frame(struct http_client_ctx * client_ctx, uint8_t opcode, uint8_t * buf, size_t size)
+{
+  // buf has WS_FRAME_HEADROOM bytes reserved before payload, server frames are not masked
+  uint8_t * p;
+  size_t n;
+
+  if ( size < 126 ) {
+    n = 2;
+    p = buf + WS_FRAME_HEADROOM - n;
+    p[1] = size;
+  }
+  else if ( size <= 0xFFFF ) {
+    n = 4;
+    p = buf + WS_FRAME_HEADROOM - n;
+    p[1] = 126;
+    p[2] = size >> 8, p[3] = size;
+  }
+  else {
+    n = 10;
+    p = buf + WS_FRAME_HEADROOM - n;
+    p[1] = 127;
+    for ( int i = 0; i < 8; ++i ) {
+      p[2 + i] = (uint64_t) size >> (56 - 8 * i);
+    }
+  }
+
+  p[0] = WS_FIN | opcode;
+
+  return http_write(client_ctx, p, n + size) == (ssize_t) (n + size);
+}
+
+
+static void ws_send_close(struct http_client_ctx * client_ctx)
+{
+  uint8_t buf[WS_FRAME_HEADROOM + 2];
+  buf[WS_FRAME_HEADROOM] = 1000 >> 8; // normal closure
+  buf[WS_FRAME_HEADROOM + 1] = 1000 & 0xFF;
+  ws_send_frame(client_ctx, WS_OPCODE_CLOSE, buf, 2);
+}
+
+
+
+static void on_http_ws_online_stream_run(void * cookie)
+{
+  struct http_ws_online_stream_context * cc = cookie;
+  struct http_client_ctx * client_ctx = cc->client_ctx;
+
+  if ( cc->output ) {
+
+    ff_run_output_stream(cc->output);
+
+    // the connection is not http anymore and can't serve next request
+    ws_send_close(client_ctx);
+    shutdown(client_ctx->so, SHUT_RDWR);
+  }
+}
+
+static void on_http_ws_online_stream_destroy(void * cookie)
+{
+  struct http_ws_online_stream_context * cc = cookie;
+  delete_output_stream(&cc->output);
+  free(cc->buf);
+}
+
+static int on_ws_sendpkt(void * cookie, int stream_index, uint8_t * buf, int buf_size)
+{
+  (void) (stream_index);
+
+  struct http_ws_online_stream_context * cc = cookie;
+  size_t need;
+
+  if ( (need = WS_FRAME_HEADROOM + cc->size + buf_size) > cc->capacity ) {
+
+    size_t capacity = FFMAX(need, FFMAX(2 * cc->capacity, 64 * 1024));
+    uint8_t * p;
+
+    if ( !(p = realloc(cc->buf, capacity)) ) {
+      return AVERROR(ENOMEM);
+    }
+
+    cc->buf = p;
+    cc->capacity = capacity;
+  }
+
+  memcpy(cc->buf + WS_FRAME_HEADROOM + cc->size, buf, buf_size);
+  cc->size += buf_size;
+
+  return 0;
+}
+
+// fragment boundary: everything accumulated goes out as single binary message
+static int on_ws_flushpkts(void * cookie)
+{
+  struct http_ws_online_stream_context * cc = cookie;
+  bool fok = true;
+
+  if ( cc->size > 0 ) {
+    fok = ws_send_frame(cc->client_ctx, WS_OPCODE_BINARY, cc->buf, cc->size);
+    cc->size = 0;
+  }
+
+  return fok ? 0 : AVERROR(errno);
+}
+
+static int on_ws_set_pacing_rate(void * cookie, uint32_t bytes_per_sec)
+{
+  struct http_ws_online_stream_context * cc = cookie;
+  return so_set_max_pacing_rate(cc->client_ctx->so, bytes_per_sec) == 0 ? 0 : AVERROR(errno);
+}
+
+static bool on_ws_getoutspc(void * cookie, int * outspc, int * maxspc)
+{
+  struct http_ws_online_stream_context * cc = cookie;
+  return http_getoutspc(cc->client_ctx, outspc, maxspc);
+}
+
+
+
+static bool ws_accept_key(const char * key, char accept[64])
+{
+  uint8_t sha1[SHA_DIGEST_LENGTH];
+  char tmp[128];
+
+  if ( strlen(key) + sizeof(WS_GUID) > sizeof(tmp) ) {
+    return false;
+  }
+
+  strcat(strcpy(tmp, key), WS_GUID);
+  SHA1((const uint8_t *) tmp, strlen(tmp), sha1);
+  EVP_EncodeBlock((uint8_t *) accept, sha1, SHA_DIGEST_LENGTH);
+
+  return true;
+}
+
+
+bool http_ws_online_stream(struct http_request_handler ** pqh,
+    struct http_client_ctx * client_ctx, const char * urlpath, const char * urlargs)
+{
+  struct http_ws_online_stream_context * cc = NULL;
+
+  static const struct http_request_handler_iface iface = {
+    .run = on_http_ws_online_stream_run,
+    .ondestroy = on_http_ws_online_stream_destroy,
+    .onbody = NULL,
+    .onbodycomplete = NULL,
+  };
+
+  const char * key = get_header(client_ctx, "Sec-WebSocket-Key");
+  const char * version = get_header(client_ctx, "Sec-WebSocket-Version");
+  const char * connection = get_header(client_ctx, "Connection");
+  const char * protocol = get_header(client_ctx, "Sec-WebSocket-Protocol");
+
+  char accept[64] = "";
+  char proto[128] = "";
+
+  int status = 0;
+
+  (void) (urlargs);
+
+  if ( !key || !connection || !strcasestr(connection, "upgrade") || !ws_accept_key(key, accept) ) {
+    http_send_error(client_ctx, HTTP_400_BadRequest, "<h1>Bad WebSocket handshake</h1>\r\n");
+    goto end;
+  }
+
+  if ( !version || atoi(version) != 13 ) {
+    http_ssend(client_ctx,
+        "%s 426 Upgrade Required\r\n"
+            "Sec-WebSocket-Version: 13\r\n"
+            "Content-Length: 0\r\n"
+            "\r\n",
+        client_ctx->req.proto);
+    goto end;
+  }
+
+  if ( !(cc = http_request_handler_alloc(sizeof(*cc), &iface)) ) {
+    http_send_500_internal_server_error(client_ctx,
+        "<p>http_request_handler_alloc() fails.</p>\n"
+            "<p>errno: %d %s</p>\n",
+        errno,
+        strerror(errno));
+    goto end;
+  }
+
+  cc->client_ctx = client_ctx;
+
+  PDBG("urlpath=%s", urlpath);
+  status = create_output_stream(&cc->output, urlpath,
+      &(struct create_output_args ) {
+            .format = "fmp4",
+            .send_pkt = on_ws_sendpkt,
+            .flush_pkts = on_ws_flushpkts,
+            .getoutspc = on_ws_getoutspc,
+            .set_pacing_rate = on_ws_set_pacing_rate,
+            .cookie = cc,
+          });
+
+  if ( status ) {
+
+    PDBG("create_output_stream() fails: %s", av_err2str(status));
+
+    switch ( status ) {
+      case AVERROR(ENOENT) :
+        http_send_404_not_found(client_ctx);
+      break;
+      case AVERROR(EPERM) :
+        http_send_405_not_allowed(client_ctx);
+      break;
+      default :
+        http_send_500_internal_server_error(client_ctx,
+            "<h1>ERROR</h1>\n"
+                "<p>create_output_stream('%s') FAILS</p>\n"
+                "<p>status=%d (%s)</p>\n",
+                urlpath, status, av_err2str(status));
+      break;
+    }
+
+    http_request_handler_destroy((struct http_request_handler **) &cc);
+
+    goto end;
+  }
+
+  // echo the first offered subprotocol, MSE players use it just as a label
+  if ( protocol && *protocol ) {
+    snprintf(proto, sizeof(proto), "Sec-WebSocket-Protocol: %.*s\r\n",
+        (int) strcspn(protocol, ", "), protocol);
+  }
+
+  http_ssend(client_ctx,
+      "%s 101 Switching Protocols\r\n"
+          "Upgrade: websocket\r\n"
+          "Connection: Upgrade\r\n"
+          "Sec-WebSocket-Accept: %s\r\n"
+          "%s"
+          "Server: ffsrv\r\n"
+          "\r\n",
+      client_ctx->req.proto,
+      accept,
+      proto);
+
+end: ;
+
+  return cc ? (*pqh = &cc->base) != NULL : false;
+}
@@ -0,0 +1,37 @@
+/*
+ * http-ws-online-stream.h
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: amyznikov
+ *
+ *  WebSocket endpoint for browser MSE players:
+ *  live stream is delivered as fragmented MP4, one binary message per fragment.
+ */
+
+
+#ifndef __ffsrv_http_ws_online_stream_h__
+#define __ffsrv_http_ws_online_stream_h__
+
+#include "http-client-context.h"
+
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+/* Check if request asks for 'Upgrade: websocket' */
+bool http_is_websocket_upgrade(const struct http_client_ctx * client_ctx);
+
+
+bool http_ws_online_stream(struct http_request_handler ** pqh,
+    struct http_client_ctx * client_ctx,
+    const char * urlpath,
+    const char * urlargs);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __ffsrv_http_ws_online_stream_h__ */
@@ -0,0 +1,1261 @@
+/*
+ * rtmp-port.c
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: amyznikov
+ *
+ *  Native RTMP publish / play port.
+ *
+ *  Publishers are mapped into create_input_stream() with recv_pkt callback
+ *  which re-wraps incoming audio/video/data messages into FLV byte stream.
+ *
+ *  Players are served by regular "flv" ffoutput, so they go through the same ffgop listeners
+ *  as http clients. FLV tags produced by muxer are sent back as RTMP messages
+ *  using large outgoing chunk size.
+ */
+#define _GNU_SOURCE
+
+#include "ffcfg.h"
+#include "rtmp-port.h"
+#include "rtmp-amf0.h"
+#include "ffobject.h"
+#include "ffoutput.h"
+#include "ffinput.h"
+#include "co-scheduler.h"
+#include "sockopt.h"
+#include "ipaddrs.h"
+#include <time.h>
+#include "debug.h"
+
+
+#define RTMP_RXBUF_SIZE         (32*1024)
+#define RTMP_CLIENT_STACK_SIZE  (1024*1024)
+#define RTMP_SERVER_STACK_SIZE  (128 * 1024)
+
+#define RTMP_VERSION            3
+#define RTMP_HANDSHAKE_SIZE     1536
+#define RTMP_DEFAULT_CHUNK_SIZE 128
+#define RTMP_MAX_CHUNK_STREAMS  16
+#define RTMP_WINDOW_ACK_SIZE    5000000
+#define RTMP_STREAM_ID          1
+
+#define RTMP_CSID_CONTROL       2
+#define RTMP_CSID_COMMAND       3
+#define RTMP_CSID_AUDIO         4
+#define RTMP_CSID_DATA          5
+#define RTMP_CSID_VIDEO         6
+
+#define FLV_HEADER_SIZE         9
+#define FLV_TAG_HEADER_SIZE     11
+
+
+enum rtmp_msg_type {
+  rtmp_msg_set_chunk_size = 1,
+  rtmp_msg_abort = 2,
+  rtmp_msg_ack = 3,
+  rtmp_msg_user_control = 4,
+  rtmp_msg_window_ack_size = 5,
+  rtmp_msg_set_peer_bandwidth = 6,
+  rtmp_msg_audio = 8,
+  rtmp_msg_video = 9,
+  rtmp_msg_data_amf3 = 15,
+  rtmp_msg_command_amf3 = 17,
+  rtmp_msg_data_amf0 = 18,
+  rtmp_msg_command_amf0 = 20,
+};
+
+enum rtmp_user_control_event {
+  rtmp_stream_begin = 0,
+  rtmp_stream_eof = 1,
+  rtmp_ping_request = 6,
+  rtmp_ping_response = 7,
+};
+
+enum rtmp_client_state {
+  rtmp_state_idle,
+  rtmp_state_publish,
+  rtmp_state_play,
+};
+
+
+struct rtmp_server_ctx {
+  int so;
+};
+
+
+struct rtmp_chunk_stream {
+  uint8_t * msg;
+  size_t msgcap;
+  uint32_t csid;
+  uint32_t timestamp;
+  uint32_t delta;
+  uint32_t length;
+  uint32_t received;
+  uint32_t msid;
+  uint8_t type;
+  bool extts;
+};
+
+
+struct rtmp_client_ctx {
+  struct ffinput * input;
+  struct ffoutput * output;
+  struct cosocket * tcp;
+  int so;
+  int status;
+  enum rtmp_client_state state;
+
+  char app[256];
+
+  struct rtmp_chunk_stream cs[RTMP_MAX_CHUNK_STREAMS];
+  uint32_t in_chunk_size;
+  uint32_t out_chunk_size;
+  uint32_t window_ack_size;
+  uint64_t rx_bytes;
+  uint64_t rx_acked;
+
+  // chunk stream receive buffer
+  uint8_t rx[RTMP_RXBUF_SIZE];
+  size_t rxpos, rxsize;
+
+  // chunked message transmit buffer
+  uint8_t * tx;
+  size_t txcap;
+
+  // publish: FLV byte stream for ffinput
+  // play: FLV muxer output not yet split into tags
+  uint8_t * flv;
+  size_t flvcap, flvsize, flvpos;
+  bool flvhdr;
+};
+
+
+
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static struct rtmp_server_ctx * create_rtmp_server_ctx(const struct sockaddr_in * addrs);
+static void destroy_rtmp_server_ctx(struct rtmp_server_ctx * server_ctx);
+static void on_rtmp_server_error(struct rtmp_server_ctx * server_ctx);
+static void on_rtmp_server_accept(struct rtmp_server_ctx * server_ctx, int so);
+static int rtmp_server_io_callback(void * cookie, uint32_t epoll_events);
+
+
+static struct rtmp_client_ctx * create_rtmp_client_ctx(int so);
+static void destroy_rtmp_client_ctx(struct rtmp_client_ctx * client_ctx);
+static void rtmp_client_thread(void * arg);
+
+static int rtmp_read_message(struct rtmp_client_ctx * client_ctx, struct rtmp_chunk_stream ** cs);
+static int rtmp_process_message(struct rtmp_client_ctx * client_ctx, const struct rtmp_chunk_stream * cs);
+static int rtmp_send_message(struct rtmp_client_ctx * client_ctx, uint32_t csid, uint8_t type, uint32_t msid,
+    uint32_t timestamp, const uint8_t * data, uint32_t size);
+
+static int rtmp_recv_pkt(void * cookie, uint8_t * buf, int buf_size);
+static int rtmp_send_pkt(void * cookie, int stream_index, uint8_t * buf, int buf_size);
+static int rtmp_set_pacing_rate(void * cookie, uint32_t bytes_per_sec);
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+
+static inline uint32_t rd24(const uint8_t * p)
+{
+  return (((uint32_t) p[0]) << 16) | (((uint32_t) p[1]) << 8) | p[2];
+}
+
+static inline uint32_t rd32(const uint8_t * p)
+{
+  return (((uint32_t) p[0]) << 24) | (((uint32_t) p[1]) << 16) | (((uint32_t) p[2]) << 8) | p[3];
+}
+
+static inline uint8_t * wr16(uint8_t * p, uint32_t v)
+{
+  *p++ = (uint8_t) (v >> 8);
+  *p++ = (uint8_t) (v);
+  return p;
+}
+
+static inline uint8_t * wr24(uint8_t * p, uint32_t v)
+{
+  *p++ = (uint8_t) (v >> 16);
+  *p++ = (uint8_t) (v >> 8);
+  *p++ = (uint8_t) (v);
+  return p;
+}
+
+static inline uint8_t * wr32(uint8_t * p, uint32_t v)
+{
+  *p++ = (uint8_t) (v >> 24);
+  *p++ = (uint8_t) (v >> 16);
+  *p++ = (uint8_t) (v >> 8);
+  *p++ = (uint8_t) (v);
+  return p;
+}
+
+static inline uint8_t * wr32le(uint8_t * p, uint32_t v)
+{
+  *p++ = (uint8_t) (v);
+  *p++ = (uint8_t) (v >> 8);
+  *p++ = (uint8_t) (v >> 16);
+  *p++ = (uint8_t) (v >> 24);
+  return p;
+}
+
+static bool reserve(uint8_t ** buf, size_t * cap, size_t size)
+{
+  if ( size > *cap ) {
+    size_t newcap = *cap ? *cap : 4096;
+    uint8_t * p;
+
+    while ( newcap < size ) {
+      newcap *= 2;
+    }
+
+    if ( !(p = realloc(*buf, newcap)) ) {
+      return false;
+    }
+
+    *buf = p;
+    *cap = newcap;
+  }
+
+  return true;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static struct rtmp_server_ctx * create_rtmp_server_ctx(const struct sockaddr_in * addrs)
+{
+  struct rtmp_server_ctx * server_ctx = NULL;
+  int so = -1;
+
+  bool fok = false;
+
+  if ( (so = so_tcp_listen_addrs((struct sockaddr *) addrs, sizeof(*addrs))) == -1 ) {
+    PDBG("so_tcp_listen_addrs() fails: %s", strerror(errno));
+    goto end;
+  }
+
+  so_set_noblock(so, true);
+
+  if ( !(server_ctx = calloc(1, sizeof(*server_ctx))) ) {
+    PDBG("calloc(server_ctx) fails: %s", strerror(errno));
+    goto end;
+  }
+
+  server_ctx->so = so;
+  if ( !(fok = co_schedule_io(so, EPOLLIN, rtmp_server_io_callback, server_ctx, RTMP_SERVER_STACK_SIZE)) ) {
+    PDBG("co_schedule_io(rtmp_server_io_callback) fails: %s", strerror(errno));
+    goto end;
+  }
+
+end: ;
+
+  if ( !fok ) {
+
+    if ( so != -1 ) {
+      close(so);
+    }
+
+    if ( server_ctx ) {
+      free(server_ctx);
+      server_ctx = NULL;
+    }
+  }
+
+  return server_ctx;
+}
+
+
+static void destroy_rtmp_server_ctx(struct rtmp_server_ctx * server_ctx)
+{
+  if ( server_ctx ) {
+    int so = server_ctx->so;
+    if ( so != -1 ) {
+      close(so);
+    }
+    free(server_ctx);
+    PDBG("[so=%d] DESTROYED", so);
+  }
+}
+
+static void on_rtmp_server_error(struct rtmp_server_ctx * server_ctx)
+{
+  PDBG("[so=%d] SERVER ERROR", server_ctx->so);
+  destroy_rtmp_server_ctx(server_ctx);
+}
+
+static void on_rtmp_server_accept(struct rtmp_server_ctx * server_ctx, int so)
+{
+  (void)(server_ctx);
+  if ( !create_rtmp_client_ctx(so) ) {
+    so_close_connection(so, 1);
+  }
+}
+
+static int rtmp_server_io_callback(void * cookie, uint32_t epoll_events)
+{
+  struct rtmp_server_ctx * server_ctx = cookie;
+  int so;
+
+  int status = 0;
+
+  if ( epoll_events & EPOLLERR ) {
+    status = -1;
+  }
+  else if ( epoll_events & EPOLLIN ) {
+
+    struct sockaddr_in addrs;
+    socklen_t addrslen = sizeof(addrs);
+
+    while ( (so = accept(server_ctx->so, (struct sockaddr*) &addrs, &addrslen)) != -1 ) {
+      char ss[64] = "";
+      PDBG("ACCEPTED SO=%d from %s", so, saddr2str(&addrs, ss));
+      on_rtmp_server_accept(server_ctx, so);
+    }
+
+    if ( errno != EAGAIN ) {
+      PDBG("ACCEPT(so=%d) FAILS: %s", server_ctx->so, strerror(errno));
+      status = -1;
+    }
+  }
+  else {
+    status = -1;
+  }
+
+  if ( status ) {
+    on_rtmp_server_error(server_ctx);
+  }
+
+  return status;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static struct rtmp_client_ctx * create_rtmp_client_ctx(int so)
+{
+  struct rtmp_client_ctx * client_ctx = NULL;
+  bool fok = false;
+
+  if ( !(client_ctx = calloc(1, sizeof(*client_ctx))) ) {
+    PDBG("calloc(client_ctx) fails: %s", strerror(errno));
+    goto end;
+  }
+
+  so_set_noblock(client_ctx->so = so, true);
+
+  if ( so_set_recvbuf(so, ffsrv.rtmp.rxbuf) != 0 ) {
+    PDBG("[so=%d] so_set_recvbuf() fails: %s", so, strerror(errno));
+    goto end;
+  }
+
+  if ( so_set_sendbuf(so, ffsrv.rtmp.txbuf) != 0 ) {
+    PDBG("[so=%d] so_set_sendbuf() fails: %s", so, strerror(errno));
+    goto end;
+  }
+
+  if ( !(client_ctx->tcp = cosocket_create(so)) ) {
+    PDBG("[so=%d] create_cosock() fails: %s", so, strerror(errno));
+    goto end;
+  }
+
+  cosocket_set_rcvtmout(client_ctx->tcp, ffsrv.rtmp.rcvtmo);
+  cosocket_set_sndtmout(client_ctx->tcp, ffsrv.rtmp.sndtmo);
+
+  client_ctx->in_chunk_size = RTMP_DEFAULT_CHUNK_SIZE;
+  client_ctx->out_chunk_size = RTMP_DEFAULT_CHUNK_SIZE;
+
+  if ( !(fok = co_schedule(rtmp_client_thread, client_ctx, RTMP_CLIENT_STACK_SIZE)) ) {
+    PDBG("co_schedule(rtmp_client_thread) fails: %s", strerror(errno));
+    goto end;
+  }
+
+end: ;
+
+  if ( !fok && client_ctx ) {
+    cosocket_delete(&client_ctx->tcp);
+    free(client_ctx);
+    client_ctx = NULL;
+  }
+
+  return client_ctx;
+}
+
+static void destroy_rtmp_client_ctx(struct rtmp_client_ctx * client_ctx)
+{
+  if ( client_ctx ) {
+
+    int so = client_ctx->so;
+
+    delete_output_stream(&client_ctx->output);
+    release_input_stream(&client_ctx->input);
+
+    if ( so != -1 ) {
+      so_close_connection(so, 0);
+      cosocket_delete(&client_ctx->tcp);
+    }
+
+    for ( int i = 0; i < RTMP_MAX_CHUNK_STREAMS; ++i ) {
+      free(client_ctx->cs[i].msg);
+    }
+
+    free(client_ctx->tx);
+    free(client_ctx->flv);
+    free(client_ctx);
+
+    PDBG("[so=%d] DESTROYED", so);
+  }
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static int rtmp_recv(struct rtmp_client_ctx * client_ctx, void * buf, size_t size)
+{
+  uint8_t * p = buf;
+  ssize_t cb;
+  size_t n;
+
+  while ( size > 0 ) {
+
+    if ( client_ctx->rxpos == client_ctx->rxsize ) {
+
+      if ( (cb = cosocket_recv(client_ctx->tcp, client_ctx->rx, sizeof(client_ctx->rx), 0)) <= 0 ) {
+        if ( cb == 0 ) {
+          return AVERROR_EOF;
+        }
+        if ( errno == EAGAIN ) { // AVERROR(EAGAIN) would spin in ff_run_input_stream()
+          return AVERROR(ETIMEDOUT);
+        }
+        return AVERROR(errno);
+      }
+
+      client_ctx->rxpos = 0;
+      client_ctx->rxsize = cb;
+      client_ctx->rx_bytes += cb;
+    }
+
+    if ( (n = client_ctx->rxsize - client_ctx->rxpos) > size ) {
+      n = size;
+    }
+
+    memcpy(p, client_ctx->rx + client_ctx->rxpos, n);
+    client_ctx->rxpos += n;
+    p += n;
+    size -= n;
+  }
+
+  return 0;
+}
+
+static int rtmp_send(struct rtmp_client_ctx * client_ctx, const void * buf, size_t size)
+{
+  return cosocket_send(client_ctx->tcp, buf, size, 0) == (ssize_t) size ? 0 : AVERROR(errno);
+}
+
+
+static int rtmp_handshake(struct rtmp_client_ctx * client_ctx)
+{
+  uint8_t c0c1[1 + RTMP_HANDSHAKE_SIZE];
+  uint8_t s0s1s2[1 + 2 * RTMP_HANDSHAKE_SIZE];
+  uint8_t * s1, * s2;
+  int status;
+
+  if ( (status = rtmp_recv(client_ctx, c0c1, sizeof(c0c1))) ) {
+    goto end;
+  }
+
+  if ( c0c1[0] != RTMP_VERSION ) {
+    PDBG("[so=%d] Unsupported RTMP version %u", client_ctx->so, c0c1[0]);
+    status = AVERROR(EPROTONOSUPPORT);
+    goto end;
+  }
+
+  s0s1s2[0] = RTMP_VERSION;
+
+  // S1: time, zero, random
+  s1 = s0s1s2 + 1;
+  wr32(s1, 0);
+  wr32(s1 + 4, 0);
+  for ( int i = 8; i < RTMP_HANDSHAKE_SIZE; ++i ) {
+    s1[i] = (uint8_t) rand();
+  }
+
+  // S2: echo of C1
+  s2 = s1 + RTMP_HANDSHAKE_SIZE;
+  memcpy(s2, c0c1 + 1, RTMP_HANDSHAKE_SIZE);
+
+  if ( (status = rtmp_send(client_ctx, s0s1s2, sizeof(s0s1s2))) ) {
+    goto end;
+  }
+
+  // C2: echo of S1, content is not verified
+  status = rtmp_recv(client_ctx, c0c1, RTMP_HANDSHAKE_SIZE);
+
+end:
+
+  return status;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static struct rtmp_chunk_stream * get_chunk_stream(struct rtmp_client_ctx * client_ctx, uint32_t csid)
+{
+  struct rtmp_chunk_stream * cs = NULL;
+  const int nb_cs = FFMIN(ffsrv.rtmp.maxchunkstreams, RTMP_MAX_CHUNK_STREAMS);
+
+  for ( int i = 0; i < nb_cs; ++i ) {
+    if ( client_ctx->cs[i].csid == csid ) {
+      return &client_ctx->cs[i];
+    }
+    if ( !cs && !client_ctx->cs[i].csid ) {
+      cs = &client_ctx->cs[i];
+    }
+  }
+
+  if ( cs ) {
+    cs->csid = csid;
+  }
+
+  return cs;
+}
+
+
+/*
+ * Read chunks until some of chunk streams completes the message
+ */
+static int rtmp_read_message(struct rtmp_client_ctx * client_ctx, struct rtmp_chunk_stream ** pcs)
+{
+  static const uint8_t hdrsizes[4] = { 11, 7, 3, 0 };
+
+  struct rtmp_chunk_stream * cs;
+  uint8_t hdr[11];
+  uint32_t csid, fmt, ts, n;
+  int status;
+
+  while ( 42 ) {
+
+    if ( (status = rtmp_recv(client_ctx, hdr, 1)) ) {
+      break;
+    }
+
+    fmt = hdr[0] >> 6;
+    csid = hdr[0] & 0x3F;
+
+    if ( csid == 0 ) {
+      if ( (status = rtmp_recv(client_ctx, hdr, 1)) ) {
+        break;
+      }
+      csid = 64 + hdr[0];
+    }
+    else if ( csid == 1 ) {
+      if ( (status = rtmp_recv(client_ctx, hdr, 2)) ) {
+        break;
+      }
+      csid = 64 + hdr[0] + (((uint32_t) hdr[1]) << 8);
+    }
+
+    if ( !(cs = get_chunk_stream(client_ctx, csid)) ) {
+      PDBG("[so=%d] csid=%u: too many chunk streams, see rtmp.maxchunkstreams", client_ctx->so, csid);
+      status = AVERROR_INVALIDDATA;
+      break;
+    }
+
+    if ( (status = rtmp_recv(client_ctx, hdr, hdrsizes[fmt])) ) {
+      break;
+    }
+
+    if ( fmt < 3 ) {
+
+      ts = rd24(hdr);
+
+      if ( fmt < 2 ) {
+        if ( (cs->length = rd24(hdr + 3)) > ffsrv.rtmp.maxmsgsize ) {
+          PDBG("[so=%d] csid=%u: message length %u exceeds rtmp.maxmsgsize", client_ctx->so, csid, cs->length);
+          status = AVERROR_INVALIDDATA;
+          break;
+        }
+        cs->type = hdr[6];
+        if ( fmt == 0 ) {
+          cs->msid = hdr[7] | (hdr[8] << 8) | (hdr[9] << 16) | (((uint32_t) hdr[10]) << 24);
+        }
+      }
+
+      if ( (cs->extts = (ts == 0xFFFFFF)) ) {
+        if ( (status = rtmp_recv(client_ctx, hdr, 4)) ) {
+          break;
+        }
+        ts = rd32(hdr);
+      }
+
+      if ( fmt == 0 ) {
+        cs->timestamp = ts;
+        cs->delta = 0;
+      }
+      else {
+        cs->timestamp += (cs->delta = ts);
+      }
+
+      cs->received = 0;
+    }
+    else {
+
+      if ( cs->extts && (status = rtmp_recv(client_ctx, hdr, 4)) ) {
+        break;
+      }
+
+      if ( cs->received == 0 ) {
+        cs->timestamp += cs->delta;
+      }
+    }
+
+    if ( !reserve(&cs->msg, &cs->msgcap, cs->length) ) {
+      status = AVERROR(ENOMEM);
+      break;
+    }
+
+    if ( (n = cs->length - cs->received) > client_ctx->in_chunk_size ) {
+      n = client_ctx->in_chunk_size;
+    }
+
+    if ( n && (status = rtmp_recv(client_ctx, cs->msg + cs->received, n)) ) {
+      break;
+    }
+
+    if ( (cs->received += n) == cs->length ) {
+      cs->received = 0;
+      *pcs = cs;
+      break;
+    }
+  }
+
+  if ( !status && client_ctx->window_ack_size
+      && client_ctx->rx_bytes - client_ctx->rx_acked >= client_ctx->window_ack_size ) {
+
+    uint8_t ack[4];
+
+    wr32(ack, (uint32_t) client_ctx->rx_bytes);
+    client_ctx->rx_acked = client_ctx->rx_bytes;
+
+    status = rtmp_send_message(client_ctx, RTMP_CSID_CONTROL, rtmp_msg_ack, 0, 0, ack, sizeof(ack));
+  }
+
+  return status;
+}
+
+
+
+static int rtmp_send_message(struct rtmp_client_ctx * client_ctx, uint32_t csid, uint8_t type, uint32_t msid,
+    uint32_t timestamp, const uint8_t * data, uint32_t size)
+{
+  const uint32_t chunk_size = client_ctx->out_chunk_size;
+  const bool extts = timestamp >= 0xFFFFFF;
+  const uint32_t nb_chunks = size ? (size + chunk_size - 1) / chunk_size : 1;
+
+  uint8_t * p;
+  uint32_t n;
+
+  // csid is always < 64 here, so the basic header is single byte
+  if ( !reserve(&client_ctx->tx, &client_ctx->txcap, size + 16 + nb_chunks * 5) ) {
+    return AVERROR(ENOMEM);
+  }
+
+  p = client_ctx->tx;
+
+  *p++ = (uint8_t) (csid & 0x3F);
+  p = wr24(p, extts ? 0xFFFFFF : timestamp);
+  p = wr24(p, size);
+  *p++ = type;
+  p = wr32le(p, msid);
+  if ( extts ) {
+    p = wr32(p, timestamp);
+  }
+
+  while ( 42 ) {
+
+    if ( (n = size) > chunk_size ) {
+      n = chunk_size;
+    }
+
+    memcpy(p, data, n);
+    p += n, data += n, size -= n;
+
+    if ( !size ) {
+      break;
+    }
+
+    *p++ = (uint8_t) (0xC0 | (csid & 0x3F));
+    if ( extts ) {
+      p = wr32(p, timestamp);
+    }
+  }
+
+  return rtmp_send(client_ctx, client_ctx->tx, p - client_ctx->tx);
+}
+
+static int rtmp_send_control(struct rtmp_client_ctx * client_ctx, uint8_t type, uint32_t value)
+{
+  uint8_t msg[5];
+  uint32_t size = 4;
+
+  wr32(msg, value);
+
+  if ( type == rtmp_msg_set_peer_bandwidth ) {
+    msg[size++] = 2; // dynamic
+  }
+
+  return rtmp_send_message(client_ctx, RTMP_CSID_CONTROL, type, 0, 0, msg, size);
+}
+
+static int rtmp_send_user_control(struct rtmp_client_ctx * client_ctx, uint16_t event, uint32_t value)
+{
+  uint8_t msg[6];
+
+  wr32(wr16(msg, event), value);
+
+  return rtmp_send_message(client_ctx, RTMP_CSID_CONTROL, rtmp_msg_user_control, 0, 0, msg, sizeof(msg));
+}
+
+static int rtmp_send_result(struct rtmp_client_ctx * client_ctx, double txid, double value)
+{
+  uint8_t msg[64];
+  uint8_t * p, * end = msg + sizeof(msg);
+
+  p = amf0_put_string(msg, end, "_result");
+  p = amf0_put_number(p, end, txid);
+  p = amf0_put_null(p, end);
+  p = amf0_put_number(p, end, value);
+
+  return rtmp_send_message(client_ctx, RTMP_CSID_COMMAND, rtmp_msg_command_amf0, 0, 0, msg, p - msg);
+}
+
+static int rtmp_send_status(struct rtmp_client_ctx * client_ctx, const char * level, const char * code,
+    const char * description)
+{
+  uint8_t msg[512];
+  uint8_t * p, * end = msg + sizeof(msg);
+
+  p = amf0_put_string(msg, end, "onStatus");
+  p = amf0_put_number(p, end, 0);
+  p = amf0_put_null(p, end);
+  p = amf0_put_object_start(p, end);
+  p = amf0_put_prop_string(p, end, "level", level);
+  p = amf0_put_prop_string(p, end, "code", code);
+  p = amf0_put_prop_string(p, end, "description", description);
+  p = amf0_put_object_end(p, end);
+
+  if ( !p ) {
+    return AVERROR(ENOBUFS);
+  }
+
+  return rtmp_send_message(client_ctx, RTMP_CSID_DATA, rtmp_msg_command_amf0, RTMP_STREAM_ID, 0, msg, p - msg);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static void get_stream_path(const struct rtmp_client_ctx * client_ctx, const char * name, char path[], size_t size)
+{
+  int n;
+
+  if ( *client_ctx->app ) {
+    n = snprintf(path, size, "%s/%s", client_ctx->app, name);
+  }
+  else {
+    n = snprintf(path, size, "%s", name);
+  }
+
+  if ( n > 0 && (size_t) n < size ) {
+    path[strcspn(path, "?")] = 0;
+  }
+}
+
+
+static int on_rtmp_connect(struct rtmp_client_ctx * client_ctx, double txid, const uint8_t * p, const uint8_t * end)
+{
+  uint8_t msg[512];
+  uint8_t * q, * qend = msg + sizeof(msg);
+  size_t n;
+  int status;
+
+  amf0_get_prop_string(p, end, "app", client_ctx->app, sizeof(client_ctx->app));
+  while ( (n = strlen(client_ctx->app)) > 0 && client_ctx->app[n - 1] == '/' ) {
+    client_ctx->app[n - 1] = 0;
+  }
+
+  PDBG("[so=%d] app='%s'", client_ctx->so, client_ctx->app);
+
+  if ( (status = rtmp_send_control(client_ctx, rtmp_msg_window_ack_size, RTMP_WINDOW_ACK_SIZE)) ) {
+    goto end;
+  }
+
+  if ( (status = rtmp_send_control(client_ctx, rtmp_msg_set_peer_bandwidth, RTMP_WINDOW_ACK_SIZE)) ) {
+    goto end;
+  }
+
+  if ( (status = rtmp_send_control(client_ctx, rtmp_msg_set_chunk_size, ffsrv.rtmp.chunksize)) ) {
+    goto end;
+  }
+
+  client_ctx->out_chunk_size = ffsrv.rtmp.chunksize;
+
+  q = amf0_put_string(msg, qend, "_result");
+  q = amf0_put_number(q, qend, txid);
+  q = amf0_put_object_start(q, qend);
+  q = amf0_put_prop_string(q, qend, "fmsVer", "FMS/3,0,1,123");
+  q = amf0_put_prop_number(q, qend, "capabilities", 31);
+  q = amf0_put_object_end(q, qend);
+  q = amf0_put_object_start(q, qend);
+  q = amf0_put_prop_string(q, qend, "level", "status");
+  q = amf0_put_prop_string(q, qend, "code", "NetConnection.Connect.Success");
+  q = amf0_put_prop_string(q, qend, "description", "Connection succeeded.");
+  q = amf0_put_prop_number(q, qend, "objectEncoding", 0);
+  q = amf0_put_object_end(q, qend);
+
+  status = rtmp_send_message(client_ctx, RTMP_CSID_COMMAND, rtmp_msg_command_amf0, 0, 0, msg, q - msg);
+
+end:
+
+  return status;
+}
+
+static int on_rtmp_publish(struct rtmp_client_ctx * client_ctx, const uint8_t * p, const uint8_t * end)
+{
+  static const uint8_t flvhdr[FLV_HEADER_SIZE + 4] = {
+    'F', 'L', 'V', 1, 0x05, 0, 0, 0, FLV_HEADER_SIZE, 0, 0, 0, 0
+  };
+
+  char name[256] = "";
+  char path[512] = "";
+  int status;
+
+  if ( client_ctx->state != rtmp_state_idle ) {
+    return AVERROR_INVALIDDATA;
+  }
+
+  if ( !amf0_get_string(amf0_skip(p, end), end, name, sizeof(name)) || !*name ) {
+    return rtmp_send_status(client_ctx, "error", "NetStream.Publish.BadName", "No stream name");
+  }
+
+  get_stream_path(client_ctx, name, path, sizeof(path));
+
+  PDBG("[so=%d] PUBLISH '%s'", client_ctx->so, path);
+
+  status = create_input_stream(&client_ctx->input, path,
+      &(struct create_input_args ) {
+            .cookie = client_ctx,
+            .recv_pkt = rtmp_recv_pkt
+          });
+
+  if ( status ) {
+    PDBG("create_input_stream(%s) fails: %s", path, av_err2str(status));
+    rtmp_send_status(client_ctx, "error",
+        status == AVERROR(ENOENT) ? "NetStream.Publish.BadName" : "NetStream.Publish.Denied",
+        av_err2str(status));
+    return status;
+  }
+
+  if ( !reserve(&client_ctx->flv, &client_ctx->flvcap, sizeof(flvhdr)) ) {
+    return AVERROR(ENOMEM);
+  }
+
+  memcpy(client_ctx->flv, flvhdr, sizeof(flvhdr));
+  client_ctx->flvsize = sizeof(flvhdr);
+  client_ctx->flvpos = 0;
+
+  if ( (status = rtmp_send_user_control(client_ctx, rtmp_stream_begin, RTMP_STREAM_ID)) ) {
+    return status;
+  }
+
+  if ( (status = rtmp_send_status(client_ctx, "status", "NetStream.Publish.Start", path)) ) {
+    return status;
+  }
+
+  client_ctx->state = rtmp_state_publish;
+
+  return 0;
+}
+
+static int on_rtmp_play(struct rtmp_client_ctx * client_ctx, const uint8_t * p, const uint8_t * end)
+{
+  char name[256] = "";
+  char path[512] = "";
+  int status;
+
+  if ( client_ctx->state != rtmp_state_idle ) {
+    return AVERROR_INVALIDDATA;
+  }
+
+  if ( !amf0_get_string(amf0_skip(p, end), end, name, sizeof(name)) || !*name ) {
+    return rtmp_send_status(client_ctx, "error", "NetStream.Play.StreamNotFound", "No stream name");
+  }
+
+  get_stream_path(client_ctx, name, path, sizeof(path));
+
+  PDBG("[so=%d] PLAY '%s'", client_ctx->so, path);
+
+  status = create_output_stream(&client_ctx->output, path,
+      &(struct create_output_args ) {
+            .format = "flv",
+            .send_pkt = rtmp_send_pkt,
+            .set_pacing_rate = rtmp_set_pacing_rate,
+            .cookie = client_ctx,
+          });
+
+  if ( status ) {
+    PDBG("create_output_stream(%s) fails: %s", path, av_err2str(status));
+    rtmp_send_status(client_ctx, "error",
+        status == AVERROR(ENOENT) ? "NetStream.Play.StreamNotFound" : "NetStream.Play.Failed",
+        av_err2str(status));
+    return status;
+  }
+
+  if ( (status = rtmp_send_user_control(client_ctx, rtmp_stream_begin, RTMP_STREAM_ID)) ) {
+    return status;
+  }
+
+  if ( (status = rtmp_send_status(client_ctx, "status", "NetStream.Play.Reset", path)) ) {
+    return status;
+  }
+
+  if ( (status = rtmp_send_status(client_ctx, "status", "NetStream.Play.Start", path)) ) {
+    return status;
+  }
+
+  client_ctx->flvsize = client_ctx->flvpos = 0;
+  client_ctx->flvhdr = false;
+  client_ctx->state = rtmp_state_play;
+
+  return 0;
+}
+
+static int on_rtmp_command(struct rtmp_client_ctx * client_ctx, const uint8_t * p, const uint8_t * end)
+{
+  char cmd[64] = "";
+  double txid = 0;
+  int status = 0;
+
+  if ( !(p = amf0_get_number(amf0_get_string(p, end, cmd, sizeof(cmd)), end, &txid)) ) {
+    PDBG("[so=%d] Malformed command message", client_ctx->so);
+    return AVERROR_INVALIDDATA;
+  }
+
+  PDBG("[so=%d] %s(%g)", client_ctx->so, cmd, txid);
+
+  if ( strcmp(cmd, "connect") == 0 ) {
+    status = on_rtmp_connect(client_ctx, txid, p, end);
+  }
+  else if ( strcmp(cmd, "createStream") == 0 ) {
+    status = rtmp_send_result(client_ctx, txid, RTMP_STREAM_ID);
+  }
+  else if ( strcmp(cmd, "publish") == 0 ) {
+    status = on_rtmp_publish(client_ctx, p, end);
+  }
+  else if ( strcmp(cmd, "play") == 0 ) {
+    status = on_rtmp_play(client_ctx, p, end);
+  }
+  else if ( strcmp(cmd, "deleteStream") == 0 || strcmp(cmd, "closeStream") == 0
+      || strcmp(cmd, "FCUnpublish") == 0 ) {
+    status = client_ctx->state == rtmp_state_idle ? 0 : AVERROR_EOF;
+  }
+
+  // releaseStream, FCPublish, getStreamLength etc are silently ignored
+
+  return status;
+}
+
+
+static int on_rtmp_media(struct rtmp_client_ctx * client_ctx, const struct rtmp_chunk_stream * cs)
+{
+  const uint8_t * data = cs->msg, * next;
+  uint32_t size = cs->length;
+  uint8_t type = cs->type;
+  uint8_t * p;
+  char name[16];
+
+  if ( client_ctx->state != rtmp_state_publish ) {
+    return 0;
+  }
+
+  if ( type == rtmp_msg_data_amf3 || type == rtmp_msg_data_amf0 ) {
+
+    if ( type == rtmp_msg_data_amf3 && size > 0 ) {
+      ++data, --size;
+    }
+
+    // publishers wrap onMetaData into @setDataFrame, FLV wants it naked
+    if ( (next = amf0_get_string(data, data + size, name, sizeof(name))) && strcmp(name, "@setDataFrame") == 0 ) {
+      size -= next - data;
+      data = next;
+    }
+
+    type = rtmp_msg_data_amf0;
+  }
+
+  if ( !size ) {
+    return 0;
+  }
+
+  if ( !reserve(&client_ctx->flv, &client_ctx->flvcap, client_ctx->flvsize + FLV_TAG_HEADER_SIZE + size + 4) ) {
+    return AVERROR(ENOMEM);
+  }
+
+  p = client_ctx->flv + client_ctx->flvsize;
+  *p++ = type;
+  p = wr24(p, size);
+  p = wr24(p, cs->timestamp & 0xFFFFFF);
+  *p++ = (uint8_t) (cs->timestamp >> 24);
+  p = wr24(p, 0);
+  memcpy(p, data, size);
+  p = wr32(p + size, FLV_TAG_HEADER_SIZE + size);
+
+  client_ctx->flvsize = p - client_ctx->flv;
+
+  return 0;
+}
+
+
+static int rtmp_process_message(struct rtmp_client_ctx * client_ctx, const struct rtmp_chunk_stream * cs)
+{
+  const uint8_t * msg = cs->msg;
+  uint32_t size = cs->length;
+  int status = 0;
+
+  switch ( cs->type ) {
+
+    case rtmp_msg_set_chunk_size :
+      if ( size >= 4 ) {
+        if ( (client_ctx->in_chunk_size = rd32(msg) & 0x7FFFFFFF) < 1 ) {
+          status = AVERROR_INVALIDDATA;
+        }
+      }
+    break;
+
+    case rtmp_msg_abort :
+      if ( size >= 4 ) {
+        struct rtmp_chunk_stream * acs = get_chunk_stream(client_ctx, rd32(msg));
+        if ( acs ) {
+          acs->received = 0;
+        }
+      }
+    break;
+
+    case rtmp_msg_window_ack_size :
+      if ( size >= 4 ) {
+        client_ctx->window_ack_size = rd32(msg);
+      }
+    break;
+
+    case rtmp_msg_user_control :
+      if ( size >= 6 && ((msg[0] << 8) | msg[1]) == rtmp_ping_request ) {
+        status = rtmp_send_user_control(client_ctx, rtmp_ping_response, rd32(msg + 2));
+      }
+    break;
+
+    case rtmp_msg_command_amf3 :
+      if ( size > 0 ) {
+        status = on_rtmp_command(client_ctx, msg + 1, msg + size);
+      }
+    break;
+
+    case rtmp_msg_command_amf0 :
+      status = on_rtmp_command(client_ctx, msg, msg + size);
+    break;
+
+    case rtmp_msg_audio :
+    case rtmp_msg_video :
+    case rtmp_msg_data_amf3 :
+    case rtmp_msg_data_amf0 :
+      status = on_rtmp_media(client_ctx, cs);
+    break;
+
+    default :
+      // ack, set peer bandwidth and others are not interesting
+    break;
+  }
+
+  return status;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static void rtmp_client_thread(void * arg)
+{
+  struct rtmp_client_ctx * client_ctx = arg;
+  struct rtmp_chunk_stream * cs;
+
+  PDBG("[so=%d] STARTED", client_ctx->so);
+
+  if ( (client_ctx->status = rtmp_handshake(client_ctx)) ) {
+    PDBG("[so=%d] rtmp_handshake() fails: %s", client_ctx->so, av_err2str(client_ctx->status));
+  }
+
+  while ( !client_ctx->status && client_ctx->state == rtmp_state_idle ) {
+    if ( !(client_ctx->status = rtmp_read_message(client_ctx, &cs)) ) {
+      client_ctx->status = rtmp_process_message(client_ctx, cs);
+    }
+  }
+
+  if ( !client_ctx->status ) {
+
+    switch ( client_ctx->state ) {
+
+      case rtmp_state_publish :
+        // chunk stream is now consumed by rtmp_recv_pkt()
+        ff_run_input_stream(client_ctx->input);
+      break;
+
+      case rtmp_state_play :
+        ff_run_output_stream(client_ctx->output);
+      break;
+
+      default :
+      break;
+    }
+  }
+
+  PDBG("[so=%d] FINISHED", client_ctx->so);
+
+  destroy_rtmp_client_ctx(client_ctx);
+}
+
+
+
+static int rtmp_recv_pkt(void * cookie, uint8_t * buf, int buf_size)
+{
+  struct rtmp_client_ctx * client_ctx = cookie;
+  struct rtmp_chunk_stream * cs;
+  size_t n;
+
+  while ( client_ctx->flvpos == client_ctx->flvsize ) {
+
+    client_ctx->flvpos = client_ctx->flvsize = 0;
+
+    if ( client_ctx->status ) {
+      return client_ctx->status;
+    }
+
+    if ( !(client_ctx->status = rtmp_read_message(client_ctx, &cs)) ) {
+      client_ctx->status = rtmp_process_message(client_ctx, cs);
+    }
+  }
+
+  if ( (n = client_ctx->flvsize - client_ctx->flvpos) > (size_t) buf_size ) {
+    n = buf_size;
+  }
+
+  memcpy(buf, client_ctx->flv + client_ctx->flvpos, n);
+  client_ctx->flvpos += n;
+
+  return n;
+}
+
+
+static int rtmp_set_pacing_rate(void * cookie, uint32_t bytes_per_sec)
+{
+  struct rtmp_client_ctx * client_ctx = cookie;
+  return so_set_max_pacing_rate(client_ctx->so, bytes_per_sec) == 0 ? 0 : AVERROR(errno);
+}
+
+
+/*
+ * Play session: process messages the client has already sent, without waiting for more.
+ * Pings are answered and our acks sent, deleteStream / closeStream end the session,
+ * acks and media of the client are discarded. Otherwise the client's window fills up.
+ */
+static int rtmp_poll_messages(struct rtmp_client_ctx * client_ctx)
+{
+  struct rtmp_chunk_stream * cs;
+  int status = 0;
+
+  while ( !status && (client_ctx->rxpos < client_ctx->rxsize || so_get_inq_size(client_ctx->so) > 0) ) {
+    if ( !(status = rtmp_read_message(client_ctx, &cs)) ) {
+      status = rtmp_process_message(client_ctx, cs);
+    }
+  }
+
+  return status;
+}
+
+
+/*
+ * Split FLV muxer output into tags and send them as RTMP messages
+ */
+
+static int rtmp_send_pkt(void * cookie, int stream_index, uint8_t * buf, int buf_size)
+{
+  (void)(stream_index);
+
+  struct rtmp_client_ctx * client_ctx = cookie;
+  const uint8_t * p, * end;
+  uint32_t size, timestamp, csid;
+  int status;
+
+  if ( (status = rtmp_poll_messages(client_ctx)) ) {
+    return status;
+  }
+
+  if ( !reserve(&client_ctx->flv, &client_ctx->flvcap, client_ctx->flvsize + buf_size) ) {
+    return AVERROR(ENOMEM);
+  }
+
+  memcpy(client_ctx->flv + client_ctx->flvsize, buf, buf_size);
+  client_ctx->flvsize += buf_size;
+
+  p = client_ctx->flv;
+  end = p + client_ctx->flvsize;
+
+  if ( !client_ctx->flvhdr ) {
+    if ( end - p < FLV_HEADER_SIZE || end - p < (ptrdiff_t) rd32(p + 5) + 4 ) {
+      return 0;
+    }
+    p += rd32(p + 5) + 4;
+    client_ctx->flvhdr = true;
+  }
+
+  while ( end - p >= FLV_TAG_HEADER_SIZE && end - p >= FLV_TAG_HEADER_SIZE + (size = rd24(p + 1)) + 4 ) {
+
+    timestamp = rd24(p + 4) | (((uint32_t) p[7]) << 24);
+
+    switch ( p[0] & 0x1F ) {
+      case rtmp_msg_audio :
+        csid = RTMP_CSID_AUDIO;
+      break;
+      case rtmp_msg_video :
+        csid = RTMP_CSID_VIDEO;
+      break;
+      default :
+        csid = RTMP_CSID_DATA;
+      break;
+    }
+
+    status = rtmp_send_message(client_ctx, csid, p[0] & 0x1F, RTMP_STREAM_ID, timestamp,
+        p + FLV_TAG_HEADER_SIZE, size);
+
+    if ( status ) {
+      break;
+    }
+
+    p += FLV_TAG_HEADER_SIZE + size + 4;
+  }
+
+  if ( p > client_ctx->flv ) {
+    client_ctx->flvsize = end - p;
+    memmove(client_ctx->flv, p, client_ctx->flvsize);
+  }
+
+  return status;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+bool ffsrv_add_rtmp_port(const struct sockaddr_in * addrs)
+{
+  return create_rtmp_server_ctx(addrs) != NULL;
+}
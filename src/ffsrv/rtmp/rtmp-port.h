@@ -0,0 +1,29 @@
+/*
+ * rtmp-port.h
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: amyznikov
+ */
+
+// #pragma once
+
+#ifndef __ffsrv_rtmp_port_h__
+#define __ffsrv_rtmp_port_h__
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <netinet/in.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+bool ffsrv_add_rtmp_port(const struct sockaddr_in * addrs);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __ffsrv_rtmp_port_h__ */
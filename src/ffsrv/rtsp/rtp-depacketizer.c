@@ -0,0 +1,953 @@
+/*
+ * rtp-depacketizer.c
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: amyznikov
+ */
+
+#define _GNU_SOURCE
+
+#include <ctype.h>
+#include <libavutil/base64.h>
+#include "rtp-depacketizer.h"
+#include "debug.h"
+
+
+#define RTP_MAX_MEDIA           8
+#define RTP_PKT_QUEUE_SIZE      64
+#define RTP_HEADER_SIZE         12
+#define RTP_MAX_FRAME_SIZE      (4*1024*1024)
+#define AAC_FRAME_SAMPLES       1024
+
+
+enum rtp_payload_format {
+  rtp_payload_unknown = 0,
+  rtp_payload_h264,
+  rtp_payload_hevc,
+  rtp_payload_aac,
+  rtp_payload_pcm,
+  rtp_payload_mp4v,
+};
+
+struct rtp_media {
+
+  // SDP
+  enum AVMediaType codec_type;
+  enum AVCodecID codec_id;
+  enum rtp_payload_format pf;
+  int payload_type;
+  int clock_rate;
+  int channels;
+  char encoding[32];
+  char * fmtp;
+  char * control;
+  uint8_t * extradata;
+  int extradata_size;
+  int sizelength, indexlength, indexdeltalength; // mpeg4-generic AU headers
+
+  // SETUP
+  int channel;
+  int index;
+
+  // reassembly state
+  uint8_t * frame;
+  size_t frame_size, frame_capacity;
+  uint32_t frame_ts;
+  int64_t frame_pts;
+  bool keyframe, broken;
+
+  uint16_t seq;
+  uint32_t last_ts;
+  int64_t ext_ts;
+  bool seq_valid, ts_valid;
+};
+
+struct rtp_depacketizer {
+  struct rtp_media media[RTP_MAX_MEDIA];
+  int nb_media;
+
+  AVPacket q[RTP_PKT_QUEUE_SIZE];
+  int qhead, qsize;
+
+  int64_t t0;
+};
+
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+
+static char * strtrim(char * s)
+{
+  char * e;
+
+  while ( isspace(*s) ) {
+    ++s;
+  }
+
+  for ( e = s + strlen(s); e > s && isspace(e[-1]); ) {
+    *--e = 0;
+  }
+
+  return s;
+}
+
+static int hex2bin(const char * hex, uint8_t ** out)
+{
+  size_t n = strlen(hex) / 2;
+  uint8_t * bin;
+  uint v;
+
+  if ( !n || !(bin = av_mallocz(n + AV_INPUT_BUFFER_PADDING_SIZE)) ) {
+    return AVERROR(ENOMEM);
+  }
+
+  for ( size_t i = 0; i < n; ++i ) {
+    if ( sscanf(hex + 2 * i, "%2x", &v) != 1 ) {
+      av_free(bin);
+      return AVERROR_INVALIDDATA;
+    }
+    bin[i] = v;
+  }
+
+  *out = bin;
+  return n;
+}
+
+/* Append comma-separated base64 parameter sets to extradata in annex-b form */
+static int append_parameter_sets(struct rtp_media * m, const char * sprop)
+{
+  char * list = strdup(sprop);
+  char * pl = list, * ps;
+  uint8_t nal[2048];
+  int size;
+
+  int status = 0;
+
+  while ( (ps = strsep(&pl, ",")) ) {
+
+    if ( !*ps ) {
+      continue;
+    }
+
+    if ( (size = av_base64_decode(nal, ps, sizeof(nal))) <= 0 ) {
+      status = AVERROR_INVALIDDATA;
+      break;
+    }
+
+    m->extradata = av_realloc(m->extradata, m->extradata_size + 4 + size + AV_INPUT_BUFFER_PADDING_SIZE);
+    if ( !m->extradata ) {
+      m->extradata_size = 0;
+      status = AVERROR(ENOMEM);
+      break;
+    }
+
+    AV_WB32(m->extradata + m->extradata_size, 1);
+    memcpy(m->extradata + m->extradata_size + 4, nal, size);
+    m->extradata_size += 4 + size;
+    memset(m->extradata + m->extradata_size, 0, AV_INPUT_BUFFER_PADDING_SIZE);
+  }
+
+  free(list);
+
+  return status;
+}
+
+static int parse_fmtp(struct rtp_media * m)
+{
+  char * list, * pl, * ps, * key, * value;
+  int status = 0;
+
+  if ( !m->fmtp ) {
+    return 0;
+  }
+
+  pl = list = strdup(m->fmtp);
+
+  while ( status == 0 && (ps = strsep(&pl, ";")) ) {
+
+    if ( !(value = strchr(ps, '=')) ) {
+      continue;
+    }
+
+    *value++ = 0;
+    key = strtrim(ps);
+    value = strtrim(value);
+
+    if ( m->pf == rtp_payload_h264 ) {
+      if ( strcasecmp(key, "sprop-parameter-sets") == 0 ) {
+        status = append_parameter_sets(m, value);
+      }
+    }
+    else if ( m->pf == rtp_payload_hevc ) {
+      if ( strcasecmp(key, "sprop-vps") == 0 || strcasecmp(key, "sprop-sps") == 0 || strcasecmp(key, "sprop-pps") == 0 ) {
+        status = append_parameter_sets(m, value);
+      }
+    }
+    else if ( m->pf == rtp_payload_aac ) {
+      if ( strcasecmp(key, "mode") == 0 ) {
+        if ( strcasecmp(value, "AAC-hbr") != 0 && strcasecmp(value, "AAC-lbr") != 0 ) {
+          status = AVERROR_PATCHWELCOME;
+        }
+      }
+      else if ( strcasecmp(key, "sizelength") == 0 ) {
+        m->sizelength = atoi(value);
+      }
+      else if ( strcasecmp(key, "indexlength") == 0 ) {
+        m->indexlength = atoi(value);
+      }
+      else if ( strcasecmp(key, "indexdeltalength") == 0 ) {
+        m->indexdeltalength = atoi(value);
+      }
+      else if ( strcasecmp(key, "config") == 0 ) {
+        av_freep(&m->extradata);
+        if ( (m->extradata_size = hex2bin(value, &m->extradata)) < 0 ) {
+          status = m->extradata_size;
+          m->extradata_size = 0;
+        }
+      }
+    }
+    else if ( m->pf == rtp_payload_mp4v ) {
+      if ( strcasecmp(key, "config") == 0 ) {
+        av_freep(&m->extradata);
+        if ( (m->extradata_size = hex2bin(value, &m->extradata)) < 0 ) {
+          status = m->extradata_size;
+          m->extradata_size = 0;
+        }
+      }
+    }
+  }
+
+  free(list);
+
+  return status;
+}
+
+static int resolve_media_format(struct rtp_media * m)
+{
+  static const struct {
+    const char * encoding;
+    enum AVMediaType codec_type;
+    enum AVCodecID codec_id;
+    enum rtp_payload_format pf;
+  } formats[] = {
+    { "H264", AVMEDIA_TYPE_VIDEO, AV_CODEC_ID_H264, rtp_payload_h264 },
+    { "H265", AVMEDIA_TYPE_VIDEO, AV_CODEC_ID_HEVC, rtp_payload_hevc },
+    { "HEVC", AVMEDIA_TYPE_VIDEO, AV_CODEC_ID_HEVC, rtp_payload_hevc },
+    { "MP4V-ES", AVMEDIA_TYPE_VIDEO, AV_CODEC_ID_MPEG4, rtp_payload_mp4v },
+    { "MPEG4-GENERIC", AVMEDIA_TYPE_AUDIO, AV_CODEC_ID_AAC, rtp_payload_aac },
+    { "PCMU", AVMEDIA_TYPE_AUDIO, AV_CODEC_ID_PCM_MULAW, rtp_payload_pcm },
+    { "PCMA", AVMEDIA_TYPE_AUDIO, AV_CODEC_ID_PCM_ALAW, rtp_payload_pcm },
+  };
+
+  if ( !*m->encoding ) {
+    // static payload types, RFC 3551
+    switch ( m->payload_type ) {
+      case 0 :
+        strcpy(m->encoding, "PCMU");
+      break;
+      case 8 :
+        strcpy(m->encoding, "PCMA");
+      break;
+      default :
+        return AVERROR_PATCHWELCOME;
+    }
+    m->clock_rate = 8000;
+    m->channels = 1;
+  }
+
+  for ( size_t i = 0; i < sizeof(formats) / sizeof(formats[0]); ++i ) {
+    if ( strcasecmp(m->encoding, formats[i].encoding) == 0 && m->codec_type == formats[i].codec_type ) {
+      m->codec_id = formats[i].codec_id;
+      m->pf = formats[i].pf;
+      break;
+    }
+  }
+
+  if ( m->pf == rtp_payload_unknown || m->clock_rate <= 0 ) {
+    return AVERROR_PATCHWELCOME;
+  }
+
+  if ( m->codec_type == AVMEDIA_TYPE_AUDIO && m->channels < 1 ) {
+    m->channels = 1;
+  }
+
+  return parse_fmtp(m);
+}
+
+static int parse_sdp(struct rtp_depacketizer * dp, const char * sdp, size_t sdp_size)
+{
+  char * text = strndup(sdp, sdp_size);
+  char * pl = text, * line;
+  struct rtp_media * m = NULL;
+
+  char type[16], proto[32];
+  int pt, clock_rate, channels;
+
+  int status = 0;
+
+  while ( (line = strsep(&pl, "\n")) ) {
+
+    line = strtrim(line);
+
+    if ( strncmp(line, "m=", 2) == 0 ) {
+
+      if ( dp->nb_media >= RTP_MAX_MEDIA ) {
+        status = AVERROR(ENOBUFS);
+        break;
+      }
+
+      if ( sscanf(line + 2, "%15s %*d %31s %d", type, proto, &pt) != 3 ) {
+        status = AVERROR_INVALIDDATA;
+        break;
+      }
+
+      m = &dp->media[dp->nb_media++];
+      m->payload_type = pt;
+
+      if ( strcmp(type, "video") == 0 ) {
+        m->codec_type = AVMEDIA_TYPE_VIDEO;
+      }
+      else if ( strcmp(type, "audio") == 0 ) {
+        m->codec_type = AVMEDIA_TYPE_AUDIO;
+      }
+      else {
+        m->codec_type = AVMEDIA_TYPE_DATA;
+      }
+    }
+    else if ( !m ) {
+      // session-level attributes are not used
+    }
+    else if ( strncmp(line, "a=rtpmap:", 9) == 0 ) {
+      channels = 0;
+      if ( sscanf(line + 9, "%d %31[^/]/%d/%d", &pt, m->encoding, &clock_rate, &channels) >= 3 && pt == m->payload_type ) {
+        m->clock_rate = clock_rate;
+        m->channels = channels;
+      }
+    }
+    else if ( strncmp(line, "a=fmtp:", 7) == 0 ) {
+      if ( sscanf(line + 7, "%d", &pt) == 1 && pt == m->payload_type && (line = strchr(line, ' ')) ) {
+        free(m->fmtp);
+        m->fmtp = strdup(line + 1);
+      }
+    }
+    else if ( strncmp(line, "a=control:", 10) == 0 ) {
+      free(m->control);
+      m->control = strdup(strtrim(line + 10));
+    }
+  }
+
+  for ( int i = 0; status == 0 && i < dp->nb_media; ++i ) {
+    if ( (status = resolve_media_format(&dp->media[i])) ) {
+      PDBG("media %d: unsupported payload '%s' pt=%d: %s", i, dp->media[i].encoding, dp->media[i].payload_type,
+          av_err2str(status));
+    }
+  }
+
+  if ( status == 0 && dp->nb_media < 1 ) {
+    status = AVERROR_INVALIDDATA;
+  }
+
+  free(text);
+
+  return status;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+
+static int queue_pkt(struct rtp_depacketizer * dp, const struct rtp_media * m, const uint8_t * data, size_t size,
+    int64_t pts, bool key)
+{
+  AVPacket * pkt;
+  int status;
+
+  if ( dp->qsize == RTP_PKT_QUEUE_SIZE ) {
+    PDBG("[st=%d] QUEUE OVERFLOW, DROP OLDEST", m->index);
+    av_packet_unref(&dp->q[dp->qhead]);
+    dp->qhead = (dp->qhead + 1) % RTP_PKT_QUEUE_SIZE;
+    --dp->qsize;
+  }
+
+  pkt = &dp->q[(dp->qhead + dp->qsize) % RTP_PKT_QUEUE_SIZE];
+  av_init_packet(pkt);
+
+  if ( (status = av_new_packet(pkt, size)) ) {
+    return status;
+  }
+
+  memcpy(pkt->data, data, size);
+  pkt->pts = pkt->dts = pts;
+  pkt->stream_index = m->index;
+  if ( key ) {
+    pkt->flags |= AV_PKT_FLAG_KEY;
+  }
+
+  ++dp->qsize;
+
+  return 0;
+}
+
+static int frame_append(struct rtp_media * m, const uint8_t * data, size_t size, bool startcode)
+{
+  size_t required = m->frame_size + size + (startcode ? 4 : 0);
+
+  if ( required > RTP_MAX_FRAME_SIZE ) {
+    return AVERROR(EMSGSIZE);
+  }
+
+  if ( required > m->frame_capacity ) {
+    size_t capacity = (required + 0xFFFF) & ~0xFFFFUL;
+    uint8_t * frame = realloc(m->frame, capacity);
+    if ( !frame ) {
+      return AVERROR(ENOMEM);
+    }
+    m->frame = frame;
+    m->frame_capacity = capacity;
+  }
+
+  if ( startcode ) {
+    AV_WB32(m->frame + m->frame_size, 1);
+    m->frame_size += 4;
+  }
+
+  memcpy(m->frame + m->frame_size, data, size);
+  m->frame_size += size;
+
+  return 0;
+}
+
+static int flush_frame(struct rtp_depacketizer * dp, struct rtp_media * m)
+{
+  int status = 0;
+
+  if ( m->frame_size && !m->broken ) {
+    status = queue_pkt(dp, m, m->frame, m->frame_size, m->frame_pts, m->keyframe);
+  }
+
+  m->frame_size = 0;
+  m->keyframe = false;
+  m->broken = false;
+
+  return status;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+
+static int depacketize_h264(struct rtp_media * m, const uint8_t * p, size_t n)
+{
+  int nal_type = p[0] & 0x1F;
+  size_t nalsize;
+  int status = 0;
+
+  if ( nal_type >= 1 && nal_type <= 23 ) {
+    if ( nal_type == 5 ) {
+      m->keyframe = true;
+    }
+    status = frame_append(m, p, n, true);
+  }
+  else if ( nal_type == 24 ) { // STAP-A
+    for ( ++p, --n; n > 2 && status == 0; p += nalsize, n -= nalsize ) {
+      nalsize = AV_RB16(p);
+      p += 2, n -= 2;
+      if ( nalsize > n ) {
+        status = AVERROR_INVALIDDATA;
+        break;
+      }
+      if ( (p[0] & 0x1F) == 5 ) {
+        m->keyframe = true;
+      }
+      status = frame_append(m, p, nalsize, true);
+    }
+  }
+  else if ( nal_type == 28 ) { // FU-A
+    if ( n < 3 ) {
+      status = AVERROR_INVALIDDATA;
+    }
+    else if ( p[1] & 0x80 ) {
+      uint8_t hdr = (p[0] & 0xE0) | (p[1] & 0x1F);
+      if ( (p[1] & 0x1F) == 5 ) {
+        m->keyframe = true;
+      }
+      if ( (status = frame_append(m, &hdr, 1, true)) == 0 ) {
+        status = frame_append(m, p + 2, n - 2, false);
+      }
+    }
+    else if ( m->frame_size ) {
+      status = frame_append(m, p + 2, n - 2, false);
+    }
+    else {
+      m->broken = true;
+    }
+  }
+  else {
+    status = AVERROR_PATCHWELCOME;
+  }
+
+  return status;
+}
+
+static int depacketize_hevc(struct rtp_media * m, const uint8_t * p, size_t n)
+{
+  int nal_type;
+  size_t nalsize;
+  int status = 0;
+
+  if ( n < 3 ) {
+    return AVERROR_INVALIDDATA;
+  }
+
+  nal_type = (p[0] >> 1) & 0x3F;
+
+  if ( nal_type < 48 ) {
+    if ( nal_type >= 16 && nal_type <= 21 ) {
+      m->keyframe = true;
+    }
+    status = frame_append(m, p, n, true);
+  }
+  else if ( nal_type == 48 ) { // AP
+    for ( p += 2, n -= 2; n > 2 && status == 0; p += nalsize, n -= nalsize ) {
+      nalsize = AV_RB16(p);
+      p += 2, n -= 2;
+      if ( nalsize > n || nalsize < 2 ) {
+        status = AVERROR_INVALIDDATA;
+        break;
+      }
+      nal_type = (p[0] >> 1) & 0x3F;
+      if ( nal_type >= 16 && nal_type <= 21 ) {
+        m->keyframe = true;
+      }
+      status = frame_append(m, p, nalsize, true);
+    }
+  }
+  else if ( nal_type == 49 ) { // FU
+    nal_type = p[2] & 0x3F;
+    if ( p[2] & 0x80 ) {
+      uint8_t hdr[2] = { (p[0] & 0x81) | (nal_type << 1), p[1] };
+      if ( nal_type >= 16 && nal_type <= 21 ) {
+        m->keyframe = true;
+      }
+      if ( (status = frame_append(m, hdr, 2, true)) == 0 ) {
+        status = frame_append(m, p + 3, n - 3, false);
+      }
+    }
+    else if ( m->frame_size ) {
+      status = frame_append(m, p + 3, n - 3, false);
+    }
+    else {
+      m->broken = true;
+    }
+  }
+  else {
+    status = AVERROR_PATCHWELCOME;
+  }
+
+  return status;
+}
+
+static int depacketize_mp4v(struct rtp_media * m, const uint8_t * p, size_t n)
+{
+  for ( size_t i = 0; i + 4 < n; ++i ) {
+    if ( p[i] == 0 && p[i + 1] == 0 && p[i + 2] == 1 && p[i + 3] == 0xB6 ) {
+      if ( (p[i + 4] >> 6) == 0 ) {
+        m->keyframe = true;
+      }
+      break;
+    }
+  }
+  return frame_append(m, p, n, false);
+}
+
+static uint32_t get_bits(const uint8_t * p, size_t * pos, int nbits)
+{
+  uint32_t v = 0;
+  while ( nbits-- > 0 ) {
+    v = (v << 1) | ((p[*pos >> 3] >> (7 - (*pos & 7))) & 1);
+    ++*pos;
+  }
+  return v;
+}
+
+static int depacketize_aac(struct rtp_depacketizer * dp, struct rtp_media * m, const uint8_t * p, size_t n,
+    bool marker)
+{
+  size_t au_headers_bits, au_headers_bytes, bitpos = 0;
+  size_t au_size;
+  int64_t pts;
+  int status = 0;
+
+  if ( m->frame_size ) {
+    // continuation of fragmented AU, RFC 3640 3.2.3
+    if ( n < 2 || (au_headers_bytes = (AV_RB16(p) + 7) / 8) + 2 > n ) {
+      return AVERROR_INVALIDDATA;
+    }
+    if ( (status = frame_append(m, p + 2 + au_headers_bytes, n - 2 - au_headers_bytes, false)) == 0 && marker ) {
+      m->keyframe = true;
+      status = flush_frame(dp, m);
+    }
+    return status;
+  }
+
+  if ( n < 2 || m->sizelength < 1 ) {
+    return AVERROR_INVALIDDATA;
+  }
+
+  au_headers_bits = AV_RB16(p);
+  au_headers_bytes = (au_headers_bits + 7) / 8;
+  if ( 2 + au_headers_bytes > n ) {
+    return AVERROR_INVALIDDATA;
+  }
+
+  const uint8_t * hdr = p + 2;
+  const uint8_t * data = hdr + au_headers_bytes;
+  size_t data_size = n - 2 - au_headers_bytes;
+
+  for ( int i = 0; bitpos + m->sizelength <= au_headers_bits; ++i ) {
+
+    au_size = get_bits(hdr, &bitpos, m->sizelength);
+    bitpos += i == 0 ? m->indexlength : m->indexdeltalength;
+
+    pts = m->ext_ts + (int64_t) i * AAC_FRAME_SAMPLES;
+
+    if ( au_size > data_size ) {
+      // first fragment of AU spanning multiple packets
+      m->frame_pts = pts;
+      status = frame_append(m, data, data_size, false);
+      break;
+    }
+
+    if ( (status = queue_pkt(dp, m, data, au_size, pts, true)) ) {
+      break;
+    }
+
+    data += au_size;
+    data_size -= au_size;
+  }
+
+  return status;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+
+static int64_t unwrap_ts(struct rtp_depacketizer * dp, struct rtp_media * m, uint32_t ts)
+{
+  if ( m->ts_valid ) {
+    m->ext_ts += (int32_t) (ts - m->last_ts);
+  }
+  else {
+    // align stream starts by arrival time of first packets
+    int64_t now = ffmpeg_gettime_us();
+    if ( dp->t0 == AV_NOPTS_VALUE ) {
+      dp->t0 = now;
+    }
+    m->ext_ts = av_rescale(now - dp->t0, m->clock_rate, FFMPEG_TIME_SCALE);
+    m->ts_valid = true;
+  }
+
+  m->last_ts = ts;
+
+  return m->ext_ts;
+}
+
+static int depacketize(struct rtp_depacketizer * dp, struct rtp_media * m, const uint8_t * data, size_t size)
+{
+  size_t hlen;
+  uint16_t seq;
+  uint32_t ts;
+  bool marker;
+  int64_t pts;
+  int status = 0;
+
+  if ( size < RTP_HEADER_SIZE || (data[0] >> 6) != 2 ) {
+    return AVERROR_INVALIDDATA;
+  }
+
+  if ( (data[1] & 0x7F) != m->payload_type ) {
+    return 0;
+  }
+
+  hlen = RTP_HEADER_SIZE + (data[0] & 0x0F) * 4;
+
+  if ( (data[0] & 0x10) ) { // header extension
+    if ( hlen + 4 > size ) {
+      return AVERROR_INVALIDDATA;
+    }
+    hlen += 4 + AV_RB16(data + hlen + 2) * 4;
+  }
+
+  if ( (data[0] & 0x20) ) { // padding
+    if ( data[size - 1] > size ) {
+      return AVERROR_INVALIDDATA;
+    }
+    size -= data[size - 1];
+  }
+
+  if ( hlen >= size ) {
+    return hlen == size ? 0 : AVERROR_INVALIDDATA;
+  }
+
+  marker = (data[1] & 0x80) != 0;
+  seq = AV_RB16(data + 2);
+  ts = AV_RB32(data + 4);
+
+  if ( m->seq_valid && seq != (uint16_t) (m->seq + 1) ) {
+    PDBG("[st=%d] RTP LOSS: expected seq=%u got %u", m->index, (uint16_t) (m->seq + 1), seq);
+    m->broken = true;
+  }
+
+  m->seq = seq;
+  m->seq_valid = true;
+
+  if ( m->frame_size && ts != m->frame_ts && m->pf != rtp_payload_aac ) {
+    // marker of previous frame was lost
+    flush_frame(dp, m);
+  }
+
+  pts = unwrap_ts(dp, m, ts);
+
+  if ( !m->frame_size ) {
+    m->frame_ts = ts;
+    m->frame_pts = pts;
+  }
+
+  data += hlen;
+  size -= hlen;
+
+  switch ( m->pf ) {
+
+    case rtp_payload_h264 :
+      if ( (status = depacketize_h264(m, data, size)) == 0 && marker ) {
+        status = flush_frame(dp, m);
+      }
+    break;
+
+    case rtp_payload_hevc :
+      if ( (status = depacketize_hevc(m, data, size)) == 0 && marker ) {
+        status = flush_frame(dp, m);
+      }
+    break;
+
+    case rtp_payload_mp4v :
+      if ( (status = depacketize_mp4v(m, data, size)) == 0 && marker ) {
+        status = flush_frame(dp, m);
+      }
+    break;
+
+    case rtp_payload_aac :
+      if ( m->broken ) {
+        m->frame_size = 0;
+        m->broken = false;
+      }
+      status = depacketize_aac(dp, m, data, size, marker);
+    break;
+
+    case rtp_payload_pcm :
+      m->broken = false;
+      status = queue_pkt(dp, m, data, size, pts, true);
+    break;
+
+    default :
+      status = AVERROR_PATCHWELCOME;
+    break;
+  }
+
+  if ( status && status != AVERROR(ENOMEM) ) {
+    PDBG("[st=%d] DROP BAD RTP PAYLOAD: %s", m->index, av_err2str(status));
+    m->frame_size = 0;
+    m->broken = false;
+    status = 0;
+  }
+
+  return status;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+int rtp_depacketizer_create(struct rtp_depacketizer ** pdp, const char * sdp, size_t sdp_size)
+{
+  struct rtp_depacketizer * dp = NULL;
+  int status;
+
+  if ( !(dp = calloc(1, sizeof(*dp))) ) {
+    status = AVERROR(ENOMEM);
+    goto end;
+  }
+
+  dp->t0 = AV_NOPTS_VALUE;
+
+  for ( int i = 0; i < RTP_MAX_MEDIA; ++i ) {
+    dp->media[i].channel = -1;
+    dp->media[i].index = -1;
+  }
+
+  if ( (status = parse_sdp(dp, sdp, sdp_size)) ) {
+    PDBG("parse_sdp() fails: %s", av_err2str(status));
+    goto end;
+  }
+
+end:
+
+  if ( status ) {
+    rtp_depacketizer_destroy(&dp);
+  }
+
+  *pdp = dp;
+
+  return status;
+}
+
+void rtp_depacketizer_destroy(struct rtp_depacketizer ** dp)
+{
+  if ( dp && *dp ) {
+
+    for ( int i = 0; i < RTP_MAX_MEDIA; ++i ) {
+      struct rtp_media * m = &(*dp)->media[i];
+      free(m->fmtp);
+      free(m->control);
+      free(m->frame);
+      av_free(m->extradata);
+    }
+
+    while ( (*dp)->qsize ) {
+      av_packet_unref(&(*dp)->q[(*dp)->qhead]);
+      (*dp)->qhead = ((*dp)->qhead + 1) % RTP_PKT_QUEUE_SIZE;
+      --(*dp)->qsize;
+    }
+
+    free(*dp);
+    *dp = NULL;
+  }
+}
+
+int rtp_depacketizer_setup(struct rtp_depacketizer * dp, const char * url, int channel)
+{
+  struct rtp_media * m = NULL;
+  size_t ulen = strlen(url), clen;
+
+  for ( int i = 0; i < dp->nb_media && !m; ++i ) {
+
+    const char * control = dp->media[i].control;
+
+    if ( !control || !*control ) {
+      continue;
+    }
+
+    if ( strcmp(url, control) == 0 ) {
+      m = &dp->media[i];
+    }
+    else if ( ulen > (clen = strlen(control)) && url[ulen - clen - 1] == '/' && strcmp(url + ulen - clen, control) == 0 ) {
+      m = &dp->media[i];
+    }
+  }
+
+  // fallback: bind media in order of SETUP requests
+  for ( int i = 0; i < dp->nb_media && !m; ++i ) {
+    if ( dp->media[i].channel < 0 ) {
+      m = &dp->media[i];
+    }
+  }
+
+  if ( !m ) {
+    return AVERROR(ENOENT);
+  }
+
+  return (m->channel = channel >= 0 ? channel : 2 * (m - dp->media));
+}
+
+int rtp_depacketizer_open_input(struct rtp_depacketizer * dp, AVFormatContext ** pic)
+{
+  AVFormatContext * ic = NULL;
+  AVStream * st;
+  int status = 0;
+
+  if ( !(ic = avformat_alloc_context()) ) {
+    status = AVERROR(ENOMEM);
+    goto end;
+  }
+
+  for ( int i = 0; i < dp->nb_media; ++i ) {
+
+    struct rtp_media * m = &dp->media[i];
+
+    if ( m->channel < 0 ) {
+      continue;
+    }
+
+    if ( !(st = avformat_new_stream(ic, NULL)) ) {
+      status = AVERROR(ENOMEM);
+      goto end;
+    }
+
+    m->index = st->index;
+
+    st->id = i;
+    st->time_base = (AVRational ) { 1, m->clock_rate };
+    st->codecpar->codec_type = m->codec_type;
+    st->codecpar->codec_id = m->codec_id;
+
+    if ( m->codec_type == AVMEDIA_TYPE_AUDIO ) {
+      st->codecpar->sample_rate = m->clock_rate;
+      st->codecpar->channels = m->channels;
+      st->codecpar->channel_layout = av_get_default_channel_layout(m->channels);
+      if ( m->codec_id == AV_CODEC_ID_AAC ) {
+        st->codecpar->frame_size = AAC_FRAME_SAMPLES;
+      }
+    }
+
+    if ( m->extradata_size > 0 ) {
+      if ( !(st->codecpar->extradata = av_mallocz(m->extradata_size + AV_INPUT_BUFFER_PADDING_SIZE)) ) {
+        status = AVERROR(ENOMEM);
+        goto end;
+      }
+      memcpy(st->codecpar->extradata, m->extradata, m->extradata_size);
+      st->codecpar->extradata_size = m->extradata_size;
+    }
+  }
+
+  if ( ic->nb_streams < 1 ) {
+    PDBG("No media was SETUP");
+    status = AVERROR_STREAM_NOT_FOUND;
+  }
+
+end:
+
+  if ( status && ic ) {
+    avformat_free_context(ic);
+    ic = NULL;
+  }
+
+  *pic = ic;
+
+  return status;
+}
+
+int rtp_depacketizer_put(struct rtp_depacketizer * dp, int channel, const uint8_t * data, size_t size)
+{
+  for ( int i = 0; i < dp->nb_media; ++i ) {
+    struct rtp_media * m = &dp->media[i];
+    if ( m->index >= 0 && channel == m->channel ) {
+      return depacketize(dp, m, data, size);
+    }
+  }
+
+  // RTCP and not yet opened streams are ignored
+  return 0;
+}
+
+int rtp_depacketizer_get_pkt(struct rtp_depacketizer * dp, AVPacket * pkt)
+{
+  if ( !dp->qsize ) {
+    return AVERROR(EAGAIN);
+  }
+
+  av_packet_move_ref(pkt, &dp->q[dp->qhead]);
+  dp->qhead = (dp->qhead + 1) % RTP_PKT_QUEUE_SIZE;
+  --dp->qsize;
+
+  return 0;
+}
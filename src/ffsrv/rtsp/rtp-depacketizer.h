@@ -0,0 +1,64 @@
+/*
+ * rtp-depacketizer.h
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: amyznikov
+ *
+ *  SDP parser and RTP payload reassembler for RTSP ANNOUNCE/RECORD publishers.
+ *  Converts interleaved RTP packets into AVPackets without any libavformat demuxer involved.
+ */
+
+// #pragma once
+
+#ifndef __rtp_depacketizer_h__
+#define __rtp_depacketizer_h__
+
+#include "ffmpeg.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+struct rtp_depacketizer;
+
+
+/* Parse ANNOUNCE SDP and create depacketizer for all supported media sections.
+ * Returns AVERROR_PATCHWELCOME if SDP contains media with unsupported payload format */
+int rtp_depacketizer_create(struct rtp_depacketizer ** dp,
+    const char * sdp,
+    size_t sdp_size);
+
+void rtp_depacketizer_destroy(struct rtp_depacketizer ** dp);
+
+
+/* Bind interleaved channel to the media section referenced by SETUP url.
+ * If channel < 0 then 2 * media index is assigned.
+ * Returns bound channel or negative AVERROR code */
+int rtp_depacketizer_setup(struct rtp_depacketizer * dp,
+    const char * url,
+    int channel);
+
+
+/* Create demuxer-less AVFormatContext with streams described by SDP */
+int rtp_depacketizer_open_input(struct rtp_depacketizer * dp,
+    AVFormatContext ** ic);
+
+
+/* Feed one interleaved frame ('$' channel size data) */
+int rtp_depacketizer_put(struct rtp_depacketizer * dp,
+    int channel,
+    const uint8_t * data,
+    size_t size);
+
+
+/* Pop next reassembled packet, returns AVERROR(EAGAIN) if queue is empty */
+int rtp_depacketizer_get_pkt(struct rtp_depacketizer * dp,
+    AVPacket * pkt);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __rtp_depacketizer_h__ */
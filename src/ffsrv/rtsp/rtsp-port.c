@@ -12,6 +12,8 @@
 #include "rtsp-parser.h"
 #include "ffobject.h"
 #include "ffoutput.h"
+#include "ffinput.h"
+#include "rtp-depacketizer.h"
 #include "co-scheduler.h"
 #include "sockopt.h"
 #include "ipaddrs.h"
@@ -21,9 +23,16 @@
 
 
 #define RTSP_RXBUF_SIZE (4*1024)
+#define RTSP_RECORD_RXBUF_SIZE (32*1024)
 #define RTSP_CLIENT_STACK_SIZE (RTSP_RXBUF_SIZE + 1024*1024)
 #define RTSP_SERVER_STACK_SIZE  (128 * 1024)
 
+#define RTSP_MAX_STREAMS          8
+#define RTSP_UDP_BATCH_SIZE       64
+#define RTSP_UDP_MAX_PACKET_SIZE  1472
+#define RTSP_TCP_BATCH_SIZE       64
+#define RTSP_HDR_SLOT_SIZE        64  // '$' framing + RTP header or small RTCP packet
+
 
 struct rtsp_server_ctx {
   int so;
@@ -32,14 +41,47 @@ struct rtsp_server_ctx {
 
 
 
+// sendmmsg() batch of RTP packets for one stream, payloads are referenced, not copied
+struct rtsp_udp_batch {
+  struct mmsghdr msgs[RTSP_UDP_BATCH_SIZE];
+  struct iovec iov[RTSP_UDP_BATCH_SIZE][2];
+  uint8_t hdrs[RTSP_UDP_BATCH_SIZE][RTSP_HDR_SLOT_SIZE];
+  int count;
+};
+
+// interleaved framing gathered into single sendmsg()
+struct rtsp_tcp_batch {
+  struct iovec iov[2 * RTSP_TCP_BATCH_SIZE];
+  uint8_t hdrs[RTSP_TCP_BATCH_SIZE][RTSP_HDR_SLOT_SIZE];
+  int count, iovcnt;
+};
+
+// RTP/AVP (UDP) transport of one stream, sockets are connected to client_port pair
+struct rtsp_udp_stream {
+  struct rtsp_udp_batch * batch;
+  int rtp, rtcp;
+  uint16_t server_port;
+  uint64_t dropped;
+};
+
+
 struct rtsp_client_ctx {
-  struct ffmixer * input;
+  struct ffinput * input;
   struct ffoutput * output;
+  struct rtp_depacketizer * rtpdp;
   struct cosocket * tcp;
+  struct rtsp_tcp_batch * txb;
   struct rtsp_parser rstp;
   uint64_t rtsp_session_id;
   int so;
   int status;
+  bool recording;
+  bool input_opened;
+  bool udp_transport;
+  bool tcp_transport;
+  uint8_t * early; // interleaved frames received together with RECORD: channel, size[2], data
+  size_t early_size;
+  struct rtsp_udp_stream udp[RTSP_MAX_STREAMS];
 };
 
 
@@ -77,9 +119,16 @@ static bool on_rtsp_announce(void * cookie, const struct rtsp_parser_callback_ar
 static bool on_rtsp_get_parameter(void * cookie, const struct rtsp_parser_callback_args * args);
 static bool on_rtsp_set_parameter(void * cookie, const struct rtsp_parser_callback_args * args);
 static bool on_rtsp_teardown(void * cookie, const struct rtsp_parser_callback_args * args);
+static bool on_rtsp_interleaved(void * cookie, int channel, const uint8_t * data, size_t size);
 
 
 static int rtsp_send_pkt(void * cookie, int stream_index, uint8_t * buf, int buf_size);
+static int rtsp_send_pktv(void * cookie, int stream_index, const struct iovec * iov, int iovcnt);
+static int rtsp_flush_pkts(void * cookie);
+static void rtsp_output_onidle(void * cookie);
+static int rtsp_set_pacing_rate(void * cookie, uint32_t bytes_per_sec);
+static int rtsp_open_input(void * cookie, AVFormatContext ** ic);
+static int rtsp_read_pkt(void * cookie, AVPacket * pkt);
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////////
 
@@ -215,6 +264,7 @@ static struct rtsp_client_ctx * create_rtsp_client_ctx(int so)
     .on_get_parameter = on_rtsp_get_parameter,
     .on_set_parameter = on_rtsp_set_parameter,
     .on_teardown = on_rtsp_teardown,
+    .on_interleaved = on_rtsp_interleaved,
   };
 
 
@@ -228,6 +278,10 @@ static struct rtsp_client_ctx * create_rtsp_client_ctx(int so)
 
   so_set_noblock(client_ctx->so = so, true);
 
+  for ( int i = 0; i < RTSP_MAX_STREAMS; ++i ) {
+    client_ctx->udp[i].rtp = client_ctx->udp[i].rtcp = -1;
+  }
+
   if ( so_set_recvbuf(so, ffsrv.rtsp.rxbuf) != 0 ) {
     PDBG("[so=%d] so_set_recvbuf() fails: %s", so, strerror(errno));
     goto end;
@@ -272,6 +326,25 @@ static void destroy_rtsp_client_ctx(struct rtsp_client_ctx * client_ctx)
     int so = client_ctx->so;
 
     delete_output_stream(&client_ctx->output);
+    release_input_stream(&client_ctx->input);
+    rtp_depacketizer_destroy(&client_ctx->rtpdp);
+    rtsp_parser_cleanup(&client_ctx->rstp);
+    free(client_ctx->txb);
+    free(client_ctx->early);
+
+    for ( int i = 0; i < RTSP_MAX_STREAMS; ++i ) {
+      struct rtsp_udp_stream * us = &client_ctx->udp[i];
+      if ( us->rtp != -1 ) {
+        close(us->rtp);
+      }
+      if ( us->rtcp != -1 ) {
+        close(us->rtcp);
+      }
+      if ( us->dropped ) {
+        PDBG("[so=%d] st=%d: %" PRIu64 " RTP packets dropped", so, i, us->dropped);
+      }
+      free(us->batch);
+    }
 
     if ( so != -1 ) {
       so_close_connection(so, 0);
@@ -301,6 +374,12 @@ static void rtsp_client_thread(void * arg)
       PDBG("rtsp_parser_execute() fails");
       break;
     }
+
+    if ( client_ctx->recording ) {
+      // publisher session: rtsp requests and interleaved rtp are now consumed by rtsp_read_pkt()
+      ff_run_input_stream(client_ctx->input);
+      break;
+    }
   }
 
   PDBG("[so=%d] FINISHED", client_ctx->so);
@@ -322,34 +401,506 @@ static void rtsp_output_thread(void * arg)
 }
 
 
-static int rtsp_send_pkt(void * cookie, int stream_index, uint8_t * buf, int buf_size)
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static int create_udp_socket_pair(const struct sockaddr_in * peer, uint16_t client_rtp_port, uint16_t client_rtcp_port,
+    int * rtp, int * rtcp, uint16_t * server_port)
+{
+  struct sockaddr_in sin;
+  socklen_t len;
+
+  int status = AVERROR(EADDRINUSE);
+
+  *rtp = *rtcp = -1;
+
+  // RTP must be even port, RTCP is next odd one
+  for ( int attempt = 0; attempt < 32; ++attempt ) {
+
+    if ( (*rtp = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0)) == -1 ) {
+      status = AVERROR(errno);
+      break;
+    }
+
+    memset(&sin, 0, sizeof(sin));
+    sin.sin_family = AF_INET;
+    len = sizeof(sin);
+
+    if ( bind(*rtp, (struct sockaddr*) &sin, sizeof(sin)) == -1 || getsockname(*rtp, (struct sockaddr*) &sin, &len) == -1 ) {
+      status = AVERROR(errno);
+      break;
+    }
+
+    if ( ntohs(sin.sin_port) & 1 ) {
+      close(*rtp), *rtp = -1;
+      continue;
+    }
+
+    *server_port = ntohs(sin.sin_port);
+
+    if ( (*rtcp = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0)) == -1 ) {
+      status = AVERROR(errno);
+      break;
+    }
+
+    sin.sin_port = htons(*server_port + 1);
+    if ( bind(*rtcp, (struct sockaddr*) &sin, sizeof(sin)) == -1 ) {
+      close(*rtp), *rtp = -1;
+      close(*rtcp), *rtcp = -1;
+      continue;
+    }
+
+    sin = *peer;
+    sin.sin_port = htons(client_rtp_port);
+    if ( connect(*rtp, (struct sockaddr*) &sin, sizeof(sin)) == -1 ) {
+      status = AVERROR(errno);
+      break;
+    }
+
+    sin.sin_port = htons(client_rtcp_port);
+    if ( connect(*rtcp, (struct sockaddr*) &sin, sizeof(sin)) == -1 ) {
+      status = AVERROR(errno);
+      break;
+    }
+
+    so_set_sendbuf(*rtp, ffsrv.rtsp.txbuf);
+
+    status = 0;
+    break;
+  }
+
+  if ( status ) {
+    if ( *rtp != -1 ) {
+      close(*rtp), *rtp = -1;
+    }
+    if ( *rtcp != -1 ) {
+      close(*rtcp), *rtcp = -1;
+    }
+  }
+
+  return status;
+}
+
+static int rtsp_setup_udp_stream(struct rtsp_client_ctx * client_ctx, int stream_id, const char * client_port)
+{
+  struct rtsp_udp_stream * us;
+  struct sockaddr_in peer;
+  socklen_t len = sizeof(peer);
+  int rtp_port = 0, rtcp_port = 0;
+  int status;
+
+  if ( stream_id < 0 || stream_id >= RTSP_MAX_STREAMS ) {
+    return AVERROR(EINVAL);
+  }
+
+  if ( !client_port || sscanf(client_port, "%d-%d", &rtp_port, &rtcp_port) < 1 || rtp_port <= 0 || rtp_port > 0xFFFF ) {
+    return AVERROR(EINVAL);
+  }
+
+  if ( rtcp_port <= 0 || rtcp_port > 0xFFFF ) {
+    rtcp_port = rtp_port + 1;
+  }
+
+  if ( getpeername(client_ctx->so, (struct sockaddr*) &peer, &len) == -1 ) {
+    return AVERROR(errno);
+  }
+
+  us = &client_ctx->udp[stream_id];
+
+  if ( us->rtp != -1 ) {
+    close(us->rtp), us->rtp = -1;
+    close(us->rtcp), us->rtcp = -1;
+  }
+
+  if ( !us->batch && !(us->batch = calloc(1, sizeof(*us->batch))) ) {
+    return AVERROR(ENOMEM);
+  }
+
+  if ( (status = create_udp_socket_pair(&peer, rtp_port, rtcp_port, &us->rtp, &us->rtcp, &us->server_port)) ) {
+    PDBG("[so=%d] create_udp_socket_pair() fails: %s", client_ctx->so, av_err2str(status));
+    return status;
+  }
+
+  for ( int i = 0; i < RTSP_UDP_BATCH_SIZE; ++i ) {
+    us->batch->iov[i][0].iov_base = us->batch->hdrs[i];
+    us->batch->msgs[i].msg_hdr.msg_iov = us->batch->iov[i];
+  }
+
+  client_ctx->udp_transport = true;
+
+  return 0;
+}
+
+/*
+ * Send batched RTP packets with single sendmmsg().
+ * UDP semantics: if socket buffer stays full after one wait, the rest of batch is dropped
+ */
+static int rtsp_flush_udp_stream(struct rtsp_client_ctx * client_ctx, struct rtsp_udp_stream * us)
+{
+  struct rtsp_udp_batch * b = us->batch;
+  int sent = 0, n;
+  bool waited = false;
+
+  while ( sent < b->count ) {
+
+    if ( (n = sendmmsg(us->rtp, b->msgs + sent, b->count - sent, MSG_DONTWAIT)) > 0 ) {
+      sent += n;
+      continue;
+    }
+
+    if ( errno == EINTR ) {
+      continue;
+    }
+
+    if ( errno != EAGAIN || waited ) {
+      if ( errno != EAGAIN ) {
+        client_ctx->status = AVERROR(errno);
+      }
+      us->dropped += b->count - sent;
+      break;
+    }
+
+    co_io_wait(us->rtp, EPOLLOUT, ffsrv.rtsp.sndtmo * 1000);
+    waited = true;
+  }
+
+  b->count = 0;
+
+  return client_ctx->status;
+}
+
+/*
+ * Drain RTCP receiver reports, client BYE ends the session
+ */
+static void rtsp_drain_rtcp(struct rtsp_client_ctx * client_ctx, struct rtsp_udp_stream * us)
+{
+  uint8_t buf[RTSP_UDP_MAX_PACKET_SIZE];
+  ssize_t size, pos, len;
+
+  while ( (size = recv(us->rtcp, buf, sizeof(buf), MSG_DONTWAIT)) > 0 ) {
+    for ( pos = 0; pos + 4 <= size; pos += len ) {
+      len = 4 * (((buf[pos + 2] << 8) | buf[pos + 3]) + 1);
+      if ( buf[pos + 1] == 203 ) {
+        PDBG("[so=%d] RTCP BYE", client_ctx->so);
+        client_ctx->status = AVERROR_EOF;
+      }
+    }
+  }
+}
+
+static void rtsp_output_onidle(void * cookie)
 {
   struct rtsp_client_ctx * client_ctx = cookie;
 
-  struct pkt {
-    uint8_t m;
-    uint8_t idx;
-    uint16_t buf_size;
-    uint8_t buf[buf_size];
-  } pkt;
+  // batches are flushed per frame, here only client RTCP is checked
+  if ( client_ctx->udp_transport ) {
+    for ( int i = 0; i < RTSP_MAX_STREAMS; ++i ) {
+      if ( client_ctx->udp[i].rtp != -1 ) {
+        rtsp_drain_rtcp(client_ctx, &client_ctx->udp[i]);
+      }
+    }
+  }
+}
 
-  size_t pktsize;
-  ssize_t sent;
+// UDP batches drop on full socket buffer, so kernel pacing is used for interleaved TCP only
+static int rtsp_set_pacing_rate(void * cookie, uint32_t bytes_per_sec)
+{
+  struct rtsp_client_ctx * client_ctx = cookie;
 
-  pkt.m = '$';
-  pkt.idx = stream_index * 2 + 1;
-  pkt.buf_size = htons(buf_size);
-  memcpy(pkt.buf, buf, buf_size);
+  if ( client_ctx->udp_transport ) {
+    return AVERROR(ENOTSUP);
+  }
 
+  return so_set_max_pacing_rate(client_ctx->so, bytes_per_sec) == 0 ? 0 : AVERROR(errno);
+}
 
-  pktsize = offsetof(struct pkt, buf) + buf_size;
-  sent = cosocket_send(client_ctx->tcp, &pkt, pktsize, 0);
+static inline bool is_rtcp(const struct iovec * iov)
+{
+  const uint8_t * p = iov[0].iov_base;
+  return iov[0].iov_len >= 2 && p[1] >= 200 && p[1] <= 204;
+}
+
+static int rtsp_send_udp_pktv(struct rtsp_client_ctx * client_ctx, int stream_index, const struct iovec * iov, int iovcnt)
+{
+  struct rtsp_udp_stream * us;
+  struct rtsp_udp_batch * b;
+  size_t size = 0;
+
+  if ( client_ctx->status ) {
+    return client_ctx->status;
+  }
 
-  // PDBG("st=%d buf_size=%d sent=%zd", stream_index, buf_size, sent);
+  if ( stream_index < 0 || stream_index >= RTSP_MAX_STREAMS || (us = &client_ctx->udp[stream_index])->rtp == -1 ) {
+    return 0; // stream was not SETUP by client
+  }
+
+  for ( int i = 0; i < iovcnt; ++i ) {
+    size += iov[i].iov_len;
+  }
+
+  if ( size > RTSP_UDP_MAX_PACKET_SIZE || iovcnt > 2 ) {
+    return AVERROR(EMSGSIZE);
+  }
+
+  if ( is_rtcp(iov) || iov[0].iov_len > RTSP_HDR_SLOT_SIZE ) {
+    // RTCP SR goes to RTCP port, unbatched RTP is sent as is
+    sendmsg(is_rtcp(iov) ? us->rtcp : us->rtp, &(struct msghdr ) {
+          .msg_iov = (struct iovec *) iov,
+          .msg_iovlen = iovcnt
+        }, MSG_DONTWAIT);
+    return 0;
+  }
+
+  b = us->batch;
+  memcpy(b->hdrs[b->count], iov[0].iov_base, iov[0].iov_len);
+  b->iov[b->count][0].iov_len = iov[0].iov_len;
+  if ( iovcnt > 1 ) {
+    b->iov[b->count][1] = iov[1];
+  }
+  b->msgs[b->count].msg_hdr.msg_iovlen = iovcnt;
+  ++b->count;
+
+  return b->count < RTSP_UDP_BATCH_SIZE ? 0 : rtsp_flush_udp_stream(client_ctx, us);
+}
+
+
+static int rtsp_flush_tcp_batch(struct rtsp_client_ctx * client_ctx, int flags)
+{
+  struct rtsp_tcp_batch * b = client_ctx->txb;
+  ssize_t sent;
+
+  if ( !b || !b->iovcnt ) {
+    return 0;
+  }
+
+  sent = cosocket_sendv(client_ctx->tcp, b->iov, b->iovcnt, flags);
+  b->count = b->iovcnt = 0;
 
   return sent > 0 ? 0 : AVERROR(errno);
 }
 
+/*
+ * RTP over RTSP interleaved: '$' framing and RTP header are copied into header slot,
+ * payload is referenced. Packets of one frame go out with single sendmsg()
+ */
+static int rtsp_send_tcp_pktv(struct rtsp_client_ctx * client_ctx, int stream_index, const struct iovec * iov, int iovcnt)
+{
+  struct rtsp_tcp_batch * b;
+  uint8_t framing[4];
+  size_t size = 0;
+  uint8_t * h;
+  int status;
+
+  for ( int i = 0; i < iovcnt; ++i ) {
+    size += iov[i].iov_len;
+  }
+
+  if ( size > 0xFFFF || iovcnt > 2 ) {
+    return AVERROR(EMSGSIZE);
+  }
+
+  framing[0] = '$';
+  framing[1] = stream_index * 2 + is_rtcp(iov);
+  framing[2] = size >> 8;
+  framing[3] = size;
+
+  if ( !(b = client_ctx->txb) && !(b = client_ctx->txb = calloc(1, sizeof(*b))) ) {
+    return AVERROR(ENOMEM);
+  }
+
+  if ( sizeof(framing) + iov[0].iov_len > RTSP_HDR_SLOT_SIZE ) {
+
+    struct iovec v[3] = {
+      { framing, sizeof(framing) }
+    };
+
+    if ( (status = rtsp_flush_tcp_batch(client_ctx, MSG_MORE)) ) {
+      return status;
+    }
+
+    for ( int i = 0; i < iovcnt; ++i ) {
+      v[i + 1] = iov[i];
+    }
+
+    return cosocket_sendv(client_ctx->tcp, v, iovcnt + 1, 0) > 0 ? 0 : AVERROR(errno);
+  }
+
+  if ( b->count == RTSP_TCP_BATCH_SIZE && (status = rtsp_flush_tcp_batch(client_ctx, MSG_MORE)) ) {
+    return status;
+  }
+
+  h = b->hdrs[b->count++];
+  memcpy(h, framing, sizeof(framing));
+  memcpy(h + sizeof(framing), iov[0].iov_base, iov[0].iov_len);
+
+  b->iov[b->iovcnt++] = (struct iovec ) { h, sizeof(framing) + iov[0].iov_len };
+  if ( iovcnt > 1 ) {
+    b->iov[b->iovcnt++] = iov[1];
+  }
+
+  return 0;
+}
+
+
+static int rtsp_send_pktv(void * cookie, int stream_index, const struct iovec * iov, int iovcnt)
+{
+  struct rtsp_client_ctx * client_ctx = cookie;
+
+  if ( iovcnt < 1 ) {
+    return 0;
+  }
+
+  if ( client_ctx->udp_transport ) {
+    return rtsp_send_udp_pktv(client_ctx, stream_index, iov, iovcnt);
+  }
+
+  return rtsp_send_tcp_pktv(client_ctx, stream_index, iov, iovcnt);
+}
+
+static int rtsp_flush_pkts(void * cookie)
+{
+  struct rtsp_client_ctx * client_ctx = cookie;
+
+  if ( !client_ctx->udp_transport ) {
+    return rtsp_flush_tcp_batch(client_ctx, 0);
+  }
+
+  for ( int i = 0; i < RTSP_MAX_STREAMS; ++i ) {
+    struct rtsp_udp_stream * us = &client_ctx->udp[i];
+    if ( us->rtp != -1 && us->batch->count ) {
+      rtsp_flush_udp_stream(client_ctx, us);
+    }
+  }
+
+  return client_ctx->status;
+}
+
+static int rtsp_send_pkt(void * cookie, int stream_index, uint8_t * buf, int buf_size)
+{
+  int status;
+
+  if ( !(status = rtsp_send_pktv(cookie, stream_index, &(struct iovec ) { buf, buf_size }, 1)) ) {
+    status = rtsp_flush_pkts(cookie);
+  }
+
+  return status;
+}
+
+
+static int rtsp_open_input(void * cookie, AVFormatContext ** ic)
+{
+  struct rtsp_client_ctx * client_ctx = cookie;
+  int status;
+
+  if ( (status = rtp_depacketizer_open_input(client_ctx->rtpdp, ic)) == 0 ) {
+    client_ctx->input_opened = true;
+  }
+
+  return status;
+}
+
+// replay rtp frames which came in the same recv() as RECORD request
+static int rtsp_put_early_frames(struct rtsp_client_ctx * client_ctx)
+{
+  const uint8_t * frame = client_ctx->early;
+  const uint8_t * end = frame + client_ctx->early_size;
+  int status = 0;
+
+  while ( frame + 3 <= end ) {
+
+    const size_t size = (frame[1] << 8) | frame[2];
+
+    if ( (status = rtp_depacketizer_put(client_ctx->rtpdp, frame[0], frame + 3, size)) ) {
+      PDBG("rtp_depacketizer_put(channel=%d) fails: %s", frame[0], av_err2str(status));
+      break;
+    }
+
+    frame += 3 + size;
+  }
+
+  free(client_ctx->early);
+  client_ctx->early = NULL;
+  client_ctx->early_size = 0;
+
+  return status;
+}
+
+static int rtsp_read_pkt(void * cookie, AVPacket * pkt)
+{
+  struct rtsp_client_ctx * client_ctx = cookie;
+  char rx[RTSP_RECORD_RXBUF_SIZE];
+  ssize_t size;
+  int status;
+
+  if ( client_ctx->early && (status = rtsp_put_early_frames(client_ctx)) ) {
+    return status;
+  }
+
+  while ( (status = rtp_depacketizer_get_pkt(client_ctx->rtpdp, pkt)) == AVERROR(EAGAIN) ) {
+
+    if ( client_ctx->status ) {
+      status = client_ctx->status;
+      break;
+    }
+
+    if ( (size = cosocket_recv(client_ctx->tcp, rx, sizeof(rx), 0)) <= 0 ) {
+      if ( size == 0 ) {
+        status = AVERROR_EOF;
+      }
+      else if ( errno == EAGAIN ) { // AVERROR(EAGAIN) would spin in ff_run_input_stream()
+        status = AVERROR(ETIMEDOUT);
+      }
+      else {
+        status = AVERROR(errno);
+      }
+      break;
+    }
+
+    if ( !rtsp_parser_execute(&client_ctx->rstp, rx, size) ) {
+      PDBG("rtsp_parser_execute() fails");
+      status = AVERROR_INVALIDDATA;
+      break;
+    }
+  }
+
+  return status;
+}
+
+static bool on_rtsp_interleaved(void * cookie, int channel, const uint8_t * data, size_t size)
+{
+  struct rtsp_client_ctx * client_ctx = cookie;
+  uint8_t * early;
+  int status;
+
+  if ( client_ctx->recording && !client_ctx->input_opened ) {
+
+    // depacketizer streams are not opened yet, keep frames for rtsp_read_pkt()
+    if ( !(early = realloc(client_ctx->early, client_ctx->early_size + 3 + size)) ) {
+      PDBG("realloc(early) fails: %s", strerror(errno));
+      return false;
+    }
+
+    client_ctx->early = early;
+    early += client_ctx->early_size;
+
+    early[0] = channel;
+    early[1] = size >> 8;
+    early[2] = size & 0xFF;
+    memcpy(early + 3, data, size);
+
+    client_ctx->early_size += 3 + size;
+
+    return true;
+  }
+
+  if ( client_ctx->rtpdp && (status = rtp_depacketizer_put(client_ctx->rtpdp, channel, data, size)) ) {
+    PDBG("rtp_depacketizer_put(channel=%d) fails: %s", channel, av_err2str(status));
+    return false;
+  }
+
+  return true;
+}
+
 
 static bool rtsp_send_responce_v(struct rtsp_client_ctx * client_ctx, enum rtsp_status status, const char * cseq,
     const char * format, va_list arglist)
@@ -426,6 +977,7 @@ static enum rtsp_status get_rtsp_status(int ff_status)
       rtsp_status = _RTSP_STATUS_NOT_FOUND;
     break;
     case AVERROR(EPERM):
+    case AVERROR(EACCES):
       rtsp_status = _RTSP_STATUS_FORBIDDEN;
     break;
     default :
@@ -444,7 +996,7 @@ static bool on_rtsp_options(void * cookie, const struct rtsp_parser_callback_arg
   rtsp_send_responce(client_ctx,
       _RTSP_STATUS_OK,
       c->cseq,
-      "Public: OPTIONS, DESCRIBE, SETUP, PLAY, PAUSE, TEARDOWN\r\n"
+      "Public: OPTIONS, DESCRIBE, ANNOUNCE, SETUP, PLAY, RECORD, PAUSE, TEARDOWN, GET_PARAMETER\r\n"
       "\r\n");
 
   return true;
@@ -523,7 +1075,11 @@ static bool on_rtsp_describe(void * cookie, const struct rtsp_parser_callback_ar
       &(struct create_output_args ) {
             .format = ofmt ? ofmt : "rtp",
             .cookie = client_ctx,
-            .send_pkt = rtsp_send_pkt
+            .send_pkt = rtsp_send_pkt,
+            .send_pktv = rtsp_send_pktv,
+            .flush_pkts = rtsp_flush_pkts,
+            .onidle = rtsp_output_onidle,
+            .set_pacing_rate = rtsp_set_pacing_rate,
           });
 
   if ( status ) {
@@ -636,7 +1192,17 @@ static bool on_rtsp_setup(void * cookie, const struct rtsp_parser_callback_args
     tp[i].mode
     );
 
-    if ( strcasecmp(tp[i].lower_transport, "TCP") == 0 ) {
+    if ( selected_transport_index >= 0 ) {
+      continue;
+    }
+
+    // take first acceptable transport in client preference order,
+    // all streams of the session must use the same lower transport
+    if ( strcasecmp(tp[i].lower_transport, "TCP") == 0 && !client_ctx->udp_transport ) {
+      selected_transport_index = i;
+    }
+    else if ( strcasecmp(tp[i].lower_transport, "UDP") == 0 && tp[i].client_port && !client_ctx->rtpdp
+        && !client_ctx->tcp_transport && (!tp[i].ccast || strcasecmp(tp[i].ccast, "multicast") != 0) ) {
       selected_transport_index = i;
     }
   }
@@ -649,6 +1215,37 @@ static bool on_rtsp_setup(void * cookie, const struct rtsp_parser_callback_args
   }
 
 
+  if ( client_ctx->rtpdp ) {
+
+    // publisher session after ANNOUNCE, RFC 2326 10.11
+    const char * interleaved = tp[selected_transport_index].interleaved;
+    int channel = -1;
+
+    if ( interleaved && sscanf(interleaved, "%d", &channel) != 1 ) {
+      channel = -1;
+    }
+
+    if ( (channel = rtp_depacketizer_setup(client_ctx->rtpdp, c->url, channel)) < 0 ) {
+      rtsp_send_error(client_ctx,
+          _RTSP_STATUS_NOT_FOUND,
+          c->cseq);
+      goto end;
+    }
+
+    rtsp_send_responce(client_ctx,
+        _RTSP_STATUS_OK,
+        c->cseq,
+        "Transport: RTP/AVP/TCP;unicast;interleaved=%d-%d;mode=record\r\n"
+            "Session: 0x%.16llX\r\n"
+            "\r\n",
+        channel,
+        channel + 1,
+        client_ctx->rtsp_session_id);
+
+    goto end;
+  }
+
+
   if ( !(s = strstr(c->url, "/streamid=")) ) {
     rtsp_send_error(client_ctx,
         _RTSP_STATUS_BAD_REQUEST,
@@ -661,6 +1258,34 @@ static bool on_rtsp_setup(void * cookie, const struct rtsp_parser_callback_args
   stream_id = atoi(s + 10);
   client_ctx->rtsp_session_id = (((uint64_t) rand()) << 32) | (((uint64_t) rand()));
 
+  if ( strcasecmp(tp[selected_transport_index].lower_transport, "UDP") == 0 ) {
+
+    const char * client_port = tp[selected_transport_index].client_port;
+    int status;
+
+    if ( (status = rtsp_setup_udp_stream(client_ctx, stream_id, client_port)) ) {
+      rtsp_send_error(client_ctx,
+          status == AVERROR(EINVAL) ? _RTSP_STATUS_BAD_REQUEST : _RTSP_STATUS_TRANSPORT,
+          c->cseq);
+      goto end;
+    }
+
+    rtsp_send_responce(client_ctx,
+        _RTSP_STATUS_OK,
+        c->cseq,
+        "Transport: RTP/AVP;unicast;client_port=%s;server_port=%u-%u\r\n"
+            "Session: 0x%.16llX\r\n"
+            "\r\n",
+        client_port,
+        client_ctx->udp[stream_id].server_port,
+        client_ctx->udp[stream_id].server_port + 1,
+        client_ctx->rtsp_session_id);
+
+    goto end;
+  }
+
+  client_ctx->tcp_transport = true;
+
   rtsp_send_responce(client_ctx,
       _RTSP_STATUS_OK,
       c->cseq,
@@ -707,11 +1332,30 @@ static bool on_rtsp_pause(void * cookie, const struct rtsp_parser_callback_args
   return 0;
 }
 
-static bool on_rtsp_record(void * cookie, const struct rtsp_parser_callback_args * args)
+static bool on_rtsp_record(void * cookie, const struct rtsp_parser_callback_args * c)
 {
-  (void)(cookie);
-  (void)(args);
-  return 0;
+  struct rtsp_client_ctx * client_ctx = cookie;
+
+  if ( !client_ctx->input ) {
+    rtsp_send_error(client_ctx,
+        _RTSP_STATUS_STATE,
+        c->cseq);
+  }
+  else {
+
+    cosocket_set_rcvtmout(client_ctx->tcp, ffsrv.rtsp.rcvtmo);
+
+    rtsp_send_responce(client_ctx,
+        _RTSP_STATUS_OK,
+        c->cseq,
+        "Session: 0x%.16llX\r\n"
+        "\r\n",
+        client_ctx->rtsp_session_id);
+
+    client_ctx->recording = true;
+  }
+
+  return true;
 }
 
 static bool on_rtsp_redirect(void * cookie, const struct rtsp_parser_callback_args * args)
@@ -722,18 +1366,96 @@ static bool on_rtsp_redirect(void * cookie, const struct rtsp_parser_callback_ar
 }
 
 
-static bool on_rtsp_announce(void * cookie, const struct rtsp_parser_callback_args * args)
+static bool on_rtsp_announce(void * cookie, const struct rtsp_parser_callback_args * c)
 {
-  (void)(cookie);
-  (void)(args);
-  return 0;
+  struct rtsp_client_ctx * client_ctx = cookie;
+
+  char name[256] = "";
+  char opts[256] = "";
+
+  int status;
+
+  if ( client_ctx->input || client_ctx->output ) {
+    rtsp_send_error(client_ctx,
+        _RTSP_STATUS_STATE,
+        c->cseq);
+    goto end;
+  }
+
+  if ( !c->body || (c->content_type && strcasecmp(c->content_type, "application/sdp") != 0) ) {
+    rtsp_send_error(client_ctx,
+        _RTSP_STATUS_UNSUPPORTED_MTYPE,
+        c->cseq);
+    goto end;
+  }
+
+  if ( !parse_rtsp_url(c->url, NULL, 0, name, sizeof(name), opts, sizeof(opts)) ) {
+    rtsp_send_error(client_ctx,
+        _RTSP_STATUS_NOT_FOUND,
+        c->cseq);
+    goto end;
+  }
+
+  PDBG("name='%s' sdp: %zu bytes", name, c->body_size);
+
+  if ( (status = rtp_depacketizer_create(&client_ctx->rtpdp, c->body, c->body_size)) ) {
+
+    PDBG("rtp_depacketizer_create() fails: %s", av_err2str(status));
+
+    rtsp_send_error(client_ctx,
+        status == AVERROR_PATCHWELCOME ? _RTSP_STATUS_UNSUPPORTED_MTYPE : _RTSP_STATUS_BAD_REQUEST,
+        c->cseq);
+
+    goto end;
+  }
+
+  status = create_input_stream(&client_ctx->input, name,
+      &(struct create_input_args ) {
+            .cookie = client_ctx,
+            .open_input = rtsp_open_input,
+            .read_pkt = rtsp_read_pkt
+          });
+
+  if ( status ) {
+
+    PDBG("create_input_stream() fails: %s", av_err2str(status));
+
+    rtp_depacketizer_destroy(&client_ctx->rtpdp);
+
+    rtsp_send_error(client_ctx,
+        get_rtsp_status(status),
+        c->cseq);
+
+    goto end;
+  }
+
+  client_ctx->rtsp_session_id = (((uint64_t) rand()) << 32) | (((uint64_t) rand()));
+
+  rtsp_send_responce(client_ctx,
+      _RTSP_STATUS_OK,
+      c->cseq,
+      "Session: 0x%.16llX\r\n"
+      "\r\n",
+      client_ctx->rtsp_session_id);
+
+end:
+
+  return true;
 }
 
-static bool on_rtsp_get_parameter(void * cookie, const struct rtsp_parser_callback_args * args)
+static bool on_rtsp_get_parameter(void * cookie, const struct rtsp_parser_callback_args * c)
 {
-  (void)(cookie);
-  (void)(args);
-  return 0;
+  struct rtsp_client_ctx * client_ctx = cookie;
+
+  // used by clients as session keep-alive
+  rtsp_send_responce(client_ctx,
+      _RTSP_STATUS_OK,
+      c->cseq,
+      "Session: 0x%.16llX\r\n"
+      "\r\n",
+      client_ctx->rtsp_session_id);
+
+  return true;
 }
 
 static bool on_rtsp_set_parameter(void * cookie, const struct rtsp_parser_callback_args * args)
@@ -743,11 +1465,22 @@ static bool on_rtsp_set_parameter(void * cookie, const struct rtsp_parser_callba
   return 0;
 }
 
-static bool on_rtsp_teardown(void * cookie, const struct rtsp_parser_callback_args * args)
+static bool on_rtsp_teardown(void * cookie, const struct rtsp_parser_callback_args * c)
 {
-  (void)(cookie);
-  (void)(args);
-  return 0;
+  struct rtsp_client_ctx * client_ctx = cookie;
+
+  rtsp_send_responce(client_ctx,
+      _RTSP_STATUS_OK,
+      c->cseq,
+      NULL);
+
+  if ( !client_ctx->recording ) {
+    return false; // close connection
+  }
+
+  client_ctx->status = AVERROR_EOF;
+
+  return true;
 }
 
 
@@ -0,0 +1,162 @@
+/*
+ * aesbench.c
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: amyznikov
+ *
+ *  hls AES-128 segment encryption throughput: EVP_aes_128_cbc over segment-sized buffers,
+ *  random IV and one EVP_EncryptInit_ex / Update / Final per segment as ffhlscrypt does.
+ *  Runs one thread per core and reports MB/s per core and in total.
+ *
+ *  usage: aesbench [seconds] [threads]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <openssl/evp.h>
+#include <openssl/rand.h>
+
+
+struct bench_thread {
+  pthread_t tid;
+  size_t segsize;
+  double seconds;
+  int64_t bytes, usec;
+  int status;
+};
+
+static int64_t bench_time_us(void)
+{
+  struct timespec tm;
+  clock_gettime(CLOCK_MONOTONIC, &tm);
+  return (int64_t) tm.tv_sec * 1000000 + tm.tv_nsec / 1000;
+}
+
+
+static void * bench_thread(void * arg)
+{
+  struct bench_thread * bt = arg;
+
+  EVP_CIPHER_CTX * ctx = NULL;
+  uint8_t key[16], iv[16];
+  uint8_t * in = NULL, * out = NULL;
+  int64_t t0, duration;
+  int n1, n2;
+
+  bt->status = -1;
+
+  if ( !(ctx = EVP_CIPHER_CTX_new()) ) {
+    goto end;
+  }
+
+  if ( !(in = malloc(bt->segsize)) || !(out = malloc(bt->segsize + 16)) ) {
+    goto end;
+  }
+
+  for ( size_t i = 0; i < bt->segsize; ++i ) {
+    in[i] = (uint8_t) (i * 31 + 7);
+  }
+
+  memset(key, 0x5A, sizeof(key));
+
+  duration = (int64_t) (bt->seconds * 1e6);
+  t0 = bench_time_us();
+
+  do {
+    if ( RAND_bytes(iv, sizeof(iv)) != 1 ||
+        EVP_EncryptInit_ex(ctx, EVP_aes_128_cbc(), NULL, key, iv) != 1 ||
+        EVP_EncryptUpdate(ctx, out, &n1, in, (int) bt->segsize) != 1 ||
+        EVP_EncryptFinal_ex(ctx, out + n1, &n2) != 1 ) {
+      goto end;
+    }
+    bt->bytes += bt->segsize;
+  } while ( (bt->usec = bench_time_us() - t0) < duration );
+
+  bt->status = 0;
+
+end:
+
+  EVP_CIPHER_CTX_free(ctx);
+  free(in);
+  free(out);
+
+  return NULL;
+}
+
+
+int main(int argc, char *argv[])
+{
+  static const size_t segsizes[] = {
+    256 * 1024,       // 2 s segment at 1 Mbit/s
+    1024 * 1024,      // 2 s segment at 4 Mbit/s
+    4 * 1024 * 1024,  // 4 s segment at 8 Mbit/s
+  };
+
+  struct bench_thread * bts = NULL;
+  double seconds = 2;
+  long nb_threads = sysconf(_SC_NPROCESSORS_ONLN);
+  int64_t bytes, usec;
+  int status = 1;
+
+  if ( argc > 1 && sscanf(argv[1], "%lf", &seconds) != 1 ) {
+    fprintf(stderr, "usage: %s [seconds] [threads]\n", argv[0]);
+    goto end;
+  }
+  if ( argc > 2 && sscanf(argv[2], "%ld", &nb_threads) != 1 ) {
+    fprintf(stderr, "usage: %s [seconds] [threads]\n", argv[0]);
+    goto end;
+  }
+  if ( nb_threads < 1 ) {
+    nb_threads = 1;
+  }
+
+  if ( !(bts = calloc(nb_threads, sizeof(*bts))) ) {
+    fprintf(stderr, "calloc() fails\n");
+    goto end;
+  }
+
+  fprintf(stdout, "%s, %ld threads, %g s per size\n", OpenSSL_version(OPENSSL_VERSION), nb_threads, seconds);
+
+  for ( size_t s = 0; s < sizeof(segsizes) / sizeof(segsizes[0]); ++s ) {
+
+    memset(bts, 0, nb_threads * sizeof(*bts));
+
+    for ( long i = 0; i < nb_threads; ++i ) {
+      bts[i].segsize = segsizes[s];
+      bts[i].seconds = seconds;
+      if ( pthread_create(&bts[i].tid, NULL, bench_thread, &bts[i]) ) {
+        fprintf(stderr, "pthread_create() fails\n");
+        goto end;
+      }
+    }
+
+    bytes = usec = 0;
+
+    for ( long i = 0; i < nb_threads; ++i ) {
+      pthread_join(bts[i].tid, NULL);
+      if ( bts[i].status ) {
+        fprintf(stderr, "EVP_Encrypt() fails\n");
+        goto end;
+      }
+      bytes += bts[i].bytes;
+      usec += bts[i].usec;
+    }
+
+    fprintf(stdout, "segment %5zu KiB: %8.1f MB/s per core %8.1f MB/s total\n", segsizes[s] / 1024,
+        (double) bytes / usec, (double) bytes * nb_threads / usec);
+  }
+
+  status = 0;
+
+end:
+
+  free(bts);
+
+  return status;
+}
@@ -0,0 +1,298 @@
+/*
+ * tsbench.c
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: amyznikov
+ *
+ *  MPEG-TS packetization cost: native ffts packetizer vs libavformat mpegts muxer.
+ *  Feeds synthetic H.264 AnnexB gops (key frame + P frames) through both paths and
+ *  reports time per source packet and output MB/s.
+ *
+ *  A hls segments object muxes every source packet once per rendition, so the
+ *  1 client line is what hls would gain from ffts. The N clients lines show the
+ *  fmt=mpegts online stream case, where ffts packetizes once and libavformat
+ *  muxes once per client.
+ *
+ *  usage: tsbench [frames] [clients]
+ */
+
+#include "ffts.h"
+#include "debug.h"
+#include <time.h>
+
+
+#define BENCH_FPS         25
+#define BENCH_GOP         50
+#define BENCH_KEY_SIZE    (96 * 1024)
+#define BENCH_DELTA_SIZE  (12 * 1024)
+#define BENCH_IO_BUF_SIZE (32 * 1024)
+
+
+static int64_t bench_time_us(void)
+{
+  struct timespec tm;
+  clock_gettime(CLOCK_MONOTONIC, &tm);
+  return (int64_t) tm.tv_sec * 1000000 + tm.tv_nsec / 1000;
+}
+
+static int bench_sink(void * opaque, uint8_t * buf, int buf_size)
+{
+  (void) buf;
+  *(int64_t*) opaque += buf_size;
+  return buf_size;
+}
+
+static int create_frames(AVPacket ** ppkts, uint nb_frames)
+{
+  static const uint8_t sps[] = { 0, 0, 0, 1, 0x67, 0x42, 0xC0, 0x1F, 0xDA, 0x01, 0x40, 0x16, 0xEC, 0x04, 0x40 };
+  static const uint8_t pps[] = { 0, 0, 0, 1, 0x68, 0xCE, 0x3C, 0x80 };
+
+  AVPacket * pkts;
+  int status = 0;
+
+  if ( !(pkts = av_mallocz_array(nb_frames, sizeof(*pkts))) ) {
+    status = AVERROR(ENOMEM);
+    goto end;
+  }
+
+  for ( uint i = 0; i < nb_frames; ++i ) {
+
+    const bool key = (i % BENCH_GOP) == 0;
+    const int size = key ? BENCH_KEY_SIZE : BENCH_DELTA_SIZE;
+    uint8_t * p;
+
+    if ( (status = av_new_packet(&pkts[i], size)) ) {
+      goto end;
+    }
+
+    p = pkts[i].data;
+
+    if ( key ) {
+      memcpy(p, sps, sizeof(sps)), p += sizeof(sps);
+      memcpy(p, pps, sizeof(pps)), p += sizeof(pps);
+    }
+
+    // slice NAL, payload bytes never form a start code
+    *p++ = 0, *p++ = 0, *p++ = 0, *p++ = 1;
+    *p++ = key ? 0x65 : 0x41;
+    memset(p, 0x5A, pkts[i].data + size - p);
+
+    pkts[i].stream_index = 0;
+    pkts[i].pts = pkts[i].dts = (int64_t) i * 90000 / BENCH_FPS;
+    pkts[i].duration = 90000 / BENCH_FPS;
+    if ( key ) {
+      pkts[i].flags |= AV_PKT_FLAG_KEY;
+    }
+  }
+
+end:
+
+  if ( status && pkts ) {
+    for ( uint i = 0; i < nb_frames; ++i ) {
+      av_packet_unref(&pkts[i]);
+    }
+    av_freep(&pkts);
+  }
+
+  *ppkts = pkts;
+
+  return status;
+}
+
+
+static int bench_ffts(const ffstream * const * iss, const AVPacket * pkts, uint nb_frames, uint nb_clients,
+    int64_t * usec, int64_t * bytes)
+{
+  static int source;
+  struct ffts * ts = NULL;
+  int64_t t0;
+  int status;
+
+  *bytes = 0;
+
+  if ( (status = ffts_attach(&ts, &source, iss, 1, BENCH_GOP)) ) {
+    PDBG("ffts_attach() fails: %s", av_err2str(status));
+    goto end;
+  }
+
+  t0 = bench_time_us();
+
+  for ( uint i = 0; i < nb_frames; ++i ) {
+    for ( uint c = 0; c < nb_clients; ++c ) {
+      if ( (status = ffts_send(ts, &pkts[i], bench_sink, bytes)) < 0 ) {
+        PDBG("ffts_send() fails: %s", av_err2str(status));
+        goto end;
+      }
+    }
+  }
+
+  *usec = bench_time_us() - t0;
+  status = 0;
+
+end:
+
+  ffts_detach(&ts);
+
+  return status;
+}
+
+
+static int bench_lavf(const ffstream * const * iss, const AVPacket * pkts, uint nb_frames, uint nb_clients,
+    int64_t * usec, int64_t * bytes)
+{
+  AVFormatContext ** ocs = NULL;
+  uint8_t * iobuf;
+  AVPacket pkt;
+  int64_t t0;
+  int status = 0;
+
+  *bytes = 0;
+
+  if ( !(ocs = av_mallocz_array(nb_clients, sizeof(*ocs))) ) {
+    status = AVERROR(ENOMEM);
+    goto end;
+  }
+
+  t0 = bench_time_us();
+
+  for ( uint c = 0; c < nb_clients; ++c ) {
+
+    if ( (status = ffmpeg_create_output_context(&ocs[c], "mpegts", iss, 1, NULL)) ) {
+      PDBG("ffmpeg_create_output_context() fails: %s", av_err2str(status));
+      goto end;
+    }
+
+    ocs[c]->flags |= AVFMT_FLAG_CUSTOM_IO;
+
+    if ( !(iobuf = av_malloc(BENCH_IO_BUF_SIZE)) ) {
+      status = AVERROR(ENOMEM);
+      goto end;
+    }
+
+    if ( !(ocs[c]->pb = avio_alloc_context(iobuf, BENCH_IO_BUF_SIZE, true, bytes, NULL, bench_sink, NULL)) ) {
+      av_free(iobuf);
+      status = AVERROR(ENOMEM);
+      goto end;
+    }
+
+    if ( (status = avformat_write_header(ocs[c], NULL)) < 0 ) {
+      PDBG("avformat_write_header() fails: %s", av_err2str(status));
+      goto end;
+    }
+  }
+
+  for ( uint i = 0; i < nb_frames; ++i ) {
+    for ( uint c = 0; c < nb_clients; ++c ) {
+      pkt = pkts[i]; // the muxer rescales timestamps in place
+      av_packet_rescale_ts(&pkt, iss[0]->time_base, ocs[c]->streams[0]->time_base);
+      if ( (status = av_write_frame(ocs[c], &pkt)) < 0 ) {
+        PDBG("av_write_frame() fails: %s", av_err2str(status));
+        goto end;
+      }
+    }
+  }
+
+  for ( uint c = 0; c < nb_clients; ++c ) {
+    av_write_trailer(ocs[c]);
+    avio_flush(ocs[c]->pb);
+  }
+
+  *usec = bench_time_us() - t0;
+  status = 0;
+
+end:
+
+  if ( ocs ) {
+    for ( uint c = 0; c < nb_clients; ++c ) {
+      if ( ocs[c] ) {
+        if ( ocs[c]->pb ) {
+          av_freep(&ocs[c]->pb->buffer);
+          av_freep(&ocs[c]->pb);
+        }
+        avformat_free_context(ocs[c]);
+      }
+    }
+    av_free(ocs);
+  }
+
+  return status;
+}
+
+
+static void report(const char * name, uint nb_frames, uint nb_clients, int64_t usec, int64_t bytes)
+{
+  fprintf(stdout, "%-6s clients=%-4u %8.2f us/packet %9.1f MB/s\n", name, nb_clients,
+      (double) usec / nb_frames, usec > 0 ? (double) bytes / usec : 0.);
+}
+
+
+int main(int argc, char *argv[])
+{
+  uint nb_frames = 25 * 600;
+  uint max_clients = 100;
+
+  ffstream is;
+  const ffstream * iss[1] = { &is };
+  AVPacket * pkts = NULL;
+
+  int64_t usec, bytes;
+  int status;
+
+  if ( argc > 1 && sscanf(argv[1], "%u", &nb_frames) != 1 ) {
+    fprintf(stderr, "usage: %s [frames] [clients]\n", argv[0]);
+    return 1;
+  }
+  if ( argc > 2 && sscanf(argv[2], "%u", &max_clients) != 1 ) {
+    fprintf(stderr, "usage: %s [frames] [clients]\n", argv[0]);
+    return 1;
+  }
+
+  av_log_set_level(AV_LOG_ERROR);
+
+  memset(&is, 0, sizeof(is));
+  is.time_base = (AVRational ) { 1, 90000 };
+
+  if ( !(is.codecpar = avcodec_parameters_alloc()) ) {
+    status = AVERROR(ENOMEM);
+    goto end;
+  }
+
+  is.codecpar->codec_type = AVMEDIA_TYPE_VIDEO;
+  is.codecpar->codec_id = AV_CODEC_ID_H264;
+  is.codecpar->width = 1280;
+  is.codecpar->height = 720;
+
+  if ( (status = create_frames(&pkts, nb_frames)) ) {
+    fprintf(stderr, "create_frames() fails: %s\n", av_err2str(status));
+    goto end;
+  }
+
+  fprintf(stdout, "%u frames, gop %u, key %u bytes, delta %u bytes\n", nb_frames, BENCH_GOP,
+      BENCH_KEY_SIZE, BENCH_DELTA_SIZE);
+
+  for ( uint nb_clients = 1; nb_clients <= max_clients; nb_clients *= 10 ) {
+
+    if ( (status = bench_ffts(iss, pkts, nb_frames, nb_clients, &usec, &bytes)) ) {
+      goto end;
+    }
+    report("ffts", nb_frames, nb_clients, usec, bytes);
+
+    if ( (status = bench_lavf(iss, pkts, nb_frames, nb_clients, &usec, &bytes)) ) {
+      goto end;
+    }
+    report("lavf", nb_frames, nb_clients, usec, bytes);
+  }
+
+end:
+
+  if ( pkts ) {
+    for ( uint i = 0; i < nb_frames; ++i ) {
+      av_packet_unref(&pkts[i]);
+    }
+    av_free(pkts);
+  }
+
+  avcodec_parameters_free(&is.codecpar);
+
+  return status ? 1 : 0;
+}